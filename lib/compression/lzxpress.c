@@ -57,179 +57,241 @@
 ))
 #endif
 
+/*
+ * The match finder keeps a hash chain of all positions within the
+ * window, keyed by the next 3 bytes. Only the most recent
+ * LZXPRESS_MAX_CHAIN candidates are checked for each position
+ * and the search stops at the first match of LZXPRESS_NICE_MATCH
+ * bytes.
+ */
+#define LZXPRESS_HASH_BITS	14
+#define LZXPRESS_HASH_SIZE	(1 << LZXPRESS_HASH_BITS)
+#define LZXPRESS_WINDOW_SIZE	0x2000
+#define LZXPRESS_WINDOW_MASK	(LZXPRESS_WINDOW_SIZE - 1)
+#define LZXPRESS_MAX_OFFSET	0x1FFF
+#define LZXPRESS_MIN_MATCH	3
+#define LZXPRESS_MAX_MATCH	(0xFFFF + 3)
+#define LZXPRESS_MAX_CHAIN	64
+#define LZXPRESS_NICE_MATCH	128
+#define LZXPRESS_NO_POS		UINT32_MAX
+
+struct lzxpress_hash_chain {
+	uint32_t head[LZXPRESS_HASH_SIZE];
+	uint32_t prev[LZXPRESS_WINDOW_SIZE];
+};
+
+static inline uint32_t lzxpress_hash(const uint8_t *p)
+{
+	uint32_t v = ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+
+	return (v * 2654435761U) >> (32 - LZXPRESS_HASH_BITS);
+}
+
+static inline void lzxpress_hash_insert(struct lzxpress_hash_chain *c,
+					const uint8_t *uncompressed,
+					uint32_t pos)
+{
+	uint32_t h = lzxpress_hash(&uncompressed[pos]);
+
+	c->prev[pos & LZXPRESS_WINDOW_MASK] = c->head[h];
+	c->head[h] = pos;
+}
+
+/*
+ * Compare 8 bytes at a time, then find the first
+ * differing byte.
+ */
+static inline uint32_t lzxpress_match_len(const uint8_t *str1,
+					  const uint8_t *str2,
+					  uint32_t max_len)
+{
+	uint32_t len = 0;
+
+	while (len + sizeof(uint64_t) <= max_len) {
+		uint64_t v1, v2;
+
+		memcpy(&v1, str1 + len, sizeof(v1));
+		memcpy(&v2, str2 + len, sizeof(v2));
+		if (v1 != v2) {
+			break;
+		}
+		len += sizeof(uint64_t);
+	}
+
+	while ((len < max_len) && (str1[len] == str2[len])) {
+		len++;
+	}
+
+	return len;
+}
+
 ssize_t lzxpress_compress(const uint8_t *uncompressed,
 			  uint32_t uncompressed_size,
 			  uint8_t *compressed,
 			  uint32_t max_compressed_size)
 {
-	uint32_t uncompressed_pos, compressed_pos, byte_left;
-	uint32_t max_offset, best_offset;
-	int32_t offset;
-	uint32_t max_len, len, best_len;
-	const uint8_t *str1, *str2;
+	struct lzxpress_hash_chain *chain = NULL;
+	uint32_t uncompressed_pos, compressed_pos;
 	uint32_t indic;
-	uint8_t *indic_pos;
+	uint32_t indic_pos;
 	uint32_t indic_bit, nibble_index;
 
-	uint32_t metadata_size;
-	uint16_t metadata;
-	uint16_t *dest;
-
 	if (!uncompressed_size) {
 		return 0;
 	}
 
+/*
+ * Fail if the output doesn't fit into the compressed buffer.
+ */
+#define __CHECK_SPACE(__needed) do { \
+	if (unlikely(max_compressed_size - compressed_pos < (__needed))) { \
+		free(chain); \
+		return -1; \
+	} \
+} while(0)
+
+	if (max_compressed_size < sizeof(uint32_t)) {
+		return -1;
+	}
+
+	chain = malloc(sizeof(*chain));
+	if (chain == NULL) {
+		return -1;
+	}
+	memset(chain->head, 0xFF, sizeof(chain->head));
+
 	uncompressed_pos = 0;
 	indic = 0;
-	*(uint32_t *)compressed = 0;
+	SIVAL(compressed, 0, 0);
 	compressed_pos = sizeof(uint32_t);
-	indic_pos = &compressed[0];
+	indic_pos = 0;
 
-	byte_left = uncompressed_size;
 	indic_bit = 0;
 	nibble_index = 0;
 
-	if (uncompressed_pos > XPRESS_BLOCK_SIZE)
-		return 0;
-
-	do {
-		bool found = false;
-
-		max_offset = uncompressed_pos;
-
-		str1 = &uncompressed[uncompressed_pos];
+	while (uncompressed_pos < uncompressed_size) {
+		uint32_t byte_left = uncompressed_size - uncompressed_pos;
+		uint32_t best_len = LZXPRESS_MIN_MATCH - 1;
+		uint32_t best_offset = 0;
 
-		best_len = 2;
-		best_offset = 0;
+		if (byte_left >= LZXPRESS_MIN_MATCH) {
+			const uint8_t *str1 = &uncompressed[uncompressed_pos];
+			uint32_t max_len = MIN(LZXPRESS_MAX_MATCH, byte_left);
+			uint32_t candidate;
+			uint32_t depth = LZXPRESS_MAX_CHAIN;
 
-		max_offset = MIN(0x1FFF, max_offset);
+			candidate = chain->head[lzxpress_hash(str1)];
 
-		/* search for the longest match in the window for the lookahead buffer */
-		for (offset = 1; (uint32_t)offset <= max_offset; offset++) {
-			str2 = &str1[-offset];
+			/* search for the longest match in the window for the lookahead buffer */
+			while ((candidate != LZXPRESS_NO_POS) && (depth-- > 0)) {
+				uint32_t offset = uncompressed_pos - candidate;
+				uint32_t len;
 
-			/* maximum len we can encode into metadata */
-			max_len = MIN((255 + 15 + 7 + 3), byte_left);
+				if (offset > LZXPRESS_MAX_OFFSET) {
+					break;
+				}
 
-			for (len = 0; (len < max_len) && (str1[len] == str2[len]); len++);
+				len = lzxpress_match_len(str1, str1 - offset, max_len);
+
+				/*
+				 * Candidates are visited from the nearest
+				 * to the farthest, so on equal length we
+				 * keep the smaller offset.
+				 */
+				if (len > best_len) {
+					best_len = len;
+					best_offset = offset;
+					if (len >= MIN(max_len, LZXPRESS_NICE_MATCH)) {
+						break;
+					}
+				}
 
-			/*
-			 * We check if len is better than the value found before, including the
-			 * sequence of identical bytes
-			 */
-			if (len > best_len) {
-				found = true;
-				best_len = len;
-				best_offset = offset;
+				candidate = chain->prev[candidate & LZXPRESS_WINDOW_MASK];
 			}
 		}
 
-		if (found) {
-			metadata_size = 0;
-			dest = (uint16_t *)&compressed[compressed_pos];
-
-			if (best_len < 10) {
-				/* Classical meta-data */
-				metadata = (uint16_t)(((best_offset - 1) << 3) | (best_len - 3));
-				SSVAL(dest, metadata_size / sizeof(uint16_t), metadata);
-				metadata_size += sizeof(uint16_t);
-			} else {
-				metadata = (uint16_t)(((best_offset - 1) << 3) | 7);
-				SSVAL(dest, metadata_size / sizeof(uint16_t), metadata);
-				metadata_size = sizeof(uint16_t);
-
-				if (best_len < (15 + 7 + 3)) {
-					/* Shared byte */
-					if (!nibble_index) {
-						compressed[compressed_pos + metadata_size] = (best_len - (3 + 7)) & 0xF;
-						metadata_size += sizeof(uint8_t);
-					} else {
-						compressed[nibble_index] &= 0xF;
-						compressed[nibble_index] |= (best_len - (3 + 7)) * 16;
-					}
-				} else if (best_len < (3 + 7 + 15 + 255)) {
-					/* Shared byte */
-					if (!nibble_index) {
-						compressed[compressed_pos + metadata_size] = 15;
-						metadata_size += sizeof(uint8_t);
-					} else {
-						compressed[nibble_index] &= 0xF;
-						compressed[nibble_index] |= (15 * 16);
-					}
+		if (best_offset != 0) {
+			uint16_t metadata;
+			uint32_t i;
 
-					/* Additional best_len */
-					compressed[compressed_pos + metadata_size] = (best_len - (3 + 7 + 15)) & 0xFF;
-					metadata_size += sizeof(uint8_t);
-				} else {
-					/* Shared byte */
-					if (!nibble_index) {
-						compressed[compressed_pos + metadata_size] |= 15;
-						metadata_size += sizeof(uint8_t);
-					} else {
-						compressed[nibble_index] |= 15 << 4;
-					}
+			__CHECK_SPACE(sizeof(uint16_t));
+			metadata = (uint16_t)(((best_offset - 1) << 3) |
+					      MIN(best_len - 3, 7));
+			SSVAL(compressed, compressed_pos, metadata);
+			compressed_pos += sizeof(uint16_t);
 
-					/* Additional best_len */
-					compressed[compressed_pos + metadata_size] = 255;
+			if (best_len >= (3 + 7)) {
+				uint32_t len = best_len - (3 + 7);
+
+				/* Shared byte */
+				if (nibble_index == 0) {
+					__CHECK_SPACE(sizeof(uint8_t));
+					nibble_index = compressed_pos;
+					compressed[compressed_pos] = MIN(len, 15);
+					compressed_pos += sizeof(uint8_t);
+				} else {
+					compressed[nibble_index] |= MIN(len, 15) << 4;
+					nibble_index = 0;
+				}
 
-					metadata_size += sizeof(uint8_t);
+				if (len >= 15) {
+					len -= 15;
 
-					compressed[compressed_pos + metadata_size] = (best_len - 3) & 0xFF;
-					compressed[compressed_pos + metadata_size + 1] = ((best_len - 3) >> 8) & 0xFF;
-					metadata_size += sizeof(uint16_t);
+					/* Additional best_len */
+					__CHECK_SPACE(sizeof(uint8_t));
+					compressed[compressed_pos] = MIN(len, 255);
+					compressed_pos += sizeof(uint8_t);
+
+					if (len >= 255) {
+						__CHECK_SPACE(sizeof(uint16_t));
+						SSVAL(compressed, compressed_pos,
+						      best_len - 3);
+						compressed_pos += sizeof(uint16_t);
+					}
 				}
 			}
 
-			indic |= 1 << (32 - ((indic_bit % 32) + 1));
+			indic |= 1U << (32 - ((indic_bit % 32) + 1));
 
-			if (best_len > 9) {
-				if (nibble_index == 0) {
-					nibble_index = compressed_pos + sizeof(uint16_t);
-				} else {
-					nibble_index = 0;
+			for (i = 0; i < best_len; i++) {
+				if (uncompressed_size - uncompressed_pos < LZXPRESS_MIN_MATCH) {
+					break;
 				}
+				lzxpress_hash_insert(chain, uncompressed,
+						     uncompressed_pos);
+				uncompressed_pos++;
 			}
-
-			compressed_pos += metadata_size;
-			uncompressed_pos += best_len;
-			byte_left -= best_len;
+			uncompressed_pos += best_len - i;
 		} else {
+			__CHECK_SPACE(sizeof(uint8_t));
+			if (byte_left >= LZXPRESS_MIN_MATCH) {
+				lzxpress_hash_insert(chain, uncompressed,
+						     uncompressed_pos);
+			}
 			compressed[compressed_pos++] = uncompressed[uncompressed_pos++];
-			byte_left--;
 		}
 		indic_bit++;
 
-		if ((indic_bit - 1) % 32 > (indic_bit % 32)) {
-			SIVAL(indic_pos, 0, indic);
+		if ((indic_bit % 32) == 0) {
+			__CHECK_SPACE(sizeof(uint32_t));
+			SIVAL(compressed, indic_pos, indic);
 			indic = 0;
-			indic_pos = &compressed[compressed_pos];
+			indic_pos = compressed_pos;
+			SIVAL(compressed, compressed_pos, 0);
 			compressed_pos += sizeof(uint32_t);
 		}
-	} while (byte_left > 3);
-
-	do {
-		compressed[compressed_pos] = uncompressed[uncompressed_pos];
-		indic_bit++;
-
-		uncompressed_pos++;
-		compressed_pos++;
-                if (((indic_bit - 1) % 32) > (indic_bit % 32)){
-			SIVAL(indic_pos, 0, indic);
-			indic = 0;
-			indic_pos = &compressed[compressed_pos];
-			compressed_pos += sizeof(uint32_t);
-		}
-	} while (uncompressed_pos < uncompressed_size);
+	}
 
 	if ((indic_bit % 32) > 0) {
-		for (; (indic_bit % 32) != 0; indic_bit++)
-			indic |= 0 << (32 - ((indic_bit % 32) + 1));
-
-		*(uint32_t *)&compressed[compressed_pos] = 0;
-		SIVAL(indic_pos, 0, indic);
+		__CHECK_SPACE(sizeof(uint32_t));
+		SIVAL(compressed, indic_pos, indic);
+		SIVAL(compressed, compressed_pos, 0);
 		compressed_pos += sizeof(uint32_t);
 	}
 
+#undef __CHECK_SPACE
+
+	free(chain);
 	return compressed_pos;
 }
 
@@ -252,10 +314,34 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 	offset = 0;
 	nibble_index = 0;
 
+/*
+ * The input may come from the network, make sure we never read
+ * beyond its end.
+ */
+#define __CHECK_BYTES(__size, __index, __needed) do { \
+	if (unlikely(__index >= __size)) { \
+		return -1; \
+	} else { \
+		uint32_t __avail = __size - __index; \
+		if (unlikely(__needed > __avail)) { \
+			return -1; \
+		} \
+	} \
+} while(0)
+
 	do {
 		if (indicator_bit == 0) {
+			__CHECK_BYTES(input_size, input_index, sizeof(uint32_t));
 			indicator = PULL_LE_UINT32(input, input_index);
 			input_index += sizeof(uint32_t);
+			if (input_index == input_size) {
+				/*
+				 * The compressor may emit a final
+				 * indicator without any data following
+				 * it.
+				 */
+				break;
+			}
 			indicator_bit = 32;
 		}
 		indicator_bit--;
@@ -266,10 +352,12 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 		 * check whether the 4th bit of the value in indicator is set
 		 */
 		if (((indicator >> indicator_bit) & 1) == 0) {
+			__CHECK_BYTES(input_size, input_index, sizeof(uint8_t));
 			output[output_index] = input[input_index];
 			input_index += sizeof(uint8_t);
 			output_index += sizeof(uint8_t);
 		} else {
+			__CHECK_BYTES(input_size, input_index, sizeof(uint16_t));
 			length = PULL_LE_UINT16(input, input_index);
 			input_index += sizeof(uint16_t);
 			offset = length / 8;
@@ -277,6 +365,7 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 
 			if (length == 7) {
 				if (nibble_index == 0) {
+					__CHECK_BYTES(input_size, input_index, sizeof(uint8_t));
 					nibble_index = input_index;
 					length = input[input_index] % 16;
 					input_index += sizeof(uint8_t);
@@ -286,9 +375,11 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 				}
 
 				if (length == 15) {
+					__CHECK_BYTES(input_size, input_index, sizeof(uint8_t));
 					length = input[input_index];
 					input_index += sizeof(uint8_t);
 					if (length == 255) {
+						__CHECK_BYTES(input_size, input_index, sizeof(uint16_t));
 						length = PULL_LE_UINT16(input, input_index);
 						input_index += sizeof(uint16_t);
 						length -= (15 + 7);
@@ -300,9 +391,26 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 
 			length += 3;
 
-			do {
-				if ((output_index >= max_output_size) || ((offset + 1) > output_index)) break;
+			if ((offset + 1) > output_index) {
+				/* the match would start before the output */
+				return -1;
+			}
 
+			length = MIN(length, max_output_size - output_index);
+
+			if (length >= 32 && length <= offset + 1) {
+				/*
+				 * long match, the source doesn't overlap
+				 * the destination
+				 */
+				memcpy(&output[output_index],
+				       &output[output_index - offset - 1],
+				       length);
+				output_index += length;
+				continue;
+			}
+
+			do {
 				output[output_index] = output[output_index - offset - 1];
 
 				output_index += sizeof(uint8_t);
@@ -311,5 +419,7 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 		}
 	} while ((output_index < max_output_size) && (input_index < (input_size)));
 
+#undef __CHECK_BYTES
+
 	return output_index;
 }
@@ -61,15 +61,195 @@ static bool test_lzxpress(struct torture_context *test)
 	torture_assert_int_equal(test, c_size, strlen(fixed_data), "fixed lzxpress_decompress size");
 	torture_assert_mem_equal(test, out2, fixed_data, c_size, "fixed lzxpress_decompress data");
 
+	torture_comment(test, "lzxpress truncated decompression\n");
+	c_size = lzxpress_decompress(out,
+				     sizeof(fixed_out) - 10,
+				     out2,
+				     talloc_get_size(out2));
+
+	torture_assert_int_equal(test, c_size, -1, "truncated lzxpress_decompress size");
+
+	return true;
+}
+
+/*
+  fill a buffer with something that looks like a log file
+ */
+static void lzxpress_fill_text(uint8_t *buf, size_t len)
+{
+	static const char *words[] = {
+		"2018-01-17 ", "12:34:56 ", "smbd ", "INFO ", "ERROR ",
+		"open_file ", "read ", "write ", "close ", "user1 ",
+		"user2 ", "share ", "ok\n", "failed\n", "0x",
+	};
+	size_t i = 0;
+
+	while (i < len) {
+		const char *w = words[random() % ARRAY_SIZE(words)];
+
+		while (*w != '\0' && i < len) {
+			buf[i++] = *w++;
+		}
+		if (random() % 8 == 0 && i < len) {
+			buf[i++] = random();
+		}
+	}
+}
+
+/*
+  compress and decompress buffers of various sizes and contents
+ */
+static bool test_lzxpress_round_trip(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(test);
+	static const uint32_t sizes[] = {
+		1, 2, 3, 4, 31, 32, 33, 255, 4096, XPRESS_BLOCK_SIZE,
+	};
+	uint8_t *in, *out, *out2;
+	size_t max_out = XPRESS_BLOCK_SIZE + XPRESS_BLOCK_SIZE / 8 + 8;
+	size_t i, kind;
+
+	in = talloc_size(tmp_ctx, XPRESS_BLOCK_SIZE);
+	out = talloc_size(tmp_ctx, max_out);
+	out2 = talloc_size(tmp_ctx, XPRESS_BLOCK_SIZE);
+	torture_assert(test, in != NULL && out != NULL && out2 != NULL,
+		       "no memory");
+
+	srandom(0);
+
+	for (kind = 0; kind < 3; kind++) {
+		for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+			uint32_t len = sizes[i];
+			ssize_t c_size, d_size;
+			size_t j;
+
+			switch (kind) {
+			case 0:
+				for (j = 0; j < len; j++) {
+					in[j] = random();
+				}
+				break;
+			case 1:
+				lzxpress_fill_text(in, len);
+				break;
+			case 2:
+				memset(in, 'A', len);
+				break;
+			}
+
+			c_size = lzxpress_compress(in, len, out, max_out);
+			torture_assert(test, c_size > 0,
+				       "lzxpress_compress failed");
+			torture_assert(test, c_size <= len + len / 8 + 8,
+				       "lzxpress_compress result too large");
+
+			d_size = lzxpress_decompress(out, c_size, out2, len);
+			torture_assert_int_equal(test, d_size, len,
+				"lzxpress_decompress size");
+			torture_assert_mem_equal(test, out2, in, len,
+				"lzxpress_decompress data");
+
+			c_size = lzxpress_compress(in, len, out, c_size - 1);
+			torture_assert_int_equal(test, c_size, -1,
+				"lzxpress_compress ignored the buffer size");
+		}
+	}
+
+	talloc_free(tmp_ctx);
 	return true;
 }
 
+/*
+  measure the throughput of lzxpress on XPRESS_BLOCK_SIZE chunks,
+  like the DRS replication code uses them.
+
+  This is a benchmark, so it only runs when a time limit is given
+  (smbtorture --timelimit), for each of compression and decompression.
+ */
+static bool test_lzxpress_speed(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx;
+	int timelimit = torture_setting_int(test, "timelimit", 0);
+	size_t in_size = 16 * XPRESS_BLOCK_SIZE;
+	size_t max_out = XPRESS_BLOCK_SIZE + XPRESS_BLOCK_SIZE / 8 + 8;
+	uint8_t *in, *out, *out2;
+	ssize_t c_sizes[16];
+	uint64_t c_total = 0;
+	uint64_t bytes;
+	struct timeval tv;
+	double elapsed;
+	size_t i;
+
+	if (timelimit <= 0) {
+		torture_skip(test, "benchmark, only run with --timelimit\n");
+	}
+
+	tmp_ctx = talloc_new(test);
+	in = talloc_size(tmp_ctx, in_size);
+	out = talloc_size(tmp_ctx, 16 * max_out);
+	out2 = talloc_size(tmp_ctx, XPRESS_BLOCK_SIZE);
+	torture_assert(test, in != NULL && out != NULL && out2 != NULL,
+		       "no memory");
+
+	srandom(0);
+	lzxpress_fill_text(in, in_size);
+
+	bytes = 0;
+	tv = timeval_current();
+	do {
+		c_total = 0;
+		for (i = 0; i < ARRAY_SIZE(c_sizes); i++) {
+			c_sizes[i] = lzxpress_compress(
+				in + i * XPRESS_BLOCK_SIZE,
+				XPRESS_BLOCK_SIZE,
+				out + i * max_out,
+				max_out);
+			torture_assert(test, c_sizes[i] > 0,
+				       "lzxpress_compress failed");
+			c_total += c_sizes[i];
+		}
+		bytes += in_size;
+		elapsed = timeval_elapsed(&tv);
+	} while (elapsed < timelimit);
+
+	torture_comment(test, "lzxpress compression: %.1f MB/s, "
+			"ratio %.2f\n",
+			bytes / elapsed / 1e6,
+			(double)in_size / c_total);
+
+	bytes = 0;
+	tv = timeval_current();
+	do {
+		for (i = 0; i < ARRAY_SIZE(c_sizes); i++) {
+			ssize_t d_size;
+
+			d_size = lzxpress_decompress(out + i * max_out,
+						     c_sizes[i],
+						     out2,
+						     XPRESS_BLOCK_SIZE);
+			torture_assert_int_equal(test, d_size,
+				XPRESS_BLOCK_SIZE, "lzxpress_decompress size");
+		}
+		bytes += in_size;
+		elapsed = timeval_elapsed(&tv);
+	} while (elapsed < timelimit);
+
+	torture_comment(test, "lzxpress decompression: %.1f MB/s\n",
+			bytes / elapsed / 1e6);
+
+	talloc_free(tmp_ctx);
+	return true;
+}
 
 struct torture_suite *torture_local_compression(TALLOC_CTX *mem_ctx)
 {
 	struct torture_suite *suite = torture_suite_create(mem_ctx, "compression");
 
 	torture_suite_add_simple_test(suite, "lzxpress", test_lzxpress);
+	torture_suite_add_simple_test(suite, "lzxpress_round_trip",
+				      test_lzxpress_round_trip);
+	torture_suite_add_simple_test(suite, "lzxpress_speed",
+				      test_lzxpress_speed);
 
 	return suite;
 }
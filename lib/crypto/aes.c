@@ -33,6 +33,7 @@
 
 #include "replace.h"
 #include "aes.h"
+#include "lib/util/byteorder.h"
 
 #ifdef SAMBA_RIJNDAEL
 #include "rijndael-alg-fst.h"
@@ -44,6 +45,11 @@
  * available.
  */
 
+#if defined(HAVE_AESNI_INTRINSICS)
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#endif
+
 static inline void __cpuid(unsigned int where[4], unsigned int leaf)
 {
 	asm volatile("cpuid" :
@@ -136,6 +142,168 @@ static void AES_decrypt_aesni(const unsigned char *in,
 {
 	aesni_dec(key->u.aes_ni.acc_ctx, out, in);
 }
+
+#if defined(HAVE_AESNI_INTRINSICS)
+static inline int AES_aesni_load_round_keys(const AES_KEY *key,
+					    __m128i rk[AES_MAXNR + 1])
+{
+	const struct crypto_aes_ctx *ctx = key->u.aes_ni.acc_ctx;
+	const __m128i *key_enc = (const __m128i *)ctx->key_enc;
+	int rounds = ctx->key_length / 4 + 6;
+	int r;
+
+	for (r = 0; r <= rounds; r++) {
+		rk[r] = _mm_load_si128(&key_enc[r]);
+	}
+
+	return rounds;
+}
+
+/*
+ * Counter mode with 8 blocks in flight, so that the
+ * latency of the aesenc instructions is hidden.
+ *
+ * The counter is kept byte swapped, so that the low
+ * 32 bits of ivec are in the lowest 32-bit lane and
+ * _mm_add_epi32() gives exactly the wrapping increment
+ * GCM and CCM need.
+ */
+#define AES_CTR32_AESNI_PARALLEL 8
+
+__attribute__((target("aes,ssse3")))
+static void AES_ctr32_encrypt_blocks_aesni(const unsigned char *in,
+				unsigned char *out,
+				size_t blocks,
+				const AES_KEY *key,
+				unsigned char ivec[AES_BLOCK_SIZE])
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					   8, 9, 10, 11, 12, 13, 14, 15);
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+	__m128i rk[AES_MAXNR + 1];
+	int rounds = AES_aesni_load_round_keys(key, rk);
+	__m128i ctr;
+	int r;
+
+	ctr = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)ivec), bswap);
+
+	while (blocks >= AES_CTR32_AESNI_PARALLEL) {
+		__m128i s[AES_CTR32_AESNI_PARALLEL];
+		int i;
+
+		for (i = 0; i < AES_CTR32_AESNI_PARALLEL; i++) {
+			s[i] = _mm_shuffle_epi8(ctr, bswap);
+			s[i] = _mm_xor_si128(s[i], rk[0]);
+			ctr = _mm_add_epi32(ctr, one);
+		}
+		for (r = 1; r < rounds; r++) {
+			for (i = 0; i < AES_CTR32_AESNI_PARALLEL; i++) {
+				s[i] = _mm_aesenc_si128(s[i], rk[r]);
+			}
+		}
+		for (i = 0; i < AES_CTR32_AESNI_PARALLEL; i++) {
+			const __m128i *ip = (const __m128i *)in + i;
+			__m128i *op = (__m128i *)out + i;
+
+			s[i] = _mm_aesenclast_si128(s[i], rk[rounds]);
+			s[i] = _mm_xor_si128(s[i], _mm_loadu_si128(ip));
+			_mm_storeu_si128(op, s[i]);
+		}
+
+		in += AES_CTR32_AESNI_PARALLEL * AES_BLOCK_SIZE;
+		out += AES_CTR32_AESNI_PARALLEL * AES_BLOCK_SIZE;
+		blocks -= AES_CTR32_AESNI_PARALLEL;
+	}
+
+	while (blocks > 0) {
+		__m128i s;
+
+		s = _mm_shuffle_epi8(ctr, bswap);
+		s = _mm_xor_si128(s, rk[0]);
+		ctr = _mm_add_epi32(ctr, one);
+		for (r = 1; r < rounds; r++) {
+			s = _mm_aesenc_si128(s, rk[r]);
+		}
+		s = _mm_aesenclast_si128(s, rk[rounds]);
+		s = _mm_xor_si128(s, _mm_loadu_si128((const __m128i *)in));
+		_mm_storeu_si128((__m128i *)out, s);
+
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+		blocks -= 1;
+	}
+
+	_mm_storeu_si128((__m128i *)ivec, _mm_shuffle_epi8(ctr, bswap));
+}
+
+/*
+ * CBC-MAC can't be parallelized, but keeping the round keys
+ * and the chaining value in registers avoids reloading them
+ * for every block.
+ */
+__attribute__((target("aes")))
+static void AES_cbc_mac_blocks_aesni(const unsigned char *in,
+				size_t blocks,
+				const AES_KEY *key,
+				unsigned char X[AES_BLOCK_SIZE])
+{
+	__m128i rk[AES_MAXNR + 1];
+	int rounds = AES_aesni_load_round_keys(key, rk);
+	__m128i x;
+	int r;
+
+	x = _mm_loadu_si128((const __m128i *)X);
+
+	while (blocks > 0) {
+		x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)in));
+		x = _mm_xor_si128(x, rk[0]);
+		for (r = 1; r < rounds; r++) {
+			x = _mm_aesenc_si128(x, rk[r]);
+		}
+		x = _mm_aesenclast_si128(x, rk[rounds]);
+
+		in += AES_BLOCK_SIZE;
+		blocks -= 1;
+	}
+
+	_mm_storeu_si128((__m128i *)X, x);
+}
+#else /* defined(HAVE_AESNI_INTRINSICS) */
+static void AES_ctr32_encrypt_blocks_aesni(const unsigned char *in,
+				unsigned char *out,
+				size_t blocks,
+				const AES_KEY *key,
+				unsigned char ivec[AES_BLOCK_SIZE])
+{
+	while (blocks > 0) {
+		unsigned char tmp[AES_BLOCK_SIZE];
+		uint32_t ctr;
+
+		aesni_enc(key->u.aes_ni.acc_ctx, tmp, ivec);
+		aes_block_xor(in, tmp, out);
+		ctr = RIVAL(ivec, AES_BLOCK_SIZE - 4);
+		RSIVAL(ivec, AES_BLOCK_SIZE - 4, ctr + 1);
+		blocks -= 1;
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+}
+
+static void AES_cbc_mac_blocks_aesni(const unsigned char *in,
+				size_t blocks,
+				const AES_KEY *key,
+				unsigned char X[AES_BLOCK_SIZE])
+{
+	while (blocks > 0) {
+		unsigned char tmp[AES_BLOCK_SIZE];
+
+		aes_block_xor(X, in, tmp);
+		aesni_enc(key->u.aes_ni.acc_ctx, X, tmp);
+		blocks -= 1;
+		in += AES_BLOCK_SIZE;
+	}
+}
+#endif /* defined(HAVE_AESNI_INTRINSICS) */
 #else /* defined(HAVE_AESNI_INTEL) */
 
 /*
@@ -175,6 +343,23 @@ static void AES_decrypt_aesni(const unsigned char *in,
 {
 	abort();
 }
+
+static void AES_ctr32_encrypt_blocks_aesni(const unsigned char *in,
+				unsigned char *out,
+				size_t blocks,
+				const AES_KEY *key,
+				unsigned char ivec[AES_BLOCK_SIZE])
+{
+	abort();
+}
+
+static void AES_cbc_mac_blocks_aesni(const unsigned char *in,
+				size_t blocks,
+				const AES_KEY *key,
+				unsigned char X[AES_BLOCK_SIZE])
+{
+	abort();
+}
 #endif /* defined(HAVE_AENI_INTEL) */
 
 /*
@@ -341,3 +526,60 @@ AES_cfb8_encrypt(const unsigned char *in, unsigned char *out,
     }
 }
 #endif /* SAMBA_AES_CFB8_ENCRYPT */
+
+#ifdef SAMBA_AES_CTR32_ENCRYPT
+/*
+ * Counter mode with a 32-bit big endian counter in the last
+ * 4 bytes of ivec, as used by GCM and by CCM with L=4.
+ * 'blocks' full blocks are processed, on return ivec holds the
+ * next unused counter block.
+ */
+void
+AES_ctr32_encrypt_blocks(const unsigned char *in, unsigned char *out,
+			 size_t blocks, const AES_KEY *key,
+			 unsigned char ivec[AES_BLOCK_SIZE])
+{
+    if (has_intel_aes_instructions()) {
+	AES_ctr32_encrypt_blocks_aesni(in, out, blocks, key, ivec);
+	return;
+    }
+
+    while (blocks > 0) {
+	unsigned char tmp[AES_BLOCK_SIZE];
+	uint32_t ctr;
+
+	AES_encrypt(ivec, tmp, key);
+	aes_block_xor(in, tmp, out);
+	ctr = RIVAL(ivec, AES_BLOCK_SIZE - 4);
+	RSIVAL(ivec, AES_BLOCK_SIZE - 4, ctr + 1);
+	blocks -= 1;
+	in += AES_BLOCK_SIZE;
+	out += AES_BLOCK_SIZE;
+    }
+}
+#endif /* SAMBA_AES_CTR32_ENCRYPT */
+
+#ifdef SAMBA_AES_CBC_MAC
+/*
+ * The core of CBC-MAC based modes (CMAC, CCM):
+ * X = E(K, X ^ in) for 'blocks' full blocks of input.
+ */
+void
+AES_cbc_mac_blocks(const unsigned char *in, size_t blocks,
+		   const AES_KEY *key, unsigned char X[AES_BLOCK_SIZE])
+{
+    if (has_intel_aes_instructions()) {
+	AES_cbc_mac_blocks_aesni(in, blocks, key, X);
+	return;
+    }
+
+    while (blocks > 0) {
+	unsigned char tmp[AES_BLOCK_SIZE];
+
+	aes_block_xor(X, in, tmp);
+	AES_encrypt(tmp, X, key);
+	blocks -= 1;
+	in += AES_BLOCK_SIZE;
+    }
+}
+#endif /* SAMBA_AES_CBC_MAC */
@@ -41,6 +41,8 @@
 #define SAMBA_RIJNDAEL 1
 #define SAMBA_AES_CBC_ENCRYPT 1
 #define SAMBA_AES_CFB8_ENCRYPT 1
+#define SAMBA_AES_CTR32_ENCRYPT 1
+#define SAMBA_AES_CBC_MAC 1
 #define SAMBA_AES_BLOCK_XOR 1
 
 /* symbol renaming */
@@ -50,6 +52,8 @@
 #define AES_decrypt samba_AES_decrypt
 #define AES_cbc_encrypt samba_AES_cbc_encrypt
 #define AES_cfb8_encrypt samba_AES_cfb8_encrypt
+#define AES_ctr32_encrypt_blocks samba_AES_ctr32_encrypt_blocks
+#define AES_cbc_mac_blocks samba_AES_cbc_mac_blocks
 
 /*
  *
@@ -94,6 +98,13 @@ void AES_cfb8_encrypt(const unsigned char *in, unsigned char *out,
 #define aes_cfb8_encrypt(in, out, size, key, iv, forward_encrypt) \
 	AES_cfb8_encrypt(in, out, size, key, iv, forward_encrypt)
 
+void AES_ctr32_encrypt_blocks(const unsigned char *in, unsigned char *out,
+			      size_t blocks, const AES_KEY *key,
+			      unsigned char ivec[AES_BLOCK_SIZE]);
+
+void AES_cbc_mac_blocks(const unsigned char *in, size_t blocks,
+			const AES_KEY *key, unsigned char X[AES_BLOCK_SIZE]);
+
 #ifdef  __cplusplus
 }
 #endif
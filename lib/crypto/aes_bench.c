@@ -0,0 +1,127 @@
+/*
+   AES-GCM-128, AES-CCM-128 and AES-CMAC-128 benchmark
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "replace.h"
+#include "../lib/util/samba_util.h"
+#include "../lib/crypto/crypto.h"
+#include "libcli/util/ntstatus.h"
+#include "lib/torture/torture.h"
+
+bool torture_local_crypto_aes_bench(struct torture_context *torture);
+
+/*
+ * SMB2 transform header (without the protocol id and signature),
+ * this is what SMB3 signs as additional data.
+ */
+#define AES_BENCH_A_SIZE 32
+
+static void aes_bench_gcm_128(uint8_t *m, size_t m_len)
+{
+	struct aes_gcm_128_context ctx;
+	uint8_t K[AES_BLOCK_SIZE] = { 0, };
+	uint8_t N[AES_GCM_128_IV_SIZE] = { 0, };
+	uint8_t A[AES_BENCH_A_SIZE] = { 0, };
+	uint8_t T[AES_BLOCK_SIZE];
+
+	aes_gcm_128_init(&ctx, K, N);
+	aes_gcm_128_updateA(&ctx, A, sizeof(A));
+	aes_gcm_128_crypt(&ctx, m, m_len);
+	aes_gcm_128_updateC(&ctx, m, m_len);
+	aes_gcm_128_digest(&ctx, T);
+}
+
+static void aes_bench_ccm_128(uint8_t *m, size_t m_len)
+{
+	struct aes_ccm_128_context ctx;
+	uint8_t K[AES_BLOCK_SIZE] = { 0, };
+	uint8_t N[AES_CCM_128_NONCE_SIZE] = { 0, };
+	uint8_t A[AES_BENCH_A_SIZE] = { 0, };
+	uint8_t T[AES_BLOCK_SIZE];
+
+	aes_ccm_128_init(&ctx, K, N, sizeof(A), m_len);
+	aes_ccm_128_update(&ctx, A, sizeof(A));
+	aes_ccm_128_update(&ctx, m, m_len);
+	aes_ccm_128_crypt(&ctx, m, m_len);
+	aes_ccm_128_digest(&ctx, T);
+}
+
+static void aes_bench_cmac_128(uint8_t *m, size_t m_len)
+{
+	struct aes_cmac_128_context ctx;
+	uint8_t K[AES_BLOCK_SIZE] = { 0, };
+	uint8_t T[AES_BLOCK_SIZE];
+
+	aes_cmac_128_init(&ctx, K);
+	aes_cmac_128_update(&ctx, m, m_len);
+	aes_cmac_128_final(&ctx, T);
+}
+
+/*
+ This reports the single core throughput of the SMB3 encryption
+ and signing algorithms for typical SMB2 READ/WRITE payload sizes.
+
+ It only runs when a time limit is given (smbtorture --timelimit),
+ which is spread over all the measurements.
+*/
+bool torture_local_crypto_aes_bench(struct torture_context *torture)
+{
+	static const struct {
+		const char *name;
+		void (*fn)(uint8_t *m, size_t m_len);
+	} modes[] = {
+		{ "AES-128-GCM", aes_bench_gcm_128 },
+		{ "AES-128-CCM", aes_bench_ccm_128 },
+		{ "AES-128-CMAC", aes_bench_cmac_128 },
+	};
+	static const size_t sizes[] = { 4096, 65536, 1024*1024 };
+	int timelimit = torture_setting_int(torture, "timelimit", 0);
+	double seconds;
+	uint8_t *m;
+	size_t i, j;
+
+	if (timelimit <= 0) {
+		torture_skip(torture, "benchmark, only run with --timelimit\n");
+	}
+	seconds = (double)timelimit /
+		(ARRAY_SIZE(modes) * ARRAY_SIZE(sizes));
+
+	m = talloc_zero_array(torture, uint8_t, sizes[ARRAY_SIZE(sizes)-1]);
+	torture_assert(torture, m != NULL, "out of memory");
+
+	for (i = 0; i < ARRAY_SIZE(modes); i++) {
+		for (j = 0; j < ARRAY_SIZE(sizes); j++) {
+			struct timeval tv = timeval_current();
+			uint64_t bytes = 0;
+			double elapsed;
+
+			do {
+				modes[i].fn(m, sizes[j]);
+				bytes += sizes[j];
+				elapsed = timeval_elapsed(&tv);
+			} while (elapsed < seconds);
+
+			torture_comment(torture,
+					"%-12s %8zu bytes: %.3f GB/s\n",
+					modes[i].name, sizes[j],
+					bytes / elapsed / 1e9);
+		}
+	}
+
+	TALLOC_FREE(m);
+	return true;
+}
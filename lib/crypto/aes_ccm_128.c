@@ -113,12 +113,13 @@ void aes_ccm_128_update(struct aes_ccm_128_context *ctx,
 		ctx->B_i_ofs = 0;
 	}
 
-	while (v_len >= AES_BLOCK_SIZE) {
-		aes_block_xor(ctx->X_i, v, ctx->B_i);
-		AES_encrypt(ctx->B_i, ctx->X_i, &ctx->aes_key);
-		v += AES_BLOCK_SIZE;
-		v_len -= AES_BLOCK_SIZE;
-		*remain -= AES_BLOCK_SIZE;
+	if (v_len >= AES_BLOCK_SIZE) {
+		size_t blocks = v_len / AES_BLOCK_SIZE;
+
+		AES_cbc_mac_blocks(v, blocks, &ctx->aes_key, ctx->X_i);
+		v += blocks * AES_BLOCK_SIZE;
+		v_len -= blocks * AES_BLOCK_SIZE;
+		*remain -= blocks * AES_BLOCK_SIZE;
 	}
 
 	if (v_len > 0) {
@@ -153,19 +154,29 @@ void aes_ccm_128_crypt(struct aes_ccm_128_context *ctx,
 		       uint8_t *m, size_t m_len)
 {
 	while (m_len > 0) {
-		if (ctx->S_i_ofs == AES_BLOCK_SIZE) {
-			ctx->S_i_ctr += 1;
-			aes_ccm_128_S_i(ctx, ctx->S_i, ctx->S_i_ctr);
-			ctx->S_i_ofs = 0;
+		if (likely(ctx->S_i_ofs == AES_BLOCK_SIZE &&
+			   m_len >= AES_BLOCK_SIZE)) {
+			size_t num_blocks = m_len / AES_BLOCK_SIZE;
+
+			/*
+			 * A_i has a 32-bit counter (L=4), so
+			 * the AES implementation can pipeline
+			 * all full blocks at once.
+			 */
+			RSIVAL(ctx->A_i, (AES_BLOCK_SIZE - AES_CCM_128_L),
+			       ctx->S_i_ctr + 1);
+			AES_ctr32_encrypt_blocks(m, m, num_blocks,
+						 &ctx->aes_key, ctx->A_i);
+			ctx->S_i_ctr += num_blocks;
+			m += num_blocks * AES_BLOCK_SIZE;
+			m_len -= num_blocks * AES_BLOCK_SIZE;
+			continue;
 		}
 
-		if (likely(ctx->S_i_ofs == 0 && m_len >= AES_BLOCK_SIZE)) {
-			aes_block_xor(m, ctx->S_i, m);
-			m += AES_BLOCK_SIZE;
-			m_len -= AES_BLOCK_SIZE;
+		if (ctx->S_i_ofs == AES_BLOCK_SIZE) {
 			ctx->S_i_ctr += 1;
 			aes_ccm_128_S_i(ctx, ctx->S_i, ctx->S_i_ctr);
-			continue;
+			ctx->S_i_ofs = 0;
 		}
 
 		m[0] ^= ctx->S_i[ctx->S_i_ofs];
@@ -80,16 +80,17 @@ void aes_cmac_128_update(struct aes_cmac_128_context *ctx,
 	}
 
 	/*
-	 * now checksum everything but the last block
+	 * now checksum everything but the last block,
+	 * directly from the callers buffer.
 	 */
-	aes_block_xor(ctx->X, ctx->last, ctx->Y);
-	AES_encrypt(ctx->Y, ctx->X, &ctx->aes_key);
-
-	while (msg_len > AES_BLOCK_SIZE) {
-		aes_block_xor(ctx->X, msg, ctx->Y);
-		AES_encrypt(ctx->Y, ctx->X, &ctx->aes_key);
-		msg += AES_BLOCK_SIZE;
-		msg_len -= AES_BLOCK_SIZE;
+	AES_cbc_mac_blocks(ctx->last, 1, &ctx->aes_key, ctx->X);
+
+	if (msg_len > AES_BLOCK_SIZE) {
+		size_t blocks = (msg_len - 1) / AES_BLOCK_SIZE;
+
+		AES_cbc_mac_blocks(msg, blocks, &ctx->aes_key, ctx->X);
+		msg += blocks * AES_BLOCK_SIZE;
+		msg_len -= blocks * AES_BLOCK_SIZE;
 	}
 
 	/*
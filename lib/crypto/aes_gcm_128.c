@@ -21,6 +21,13 @@
 #include "../lib/crypto/crypto.h"
 #include "lib/util/byteorder.h"
 
+#if defined(HAVE_AESNI_INTEL) && defined(HAVE_AESNI_INTRINSICS)
+#define AES_GCM_128_CLMUL 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#endif
+
 static inline void aes_gcm_128_inc32(uint8_t inout[AES_BLOCK_SIZE])
 {
 	uint32_t v;
@@ -63,11 +70,231 @@ static inline void aes_gcm_128_mul(const uint8_t x[AES_BLOCK_SIZE],
 	}
 }
 
+#ifdef AES_GCM_128_CLMUL
+
+/*
+ * GHASH using the carry-less multiplication instruction,
+ * see "Intel Carry-Less Multiplication Instruction and its
+ * Usage for Computing the GCM Mode" (Gueron, Kounavis).
+ *
+ * All values are kept byte reflected in the xmm registers,
+ * 4 blocks are multiplied by H^4 .. H^1 and reduced together.
+ */
+
+#define AES_GCM_128_CLMUL_FN __attribute__((target("pclmul,ssse3")))
+
+static bool aes_gcm_128_has_clmul(void)
+{
+	static int has_clmul = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (has_clmul != -1) {
+		return (bool)has_clmul;
+	}
+
+	has_clmul = 0;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+		return false;
+	}
+	if ((ecx & bit_PCLMUL) && (ecx & bit_SSSE3)) {
+		has_clmul = 1;
+	}
+	return (bool)has_clmul;
+}
+
+AES_GCM_128_CLMUL_FN
+static inline __m128i aes_gcm_128_clmul_load(const uint8_t in[AES_BLOCK_SIZE])
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					   8, 9, 10, 11, 12, 13, 14, 15);
+
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in), bswap);
+}
+
+AES_GCM_128_CLMUL_FN
+static inline void aes_gcm_128_clmul_store(uint8_t out[AES_BLOCK_SIZE],
+					   __m128i v)
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					   8, 9, 10, 11, 12, 13, 14, 15);
+
+	_mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(v, bswap));
+}
+
+/*
+ * 128x128 => 256 bit carry-less multiplication,
+ * the result is accumulated into *lo and *hi.
+ */
+AES_GCM_128_CLMUL_FN
+static inline void aes_gcm_128_clmul_mul(__m128i a, __m128i b,
+					 __m128i *lo, __m128i *hi)
+{
+	__m128i t0, t1, t2, t3;
+
+	t0 = _mm_clmulepi64_si128(a, b, 0x00);
+	t1 = _mm_clmulepi64_si128(a, b, 0x10);
+	t2 = _mm_clmulepi64_si128(a, b, 0x01);
+	t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t1 = _mm_xor_si128(t1, t2);
+	t0 = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+	t3 = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+
+	*lo = _mm_xor_si128(*lo, t0);
+	*hi = _mm_xor_si128(*hi, t3);
+}
+
+/*
+ * Shift the 256 bit product left by one (because of the bit
+ * reflection) and reduce it modulo x^128 + x^7 + x^2 + x + 1.
+ */
+AES_GCM_128_CLMUL_FN
+static inline __m128i aes_gcm_128_clmul_reduce(__m128i lo, __m128i hi)
+{
+	__m128i t7, t8, t9, t2, t4, t5;
+
+	t7 = _mm_srli_epi32(lo, 31);
+	t8 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	lo = _mm_or_si128(lo, t7);
+	hi = _mm_or_si128(hi, t8);
+	hi = _mm_or_si128(hi, t9);
+
+	t7 = _mm_slli_epi32(lo, 31);
+	t8 = _mm_slli_epi32(lo, 30);
+	t9 = _mm_slli_epi32(lo, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	lo = _mm_xor_si128(lo, t7);
+
+	t2 = _mm_srli_epi32(lo, 1);
+	t4 = _mm_srli_epi32(lo, 2);
+	t5 = _mm_srli_epi32(lo, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	lo = _mm_xor_si128(lo, t2);
+
+	return _mm_xor_si128(hi, lo);
+}
+
+AES_GCM_128_CLMUL_FN
+static void aes_gcm_128_clmul_init(struct aes_gcm_128_context *ctx)
+{
+	__m128i h, hn;
+	size_t i;
+
+	h = aes_gcm_128_clmul_load(ctx->H);
+	hn = h;
+	aes_gcm_128_clmul_store(ctx->Hn[0], hn);
+
+	for (i = 1; i < ARRAY_SIZE(ctx->Hn); i++) {
+		__m128i lo = _mm_setzero_si128();
+		__m128i hi = _mm_setzero_si128();
+
+		aes_gcm_128_clmul_mul(hn, h, &lo, &hi);
+		hn = aes_gcm_128_clmul_reduce(lo, hi);
+		aes_gcm_128_clmul_store(ctx->Hn[i], hn);
+	}
+}
+
+AES_GCM_128_CLMUL_FN
+static void aes_gcm_128_clmul_ghash(struct aes_gcm_128_context *ctx,
+				    const uint8_t *in, size_t num_blocks)
+{
+	__m128i y = aes_gcm_128_clmul_load(ctx->Y);
+	__m128i h1 = aes_gcm_128_clmul_load(ctx->Hn[0]);
+
+	if (num_blocks >= 4) {
+		__m128i h2 = aes_gcm_128_clmul_load(ctx->Hn[1]);
+		__m128i h3 = aes_gcm_128_clmul_load(ctx->Hn[2]);
+		__m128i h4 = aes_gcm_128_clmul_load(ctx->Hn[3]);
+
+		while (num_blocks >= 4) {
+			__m128i lo = _mm_setzero_si128();
+			__m128i hi = _mm_setzero_si128();
+			__m128i x1, x2, x3, x4;
+
+			x1 = aes_gcm_128_clmul_load(in);
+			x2 = aes_gcm_128_clmul_load(in + AES_BLOCK_SIZE);
+			x3 = aes_gcm_128_clmul_load(in + 2 * AES_BLOCK_SIZE);
+			x4 = aes_gcm_128_clmul_load(in + 3 * AES_BLOCK_SIZE);
+
+			/*
+			 * Y' = (Y ^ X1)*H^4 ^ X2*H^3 ^ X3*H^2 ^ X4*H
+			 */
+			aes_gcm_128_clmul_mul(_mm_xor_si128(y, x1), h4,
+					      &lo, &hi);
+			aes_gcm_128_clmul_mul(x2, h3, &lo, &hi);
+			aes_gcm_128_clmul_mul(x3, h2, &lo, &hi);
+			aes_gcm_128_clmul_mul(x4, h1, &lo, &hi);
+			y = aes_gcm_128_clmul_reduce(lo, hi);
+
+			in += 4 * AES_BLOCK_SIZE;
+			num_blocks -= 4;
+		}
+	}
+
+	while (num_blocks > 0) {
+		__m128i lo = _mm_setzero_si128();
+		__m128i hi = _mm_setzero_si128();
+		__m128i x = aes_gcm_128_clmul_load(in);
+
+		aes_gcm_128_clmul_mul(_mm_xor_si128(y, x), h1, &lo, &hi);
+		y = aes_gcm_128_clmul_reduce(lo, hi);
+
+		in += AES_BLOCK_SIZE;
+		num_blocks -= 1;
+	}
+
+	aes_gcm_128_clmul_store(ctx->Y, y);
+}
+#else /* AES_GCM_128_CLMUL */
+static bool aes_gcm_128_has_clmul(void)
+{
+	return false;
+}
+
+static void aes_gcm_128_clmul_init(struct aes_gcm_128_context *ctx)
+{
+	abort();
+}
+
+static void aes_gcm_128_clmul_ghash(struct aes_gcm_128_context *ctx,
+				    const uint8_t *in, size_t num_blocks)
+{
+	abort();
+}
+#endif /* AES_GCM_128_CLMUL */
+
+static inline void aes_gcm_128_ghash_blocks(struct aes_gcm_128_context *ctx,
+					    const uint8_t *in,
+					    size_t num_blocks)
+{
+	if (aes_gcm_128_has_clmul()) {
+		aes_gcm_128_clmul_ghash(ctx, in, num_blocks);
+		return;
+	}
+
+	while (num_blocks > 0) {
+		aes_block_xor(ctx->Y, in, ctx->y.block);
+		aes_gcm_128_mul(ctx->y.block, ctx->H, ctx->v.block, ctx->Y);
+		in += AES_BLOCK_SIZE;
+		num_blocks -= 1;
+	}
+}
+
 static inline void aes_gcm_128_ghash_block(struct aes_gcm_128_context *ctx,
 					   const uint8_t in[AES_BLOCK_SIZE])
 {
-	aes_block_xor(ctx->Y, in, ctx->y.block);
-	aes_gcm_128_mul(ctx->y.block, ctx->H, ctx->v.block, ctx->Y);
+	aes_gcm_128_ghash_blocks(ctx, in, 1);
 }
 
 void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
@@ -82,6 +309,9 @@ void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
 	 * Step 1: generate H (ctx->Y is the zero block here)
 	 */
 	AES_encrypt(ctx->Y, ctx->H, &ctx->aes_key);
+	if (aes_gcm_128_has_clmul()) {
+		aes_gcm_128_clmul_init(ctx);
+	}
 
 	/*
 	 * Step 2: generate J0
@@ -90,9 +320,11 @@ void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
 	aes_gcm_128_inc32(ctx->J0);
 
 	/*
-	 * We need to prepare CB with J0.
+	 * We need to prepare CB with inc32(J0),
+	 * CB is always the next unused counter block.
 	 */
 	memcpy(ctx->CB, ctx->J0, AES_BLOCK_SIZE);
+	aes_gcm_128_inc32(ctx->CB);
 	ctx->c.ofs = AES_BLOCK_SIZE;
 }
 
@@ -116,10 +348,12 @@ static inline void aes_gcm_128_update_tmp(struct aes_gcm_128_context *ctx,
 		tmp->ofs = 0;
 	}
 
-	while (v_len >= AES_BLOCK_SIZE) {
-		aes_gcm_128_ghash_block(ctx, v);
-		v += AES_BLOCK_SIZE;
-		v_len -= AES_BLOCK_SIZE;
+	if (v_len >= AES_BLOCK_SIZE) {
+		size_t num_blocks = v_len / AES_BLOCK_SIZE;
+
+		aes_gcm_128_ghash_blocks(ctx, v, num_blocks);
+		v += num_blocks * AES_BLOCK_SIZE;
+		v_len -= num_blocks * AES_BLOCK_SIZE;
 	}
 
 	if (v_len == 0) {
@@ -155,19 +389,25 @@ static inline void aes_gcm_128_crypt_tmp(struct aes_gcm_128_context *ctx,
 	tmp->total += m_len;
 
 	while (m_len > 0) {
-		if (tmp->ofs == AES_BLOCK_SIZE) {
-			aes_gcm_128_inc32(ctx->CB);
-			AES_encrypt(ctx->CB, tmp->block, &ctx->aes_key);
-			tmp->ofs = 0;
+		if (likely(tmp->ofs == AES_BLOCK_SIZE &&
+			   m_len >= AES_BLOCK_SIZE)) {
+			size_t num_blocks = m_len / AES_BLOCK_SIZE;
+
+			/*
+			 * Let the AES implementation pipeline
+			 * as many full blocks as possible.
+			 */
+			AES_ctr32_encrypt_blocks(m, m, num_blocks,
+						 &ctx->aes_key, ctx->CB);
+			m += num_blocks * AES_BLOCK_SIZE;
+			m_len -= num_blocks * AES_BLOCK_SIZE;
+			continue;
 		}
 
-		if (likely(tmp->ofs == 0 && m_len >= AES_BLOCK_SIZE)) {
-			aes_block_xor(m, tmp->block, m);
-			m += AES_BLOCK_SIZE;
-			m_len -= AES_BLOCK_SIZE;
-			aes_gcm_128_inc32(ctx->CB);
+		if (tmp->ofs == AES_BLOCK_SIZE) {
 			AES_encrypt(ctx->CB, tmp->block, &ctx->aes_key);
-			continue;
+			aes_gcm_128_inc32(ctx->CB);
+			tmp->ofs = 0;
 		}
 
 		m[0] ^= tmp->block[tmp->ofs];
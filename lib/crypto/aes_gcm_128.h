@@ -38,6 +38,12 @@ struct aes_gcm_128_context {
 	uint8_t CB[AES_BLOCK_SIZE];
 	uint8_t Y[AES_BLOCK_SIZE];
 	uint8_t AC[AES_BLOCK_SIZE];
+
+	/*
+	 * H^1 .. H^4 in byte reflected order,
+	 * only used by the PCLMULQDQ based GHASH.
+	 */
+	uint8_t Hn[4][AES_BLOCK_SIZE];
 };
 
 void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
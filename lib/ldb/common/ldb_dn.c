@@ -77,6 +77,9 @@ struct ldb_dn {
 
 	unsigned int ext_comp_num;
 	struct ldb_dn_ext_component *ext_components;
+
+	/* the element index of a message with this DN, see ldb_msg.c */
+	struct ldb_msg_element_index *msg_element_index;
 };
 
 /* it is helpful to be able to break on this in gdb */
@@ -1277,6 +1280,7 @@ struct ldb_dn *ldb_dn_copy(TALLOC_CTX *mem_ctx, struct ldb_dn *dn)
 	}
 
 	*new_dn = *dn;
+	new_dn->msg_element_index = NULL;
 
 	if (dn->components) {
 		unsigned int i;
@@ -2185,3 +2189,18 @@ struct ldb_context *ldb_dn_get_ldb_context(struct ldb_dn *dn)
 {
 	return dn->ldb;
 }
+
+/*
+  get and set the element index of a message with this DN, these are
+  only used by ldb_msg.c
+*/
+_PRIVATE_ struct ldb_msg_element_index *ldb_dn_get_msg_element_index(struct ldb_dn *dn)
+{
+	return dn->msg_element_index;
+}
+
+_PRIVATE_ void ldb_dn_set_msg_element_index(struct ldb_dn *dn,
+					    struct ldb_msg_element_index *index)
+{
+	dn->msg_element_index = index;
+}
@@ -33,6 +33,278 @@
 
 #include "ldb_private.h"
 
+/*
+  messages with fewer elements than this are searched element by
+  element, that is as fast as looking them up in an index
+*/
+#define LDB_MSG_ELEMENT_INDEX_MIN 16
+
+/*
+  an open addressing hash table of the element names of a message.
+  The names are compared with ldb_attr_cmp(), so the hash ignores
+  the case of the ASCII letters.
+
+  struct ldb_message is public and may be on the stack, so the index
+  can't be found from the message itself. It is a talloc child of the
+  message, and the DN of the message points at it. It is only used for
+  the message it belongs to, and only while the elements array and the
+  number of elements are those it was built for.
+
+  Each slot also records the name pointer of its element. Callers sort
+  and rename elements in place, so a probe that finds another name
+  pointer there builds the index again. A name that a caller gives an
+  element in place, and that the message did not have before, is only
+  found once something else has the index rebuilt.
+*/
+struct ldb_msg_element_index_slot {
+	uint32_t hash;
+	/* 1 + the position of the element, 0 for an empty slot */
+	unsigned int idx;
+	const char *name;
+};
+
+struct ldb_msg_element_index_guard;
+
+struct ldb_msg_element_index {
+	const struct ldb_message *msg;
+	/* the DN pointing at the index, NULL once it is freed */
+	struct ldb_dn *dn;
+	struct ldb_msg_element_index_guard *guard;
+	const struct ldb_message_element *elements;
+	unsigned int num_elements;
+	/* a power of two, at least twice the number of elements */
+	unsigned int size;
+	/* NULL until the index is first used */
+	struct ldb_msg_element_index_slot *slots;
+};
+
+/*
+  a talloc child of the DN, which detaches the index when the DN is
+  freed first
+*/
+struct ldb_msg_element_index_guard {
+	struct ldb_msg_element_index *index;
+};
+
+static int ldb_msg_element_index_guard_destructor(
+	struct ldb_msg_element_index_guard *guard)
+{
+	if (guard->index != NULL) {
+		guard->index->dn = NULL;
+		guard->index->guard = NULL;
+	}
+	return 0;
+}
+
+static int ldb_msg_element_index_destructor(struct ldb_msg_element_index *index)
+{
+	if (index->guard != NULL) {
+		index->guard->index = NULL;
+		TALLOC_FREE(index->guard);
+		ldb_dn_set_msg_element_index(index->dn, NULL);
+	}
+	return 0;
+}
+
+static uint32_t ldb_msg_element_index_hash(const char *name)
+{
+	/* FNV-1a of the name, attribute names are ASCII */
+	uint32_t hash = 0x811c9dc5;
+
+	for (; *name != '\0'; name++) {
+		uint8_t c = *name;
+
+		if (c >= 'A' && c <= 'Z') {
+			c += 'a' - 'A';
+		}
+		hash ^= c;
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+static void ldb_msg_element_index_insert(struct ldb_msg_element_index *index,
+					 unsigned int i, const char *name)
+{
+	unsigned int mask = index->size - 1;
+	uint32_t hash;
+	unsigned int pos;
+
+	index->num_elements = i + 1;
+
+	if (name == NULL) {
+		return;
+	}
+
+	/*
+	 * the probing finds earlier elements first, so the first of
+	 * several elements with the same name is found, like in a
+	 * search element by element
+	 */
+	hash = ldb_msg_element_index_hash(name);
+	pos = hash & mask;
+	while (index->slots[pos].idx != 0) {
+		pos = (pos + 1) & mask;
+	}
+	index->slots[pos].hash = hash;
+	index->slots[pos].idx = i + 1;
+	index->slots[pos].name = name;
+}
+
+/*
+  build the index from the current elements of its message
+*/
+static bool ldb_msg_element_index_build(struct ldb_msg_element_index *index,
+					const struct ldb_message *msg)
+{
+	unsigned int i, size;
+
+	TALLOC_FREE(index->slots);
+
+	if (msg->num_elements > UINT_MAX / 4) {
+		return false;
+	}
+	size = LDB_MSG_ELEMENT_INDEX_MIN * 2;
+	while (size < msg->num_elements * 2) {
+		size *= 2;
+	}
+
+	index->slots = talloc_zero_array(index,
+					 struct ldb_msg_element_index_slot,
+					 size);
+	if (index->slots == NULL) {
+		return false;
+	}
+	index->size = size;
+	index->elements = msg->elements;
+
+	for (i=0; i<msg->num_elements; i++) {
+		ldb_msg_element_index_insert(index, i, msg->elements[i].name);
+	}
+	return true;
+}
+
+/*
+  return the index of a message if it has one, building it if it
+  does not match the elements any more
+*/
+static struct ldb_msg_element_index *ldb_msg_element_index(const struct ldb_message *msg)
+{
+	struct ldb_msg_element_index *index;
+
+	if (msg->dn == NULL || msg->num_elements < LDB_MSG_ELEMENT_INDEX_MIN) {
+		return NULL;
+	}
+
+	/*
+	 * the index is a talloc child of the message it was made
+	 * for, so while it exists no other message can have the
+	 * same address. Copies of the structure have another one.
+	 */
+	index = ldb_dn_get_msg_element_index(msg->dn);
+	if (index == NULL || index->msg != msg) {
+		return NULL;
+	}
+
+	if (index->slots == NULL ||
+	    index->elements != msg->elements ||
+	    index->num_elements != msg->num_elements) {
+		if (!ldb_msg_element_index_build(index, msg)) {
+			return NULL;
+		}
+	}
+	return index;
+}
+
+/*
+  give a message made with talloc an index, which is built when
+  ldb_msg_find_element() first needs it. The index of another message
+  with the same DN is dropped.
+*/
+_PRIVATE_ void ldb_msg_element_index_attach(struct ldb_message *msg)
+{
+	struct ldb_msg_element_index *index;
+	struct ldb_msg_element_index_guard *guard;
+
+	if (msg->dn == NULL || msg->num_elements < LDB_MSG_ELEMENT_INDEX_MIN) {
+		return;
+	}
+
+	index = ldb_dn_get_msg_element_index(msg->dn);
+	if (index != NULL) {
+		if (index->msg == msg) {
+			return;
+		}
+		talloc_free(index);
+	}
+
+	index = talloc_zero(msg, struct ldb_msg_element_index);
+	if (index == NULL) {
+		return;
+	}
+	guard = talloc(msg->dn, struct ldb_msg_element_index_guard);
+	if (guard == NULL) {
+		talloc_free(index);
+		return;
+	}
+
+	index->msg = msg;
+	index->dn = msg->dn;
+	index->guard = guard;
+	guard->index = index;
+	talloc_set_destructor(index, ldb_msg_element_index_destructor);
+	talloc_set_destructor(guard, ldb_msg_element_index_guard_destructor);
+
+	ldb_dn_set_msg_element_index(msg->dn, index);
+}
+
+/*
+  add the last element of a message to its index, or give the
+  message an index once it has enough elements
+*/
+static void ldb_msg_element_index_append(struct ldb_message *msg)
+{
+	struct ldb_msg_element_index *index;
+	unsigned int i = msg->num_elements - 1;
+
+	if (msg->dn == NULL || msg->num_elements < LDB_MSG_ELEMENT_INDEX_MIN) {
+		return;
+	}
+
+	index = ldb_dn_get_msg_element_index(msg->dn);
+	if (index == NULL || index->msg != msg) {
+		ldb_msg_element_index_attach(msg);
+		return;
+	}
+	if (index->slots == NULL ||
+	    index->num_elements != i || i >= index->size / 2) {
+		/* built again when it is next needed */
+		TALLOC_FREE(index->slots);
+		return;
+	}
+
+	/* the elements array may have moved when it was grown */
+	index->elements = msg->elements;
+	ldb_msg_element_index_insert(index, i, msg->elements[i].name);
+}
+
+/*
+  drop the index of a message after the elements moved around
+*/
+static void ldb_msg_element_index_reset(struct ldb_message *msg)
+{
+	struct ldb_msg_element_index *index;
+
+	if (msg->dn == NULL) {
+		return;
+	}
+
+	index = ldb_dn_get_msg_element_index(msg->dn);
+	if (index != NULL && index->msg == msg) {
+		TALLOC_FREE(index->slots);
+	}
+}
+
 /*
   create a new ldb_message in a given memory context (NULL for top level)
 */
@@ -47,7 +319,35 @@ struct ldb_message *ldb_msg_new(TALLOC_CTX *mem_ctx)
 struct ldb_message_element *ldb_msg_find_element(const struct ldb_message *msg,
 						 const char *attr_name)
 {
+	struct ldb_msg_element_index *index;
 	unsigned int i;
+
+	index = ldb_msg_element_index(msg);
+	if (index != NULL) {
+		unsigned int mask = index->size - 1;
+		uint32_t hash = ldb_msg_element_index_hash(attr_name);
+
+		for (i = hash & mask; index->slots[i].idx != 0; i = (i + 1) & mask) {
+			struct ldb_message_element *el;
+
+			if (index->slots[i].hash != hash) {
+				continue;
+			}
+			el = &msg->elements[index->slots[i].idx - 1];
+			if (el->name != index->slots[i].name) {
+				/* changed in place, search without the index */
+				TALLOC_FREE(index->slots);
+				break;
+			}
+			if (ldb_attr_cmp(el->name, attr_name) == 0) {
+				return el;
+			}
+		}
+		if (index->slots != NULL) {
+			return NULL;
+		}
+	}
+
 	for (i=0;i<msg->num_elements;i++) {
 		if (ldb_attr_cmp(msg->elements[i].name, attr_name) == 0) {
 			return &msg->elements[i];
@@ -379,6 +679,8 @@ int ldb_msg_add_empty(struct ldb_message *msg,
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
+	ldb_msg_element_index_append(msg);
+
 	if (return_el) {
 		*return_el = el;
 	}
@@ -414,6 +716,8 @@ int ldb_msg_add(struct ldb_message *msg,
 	el_new->num_values = el_copy.num_values;
 	el_new->values     = el_copy.values;
 
+	ldb_msg_element_index_append(msg);
+
 	return LDB_SUCCESS;
 }
 
@@ -831,6 +1135,7 @@ void ldb_msg_sort_elements(struct ldb_message *msg)
 {
 	TYPESAFE_QSORT(msg->elements, msg->num_elements,
 		       ldb_msg_element_compare_name);
+	ldb_msg_element_index_reset(msg);
 }
 
 /*
@@ -856,6 +1161,8 @@ struct ldb_message *ldb_msg_copy_shallow(TALLOC_CTX *mem_ctx,
 		msg2->elements[i] = msg->elements[i];
 	}
 
+	ldb_msg_element_index_attach(msg2);
+
 	return msg2;
 
 failed:
@@ -1194,6 +1501,7 @@ int ldb_msg_rename_attr(struct ldb_message *msg, const char *attr, const char *r
 	if (el->name == NULL) {
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
+	ldb_msg_element_index_reset(msg);
 	return LDB_SUCCESS;
 }
 
@@ -1230,6 +1538,7 @@ void ldb_msg_remove_element(struct ldb_message *msg, struct ldb_message_element
 		memmove(el, el+1, ((msg->num_elements-1) - n)*sizeof(*el));
 	}
 	msg->num_elements--;
+	ldb_msg_element_index_reset(msg);
 }
 
 
@@ -1239,10 +1548,22 @@ void ldb_msg_remove_element(struct ldb_message *msg, struct ldb_message_element
 void ldb_msg_remove_attr(struct ldb_message *msg, const char *attr)
 {
 	struct ldb_message_element *el;
+	unsigned int i, j;
+
+	el = ldb_msg_find_element(msg, attr);
+	if (el == NULL) {
+		return;
+	}
 
-	while ((el = ldb_msg_find_element(msg, attr)) != NULL) {
-		ldb_msg_remove_element(msg, el);
+	/* remove this and any later element of that name in one pass */
+	j = el - msg->elements;
+	for (i = j + 1; i < msg->num_elements; i++) {
+		if (ldb_attr_cmp(msg->elements[i].name, attr) != 0) {
+			msg->elements[j++] = msg->elements[i];
+		}
 	}
+	msg->num_elements = j;
+	ldb_msg_element_index_reset(msg);
 }
 
 /*
@@ -233,6 +233,7 @@ int ldb_unpack_data_only_attr_list_flags(struct ldb_context *ldb,
 	unsigned int nelem = 0;
 	size_t len;
 	unsigned int found = 0;
+	unsigned int elements_size;
 	struct ldb_val *ldb_val_single_array = NULL;
 
 	if (list == NULL) {
@@ -315,8 +316,18 @@ int ldb_unpack_data_only_attr_list_flags(struct ldb_context *ldb,
 		goto failed;
 	}
 
+	/*
+	 * With a list of attributes we can't keep more elements than
+	 * there are names in the list, as the attribute names are
+	 * unique in a packed record.
+	 */
+	elements_size = message->num_elements;
+	if (list_size != 0 && list_size < elements_size) {
+		elements_size = list_size;
+	}
+
 	message->elements = talloc_zero_array(message, struct ldb_message_element,
-					      message->num_elements);
+					      elements_size);
 	if (!message->elements) {
 		errno = ENOMEM;
 		goto failed;
@@ -335,7 +346,7 @@ int ldb_unpack_data_only_attr_list_flags(struct ldb_context *ldb,
 	 */
 	if (flags & LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC) {
 		ldb_val_single_array = talloc_array(message->elements, struct ldb_val,
-						    message->num_elements);
+						    elements_size);
 		if (ldb_val_single_array == NULL) {
 			errno = ENOMEM;
 			goto failed;
@@ -347,6 +358,16 @@ int ldb_unpack_data_only_attr_list_flags(struct ldb_context *ldb,
 		size_t attr_len;
 		struct ldb_message_element *element = NULL;
 
+		/*
+		 * Once every attribute in the list has been found the
+		 * rest of the record can't contain anything we want,
+		 * so don't walk over it.
+		 */
+		if (list_size != 0 && found == list_size) {
+			remaining = 0;
+			break;
+		}
+
 		if (remaining < 10) {
 			errno = EIO;
 			goto failed;
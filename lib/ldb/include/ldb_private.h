@@ -237,6 +237,18 @@ char *ldb_ldif_write_redacted_trace_string(struct ldb_context *ldb, TALLOC_CTX *
  */
 struct ldb_context *ldb_dn_get_ldb_context(struct ldb_dn *dn);
 
+struct ldb_msg_element_index;
+
+struct ldb_msg_element_index *ldb_dn_get_msg_element_index(struct ldb_dn *dn);
+void ldb_dn_set_msg_element_index(struct ldb_dn *dn,
+				  struct ldb_msg_element_index *index);
+
+/*
+ * Allow ldb_msg_find_element() to keep an index of the element names
+ * of a message. The message must be allocated with talloc.
+ */
+void ldb_msg_element_index_attach(struct ldb_message *msg);
+
 #define LDB_MSG_FIND_COMMON_REMOVE_DUPLICATES 1
 
 /**
@@ -246,6 +246,8 @@ static int ltdb_index_load(struct ldb_module *module,
 		return 0;
 	}
 
+	/* this points into the old indexlist */
+	ltdb->cache->GUID_index_attribute = NULL;
 	talloc_free(ltdb->cache->indexlist);
 
 	ltdb->cache->indexlist = ldb_msg_new(ltdb->cache);
@@ -277,6 +279,15 @@ static int ltdb_index_load(struct ldb_module *module,
 		ltdb->cache->attribute_indexes = true;
 	}
 
+	/*
+	 * With @IDXGUID the records are stored under the value of the
+	 * given attribute, and the indexes hold sorted arrays of these
+	 * values rather than DNs
+	 */
+	ltdb->cache->GUID_index_attribute
+		= ldb_msg_find_attr_as_string(ltdb->cache->indexlist,
+					      LTDB_IDXGUID, NULL);
+
 	return 0;
 }
 
@@ -376,8 +387,7 @@ int ltdb_cache_load(struct ldb_module *module)
 	ldb = ldb_module_get_ctx(module);
 
 	/* a very fast check to avoid extra database reads */
-	if (ltdb->cache != NULL && 
-	    tdb_get_seqnum(ltdb->tdb) == ltdb->tdb_seqnum) {
+	if (ltdb->cache != NULL && !ltdb->kv_ops->has_changed(ltdb)) {
 		return 0;
 	}
 
@@ -400,7 +410,7 @@ int ltdb_cache_load(struct ldb_module *module)
 	/* possibly initialise the baseinfo */
 	if (r == LDB_ERR_NO_SUCH_OBJECT) {
 
-		if (tdb_transaction_start(ltdb->tdb) != 0) {
+		if (ltdb->kv_ops->begin_write(ltdb) != 0) {
 			goto failed;
 		}
 
@@ -408,14 +418,15 @@ int ltdb_cache_load(struct ldb_module *module)
 		   looking for the record again. */
 		ltdb_baseinfo_init(module);
 
-		tdb_transaction_commit(ltdb->tdb);
+		ltdb->kv_ops->finish_write(ltdb);
 
 		if (ltdb_search_dn1(module, baseinfo_dn, baseinfo, 0) != LDB_SUCCESS) {
 			goto failed;
 		}
 	}
 
-	ltdb->tdb_seqnum = tdb_get_seqnum(ltdb->tdb);
+	/* Ensure the has_changed state is up to date */
+	ltdb->kv_ops->has_changed(ltdb);
 
 	/* if the current internal sequence number is the same as the one
 	   in the database then assume the rest of the cache is OK */
@@ -564,9 +575,9 @@ int ltdb_increase_sequence_number(struct ldb_module *module)
 		ltdb->sequence_number += 1;
 	}
 
-	/* updating the tdb_seqnum here avoids us reloading the cache
-	   records due to our own modification */
-	ltdb->tdb_seqnum = tdb_get_seqnum(ltdb->tdb);
+	/* updating the has_changed state here avoids us reloading
+	   the cache records due to our own modification */
+	ltdb->kv_ops->has_changed(ltdb);
 
 	return ret;
 }
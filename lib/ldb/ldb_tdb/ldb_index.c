@@ -49,6 +49,18 @@ struct ltdb_idxptr {
 */
 #define LTDB_INDEXING_VERSION 2
 
+/* index entries in @IDXGUID mode hold a single sorted array of GUIDs */
+#define LTDB_GUID_INDEXING_VERSION 3
+
+/*
+  an AND leaves an equality test to the filtering of the results
+  once its index list has this many times more entries than there
+  are candidates left. Lists of DNs also have to be sorted to be
+  intersected, sorted lists of GUIDs are much cheaper to use.
+*/
+#define LTDB_INDEX_AND_RATIO 10
+#define LTDB_GUID_INDEX_AND_RATIO 1000
+
 /* enable the idxptr mode when transactions start */
 int ltdb_index_transaction_start(struct ldb_module *module)
 {
@@ -75,31 +87,103 @@ static int dn_list_cmp(const struct ldb_val *v1, const struct ldb_val *v2)
 }
 
 
+/* compare two GUID entries in a dn_list */
+static int guid_list_cmp(const struct ldb_val *v1, const struct ldb_val *v2)
+{
+	if (v1->length != v2->length) {
+		return v1->length < v2->length ? -1 : 1;
+	}
+	return memcmp(v1->data, v2->data, v1->length);
+}
+
 /*
-  find a entry in a dn_list, using a ldb_val. Uses a case sensitive
-  comparison with the dn returns -1 if not found
+  binary search a sorted list of GUIDs. Returns the index of an
+  entry matching v or -1 if not found, and in *pos the position
+  where v belongs
  */
-static int ltdb_dn_list_find_val(const struct dn_list *list, const struct ldb_val *v)
+static int ltdb_guid_list_search(const struct dn_list *list,
+				 const struct ldb_val *v,
+				 unsigned int *pos)
 {
-	unsigned int i;
-	for (i=0; i<list->count; i++) {
-		if (dn_list_cmp(&list->dn[i], v) == 0) {
-			return i;
+	unsigned int low = 0, high = list->count;
+
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+
+		if (guid_list_cmp(&list->dn[mid], v) < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
 		}
 	}
+
+	if (pos != NULL) {
+		*pos = low;
+	}
+	if (low < list->count && guid_list_cmp(&list->dn[low], v) == 0) {
+		return low;
+	}
 	return -1;
 }
 
 /*
-  find a entry in a dn_list. Uses a case sensitive comparison with the dn
-  returns -1 if not found
+  return the position of the first entry not less than v in a sorted
+  list of GUIDs, looking no earlier than pos.  The entries after pos
+  are probed in doubling steps before the binary search, so walking
+  through a long list costs about log(distance) comparisons per
+  lookup instead of log(count)
  */
-static int ltdb_dn_list_find_str(struct dn_list *list, const char *dn)
+static unsigned int ltdb_guid_list_gallop(const struct dn_list *list,
+					  unsigned int pos,
+					  const struct ldb_val *v)
 {
-	struct ldb_val v;
-	v.data = discard_const_p(unsigned char, dn);
-	v.length = strlen(dn);
-	return ltdb_dn_list_find_val(list, &v);
+	unsigned int low = pos, high = pos, step = 1;
+
+	while (high < list->count &&
+	       guid_list_cmp(&list->dn[high], v) < 0) {
+		low = high + 1;
+		if (step >= list->count - high) {
+			high = list->count;
+			break;
+		}
+		high += step;
+		step *= 2;
+	}
+
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+
+		if (guid_list_cmp(&list->dn[mid], v) < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+/*
+  find a entry in a dn_list, using a ldb_val. Uses a case sensitive
+  comparison with the dn, or a binary search of the sorted GUIDs in
+  @IDXGUID mode. returns -1 if not found
+ */
+static int ltdb_dn_list_find_val(struct ltdb_private *ltdb,
+				 const struct dn_list *list,
+				 const struct ldb_val *v)
+{
+	unsigned int i;
+
+	if (ltdb->cache->GUID_index_attribute != NULL) {
+		return ltdb_guid_list_search(list, v, NULL);
+	}
+
+	for (i=0; i<list->count; i++) {
+		if (dn_list_cmp(&list->dn[i], v) == 0) {
+			return i;
+		}
+	}
+	return -1;
 }
 
 /*
@@ -136,27 +220,22 @@ static struct dn_list *ltdb_index_idxptr(struct ldb_module *module, TDB_DATA rec
 }
 
 /*
-  return the @IDX list in an index entry for a dn as a
-  struct dn_list
+  find the in-memory index entry for a dn, if there is one.
+  *list is set to NULL when the entry is only in the database
  */
-static int ltdb_dn_list_load(struct ldb_module *module,
-			     struct ldb_dn *dn, struct dn_list *list)
+static int ltdb_dn_list_find_idxptr(struct ldb_module *module,
+				    struct ltdb_private *ltdb,
+				    struct ldb_dn *dn,
+				    struct dn_list **list)
 {
-	struct ldb_message *msg;
-	int ret;
-	struct ldb_message_element *el;
-	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module), struct ltdb_private);
 	TDB_DATA rec;
-	struct dn_list *list2;
 	TDB_DATA key;
 
-	list->dn = NULL;
-	list->count = 0;
+	*list = NULL;
 
-	/* see if we have any in-memory index entries */
 	if (ltdb->idxptr == NULL ||
 	    ltdb->idxptr->itdb == NULL) {
-		goto normal_index;
+		return LDB_SUCCESS;
 	}
 
 	key.dptr = discard_const_p(unsigned char, ldb_dn_get_linearized(dn));
@@ -164,21 +243,44 @@ static int ltdb_dn_list_load(struct ldb_module *module,
 
 	rec = tdb_fetch(ltdb->idxptr->itdb, key);
 	if (rec.dptr == NULL) {
-		goto normal_index;
+		return LDB_SUCCESS;
 	}
 
-	/* we've found an in-memory index entry */
-	list2 = ltdb_index_idxptr(module, rec, true);
-	if (list2 == NULL) {
-		free(rec.dptr);
+	*list = ltdb_index_idxptr(module, rec, true);
+	free(rec.dptr);
+	if (*list == NULL) {
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
-	free(rec.dptr);
-
-	*list = *list2;
 	return LDB_SUCCESS;
+}
+
+/*
+  return the @IDX list in an index entry for a dn as a
+  struct dn_list
+ */
+static int ltdb_dn_list_load(struct ldb_module *module,
+			     struct ldb_dn *dn, struct dn_list *list)
+{
+	struct ldb_message *msg;
+	int ret, version;
+	struct ldb_message_element *el;
+	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module), struct ltdb_private);
+	struct dn_list *list2;
+	unsigned int i;
+
+	list->dn = NULL;
+	list->count = 0;
+
+	/* see if we have any in-memory index entries */
+	ret = ltdb_dn_list_find_idxptr(module, ltdb, dn, &list2);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+	if (list2 != NULL) {
+		*list = *list2;
+		return LDB_SUCCESS;
+	}
 
-normal_index:
 	msg = ldb_msg_new(list);
 	if (msg == NULL) {
 		return LDB_ERR_OPERATIONS_ERROR;
@@ -192,23 +294,79 @@ normal_index:
 		return ret;
 	}
 
-	/* TODO: check indexing version number */
-
 	el = ldb_msg_find_element(msg, LTDB_IDX);
 	if (!el) {
 		talloc_free(msg);
 		return LDB_SUCCESS;
 	}
 
+	version = ldb_msg_find_attr_as_int(msg, LTDB_IDXVERSION, 0);
+
+	if (ltdb->cache->GUID_index_attribute == NULL) {
+		if (version == LTDB_GUID_INDEXING_VERSION) {
+			ldb_asprintf_errstring(ldb_module_get_ctx(module),
+					       "Index %s holds GUIDs, but the "
+					       "database is not in " LTDB_IDXGUID
+					       " mode, a re-index is needed",
+					       ldb_dn_get_linearized(dn));
+			talloc_free(msg);
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+
+		/*
+		 * we avoid copying the strings by stealing the list.
+		 * We have to steal msg onto el->values (which looks
+		 * odd) because we asked for the memory to be
+		 * allocated on msg, not on each value with
+		 * LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC above
+		 */
+		talloc_steal(el->values, msg);
+		list->dn = talloc_steal(list, el->values);
+		list->count = el->num_values;
+
+		/* We don't need msg->elements any more */
+		talloc_free(msg->elements);
+		return LDB_SUCCESS;
+	}
+
+	if (version != LTDB_GUID_INDEXING_VERSION) {
+		ldb_asprintf_errstring(ldb_module_get_ctx(module),
+				       "Index %s has version %d, but the "
+				       "database is in " LTDB_IDXGUID
+				       " mode, a re-index is needed",
+				       ldb_dn_get_linearized(dn), version);
+		talloc_free(msg);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	if (el->num_values != 1 ||
+	    (el->values[0].length % LTDB_GUID_SIZE) != 0) {
+		ldb_asprintf_errstring(ldb_module_get_ctx(module),
+				       "Corrupt GUID index %s",
+				       ldb_dn_get_linearized(dn));
+		talloc_free(msg);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
 	/*
-	 * we avoid copying the strings by stealing the list.  We have
-	 * to steal msg onto el->values (which looks odd) because we
-	 * asked for the memory to be allocated on msg, not on each
-	 * value with LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC above
+	 * The GUIDs are a single sorted array, so there is nothing to
+	 * unpack: the list just points at them. The record itself is
+	 * allocated on msg due to LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC,
+	 * so msg lives as long as the list does.
 	 */
-	talloc_steal(el->values, msg);
-	list->dn = talloc_steal(list, el->values);
-	list->count = el->num_values;
+	list->count = el->values[0].length / LTDB_GUID_SIZE;
+	list->dn = talloc_array(list, struct ldb_val, list->count);
+	if (list->dn == NULL) {
+		talloc_free(msg);
+		list->count = 0;
+		return ldb_module_oom(module);
+	}
+	talloc_steal(list->dn, msg);
+
+	for (i = 0; i < list->count; i++) {
+		list->dn[i].data = &el->values[0].data[i * LTDB_GUID_SIZE];
+		list->dn[i].length = LTDB_GUID_SIZE;
+	}
 
 	/* We don't need msg->elements any more */
 	talloc_free(msg->elements);
@@ -216,17 +374,121 @@ normal_index:
 }
 
 
+struct ltdb_dn_list_count_ctx {
+	struct ldb_module *module;
+	struct ltdb_private *ltdb;
+	unsigned int count;
+};
+
+/*
+  count the entries of an @IDX record where it is, the values are
+  only looked at and not copied
+ */
+static int ltdb_dn_list_count_parser(struct ldb_val key,
+				     struct ldb_val data,
+				     void *private_data)
+{
+	struct ltdb_dn_list_count_ctx *ctx = private_data;
+	struct ldb_context *ldb = ldb_module_get_ctx(ctx->module);
+	const char * const attrs[] = { LTDB_IDX };
+	struct ldb_message *msg;
+	struct ldb_message_element *el;
+	int ret;
+
+	msg = ldb_msg_new(ctx->module);
+	if (msg == NULL) {
+		return ldb_module_oom(ctx->module);
+	}
+
+	ret = ldb_unpack_data_only_attr_list_flags(ldb, &data, msg,
+						   attrs, 1,
+						   LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC
+						   |LDB_UNPACK_DATA_FLAG_NO_DN
+						   |LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC,
+						   NULL);
+	if (ret == -1) {
+		talloc_free(msg);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	ctx->count = 0;
+	el = ldb_msg_find_element(msg, LTDB_IDX);
+	if (el != NULL) {
+		if (ctx->ltdb->cache->GUID_index_attribute != NULL &&
+		    el->num_values == 1) {
+			ctx->count = el->values[0].length / LTDB_GUID_SIZE;
+		} else {
+			ctx->count = el->num_values;
+		}
+	}
+
+	talloc_free(msg);
+	return LDB_SUCCESS;
+}
+
+/*
+  return the number of entries in the @IDX list of an index entry
+  for a dn, without loading the list.  Returns
+  LDB_ERR_NO_SUCH_OBJECT if there is no such index entry, just like
+  ltdb_dn_list_load()
+ */
+static int ltdb_dn_list_count(struct ldb_module *module,
+			      struct ltdb_private *ltdb,
+			      struct ldb_dn *dn,
+			      unsigned int *count)
+{
+	struct ltdb_dn_list_count_ctx ctx = {
+		.module = module,
+		.ltdb = ltdb
+	};
+	struct dn_list *list;
+	struct ldb_val ldb_key;
+	TDB_DATA tdb_key;
+	int ret;
+
+	ret = ltdb_dn_list_find_idxptr(module, ltdb, dn, &list);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+	if (list != NULL) {
+		*count = list->count;
+		return LDB_SUCCESS;
+	}
+
+	tdb_key = ltdb_key(module, dn);
+	if (tdb_key.dptr == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	ldb_key.data = tdb_key.dptr;
+	ldb_key.length = tdb_key.dsize;
+
+	ret = ltdb->kv_ops->fetch_and_parse(ltdb, ldb_key,
+					    ltdb_dn_list_count_parser, &ctx);
+	talloc_free(tdb_key.dptr);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+
+	*count = ctx.count;
+	return LDB_SUCCESS;
+}
+
+
 /*
   save a dn_list into a full @IDX style record
  */
-static int ltdb_dn_list_store_full(struct ldb_module *module, struct ldb_dn *dn,
+static int ltdb_dn_list_store_full(struct ldb_module *module,
+				   struct ltdb_private *ltdb,
+				   struct ldb_dn *dn,
 				   struct dn_list *list)
 {
 	struct ldb_message *msg;
 	int ret;
 
 	if (list->count == 0) {
-		ret = ltdb_delete_noindex(module, dn);
+		struct ldb_message empty = { .dn = dn };
+
+		ret = ltdb_delete_noindex(module, &empty);
 		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
 			return LDB_SUCCESS;
 		}
@@ -238,7 +500,13 @@ static int ltdb_dn_list_store_full(struct ldb_module *module, struct ldb_dn *dn,
 		return ldb_module_oom(module);
 	}
 
-	ret = ldb_msg_add_fmt(msg, LTDB_IDXVERSION, "%u", LTDB_INDEXING_VERSION);
+	if (ltdb->cache->GUID_index_attribute == NULL) {
+		ret = ldb_msg_add_fmt(msg, LTDB_IDXVERSION, "%u",
+				      LTDB_INDEXING_VERSION);
+	} else {
+		ret = ldb_msg_add_fmt(msg, LTDB_IDXVERSION, "%u",
+				      LTDB_GUID_INDEXING_VERSION);
+	}
 	if (ret != LDB_SUCCESS) {
 		talloc_free(msg);
 		return ldb_module_oom(module);
@@ -253,8 +521,40 @@ static int ltdb_dn_list_store_full(struct ldb_module *module, struct ldb_dn *dn,
 			talloc_free(msg);
 			return ldb_module_oom(module);
 		}
-		el->values = list->dn;
-		el->num_values = list->count;
+
+		if (ltdb->cache->GUID_index_attribute == NULL) {
+			el->values = list->dn;
+			el->num_values = list->count;
+		} else {
+			struct ldb_val *v;
+			unsigned int i;
+
+			/* pack the sorted GUIDs into one value */
+			v = talloc(msg, struct ldb_val);
+			if (v == NULL) {
+				talloc_free(msg);
+				return ldb_module_oom(module);
+			}
+			v->length = list->count * LTDB_GUID_SIZE;
+			v->data = talloc_size(v, v->length);
+			if (v->data == NULL) {
+				talloc_free(msg);
+				return ldb_module_oom(module);
+			}
+			for (i = 0; i < list->count; i++) {
+				if (list->dn[i].length != LTDB_GUID_SIZE) {
+					talloc_free(msg);
+					ldb_asprintf_errstring(ldb_module_get_ctx(module),
+							       "Invalid GUID in index %s",
+							       ldb_dn_get_linearized(dn));
+					return LDB_ERR_OPERATIONS_ERROR;
+				}
+				memcpy(&v->data[i * LTDB_GUID_SIZE],
+				       list->dn[i].data, LTDB_GUID_SIZE);
+			}
+			el->values = v;
+			el->num_values = 1;
+		}
 	}
 
 	ret = ltdb_store(module, msg, TDB_REPLACE);
@@ -274,7 +574,7 @@ static int ltdb_dn_list_store(struct ldb_module *module, struct ldb_dn *dn,
 	struct dn_list *list2;
 
 	if (ltdb->idxptr == NULL) {
-		return ltdb_dn_list_store_full(module, dn, list);
+		return ltdb_dn_list_store_full(module, ltdb, dn, list);
 	}
 
 	if (ltdb->idxptr->itdb == NULL) {
@@ -345,7 +645,7 @@ static int ltdb_index_traverse_store(struct tdb_context *tdb, TDB_DATA key, TDB_
 		return -1;
 	}
 
-	ltdb->idxptr->error = ltdb_dn_list_store_full(module, dn, list);
+	ltdb->idxptr->error = ltdb_dn_list_store_full(module, ltdb, dn, list);
 	talloc_free(dn);
 	if (ltdb->idxptr->error != 0) {
 		return -1;
@@ -538,8 +838,127 @@ static int ltdb_index_dn_simple(struct ldb_module *module,
 	return ret;
 }
 
+/*
+  estimate the number of dn's a simple indexed search would return,
+  by counting the entries of its index list without loading it
+ */
+static int ltdb_index_dn_simple_count(struct ldb_module *module,
+				      struct ltdb_private *ltdb,
+				      const struct ldb_parse_tree *tree,
+				      unsigned int *count)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	struct ldb_dn *dn;
+	int ret;
+
+	if (ldb_attr_dn(tree->u.equality.attr) == 0) {
+		/* a dn= test matches one entry at most */
+		*count = 1;
+		return LDB_SUCCESS;
+	}
+
+	if (!ltdb_is_indexed(module, ltdb, tree->u.equality.attr)) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	dn = ltdb_index_key(ldb, tree->u.equality.attr, &tree->u.equality.value, NULL);
+	if (!dn) return LDB_ERR_OPERATIONS_ERROR;
+
+	ret = ltdb_dn_list_count(module, ltdb, dn, count);
+	talloc_free(dn);
+	return ret;
+}
+
 
-static bool list_union(struct ldb_context *, struct dn_list *, const struct dn_list *);
+static bool list_union(struct ldb_context *, struct ltdb_private *,
+		       struct dn_list *, const struct dn_list *);
+
+/*
+  return a list with the one entry for a DN: the DN itself, or in
+  @IDXGUID mode the GUID of the record, as found in the DN index
+ */
+static int ltdb_index_dn_base_dn(struct ldb_module *module,
+				 struct ltdb_private *ltdb,
+				 struct ldb_dn *base_dn,
+				 struct dn_list *dn_list)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	struct ldb_dn *key;
+	struct ldb_val val;
+	int ret;
+
+	if (ltdb->cache->GUID_index_attribute == NULL) {
+		dn_list->dn = talloc_array(dn_list, struct ldb_val, 1);
+		if (dn_list->dn == NULL) {
+			return ldb_module_oom(module);
+		}
+		dn_list->dn[0].data = discard_const_p(unsigned char,
+						      ldb_dn_get_linearized(base_dn));
+		if (dn_list->dn[0].data == NULL) {
+			return ldb_module_oom(module);
+		}
+		dn_list->dn[0].length = strlen((char *)dn_list->dn[0].data);
+		dn_list->count = 1;
+		return LDB_SUCCESS;
+	}
+
+	val.data = discard_const_p(uint8_t, ldb_dn_get_casefold(base_dn));
+	if (val.data == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	val.length = strlen((char *)val.data);
+
+	key = ltdb_index_key(ldb, LTDB_IDXDN, &val, NULL);
+	if (key == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	ret = ltdb_dn_list_load(module, key, dn_list);
+	talloc_free(key);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+
+	if (dn_list->count == 0) {
+		return LDB_ERR_NO_SUCH_OBJECT;
+	}
+	if (dn_list->count > 1) {
+		ldb_asprintf_errstring(ldb,
+				       "%u records found for %s in the "
+				       LTDB_IDXDN " index",
+				       dn_list->count,
+				       ldb_dn_get_linearized(base_dn));
+		return LDB_ERR_CONSTRAINT_VIOLATION;
+	}
+
+	return LDB_SUCCESS;
+}
+
+/*
+  find the key of the record for a DN in @IDXGUID mode.
+  tdb_key->dptr must point to LTDB_GUID_KEY_SIZE bytes
+ */
+int ltdb_key_dn_from_idx(struct ldb_module *module,
+			 struct ltdb_private *ltdb,
+			 struct ldb_dn *dn,
+			 TDB_DATA *tdb_key)
+{
+	struct dn_list *list;
+	int ret;
+
+	list = talloc_zero(module, struct dn_list);
+	if (list == NULL) {
+		return ldb_module_oom(module);
+	}
+
+	ret = ltdb_index_dn_base_dn(module, ltdb, dn, list);
+	if (ret == LDB_SUCCESS) {
+		ret = ltdb_guid_to_key(module, ltdb, &list->dn[0], tdb_key);
+	}
+
+	talloc_free(list);
+	return ret;
+}
 
 /*
   return a list of dn's that might match a leaf indexed search
@@ -557,6 +976,25 @@ static int ltdb_index_dn_leaf(struct ldb_module *module,
 		return LDB_SUCCESS;
 	}
 	if (ldb_attr_dn(tree->u.equality.attr) == 0) {
+		if (ltdb->cache->GUID_index_attribute != NULL) {
+			struct ldb_dn *dn;
+			int ret;
+
+			dn = ldb_dn_from_ldb_val(list,
+						 ldb_module_get_ctx(module),
+						 &tree->u.equality.value);
+			if (dn == NULL) {
+				return ldb_module_oom(module);
+			}
+			/* leave odd DNs to the full search */
+			if (!ldb_dn_validate(dn) || ldb_dn_is_special(dn)) {
+				talloc_free(dn);
+				return LDB_ERR_OPERATIONS_ERROR;
+			}
+			ret = ltdb_index_dn_base_dn(module, ltdb, dn, list);
+			talloc_free(dn);
+			return ret;
+		}
 		list->dn = talloc_array(list, struct ldb_val, 1);
 		if (list->dn == NULL) {
 			ldb_module_oom(module);
@@ -575,10 +1013,12 @@ static int ltdb_index_dn_leaf(struct ldb_module *module,
   list = list & list2
 */
 static bool list_intersect(struct ldb_context *ldb,
+			   struct ltdb_private *ltdb,
 			   struct dn_list *list, const struct dn_list *list2)
 {
 	struct dn_list *list3;
-	unsigned int i;
+	const struct dn_list *short_list, *long_list;
+	unsigned int i, j;
 
 	if (list->count == 0) {
 		/* 0 & X == 0 */
@@ -609,25 +1049,94 @@ static bool list_intersect(struct ldb_context *ldb,
 		return true;
 	}
 
+	/* walk the shorter list, looking its entries up in the longer */
+	if (list->count <= list2->count) {
+		short_list = list;
+		long_list = list2;
+	} else {
+		short_list = list2;
+		long_list = list;
+	}
+
 	list3 = talloc_zero(list, struct dn_list);
 	if (list3 == NULL) {
 		return false;
 	}
 
-	list3->dn = talloc_array(list3, struct ldb_val, list->count);
+	list3->dn = talloc_array(list3, struct ldb_val, short_list->count);
 	if (!list3->dn) {
 		talloc_free(list3);
 		return false;
 	}
 	list3->count = 0;
 
-	for (i=0;i<list->count;i++) {
-		if (ltdb_dn_list_find_val(list2, &list->dn[i]) != -1) {
-			list3->dn[list3->count] = list->dn[i];
-			list3->count++;
+	if (ltdb->cache->GUID_index_attribute != NULL) {
+		/*
+		 * both lists are sorted, so the position found for
+		 * one entry is where the search for the next starts.
+		 * The result stays sorted.
+		 */
+		j = 0;
+		for (i=0; i<short_list->count; i++) {
+			j = ltdb_guid_list_gallop(long_list, j,
+						  &short_list->dn[i]);
+			if (j == long_list->count) {
+				break;
+			}
+			if (guid_list_cmp(&long_list->dn[j],
+					  &short_list->dn[i]) == 0) {
+				list3->dn[list3->count] = short_list->dn[i];
+				list3->count++;
+			}
+		}
+	} else if (short_list->count < 2) {
+		for (i=0; i<short_list->count; i++) {
+			if (ltdb_dn_list_find_val(ltdb, long_list,
+						  &short_list->dn[i]) != -1) {
+				list3->dn[list3->count] = short_list->dn[i];
+				list3->count++;
+			}
+		}
+	} else {
+		/*
+		 * lists of DNs are not sorted, sort a copy of the
+		 * longer one to binary search it
+		 */
+		struct ldb_val *sorted;
+
+		sorted = talloc_memdup(list3, long_list->dn,
+				       sizeof(long_list->dn[0]) *
+				       long_list->count);
+		if (sorted == NULL) {
+			talloc_free(list3);
+			return false;
+		}
+		TYPESAFE_QSORT(sorted, long_list->count, dn_list_cmp);
+
+		for (i=0; i<short_list->count; i++) {
+			unsigned int low = 0, high = long_list->count;
+
+			while (low < high) {
+				unsigned int mid = low + (high - low) / 2;
+
+				if (dn_list_cmp(&sorted[mid],
+						&short_list->dn[i]) < 0) {
+					low = mid + 1;
+				} else {
+					high = mid;
+				}
+			}
+			if (low < long_list->count &&
+			    dn_list_cmp(&sorted[low],
+					&short_list->dn[i]) == 0) {
+				list3->dn[list3->count] = short_list->dn[i];
+				list3->count++;
+			}
 		}
 	}
 
+	/* entries of list2 may be kept: ltdb_index_dn_and() allocates
+	   list2 on list, or its entries are owned by ltdb->idxptr */
 	list->dn = talloc_steal(list, list3->dn);
 	list->count = list3->count;
 	talloc_free(list3);
@@ -641,9 +1150,11 @@ static bool list_intersect(struct ldb_context *ldb,
   list = list | list2
 */
 static bool list_union(struct ldb_context *ldb,
+		       struct ltdb_private *ltdb,
 		       struct dn_list *list, const struct dn_list *list2)
 {
 	struct ldb_val *dn3;
+	unsigned int i, j, k;
 
 	if (list2->count == 0) {
 		/* X | 0 == X */
@@ -668,6 +1179,33 @@ static bool list_union(struct ldb_context *ldb,
 		return false;
 	}
 
+	if (ltdb->cache->GUID_index_attribute != NULL) {
+		/* merge the sorted GUID lists, to keep them searchable */
+		i = j = k = 0;
+		while (i < list->count && j < list2->count) {
+			int cmp = guid_list_cmp(&list->dn[i], &list2->dn[j]);
+
+			if (cmp <= 0) {
+				dn3[k++] = list->dn[i++];
+				if (cmp == 0) {
+					j++;
+				}
+			} else {
+				dn3[k++] = list2->dn[j++];
+			}
+		}
+		while (i < list->count) {
+			dn3[k++] = list->dn[i++];
+		}
+		while (j < list2->count) {
+			dn3[k++] = list2->dn[j++];
+		}
+
+		list->dn = dn3;
+		list->count = k;
+		return true;
+	}
+
 	/* we allow for duplicates here, and get rid of them later */
 	memcpy(dn3, list->dn, sizeof(list->dn[0])*list->count);
 	memcpy(dn3+list->count, list2->dn, sizeof(list2->dn[0])*list2->count);
@@ -724,7 +1262,7 @@ static int ltdb_index_dn_or(struct ldb_module *module,
 			return ret;
 		}
 
-		if (!list_union(ldb, list, list2)) {
+		if (!list_union(ldb, ltdb, list, list2)) {
 			talloc_free(list2);
 			return LDB_ERR_OPERATIONS_ERROR;
 		}
@@ -769,6 +1307,24 @@ static bool ltdb_index_unique(struct ldb_context *ldb,
 	return false;
 }
 
+/*
+  a branch of an AND expression, with the estimated number of
+  entries in its index list. UINT_MAX if there is no estimate.
+ */
+struct ltdb_and_term {
+	const struct ldb_parse_tree *tree;
+	unsigned int count;
+};
+
+static int ltdb_and_term_cmp(const struct ltdb_and_term *t1,
+			     const struct ltdb_and_term *t2)
+{
+	if (t1->count != t2->count) {
+		return t1->count < t2->count ? -1 : 1;
+	}
+	return 0;
+}
+
 /*
   process an AND expression (intersection)
  */
@@ -778,7 +1334,8 @@ static int ltdb_index_dn_and(struct ldb_module *module,
 			     struct dn_list *list)
 {
 	struct ldb_context *ldb;
-	unsigned int i;
+	struct ltdb_and_term *terms;
+	unsigned int i, ratio;
 	bool found;
 
 	ldb = ldb_module_get_ctx(module);
@@ -812,14 +1369,70 @@ static int ltdb_index_dn_and(struct ldb_module *module,
 		}
 	}
 
+	/*
+	 * then estimate the size of the index list of the other
+	 * equality tests, so the intersection can start with the
+	 * smallest list and may not need to load the largest ones
+	 */
+	terms = talloc_array(list, struct ltdb_and_term,
+			     tree->u.list.num_elements);
+	if (terms == NULL) {
+		return ldb_module_oom(module);
+	}
+
+	for (i=0; i<tree->u.list.num_elements; i++) {
+		const struct ldb_parse_tree *subtree = tree->u.list.elements[i];
+		int ret;
+
+		terms[i].tree = subtree;
+		terms[i].count = UINT_MAX;
+
+		if (subtree->operation != LDB_OP_EQUALITY ||
+		    tree->u.list.num_elements < 2) {
+			continue;
+		}
+
+		ret = ltdb_index_dn_simple_count(module, ltdb, subtree,
+						 &terms[i].count);
+		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
+			/* X && 0 == 0 */
+			talloc_free(terms);
+			return LDB_ERR_NO_SUCH_OBJECT;
+		}
+		if (ret != LDB_SUCCESS) {
+			terms[i].count = UINT_MAX;
+		}
+	}
+
+	TYPESAFE_QSORT(terms, tree->u.list.num_elements, ltdb_and_term_cmp);
+
+	if (ltdb->cache->GUID_index_attribute != NULL) {
+		ratio = LTDB_GUID_INDEX_AND_RATIO;
+	} else {
+		ratio = LTDB_INDEX_AND_RATIO;
+	}
+
 	/* now do a full intersection */
 	found = false;
 
 	for (i=0; i<tree->u.list.num_elements; i++) {
-		const struct ldb_parse_tree *subtree = tree->u.list.elements[i];
+		const struct ldb_parse_tree *subtree = terms[i].tree;
 		struct dn_list *list2;
 		int ret;
 
+		/*
+		 * the indexing code is allowed to return a longer
+		 * list than what really matches, as all results are
+		 * filtered by the full expression at the end. Once
+		 * the candidates are many times fewer than the entries
+		 * of the next index list, filtering them costs less
+		 * than loading that list.
+		 */
+		if (found && terms[i].count != UINT_MAX &&
+		    terms[i].count / ratio > list->count) {
+			continue;
+		}
+
 		list2 = talloc_zero(list, struct dn_list);
 		if (list2 == NULL) {
 			return ldb_module_oom(module);
@@ -832,6 +1445,7 @@ static int ltdb_index_dn_and(struct ldb_module *module,
 			list->dn = NULL;
 			list->count = 0;
 			talloc_free(list2);
+			talloc_free(terms);
 			return LDB_ERR_NO_SUCH_OBJECT;
 		}
 
@@ -846,22 +1460,27 @@ static int ltdb_index_dn_and(struct ldb_module *module,
 			list->dn = list2->dn;
 			list->count = list2->count;
 			found = true;
-		} else if (!list_intersect(ldb, list, list2)) {
+		} else if (!list_intersect(ldb, ltdb, list, list2)) {
 			talloc_free(list2);
+			talloc_free(terms);
 			return LDB_ERR_OPERATIONS_ERROR;
 		}
 
 		if (list->count == 0) {
 			list->dn = NULL;
+			talloc_free(terms);
 			return LDB_ERR_NO_SUCH_OBJECT;
 		}
 
 		if (list->count < 2) {
 			/* it isn't worth loading the next part of the tree */
+			talloc_free(terms);
 			return LDB_SUCCESS;
 		}
 	}
 
+	talloc_free(terms);
+
 	if (!found) {
 		/* none of the attributes were indexed */
 		return LDB_ERR_OPERATIONS_ERROR;
@@ -948,74 +1567,126 @@ static int ltdb_index_dn(struct ldb_module *module,
 	return ret;
 }
 
+struct ltdb_index_filter_state {
+	struct ltdb_context *ac;
+	/* the DN in the index, for records that are packed without it */
+	struct ldb_dn *dn;
+	struct ldb_message *filtered_msg;
+};
+
+/*
+  match a record found by the index with the search, and copy the
+  attributes that the user wants out of it. The record is not
+  copied, msg points into it
+ */
+static int ltdb_index_filter_msg(struct ldb_message *msg, void *private_data)
+{
+	struct ltdb_index_filter_state *state = private_data;
+	struct ltdb_context *ac = state->ac;
+	struct ldb_context *ldb = ldb_module_get_ctx(ac->module);
+	bool matched;
+	int ret;
+
+	if (msg->dn == NULL) {
+		if (state->dn == NULL) {
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+		msg->dn = state->dn;
+	}
+
+	ret = ldb_match_msg_error(ldb, msg,
+				  ac->tree, ac->base, ac->scope, &matched);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+	if (!matched) {
+		return LDB_SUCCESS;
+	}
+
+	/* filter the attributes that the user wants */
+	ret = ltdb_filter_attrs(ac, msg, ac->attrs, &state->filtered_msg);
+	if (ret == -1) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	return LDB_SUCCESS;
+}
+
 /*
   filter a candidate dn_list from an indexed search into a set of results
   extracting just the given attributes
 */
-static int ltdb_index_filter(const struct dn_list *dn_list,
+static int ltdb_index_filter(struct ltdb_private *ltdb,
+			     const struct dn_list *dn_list,
 			     struct ltdb_context *ac,
 			     uint32_t *match_count)
 {
 	struct ldb_context *ldb;
-	struct ldb_message *msg;
-	struct ldb_message *filtered_msg;
 	unsigned int i;
 
 	ldb = ldb_module_get_ctx(ac->module);
 
 	for (i = 0; i < dn_list->count; i++) {
-		struct ldb_dn *dn;
+		struct ltdb_index_filter_state state = {
+			.ac = ac
+		};
+		uint8_t guid_key[LTDB_GUID_KEY_SIZE];
+		TDB_DATA tdb_key;
 		int ret;
-		bool matched;
 
-		msg = ldb_msg_new(ac);
-		if (!msg) {
-			return LDB_ERR_OPERATIONS_ERROR;
-		}
+		if (ltdb->cache->GUID_index_attribute != NULL) {
+			/* the record is stored under the GUID itself */
+			tdb_key.dptr = guid_key;
+			tdb_key.dsize = sizeof(guid_key);
 
-		dn = ldb_dn_from_ldb_val(msg, ldb, &dn_list->dn[i]);
-		if (dn == NULL) {
-			talloc_free(msg);
-			return LDB_ERR_OPERATIONS_ERROR;
-		}
+			ret = ltdb_guid_to_key(ac->module, ltdb,
+					       &dn_list->dn[i], &tdb_key);
+			if (ret != LDB_SUCCESS) {
+				return ret;
+			}
+			ret = ltdb_search_key_parse(ac->module, ltdb, tdb_key,
+						    ac->unpack_attrs,
+						    ac->num_unpack_attrs,
+						    ltdb_index_filter_msg,
+						    &state);
+		} else {
+			state.dn = ldb_dn_from_ldb_val(ac, ldb,
+						       &dn_list->dn[i]);
+			if (state.dn == NULL) {
+				return LDB_ERR_OPERATIONS_ERROR;
+			}
 
-		ret = ltdb_search_dn1(ac->module, dn, msg,
-				      LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC|
-				      LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC);
-		talloc_free(dn);
+			tdb_key = ltdb_key(ac->module, state.dn);
+			if (tdb_key.dptr == NULL) {
+				talloc_free(state.dn);
+				return LDB_ERR_OPERATIONS_ERROR;
+			}
+
+			ret = ltdb_search_key_parse(ac->module, ltdb, tdb_key,
+						    ac->unpack_attrs,
+						    ac->num_unpack_attrs,
+						    ltdb_index_filter_msg,
+						    &state);
+			talloc_free(tdb_key.dptr);
+			talloc_free(state.dn);
+		}
 		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
 			/* the record has disappeared? yes, this can happen */
-			talloc_free(msg);
 			continue;
 		}
 
-		if (ret != LDB_SUCCESS && ret != LDB_ERR_NO_SUCH_OBJECT) {
-			/* an internal error */
-			talloc_free(msg);
-			return LDB_ERR_OPERATIONS_ERROR;
-		}
-
-		ret = ldb_match_msg_error(ldb, msg,
-					  ac->tree, ac->base, ac->scope, &matched);
 		if (ret != LDB_SUCCESS) {
-			talloc_free(msg);
+			/* an internal error, or the match failed */
+			talloc_free(state.filtered_msg);
 			return ret;
 		}
-		if (!matched) {
-			talloc_free(msg);
-			continue;
-		}
 
-		/* filter the attributes that the user wants */
-		ret = ltdb_filter_attrs(ac, msg, ac->attrs, &filtered_msg);
-
-		talloc_free(msg);
-
-		if (ret == -1) {
-			return LDB_ERR_OPERATIONS_ERROR;
+		if (state.filtered_msg == NULL) {
+			/* it didn't match */
+			continue;
 		}
 
-		ret = ldb_module_send_entry(ac->req, filtered_msg, NULL);
+		ret = ldb_module_send_entry(ac->req, state.filtered_msg, NULL);
 		if (ret != LDB_SUCCESS) {
 			/* Regardless of success or failure, the msg
 			 * is the callbacks responsiblity, and should
@@ -1033,19 +1704,27 @@ static int ltdb_index_filter(const struct dn_list *dn_list,
 /*
   remove any duplicated entries in a indexed result
  */
-static void ltdb_dn_list_remove_duplicates(struct dn_list *list)
+static void ltdb_dn_list_remove_duplicates(struct ltdb_private *ltdb,
+					   struct dn_list *list)
 {
+	int (*cmp)(const struct ldb_val *, const struct ldb_val *);
 	unsigned int i, new_count;
 
 	if (list->count < 2) {
 		return;
 	}
 
-	TYPESAFE_QSORT(list->dn, list->count, dn_list_cmp);
+	if (ltdb->cache->GUID_index_attribute != NULL) {
+		cmp = guid_list_cmp;
+	} else {
+		cmp = dn_list_cmp;
+	}
+
+	TYPESAFE_QSORT(list->dn, list->count, cmp);
 
 	new_count = 1;
 	for (i=1; i<list->count; i++) {
-		if (dn_list_cmp(&list->dn[i], &list->dn[new_count-1]) != 0) {
+		if (cmp(&list->dn[i], &list->dn[new_count-1]) != 0) {
 			if (new_count != i) {
 				list->dn[new_count] = list->dn[i];
 			}
@@ -1082,18 +1761,12 @@ int ltdb_search_indexed(struct ltdb_context *ac, uint32_t *match_count)
 
 	switch (ac->scope) {
 	case LDB_SCOPE_BASE:
-		dn_list->dn = talloc_array(dn_list, struct ldb_val, 1);
-		if (dn_list->dn == NULL) {
-			talloc_free(dn_list);
-			return ldb_module_oom(ac->module);
-		}
-		dn_list->dn[0].data = discard_const_p(unsigned char, ldb_dn_get_linearized(ac->base));
-		if (dn_list->dn[0].data == NULL) {
+		ret = ltdb_index_dn_base_dn(ac->module, ltdb, ac->base,
+					    dn_list);
+		if (ret != LDB_SUCCESS) {
 			talloc_free(dn_list);
-			return ldb_module_oom(ac->module);
+			return ret;
 		}
-		dn_list->dn[0].length = strlen((char *)dn_list->dn[0].data);
-		dn_list->count = 1;
 		break;
 
 	case LDB_SCOPE_ONELEVEL:
@@ -1119,11 +1792,11 @@ int ltdb_search_indexed(struct ltdb_context *ac, uint32_t *match_count)
 			talloc_free(dn_list);
 			return ret;
 		}
-		ltdb_dn_list_remove_duplicates(dn_list);
+		ltdb_dn_list_remove_duplicates(ltdb, dn_list);
 		break;
 	}
 
-	ret = ltdb_index_filter(dn_list, ac, match_count);
+	ret = ltdb_index_filter(ltdb, dn_list, ac, match_count);
 	talloc_free(dn_list);
 	return ret;
 }
@@ -1131,13 +1804,16 @@ int ltdb_search_indexed(struct ltdb_context *ac, uint32_t *match_count)
 /**
  * @brief Add a DN in the index list of a given attribute name/value pair
  *
- * This function will add the DN in the index list for the index for
- * the given attribute name and value.
+ * This function will add the DN, or in @IDXGUID mode the GUID, of
+ * the message in the index list for the index for the given
+ * attribute name and value.
  *
  * @param[in]  module       A ldb_module structure
  *
- * @param[in]  dn           The string representation of the DN as it
- *                          will be stored in the index entry
+ * @param[in]  ltdb         The ltdb_private structure of the backend
+ *
+ * @param[in]  msg          The message whose DN or GUID will be
+ *                          stored in the index entry
  *
  * @param[in]  el           A ldb_message_element array, one of the entry
  *                          referred by the v_idx is the attribute name and
@@ -1148,7 +1824,9 @@ int ltdb_search_indexed(struct ltdb_context *ac, uint32_t *match_count)
  *
  * @return                  An ldb error code
  */
-static int ltdb_index_add1(struct ldb_module *module, const char *dn,
+static int ltdb_index_add1(struct ldb_module *module,
+			   struct ltdb_private *ltdb,
+			   const struct ldb_message *msg,
 			   struct ldb_message_element *el, int v_idx)
 {
 	struct ldb_context *ldb;
@@ -1157,9 +1835,31 @@ static int ltdb_index_add1(struct ldb_module *module, const char *dn,
 	const struct ldb_schema_attribute *a;
 	struct dn_list *list;
 	unsigned alloc_len;
+	const char *dn;
+	const struct ldb_val *guid = NULL;
+	unsigned int pos;
 
 	ldb = ldb_module_get_ctx(module);
 
+	dn = ldb_dn_get_linearized(msg->dn);
+	if (dn == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	if (ltdb->cache->GUID_index_attribute != NULL) {
+		guid = ldb_msg_find_ldb_val(msg,
+					    ltdb->cache->GUID_index_attribute);
+		if (guid == NULL || guid->length != LTDB_GUID_SIZE) {
+			ldb_asprintf_errstring(ldb,
+					       "%s has no valid %s, needed "
+					       "for the index in "
+					       LTDB_IDXGUID " mode",
+					       dn,
+					       ltdb->cache->GUID_index_attribute);
+			return LDB_ERR_CONSTRAINT_VIOLATION;
+		}
+	}
+
 	list = talloc_zero(module, struct dn_list);
 	if (list == NULL) {
 		return LDB_ERR_OPERATIONS_ERROR;
@@ -1178,21 +1878,33 @@ static int ltdb_index_add1(struct ldb_module *module, const char *dn,
 		return ret;
 	}
 
+	/* the DN index is always unique */
 	if (list->count > 0 &&
-	    a->flags & LDB_ATTR_FLAG_UNIQUE_INDEX) {
+	    ((a->flags & LDB_ATTR_FLAG_UNIQUE_INDEX) ||
+	     ldb_attr_cmp(el->name, LTDB_IDXDN) == 0)) {
 		/*
 		 * We do not want to print info about a possibly
 		 * confidential DN that the conflict was with in the
 		 * user-visible error string
 		 */
-		ldb_debug(ldb, LDB_DEBUG_WARNING,
-			  __location__ ": unique index violation on %s in %s, "
-			  "conficts with %*.*s in %s",
-			  el->name, dn,
-			  (int)list->dn[0].length,
-			  (int)list->dn[0].length,
-			  list->dn[0].data,
-			  ldb_dn_get_linearized(dn_key));
+		if (guid != NULL) {
+			ldb_debug(ldb, LDB_DEBUG_WARNING,
+				  __location__ ": unique index violation on %s in %s, "
+				  "conficts with %s %s in %s",
+				  el->name, dn,
+				  ltdb->cache->GUID_index_attribute,
+				  ldb_binary_encode(list, list->dn[0]),
+				  ldb_dn_get_linearized(dn_key));
+		} else {
+			ldb_debug(ldb, LDB_DEBUG_WARNING,
+				  __location__ ": unique index violation on %s in %s, "
+				  "conficts with %*.*s in %s",
+				  el->name, dn,
+				  (int)list->dn[0].length,
+				  (int)list->dn[0].length,
+				  list->dn[0].data,
+				  ldb_dn_get_linearized(dn_key));
+		}
 		ldb_asprintf_errstring(ldb, __location__ ": unique index violation on %s in %s",
 				       el->name, dn);
 		talloc_free(list);
@@ -1208,13 +1920,29 @@ static int ltdb_index_add1(struct ldb_module *module, const char *dn,
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
-	list->dn[list->count].data
-		= (uint8_t *)talloc_strdup(list->dn, dn);
-	if (list->dn[list->count].data == NULL) {
-		talloc_free(list);
-		return LDB_ERR_OPERATIONS_ERROR;
+	if (guid != NULL) {
+		/* keep the GUIDs sorted, so they can be binary searched */
+		ltdb_guid_list_search(list, guid, &pos);
+		if (pos < list->count) {
+			memmove(&list->dn[pos + 1], &list->dn[pos],
+				sizeof(list->dn[0]) * (list->count - pos));
+		}
+		list->dn[pos].data = talloc_memdup(list->dn, guid->data,
+						   guid->length);
+		if (list->dn[pos].data == NULL) {
+			talloc_free(list);
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+		list->dn[pos].length = guid->length;
+	} else {
+		list->dn[list->count].data
+			= (uint8_t *)talloc_strdup(list->dn, dn);
+		if (list->dn[list->count].data == NULL) {
+			talloc_free(list);
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+		list->dn[list->count].length = strlen(dn);
 	}
-	list->dn[list->count].length = strlen(dn);
 	list->count++;
 
 	ret = ltdb_dn_list_store(module, dn_key, list);
@@ -1227,12 +1955,14 @@ static int ltdb_index_add1(struct ldb_module *module, const char *dn,
 /*
   add index entries for one elements in a message
  */
-static int ltdb_index_add_el(struct ldb_module *module, const char *dn,
+static int ltdb_index_add_el(struct ldb_module *module,
+			     struct ltdb_private *ltdb,
+			     const struct ldb_message *msg,
 			     struct ldb_message_element *el)
 {
 	unsigned int i;
 	for (i = 0; i < el->num_values; i++) {
-		int ret = ltdb_index_add1(module, dn, el, i);
+		int ret = ltdb_index_add1(module, ltdb, msg, el, i);
 		if (ret != LDB_SUCCESS) {
 			return ret;
 		}
@@ -1244,14 +1974,15 @@ static int ltdb_index_add_el(struct ldb_module *module, const char *dn,
 /*
   add index entries for all elements in a message
  */
-static int ltdb_index_add_all(struct ldb_module *module, const char *dn,
-			      struct ldb_message_element *elements,
-			      unsigned int num_el)
+static int ltdb_index_add_all(struct ldb_module *module,
+			      struct ltdb_private *ltdb,
+			      const struct ldb_message *msg)
 {
-	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module), struct ltdb_private);
+	struct ldb_message_element *elements = msg->elements;
 	unsigned int i;
+	const char *dn_str;
 
-	if (dn[0] == '@') {
+	if (ldb_dn_is_special(msg->dn)) {
 		return LDB_SUCCESS;
 	}
 
@@ -1260,17 +1991,18 @@ static int ltdb_index_add_all(struct ldb_module *module, const char *dn,
 		return LDB_SUCCESS;
 	}
 
-	for (i = 0; i < num_el; i++) {
+	for (i = 0; i < msg->num_elements; i++) {
 		int ret;
 		if (!ltdb_is_indexed(module, ltdb, elements[i].name)) {
 			continue;
 		}
-		ret = ltdb_index_add_el(module, dn, &elements[i]);
+		ret = ltdb_index_add_el(module, ltdb, msg, &elements[i]);
 		if (ret != LDB_SUCCESS) {
 			struct ldb_context *ldb = ldb_module_get_ctx(module);
+			dn_str = ldb_dn_get_linearized(msg->dn);
 			ldb_asprintf_errstring(ldb,
 					       __location__ ": Failed to re-index %s in %s - %s",
-					       elements[i].name, dn, ldb_errstring(ldb));
+					       elements[i].name, dn_str, ldb_errstring(ldb));
 			return ret;
 		}
 	}
@@ -1290,7 +2022,6 @@ static int ltdb_index_onelevel(struct ldb_module *module,
 	struct ldb_message_element el;
 	struct ldb_val val;
 	struct ldb_dn *pdn;
-	const char *dn;
 	int ret;
 
 	/* We index for ONE Level only if requested */
@@ -1303,12 +2034,6 @@ static int ltdb_index_onelevel(struct ldb_module *module,
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
-	dn = ldb_dn_get_linearized(msg->dn);
-	if (dn == NULL) {
-		talloc_free(pdn);
-		return LDB_ERR_OPERATIONS_ERROR;
-	}
-
 	val.data = (uint8_t *)((uintptr_t)ldb_dn_get_casefold(pdn));
 	if (val.data == NULL) {
 		talloc_free(pdn);
@@ -1321,9 +2046,9 @@ static int ltdb_index_onelevel(struct ldb_module *module,
 	el.num_values = 1;
 
 	if (add) {
-		ret = ltdb_index_add1(module, dn, &el, 0);
+		ret = ltdb_index_add1(module, ltdb, msg, &el, 0);
 	} else { /* delete */
-		ret = ltdb_index_del_value(module, msg->dn, &el, 0);
+		ret = ltdb_index_del_value(module, msg, &el, 0);
 	}
 
 	talloc_free(pdn);
@@ -1331,21 +2056,64 @@ static int ltdb_index_onelevel(struct ldb_module *module,
 	return ret;
 }
 
+/*
+  insert the DN index for a message in @IDXGUID mode. This is how a
+  record is found by its DN, as it is stored under its GUID.
+*/
+static int ltdb_write_index_dn_guid(struct ldb_module *module,
+				    const struct ldb_message *msg,
+				    int add)
+{
+	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module),
+						    struct ltdb_private);
+	struct ldb_message_element el;
+	struct ldb_val val;
+	int ret;
+
+	if (ltdb->cache->GUID_index_attribute == NULL) {
+		return LDB_SUCCESS;
+	}
+
+	val.data = discard_const_p(uint8_t, ldb_dn_get_casefold(msg->dn));
+	if (val.data == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	val.length = strlen((char *)val.data);
+	el.name = LTDB_IDXDN;
+	el.values = &val;
+	el.num_values = 1;
+
+	if (add) {
+		ret = ltdb_index_add1(module, ltdb, msg, &el, 0);
+		if (ret == LDB_ERR_ENTRY_ALREADY_EXISTS) {
+			ldb_asprintf_errstring(ldb_module_get_ctx(module),
+					       "Entry %s already exists",
+					       ldb_dn_get_linearized(msg->dn));
+		}
+	} else { /* delete */
+		ret = ltdb_index_del_value(module, msg, &el, 0);
+	}
+
+	return ret;
+}
+
 /*
   add the index entries for a new element in a record
   The caller guarantees that these element values are not yet indexed
 */
-int ltdb_index_add_element(struct ldb_module *module, struct ldb_dn *dn,
+int ltdb_index_add_element(struct ldb_module *module,
+			   const struct ldb_message *msg,
 			   struct ldb_message_element *el)
 {
 	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module), struct ltdb_private);
-	if (ldb_dn_is_special(dn)) {
+	if (ldb_dn_is_special(msg->dn)) {
 		return LDB_SUCCESS;
 	}
 	if (!ltdb_is_indexed(module, ltdb, el->name)) {
 		return LDB_SUCCESS;
 	}
-	return ltdb_index_add_el(module, ldb_dn_get_linearized(dn), el);
+	return ltdb_index_add_el(module, ltdb, msg, el);
 }
 
 /*
@@ -1353,19 +2121,19 @@ int ltdb_index_add_element(struct ldb_module *module, struct ldb_dn *dn,
 */
 int ltdb_index_add_new(struct ldb_module *module, const struct ldb_message *msg)
 {
-	const char *dn;
+	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module), struct ltdb_private);
 	int ret;
 
 	if (ldb_dn_is_special(msg->dn)) {
 		return LDB_SUCCESS;
 	}
 
-	dn = ldb_dn_get_linearized(msg->dn);
-	if (dn == NULL) {
-		return LDB_ERR_OPERATIONS_ERROR;
+	ret = ltdb_write_index_dn_guid(module, msg, 1);
+	if (ret != LDB_SUCCESS) {
+		return ret;
 	}
 
-	ret = ltdb_index_add_all(module, dn, msg->elements, msg->num_elements);
+	ret = ltdb_index_add_all(module, ltdb, msg);
 	if (ret != LDB_SUCCESS) {
 		return ret;
 	}
@@ -1377,19 +2145,22 @@ int ltdb_index_add_new(struct ldb_module *module, const struct ldb_message *msg)
 /*
   delete an index entry for one message element
 */
-int ltdb_index_del_value(struct ldb_module *module, struct ldb_dn *dn,
+int ltdb_index_del_value(struct ldb_module *module,
+			 const struct ldb_message *msg,
 			 struct ldb_message_element *el, unsigned int v_idx)
 {
+	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module), struct ltdb_private);
 	struct ldb_context *ldb;
 	struct ldb_dn *dn_key;
 	const char *dn_str;
 	int ret, i;
 	unsigned int j;
 	struct dn_list *list;
+	struct ldb_val v;
 
 	ldb = ldb_module_get_ctx(module);
 
-	dn_str = ldb_dn_get_linearized(dn);
+	dn_str = ldb_dn_get_linearized(msg->dn);
 	if (dn_str == NULL) {
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
@@ -1398,6 +2169,21 @@ int ltdb_index_del_value(struct ldb_module *module, struct ldb_dn *dn,
 		return LDB_SUCCESS;
 	}
 
+	if (ltdb->cache->GUID_index_attribute != NULL) {
+		const struct ldb_val *guid;
+
+		guid = ldb_msg_find_ldb_val(msg,
+					    ltdb->cache->GUID_index_attribute);
+		if (guid == NULL) {
+			/* it can't have been indexed */
+			return LDB_SUCCESS;
+		}
+		v = *guid;
+	} else {
+		v.data = discard_const_p(unsigned char, dn_str);
+		v.length = strlen(dn_str);
+	}
+
 	dn_key = ltdb_index_key(ldb, el->name, &el->values[v_idx], NULL);
 	if (!dn_key) {
 		return LDB_ERR_OPERATIONS_ERROR;
@@ -1422,7 +2208,7 @@ int ltdb_index_del_value(struct ldb_module *module, struct ldb_dn *dn,
 		return ret;
 	}
 
-	i = ltdb_dn_list_find_str(list, dn_str);
+	i = ltdb_dn_list_find_val(ltdb, list, &v);
 	if (i == -1) {
 		/* nothing to delete */
 		talloc_free(dn_key);
@@ -1452,7 +2238,8 @@ int ltdb_index_del_value(struct ldb_module *module, struct ldb_dn *dn,
   delete the index entries for a element
   return -1 on failure
 */
-int ltdb_index_del_element(struct ldb_module *module, struct ldb_dn *dn,
+int ltdb_index_del_element(struct ldb_module *module,
+			   const struct ldb_message *msg,
 			   struct ldb_message_element *el)
 {
 	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module), struct ltdb_private);
@@ -1465,7 +2252,7 @@ int ltdb_index_del_element(struct ldb_module *module, struct ldb_dn *dn,
 		return LDB_SUCCESS;
 	}
 
-	dn_str = ldb_dn_get_linearized(dn);
+	dn_str = ldb_dn_get_linearized(msg->dn);
 	if (dn_str == NULL) {
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
@@ -1478,7 +2265,7 @@ int ltdb_index_del_element(struct ldb_module *module, struct ldb_dn *dn,
 		return LDB_SUCCESS;
 	}
 	for (i = 0; i < el->num_values; i++) {
-		ret = ltdb_index_del_value(module, dn, el, i);
+		ret = ltdb_index_del_value(module, msg, el, i);
 		if (ret != LDB_SUCCESS) {
 			return ret;
 		}
@@ -1506,13 +2293,18 @@ int ltdb_index_delete(struct ldb_module *module, const struct ldb_message *msg)
 		return ret;
 	}
 
+	ret = ltdb_write_index_dn_guid(module, msg, 0);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+
 	if (!ltdb->cache->attribute_indexes) {
 		/* no indexed fields */
 		return LDB_SUCCESS;
 	}
 
 	for (i = 0; i < msg->num_elements; i++) {
-		ret = ltdb_index_del_element(module, msg->dn, &msg->elements[i]);
+		ret = ltdb_index_del_element(module, msg, &msg->elements[i]);
 		if (ret != LDB_SUCCESS) {
 			return ret;
 		}
@@ -1525,17 +2317,17 @@ int ltdb_index_delete(struct ldb_module *module, const struct ldb_message *msg)
 /*
   traversal function that deletes all @INDEX records
 */
-static int delete_index(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *state)
+static int delete_index(struct ltdb_private *ltdb, struct ldb_val key,
+			struct ldb_val data, void *state)
 {
 	struct ldb_module *module = state;
-	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module), struct ltdb_private);
 	const char *dnstr = "DN=" LTDB_INDEX ":";
 	struct dn_list list;
 	struct ldb_dn *dn;
 	struct ldb_val v;
 	int ret;
 
-	if (strncmp((char *)key.dptr, dnstr, strlen(dnstr)) != 0) {
+	if (strncmp((char *)key.data, dnstr, strlen(dnstr)) != 0) {
 		return 0;
 	}
 	/* we need to put a empty list in the internal tdb for this
@@ -1544,8 +2336,8 @@ static int delete_index(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, vo
 	list.count = 0;
 
 	/* the offset of 3 is to remove the DN= prefix. */
-	v.data = key.dptr + 3;
-	v.length = strnlen((char *)key.dptr, key.dsize) - 3;
+	v.data = key.data + 3;
+	v.length = strnlen((char *)key.data, key.length) - 3;
 
 	dn = ldb_dn_from_ldb_val(ltdb, ldb_module_get_ctx(module), &v);
 	ret = ltdb_dn_list_store(module, dn, &list);
@@ -1568,18 +2360,19 @@ struct ltdb_reindex_context {
 /*
   traversal function that adds @INDEX records during a re index
 */
-static int re_key(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *state)
+static int re_key(struct ltdb_private *ltdb, struct ldb_val ldb_key,
+		  struct ldb_val val, void *state)
 {
 	struct ldb_context *ldb;
 	struct ltdb_reindex_context *ctx = (struct ltdb_reindex_context *)state;
 	struct ldb_module *module = ctx->module;
 	struct ldb_message *msg;
 	unsigned int nb_elements_in_db;
-	const struct ldb_val val = {
-		.data = data.dptr,
-		.length = data.dsize,
-	};
 	int ret;
+	TDB_DATA key = {
+		.dptr = ldb_key.data,
+		.dsize = ldb_key.length
+	};
 	TDB_DATA key2;
 	bool is_record;
 	
@@ -1624,8 +2417,18 @@ static int re_key(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *st
 	}
 	
 	/* check if the DN key has changed, perhaps due to the
-	   case insensitivity of an element changing */
-	key2 = ltdb_key(module, msg->dn);
+	   case insensitivity of an element changing, or the record
+	   has to move to or from its GUID key due to @IDXGUID */
+	key2 = ltdb_key_msg(module, msg);
+	if (key2.dptr == NULL && errno == EINVAL) {
+		/* we can't leave it where it can't be found */
+		ldb_debug(ldb, LDB_DEBUG_ERROR, "Unable to re-key %s: %s",
+			  ldb_dn_get_linearized(msg->dn),
+			  ldb_errstring(ldb));
+		ctx->error = LDB_ERR_CONSTRAINT_VIOLATION;
+		talloc_free(msg);
+		return -1;
+	}
 	if (key2.dptr == NULL) {
 		/* probably a corrupt record ... darn */
 		ldb_debug(ldb, LDB_DEBUG_ERROR, "Invalid DN in re_index: %s",
@@ -1635,30 +2438,22 @@ static int re_key(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *st
 	}
 	if (key.dsize != key2.dsize ||
 	    (memcmp(key.dptr, key2.dptr, key.dsize) != 0)) {
-		int tdb_ret;
-		tdb_ret = tdb_delete(tdb, key);
-		if (tdb_ret != 0) {
-			ldb_debug(ldb, LDB_DEBUG_ERROR,
-				  "Failed to delete %*.*s "
-				  "for rekey as %*.*s: %s",
-				  (int)key.dsize, (int)key.dsize,
-				  (const char *)key.dptr,
-				  (int)key2.dsize, (int)key2.dsize,
-				  (const char *)key.dptr,
-				  tdb_errorstr(tdb));
-			ctx->error = ltdb_err_map(tdb_error(tdb));
-			return -1;
-		}
-		tdb_ret = tdb_store(tdb, key2, data, 0);
-		if (tdb_ret != 0) {
+		struct ldb_val ldb_key2 = {
+			.data = key2.dptr,
+			.length = key2.dsize
+		};
+
+		ret = ltdb->kv_ops->update_in_iterate(ltdb, ldb_key,
+						      ldb_key2, val);
+		if (ret != LDB_SUCCESS) {
 			ldb_debug(ldb, LDB_DEBUG_ERROR,
 				  "Failed to rekey %*.*s as %*.*s: %s",
 				  (int)key.dsize, (int)key.dsize,
 				  (const char *)key.dptr,
 				  (int)key2.dsize, (int)key2.dsize,
-				  (const char *)key.dptr,
-				  tdb_errorstr(tdb));
-			ctx->error = ltdb_err_map(tdb_error(tdb));
+				  (const char *)key2.dptr,
+				  ltdb->kv_ops->errorstr(ltdb));
+			ctx->error = ret;
 			return -1;
 		}
 	}
@@ -1672,19 +2467,19 @@ static int re_key(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *st
 /*
   traversal function that adds @INDEX records during a re index
 */
-static int re_index(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *state)
+static int re_index(struct ltdb_private *ltdb, struct ldb_val ldb_key,
+		    struct ldb_val val, void *state)
 {
 	struct ldb_context *ldb;
 	struct ltdb_reindex_context *ctx = (struct ltdb_reindex_context *)state;
 	struct ldb_module *module = ctx->module;
 	struct ldb_message *msg;
-	const char *dn = NULL;
 	unsigned int nb_elements_in_db;
-	const struct ldb_val val = {
-		.data = data.dptr,
-		.length = data.dsize,
-	};
 	int ret;
+	TDB_DATA key = {
+		.dptr = ldb_key.data,
+		.dsize = ldb_key.length
+	};
 	bool is_record;
 	
 	ldb = ldb_module_get_ctx(module);
@@ -1725,8 +2520,16 @@ static int re_index(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *
 			  (char *)key.dptr);
 		talloc_free(msg);
 		return -1;
-	} else {
-		dn = ldb_dn_get_linearized(msg->dn);
+	}
+
+	ret = ltdb_write_index_dn_guid(module, msg, 1);
+	if (ret != LDB_SUCCESS) {
+		ldb_debug(ldb, LDB_DEBUG_ERROR,
+			  "Adding special DN index failed (%s)!",
+			  ldb_dn_get_linearized(msg->dn));
+		ctx->error = ret;
+		talloc_free(msg);
+		return -1;
 	}
 
 	ret = ltdb_index_onelevel(module, msg, 1);
@@ -1738,7 +2541,7 @@ static int re_index(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *
 		return -1;
 	}
 
-	ret = ltdb_index_add_all(module, dn, msg->elements, msg->num_elements);
+	ret = ltdb_index_add_all(module, ltdb, msg);
 
 	if (ret != LDB_SUCCESS) {
 		ctx->error = ret;
@@ -1779,7 +2582,7 @@ int ltdb_reindex(struct ldb_module *module)
 	/* first traverse the database deleting any @INDEX records by
 	 * putting NULL entries in the in-memory tdb
 	 */
-	ret = tdb_traverse(ltdb->tdb, delete_index, module);
+	ret = ltdb->kv_ops->iterate(ltdb, delete_index, module);
 	if (ret < 0) {
 		struct ldb_context *ldb = ldb_module_get_ctx(module);
 		ldb_asprintf_errstring(ldb, "index deletion traverse failed: %s",
@@ -1787,16 +2590,14 @@ int ltdb_reindex(struct ldb_module *module)
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
-	/* if we don't have indexes we have nothing todo */
-	if (!ltdb->cache->attribute_indexes) {
-		return LDB_SUCCESS;
-	}
-
 	ctx.module = module;
 	ctx.error = 0;
 
-	/* now traverse adding any indexes for normal LDB records */
-	ret = tdb_traverse(ltdb->tdb, re_key, &ctx);
+	/*
+	 * the keys have to be corrected even without indexes, records
+	 * move to or from their GUID keys when @IDXGUID changes
+	 */
+	ret = ltdb->kv_ops->iterate(ltdb, re_key, &ctx);
 	if (ret < 0) {
 		struct ldb_context *ldb = ldb_module_get_ctx(module);
 		ldb_asprintf_errstring(ldb, "key correction traverse failed: %s",
@@ -1810,10 +2611,16 @@ int ltdb_reindex(struct ldb_module *module)
 		return ctx.error;
 	}
 
+	/* if we don't have indexes we have nothing more todo */
+	if (!ltdb->cache->attribute_indexes &&
+	    ltdb->cache->GUID_index_attribute == NULL) {
+		return LDB_SUCCESS;
+	}
+
 	ctx.error = 0;
 
 	/* now traverse adding any indexes for normal LDB records */
-	ret = tdb_traverse(ltdb->tdb, re_index, &ctx);
+	ret = ltdb->kv_ops->iterate(ltdb, re_index, &ctx);
 	if (ret < 0) {
 		struct ldb_context *ldb = ldb_module_get_ctx(module);
 		ldb_asprintf_errstring(ldb, "reindexing traverse failed: %s",
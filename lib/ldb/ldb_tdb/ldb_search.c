@@ -108,31 +108,68 @@ static int msg_add_distinguished_name(struct ldb_message *msg)
 	return ret;
 }
 
+static int ltdb_key_exists_parser(struct ldb_val key, struct ldb_val data,
+				  void *private_data)
+{
+	return LDB_SUCCESS;
+}
+
+/*
+  check if a record exists under the given key
+*/
+bool ltdb_key_exists(struct ltdb_private *ltdb, TDB_DATA tdb_key)
+{
+	struct ldb_val key = {
+		.data = tdb_key.dptr,
+		.length = tdb_key.dsize
+	};
+	int ret;
+
+	ret = ltdb->kv_ops->fetch_and_parse(ltdb, key,
+					    ltdb_key_exists_parser, NULL);
+	return (ret == LDB_SUCCESS);
+}
+
 /*
   search the database for a single simple dn.
   return LDB_ERR_NO_SUCH_OBJECT on record-not-found
   and LDB_SUCCESS on success
 */
-static int ltdb_search_base(struct ldb_module *module, struct ldb_dn *dn)
+int ltdb_search_base(struct ldb_module *module, struct ldb_dn *dn)
 {
 	void *data = ldb_module_get_private(module);
 	struct ltdb_private *ltdb = talloc_get_type(data, struct ltdb_private);
 	TDB_DATA tdb_key;
-	int exists;
+	bool exists;
+	int ret;
 
 	if (ldb_dn_is_null(dn)) {
 		return LDB_ERR_NO_SUCH_OBJECT;
 	}
 
-	/* form the key */
-	tdb_key = ltdb_key(module, dn);
-	if (!tdb_key.dptr) {
-		return LDB_ERR_OPERATIONS_ERROR;
+	if (ltdb->cache->GUID_index_attribute != NULL &&
+	    !ldb_dn_is_special(dn)) {
+		uint8_t guid_key[LTDB_GUID_KEY_SIZE];
+
+		tdb_key.dptr = guid_key;
+		tdb_key.dsize = sizeof(guid_key);
+
+		ret = ltdb_key_dn_from_idx(module, ltdb, dn, &tdb_key);
+		if (ret != LDB_SUCCESS) {
+			return ret;
+		}
+		exists = ltdb_key_exists(ltdb, tdb_key);
+	} else {
+		/* form the key */
+		tdb_key = ltdb_key(module, dn);
+		if (!tdb_key.dptr) {
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+
+		exists = ltdb_key_exists(ltdb, tdb_key);
+		talloc_free(tdb_key.dptr);
 	}
 
-	exists = tdb_exists(ltdb->tdb, tdb_key);
-	talloc_free(tdb_key.dptr);
-		
 	if (exists) {
 		return LDB_SUCCESS;
 	}
@@ -145,17 +182,14 @@ struct ltdb_parse_data_unpack_ctx {
 	unsigned int unpack_flags;
 };
 
-static int ltdb_parse_data_unpack(TDB_DATA key, TDB_DATA data,
+static int ltdb_parse_data_unpack(struct ldb_val key, struct ldb_val data,
 				  void *private_data)
 {
 	struct ltdb_parse_data_unpack_ctx *ctx = private_data;
 	unsigned int nb_elements_in_db;
 	int ret;
 	struct ldb_context *ldb = ldb_module_get_ctx(ctx->module);
-	struct ldb_val data_parse = {
-		.data = data.dptr,
-		.length = data.dsize
-	};
+	struct ldb_val data_parse = data;
 
 	if (ctx->unpack_flags & LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC) {
 		/*
@@ -165,13 +199,13 @@ static int ltdb_parse_data_unpack(TDB_DATA key, TDB_DATA data,
 		 * and the caller needs a stable result.
 		 */
 		data_parse.data = talloc_memdup(ctx->msg,
-						data.dptr,
-						data.dsize);
+						data.data,
+						data.length);
 		if (data_parse.data == NULL) {
 			ldb_debug(ldb, LDB_DEBUG_ERROR,
 				  "Unable to allocate data(%d) for %*.*s\n",
-				  (int)data.dsize,
-				  (int)key.dsize, (int)key.dsize, key.dptr);
+				  (int)data.length,
+				  (int)key.length, (int)key.length, key.data);
 			return LDB_ERR_OPERATIONS_ERROR;
 		}
 	}
@@ -182,58 +216,165 @@ static int ltdb_parse_data_unpack(TDB_DATA key, TDB_DATA data,
 						   ctx->unpack_flags,
 						   &nb_elements_in_db);
 	if (ret == -1) {
-		if (data_parse.data != data.dptr) {
+		if (data_parse.data != data.data) {
 			talloc_free(data_parse.data);
 		}
 
 		ldb_debug(ldb, LDB_DEBUG_ERROR, "Invalid data for index %*.*s\n",
-			  (int)key.dsize, (int)key.dsize, key.dptr);
+			  (int)key.length, (int)key.length, key.data);
 		return LDB_ERR_OPERATIONS_ERROR;		
 	}
 	return ret;
 }
 
 /*
-  search the database for a single simple dn, returning all attributes
-  in a single message
+  search the database for the record stored under a key, returning
+  all attributes in a single message
 
   return LDB_ERR_NO_SUCH_OBJECT on record-not-found
   and LDB_SUCCESS on success
 */
-int ltdb_search_dn1(struct ldb_module *module, struct ldb_dn *dn, struct ldb_message *msg,
+int ltdb_search_key(struct ldb_module *module, struct ltdb_private *ltdb,
+		    TDB_DATA tdb_key, struct ldb_message *msg,
 		    unsigned int unpack_flags)
 {
-	void *data = ldb_module_get_private(module);
-	struct ltdb_private *ltdb = talloc_get_type(data, struct ltdb_private);
-	int ret;
-	TDB_DATA tdb_key;
+	struct ldb_val ldb_key = {
+		.data = tdb_key.dptr,
+		.length = tdb_key.dsize
+	};
 	struct ltdb_parse_data_unpack_ctx ctx = {
 		.msg = msg,
 		.module = module,
 		.unpack_flags = unpack_flags
 	};
 
-	/* form the key */
-	tdb_key = ltdb_key(module, dn);
-	if (!tdb_key.dptr) {
-		return LDB_ERR_OPERATIONS_ERROR;
-	}
-
 	memset(msg, 0, sizeof(*msg));
 
 	msg->num_elements = 0;
 	msg->elements = NULL;
 
-	ret = tdb_parse_record(ltdb->tdb, tdb_key, 
-			       ltdb_parse_data_unpack, &ctx); 
-	talloc_free(tdb_key.dptr);
-	
+	return ltdb->kv_ops->fetch_and_parse(ltdb, ldb_key,
+					     ltdb_parse_data_unpack, &ctx);
+}
+
+struct ltdb_parse_data_in_place_ctx {
+	struct ldb_module *module;
+	const char * const *attrs;
+	unsigned int num_attrs;
+	int (*parser)(struct ldb_message *msg, void *private_data);
+	void *private_data;
+};
+
+static int ltdb_parse_data_in_place(struct ldb_val key, struct ldb_val data,
+				    void *private_data)
+{
+	struct ltdb_parse_data_in_place_ctx *ctx = private_data;
+	struct ldb_context *ldb = ldb_module_get_ctx(ctx->module);
+	struct ldb_message *msg;
+	unsigned int nb_elements_in_db;
+	int ret;
+
+	msg = ldb_msg_new(ctx->module);
+	if (msg == NULL) {
+		return ldb_module_oom(ctx->module);
+	}
+
+	ret = ldb_unpack_data_only_attr_list_flags(ldb, &data, msg,
+						   ctx->attrs, ctx->num_attrs,
+						   LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC|
+						   LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC,
+						   &nb_elements_in_db);
 	if (ret == -1) {
-		if (tdb_error(ltdb->tdb) == TDB_ERR_NOEXIST) {
-			return LDB_ERR_NO_SUCH_OBJECT;
-		}
+		talloc_free(msg);
+		ldb_debug(ldb, LDB_DEBUG_ERROR, "Invalid data for index %*.*s\n",
+			  (int)key.length, (int)key.length, key.data);
 		return LDB_ERR_OPERATIONS_ERROR;
-	} else if (ret != LDB_SUCCESS) {
+	}
+
+	ret = ctx->parser(msg, ctx->private_data);
+	talloc_free(msg);
+	return ret;
+}
+
+/*
+  search the database for the record stored under a key, and pass it
+  to a parser function without copying the record.
+
+  The names and values of the message point into the record, which
+  is only valid until the parser returns, and the message is freed
+  then. Anything the parser wants to keep has to be copied, see
+  ltdb_filter_attrs(). The parser must not change the database.
+
+  Only the attributes in attrs are unpacked, or all of them if attrs
+  is NULL.
+*/
+int ltdb_search_key_parse(struct ldb_module *module,
+			  struct ltdb_private *ltdb,
+			  TDB_DATA tdb_key,
+			  const char * const *attrs,
+			  unsigned int num_attrs,
+			  int (*parser)(struct ldb_message *msg,
+					void *private_data),
+			  void *private_data)
+{
+	struct ldb_val ldb_key = {
+		.data = tdb_key.dptr,
+		.length = tdb_key.dsize
+	};
+	struct ltdb_parse_data_in_place_ctx ctx = {
+		.module = module,
+		.attrs = attrs,
+		.num_attrs = num_attrs,
+		.parser = parser,
+		.private_data = private_data
+	};
+
+	return ltdb->kv_ops->fetch_and_parse(ltdb, ldb_key,
+					     ltdb_parse_data_in_place, &ctx);
+}
+
+/*
+  search the database for a single simple dn, returning all attributes
+  in a single message
+
+  return LDB_ERR_NO_SUCH_OBJECT on record-not-found
+  and LDB_SUCCESS on success
+*/
+int ltdb_search_dn1(struct ldb_module *module, struct ldb_dn *dn, struct ldb_message *msg,
+		    unsigned int unpack_flags)
+{
+	void *data = ldb_module_get_private(module);
+	struct ltdb_private *ltdb = talloc_get_type(data, struct ltdb_private);
+	int ret;
+	TDB_DATA tdb_key;
+
+	if (ltdb->cache->GUID_index_attribute != NULL &&
+	    !ldb_dn_is_special(dn)) {
+		/* the record is found by the GUID in the DN index */
+		uint8_t guid_key[LTDB_GUID_KEY_SIZE];
+
+		tdb_key.dptr = guid_key;
+		tdb_key.dsize = sizeof(guid_key);
+
+		ret = ltdb_key_dn_from_idx(module, ltdb, dn, &tdb_key);
+		if (ret != LDB_SUCCESS) {
+			return ret;
+		}
+		ret = ltdb_search_key(module, ltdb, tdb_key, msg,
+				      unpack_flags);
+	} else {
+		/* form the key */
+		tdb_key = ltdb_key(module, dn);
+		if (!tdb_key.dptr) {
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+
+		ret = ltdb_search_key(module, ltdb, tdb_key, msg,
+				      unpack_flags);
+		talloc_free(tdb_key.dptr);
+	}
+
+	if (ret != LDB_SUCCESS) {
 		return ret;
 	}
 
@@ -394,14 +535,15 @@ failed:
 /*
   search function for a non-indexed search
  */
-static int search_func(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *state)
+static int search_func(struct ltdb_private *ltdb, struct ldb_val key,
+		       struct ldb_val val, void *state)
 {
 	struct ldb_context *ldb;
 	struct ltdb_context *ac;
 	struct ldb_message *msg, *filtered_msg;
-	const struct ldb_val val = {
-		.data = data.dptr,
-		.length = data.dsize,
+	TDB_DATA tdb_key = {
+		.dptr = key.data,
+		.dsize = key.length
 	};
 	int ret;
 	bool matched;
@@ -410,7 +552,7 @@ static int search_func(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, voi
 	ac = talloc_get_type(state, struct ltdb_context);
 	ldb = ldb_module_get_ctx(ac->module);
 
-	if (ltdb_key_is_record(key) == false) {
+	if (ltdb_key_is_record(tdb_key) == false) {
 		return 0;
 	}
 
@@ -423,7 +565,8 @@ static int search_func(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, voi
 	/* unpack the record */
 	ret = ldb_unpack_data_only_attr_list_flags(ldb, &val,
 						   msg,
-						   NULL, 0,
+						   ac->unpack_attrs,
+						   ac->num_unpack_attrs,
 						   LDB_UNPACK_DATA_FLAG_NO_DATA_ALLOC|
 						   LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC,
 						   &nb_elements_in_db);
@@ -435,7 +578,7 @@ static int search_func(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, voi
 
 	if (!msg->dn) {
 		msg->dn = ldb_dn_new(msg, ldb,
-				     (char *)key.dptr + 3);
+				     (char *)key.data + 3);
 		if (msg->dn == NULL) {
 			talloc_free(msg);
 			ac->error = LDB_ERR_OPERATIONS_ERROR;
@@ -477,6 +620,118 @@ static int search_func(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, voi
 }
 
 
+/*
+  add an attribute name to the list of attributes to unpack, unless
+  it is already there
+*/
+static int ltdb_unpack_attrs_add(struct ltdb_context *ctx, const char *attr)
+{
+	const char **attrs;
+	unsigned int i;
+
+	for (i = 0; i < ctx->num_unpack_attrs; i++) {
+		if (ldb_attr_cmp(ctx->unpack_attrs[i], attr) == 0) {
+			return LDB_SUCCESS;
+		}
+	}
+
+	attrs = talloc_realloc(ctx, ctx->unpack_attrs, const char *,
+			       ctx->num_unpack_attrs + 1);
+	if (attrs == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	attrs[ctx->num_unpack_attrs] = attr;
+	ctx->unpack_attrs = attrs;
+	ctx->num_unpack_attrs++;
+
+	return LDB_SUCCESS;
+}
+
+/*
+  callback for ldb_parse_tree_walk(), collecting the attributes the
+  filter needs to see
+*/
+static int ltdb_unpack_attrs_tree(struct ldb_parse_tree *tree,
+				  void *private_data)
+{
+	struct ltdb_context *ctx = private_data;
+
+	switch (tree->operation) {
+	case LDB_OP_EQUALITY:
+	case LDB_OP_GREATER:
+	case LDB_OP_LESS:
+	case LDB_OP_APPROX:
+		return ltdb_unpack_attrs_add(ctx, tree->u.equality.attr);
+	case LDB_OP_SUBSTRING:
+		return ltdb_unpack_attrs_add(ctx, tree->u.substring.attr);
+	case LDB_OP_PRESENT:
+		return ltdb_unpack_attrs_add(ctx, tree->u.present.attr);
+	case LDB_OP_EXTENDED:
+		if (tree->u.extended.attr == NULL) {
+			return LDB_ERR_UNWILLING_TO_PERFORM;
+		}
+		return ltdb_unpack_attrs_add(ctx, tree->u.extended.attr);
+	default:
+		break;
+	}
+	return LDB_SUCCESS;
+}
+
+/*
+  work out which attributes of the records the search has to look at:
+  the requested attributes and the ones in the filter. The others are
+  skipped when unpacking the records.
+
+  This leaves the list NULL, so that the whole records are unpacked,
+  when all attributes are requested or the list can't be built.
+*/
+static void ltdb_search_unpack_attrs(struct ltdb_context *ctx)
+{
+	unsigned int i;
+	int ret;
+
+	ctx->unpack_attrs = NULL;
+	ctx->num_unpack_attrs = 0;
+
+	if (ctx->attrs == NULL) {
+		return;
+	}
+
+	for (i = 0; ctx->attrs[i] != NULL; i++) {
+		if (strcmp(ctx->attrs[i], "*") == 0) {
+			goto unpack_all;
+		}
+		ret = ltdb_unpack_attrs_add(ctx, ctx->attrs[i]);
+		if (ret != LDB_SUCCESS) {
+			goto unpack_all;
+		}
+	}
+
+	ret = ldb_parse_tree_walk(discard_const_p(struct ldb_parse_tree,
+						  ctx->tree),
+				  ltdb_unpack_attrs_tree, ctx);
+	if (ret != LDB_SUCCESS) {
+		goto unpack_all;
+	}
+
+	/*
+	 * An empty list would unpack everything, but we only need
+	 * the DN
+	 */
+	if (ctx->num_unpack_attrs == 0) {
+		ret = ltdb_unpack_attrs_add(ctx, "dn");
+		if (ret != LDB_SUCCESS) {
+			goto unpack_all;
+		}
+	}
+
+	return;
+
+unpack_all:
+	TALLOC_FREE(ctx->unpack_attrs);
+	ctx->num_unpack_attrs = 0;
+}
+
 /*
   search the database with a LDAP-like expression.
   this is the "full search" non-indexed variant
@@ -488,11 +743,7 @@ static int ltdb_search_full(struct ltdb_context *ctx)
 	int ret;
 
 	ctx->error = LDB_SUCCESS;
-	if (ltdb->in_transaction != 0) {
-		ret = tdb_traverse(ltdb->tdb, search_func, ctx);
-	} else {
-		ret = tdb_traverse_read(ltdb->tdb, search_func, ctx);
-	}
+	ret = ltdb->kv_ops->iterate(ltdb, search_func, ctx);
 
 	if (ret < 0) {
 		return LDB_ERR_OPERATIONS_ERROR;
@@ -578,6 +829,7 @@ int ltdb_search(struct ltdb_context *ctx)
 	ctx->scope = req->op.search.scope;
 	ctx->base = req->op.search.base;
 	ctx->attrs = req->op.search.attrs;
+	ltdb_search_unpack_attrs(ctx);
 
 	if (ret == LDB_SUCCESS) {
 		uint32_t match_count = 0;
@@ -91,6 +91,246 @@ int ltdb_err_map(enum TDB_ERROR tdb_code)
 	return LDB_ERR_OTHER;
 }
 
+static int ltdb_tdb_store(struct ltdb_private *ltdb, struct ldb_val ldb_key,
+			  struct ldb_val ldb_data, int flags)
+{
+	TDB_DATA key = {
+		.dptr = ldb_key.data,
+		.dsize = ldb_key.length
+	};
+	TDB_DATA data = {
+		.dptr = ldb_data.data,
+		.dsize = ldb_data.length
+	};
+
+	if (tdb_store(ltdb->tdb, key, data, flags) != 0) {
+		return ltdb_err_map(tdb_error(ltdb->tdb));
+	}
+	return LDB_SUCCESS;
+}
+
+static int ltdb_tdb_delete(struct ltdb_private *ltdb, struct ldb_val ldb_key)
+{
+	TDB_DATA key = {
+		.dptr = ldb_key.data,
+		.dsize = ldb_key.length
+	};
+
+	if (tdb_delete(ltdb->tdb, key) != 0) {
+		return ltdb_err_map(tdb_error(ltdb->tdb));
+	}
+	return LDB_SUCCESS;
+}
+
+struct kv_ctx {
+	ldb_kv_traverse_fn kv_traverse_fn;
+	void *ctx;
+	struct ltdb_private *ltdb;
+	int (*parser)(struct ldb_val key,
+		      struct ldb_val data,
+		      void *private_data);
+};
+
+static int ltdb_tdb_traverse_fn_wrapper(struct tdb_context *tdb,
+					TDB_DATA tdb_key, TDB_DATA tdb_data,
+					void *ctx)
+{
+	struct kv_ctx *kv_ctx = ctx;
+	struct ldb_val key = {
+		.data = tdb_key.dptr,
+		.length = tdb_key.dsize
+	};
+	struct ldb_val data = {
+		.data = tdb_data.dptr,
+		.length = tdb_data.dsize
+	};
+
+	return kv_ctx->kv_traverse_fn(kv_ctx->ltdb, key, data, kv_ctx->ctx);
+}
+
+/*
+  only a transaction may change the records under us, otherwise a
+  read traverse allows other readers at the same time
+*/
+static int ltdb_tdb_traverse_fn(struct ltdb_private *ltdb,
+				ldb_kv_traverse_fn fn, void *ctx)
+{
+	struct kv_ctx kv_ctx = {
+		.kv_traverse_fn = fn,
+		.ctx = ctx,
+		.ltdb = ltdb
+	};
+
+	if (ltdb->in_transaction != 0) {
+		return tdb_traverse(ltdb->tdb, ltdb_tdb_traverse_fn_wrapper,
+				    &kv_ctx);
+	}
+	return tdb_traverse_read(ltdb->tdb, ltdb_tdb_traverse_fn_wrapper,
+				 &kv_ctx);
+}
+
+static int ltdb_tdb_update_in_iterate(struct ltdb_private *ltdb,
+				      struct ldb_val ldb_key,
+				      struct ldb_val ldb_key2,
+				      struct ldb_val ldb_data)
+{
+	TDB_DATA key = {
+		.dptr = ldb_key.data,
+		.dsize = ldb_key.length
+	};
+	TDB_DATA key2 = {
+		.dptr = ldb_key2.data,
+		.dsize = ldb_key2.length
+	};
+	TDB_DATA data = {
+		.dptr = ldb_data.data,
+		.dsize = ldb_data.length
+	};
+
+	/* deleting and storing from within a tdb_traverse() is fine */
+	if (tdb_delete(ltdb->tdb, key) != 0) {
+		return ltdb_err_map(tdb_error(ltdb->tdb));
+	}
+	if (tdb_store(ltdb->tdb, key2, data, 0) != 0) {
+		return ltdb_err_map(tdb_error(ltdb->tdb));
+	}
+	return LDB_SUCCESS;
+}
+
+static int ltdb_tdb_parse_record_wrapper(TDB_DATA tdb_key, TDB_DATA tdb_data,
+					 void *ctx)
+{
+	struct kv_ctx *kv_ctx = ctx;
+	struct ldb_val key = {
+		.data = tdb_key.dptr,
+		.length = tdb_key.dsize
+	};
+	struct ldb_val data = {
+		.data = tdb_data.dptr,
+		.length = tdb_data.dsize
+	};
+
+	return kv_ctx->parser(key, data, kv_ctx->ctx);
+}
+
+static int ltdb_tdb_parse_record(struct ltdb_private *ltdb,
+				 struct ldb_val ldb_key,
+				 int (*parser)(struct ldb_val key,
+					       struct ldb_val data,
+					       void *private_data),
+				 void *ctx)
+{
+	struct kv_ctx kv_ctx = {
+		.parser = parser,
+		.ctx = ctx,
+		.ltdb = ltdb
+	};
+	TDB_DATA key = {
+		.dptr = ldb_key.data,
+		.dsize = ldb_key.length
+	};
+	int ret;
+
+	ret = tdb_parse_record(ltdb->tdb, key, ltdb_tdb_parse_record_wrapper,
+			       &kv_ctx);
+	if (ret == -1) {
+		if (tdb_error(ltdb->tdb) == TDB_ERR_NOEXIST) {
+			return LDB_ERR_NO_SUCH_OBJECT;
+		}
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	return ret;
+}
+
+static int ltdb_tdb_lock_read(struct ltdb_private *ltdb)
+{
+	return tdb_lockall_read(ltdb->tdb);
+}
+
+static int ltdb_tdb_unlock_read(struct ltdb_private *ltdb)
+{
+	return tdb_unlockall_read(ltdb->tdb);
+}
+
+static int ltdb_tdb_transaction_start(struct ltdb_private *ltdb)
+{
+	if (tdb_transaction_start(ltdb->tdb) != 0) {
+		return ltdb_err_map(tdb_error(ltdb->tdb));
+	}
+	return LDB_SUCCESS;
+}
+
+static int ltdb_tdb_transaction_prepare_commit(struct ltdb_private *ltdb)
+{
+	if (tdb_transaction_prepare_commit(ltdb->tdb) != 0) {
+		return ltdb_err_map(tdb_error(ltdb->tdb));
+	}
+	return LDB_SUCCESS;
+}
+
+static int ltdb_tdb_transaction_cancel(struct ltdb_private *ltdb)
+{
+	if (tdb_transaction_cancel(ltdb->tdb) != 0) {
+		return ltdb_err_map(tdb_error(ltdb->tdb));
+	}
+	return LDB_SUCCESS;
+}
+
+static int ltdb_tdb_transaction_commit(struct ltdb_private *ltdb)
+{
+	if (tdb_transaction_commit(ltdb->tdb) != 0) {
+		return ltdb_err_map(tdb_error(ltdb->tdb));
+	}
+	return LDB_SUCCESS;
+}
+
+static int ltdb_tdb_error(struct ltdb_private *ltdb)
+{
+	return ltdb_err_map(tdb_error(ltdb->tdb));
+}
+
+static const char *ltdb_tdb_errorstr(struct ltdb_private *ltdb)
+{
+	return tdb_errorstr(ltdb->tdb);
+}
+
+static const char *ltdb_tdb_name(struct ltdb_private *ltdb)
+{
+	return tdb_name(ltdb->tdb);
+}
+
+/*
+  the tdb sequence number is changed by every store and delete, by
+  us or any other process
+*/
+static bool ltdb_tdb_changed(struct ltdb_private *ltdb)
+{
+	int seq = tdb_get_seqnum(ltdb->tdb);
+	bool has_changed = (seq != ltdb->tdb_seqnum);
+
+	ltdb->tdb_seqnum = seq;
+
+	return has_changed;
+}
+
+static const struct kv_db_ops key_value_ops = {
+	.store             = ltdb_tdb_store,
+	.delete            = ltdb_tdb_delete,
+	.iterate           = ltdb_tdb_traverse_fn,
+	.update_in_iterate = ltdb_tdb_update_in_iterate,
+	.fetch_and_parse   = ltdb_tdb_parse_record,
+	.lock_read         = ltdb_tdb_lock_read,
+	.unlock_read       = ltdb_tdb_unlock_read,
+	.begin_write       = ltdb_tdb_transaction_start,
+	.prepare_write     = ltdb_tdb_transaction_prepare_commit,
+	.abort_write       = ltdb_tdb_transaction_cancel,
+	.finish_write      = ltdb_tdb_transaction_commit,
+	.error             = ltdb_tdb_error,
+	.errorstr          = ltdb_tdb_errorstr,
+	.name              = ltdb_tdb_name,
+	.has_changed       = ltdb_tdb_changed,
+};
+
 /*
   lock the database for read - use by ltdb_search and ltdb_sequence_number
 */
@@ -102,7 +342,7 @@ int ltdb_lock_read(struct ldb_module *module)
 
 	if (ltdb->in_transaction == 0 &&
 	    ltdb->read_lock_count == 0) {
-		ret = tdb_lockall_read(ltdb->tdb);
+		ret = ltdb->kv_ops->lock_read(ltdb);
 	}
 	if (ret == 0) {
 		ltdb->read_lock_count++;
@@ -118,7 +358,7 @@ int ltdb_unlock_read(struct ldb_module *module)
 	void *data = ldb_module_get_private(module);
 	struct ltdb_private *ltdb = talloc_get_type(data, struct ltdb_private);
 	if (ltdb->in_transaction == 0 && ltdb->read_lock_count == 1) {
-		tdb_unlockall_read(ltdb->tdb);
+		ltdb->kv_ops->unlock_read(ltdb);
 		ltdb->read_lock_count--;
 		return 0;
 	}
@@ -209,6 +449,81 @@ failed:
 	return key;
 }
 
+/*
+  form the GUID= key for a record from the value of the
+  @IDXGUID attribute. key->dptr must point to LTDB_GUID_KEY_SIZE bytes
+*/
+int ltdb_guid_to_key(struct ldb_module *module,
+		     struct ltdb_private *ltdb,
+		     const struct ldb_val *GUID_val,
+		     TDB_DATA *key)
+{
+	if (GUID_val->length != LTDB_GUID_SIZE) {
+		ldb_asprintf_errstring(ldb_module_get_ctx(module),
+				       "%s values must be %u bytes long, "
+				       "not %zu",
+				       ltdb->cache->GUID_index_attribute,
+				       LTDB_GUID_SIZE, GUID_val->length);
+		return LDB_ERR_CONSTRAINT_VIOLATION;
+	}
+
+	memcpy(key->dptr, LTDB_GUID_KEY_PREFIX, LTDB_GUID_KEY_PREFIX_LEN);
+	memcpy(&key->dptr[LTDB_GUID_KEY_PREFIX_LEN],
+	       GUID_val->data, GUID_val->length);
+	key->dsize = LTDB_GUID_KEY_SIZE;
+	return LDB_SUCCESS;
+}
+
+/*
+  form a TDB_DATA for the key a message is stored under
+  caller frees
+
+  this is the DN key, unless the database is in @IDXGUID mode, where
+  normal records are stored under their GUID. On failure errno is set
+  to ENOMEM or to EINVAL for a message that can't be stored
+*/
+TDB_DATA ltdb_key_msg(struct ldb_module *module,
+		      const struct ldb_message *msg)
+{
+	void *data = ldb_module_get_private(module);
+	struct ltdb_private *ltdb = talloc_get_type(data, struct ltdb_private);
+	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	const char *GUID_attr = ltdb->cache->GUID_index_attribute;
+	struct ldb_message_element *el;
+	TDB_DATA key = { .dptr = NULL, .dsize = 0 };
+	int ret;
+
+	if (GUID_attr == NULL || ldb_dn_is_special(msg->dn)) {
+		return ltdb_key(module, msg->dn);
+	}
+
+	el = ldb_msg_find_element(msg, GUID_attr);
+	if (el == NULL || el->num_values != 1) {
+		ldb_asprintf_errstring(ldb,
+				       "%s needs exactly one %s value, "
+				       "as this is the key of records in "
+				       LTDB_IDXGUID " mode",
+				       ldb_dn_get_linearized(msg->dn),
+				       GUID_attr);
+		errno = EINVAL;
+		return key;
+	}
+
+	key.dptr = talloc_size(ldb, LTDB_GUID_KEY_SIZE);
+	if (key.dptr == NULL) {
+		errno = ENOMEM;
+		return key;
+	}
+
+	ret = ltdb_guid_to_key(module, ltdb, &el->values[0], &key);
+	if (ret != LDB_SUCCESS) {
+		TALLOC_FREE(key.dptr);
+		key.dsize = 0;
+		errno = EINVAL;
+	}
+	return key;
+}
+
 /*
   check special dn's have valid attributes
   currently only @ATTRIBUTES is checked
@@ -264,7 +579,7 @@ static int ltdb_modified(struct ldb_module *module, struct ldb_dn *dn)
 		if (ltdb->warn_reindex) {
 			ldb_debug(ldb_module_get_ctx(module),
 				LDB_DEBUG_ERROR, "Reindexing %s due to modification on %s",
-				tdb_name(ltdb->tdb), ldb_dn_get_linearized(dn));
+				ltdb->kv_ops->name(ltdb), ldb_dn_get_linearized(dn));
 		}
 		ret = ltdb_reindex(module);
 	}
@@ -293,12 +608,15 @@ int ltdb_store(struct ldb_module *module, const struct ldb_message *msg, int flg
 {
 	void *data = ldb_module_get_private(module);
 	struct ltdb_private *ltdb = talloc_get_type(data, struct ltdb_private);
-	TDB_DATA tdb_key, tdb_data;
-	struct ldb_val ldb_data;
+	TDB_DATA tdb_key;
+	struct ldb_val ldb_key, ldb_data;
 	int ret = LDB_SUCCESS;
 
-	tdb_key = ltdb_key(module, msg->dn);
+	tdb_key = ltdb_key_msg(module, msg);
 	if (tdb_key.dptr == NULL) {
+		if (errno == EINVAL) {
+			return LDB_ERR_CONSTRAINT_VIOLATION;
+		}
 		return LDB_ERR_OTHER;
 	}
 
@@ -309,16 +627,11 @@ int ltdb_store(struct ldb_module *module, const struct ldb_message *msg, int flg
 		return LDB_ERR_OTHER;
 	}
 
-	tdb_data.dptr = ldb_data.data;
-	tdb_data.dsize = ldb_data.length;
+	ldb_key.data = tdb_key.dptr;
+	ldb_key.length = tdb_key.dsize;
 
-	ret = tdb_store(ltdb->tdb, tdb_key, tdb_data, flgs);
-	if (ret != 0) {
-		ret = ltdb_err_map(tdb_error(ltdb->tdb));
-		goto done;
-	}
+	ret = ltdb->kv_ops->store(ltdb, ldb_key, ldb_data, flgs);
 
-done:
 	talloc_free(tdb_key.dptr);
 	talloc_free(ldb_data.data);
 
@@ -359,6 +672,8 @@ static int ltdb_add_internal(struct ldb_module *module,
 			     bool check_single_value)
 {
 	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module),
+						    struct ltdb_private);
 	int ret = LDB_SUCCESS;
 	unsigned int i;
 
@@ -409,9 +724,35 @@ static int ltdb_add_internal(struct ldb_module *module,
 		}
 	}
 
+	/*
+	 * Records are not stored under their DN in @IDXGUID mode, so
+	 * storing the record can't find an existing one
+	 */
+	if (ltdb->cache->GUID_index_attribute != NULL &&
+	    !ldb_dn_is_special(msg->dn)) {
+		ret = ltdb_search_base(module, msg->dn);
+		if (ret == LDB_SUCCESS) {
+			ldb_asprintf_errstring(ldb,
+					       "Entry %s already exists",
+					       ldb_dn_get_linearized(msg->dn));
+			return LDB_ERR_ENTRY_ALREADY_EXISTS;
+		}
+		if (ret != LDB_ERR_NO_SUCH_OBJECT) {
+			return ret;
+		}
+	}
+
 	ret = ltdb_store(module, msg, TDB_INSERT);
 	if (ret != LDB_SUCCESS) {
-		if (ret == LDB_ERR_ENTRY_ALREADY_EXISTS) {
+		if (ret == LDB_ERR_ENTRY_ALREADY_EXISTS &&
+		    ltdb->cache->GUID_index_attribute != NULL &&
+		    !ldb_dn_is_special(msg->dn)) {
+			ldb_asprintf_errstring(ldb,
+					       "Entry %s has the %s of an "
+					       "existing entry",
+					       ldb_dn_get_linearized(msg->dn),
+					       ltdb->cache->GUID_index_attribute);
+		} else if (ret == LDB_ERR_ENTRY_ALREADY_EXISTS) {
 			ldb_asprintf_errstring(ldb,
 					       "Entry %s already exists",
 					       ldb_dn_get_linearized(msg->dn));
@@ -458,24 +799,25 @@ static int ltdb_add(struct ltdb_context *ctx)
   delete a record from the database, not updating indexes (used for deleting
   index records)
 */
-int ltdb_delete_noindex(struct ldb_module *module, struct ldb_dn *dn)
+int ltdb_delete_noindex(struct ldb_module *module,
+			const struct ldb_message *msg)
 {
 	void *data = ldb_module_get_private(module);
 	struct ltdb_private *ltdb = talloc_get_type(data, struct ltdb_private);
 	TDB_DATA tdb_key;
+	struct ldb_val ldb_key;
 	int ret;
 
-	tdb_key = ltdb_key(module, dn);
+	tdb_key = ltdb_key_msg(module, msg);
 	if (!tdb_key.dptr) {
 		return LDB_ERR_OTHER;
 	}
 
-	ret = tdb_delete(ltdb->tdb, tdb_key);
-	talloc_free(tdb_key.dptr);
+	ldb_key.data = tdb_key.dptr;
+	ldb_key.length = tdb_key.dsize;
 
-	if (ret != 0) {
-		ret = ltdb_err_map(tdb_error(ltdb->tdb));
-	}
+	ret = ltdb->kv_ops->delete(ltdb, ldb_key);
+	talloc_free(tdb_key.dptr);
 
 	return ret;
 }
@@ -498,7 +840,7 @@ static int ltdb_delete_internal(struct ldb_module *module, struct ldb_dn *dn)
 		goto done;
 	}
 
-	ret = ltdb_delete_noindex(module, dn);
+	ret = ltdb_delete_noindex(module, msg);
 	if (ret != LDB_SUCCESS) {
 		goto done;
 	}
@@ -621,7 +963,7 @@ static int msg_delete_attribute(struct ldb_module *module,
 	}
 	i = el - msg->elements;
 
-	ret = ltdb_index_del_element(module, msg->dn, el);
+	ret = ltdb_index_del_element(module, msg, el);
 	if (ret != LDB_SUCCESS) {
 		return ret;
 	}
@@ -678,7 +1020,7 @@ static int msg_delete_element(struct ldb_module *module,
 				return msg_delete_attribute(module, msg, name);
 			}
 
-			ret = ltdb_index_del_value(module, msg->dn, el, i);
+			ret = ltdb_index_del_value(module, msg, el, i);
 			if (ret != LDB_SUCCESS) {
 				return ret;
 			}
@@ -715,6 +1057,8 @@ int ltdb_modify_internal(struct ldb_module *module,
 			 struct ldb_request *req)
 {
 	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	struct ltdb_private *ltdb = talloc_get_type(ldb_module_get_private(module),
+						    struct ltdb_private);
 	struct ldb_message *msg2;
 	unsigned int i, j;
 	int ret = LDB_SUCCESS, idx;
@@ -753,6 +1097,19 @@ int ltdb_modify_internal(struct ldb_module *module,
 			options |= LDB_MSG_FIND_COMMON_REMOVE_DUPLICATES;
 		}
 
+		/* the record is stored under this value */
+		if (ltdb->cache->GUID_index_attribute != NULL &&
+		    ldb_attr_cmp(el->name,
+				 ltdb->cache->GUID_index_attribute) == 0) {
+			ldb_asprintf_errstring(ldb,
+					       "Must not modify %s on %s, as "
+					       "it is used as the record key",
+					       el->name,
+					       ldb_dn_get_linearized(msg2->dn));
+			ret = LDB_ERR_CONSTRAINT_VIOLATION;
+			goto done;
+		}
+
 		switch (msg->elements[i].flags & LDB_FLAG_MOD_MASK) {
 		case LDB_FLAG_MOD_ADD:
 
@@ -800,7 +1157,7 @@ int ltdb_modify_internal(struct ldb_module *module,
 					ret = LDB_ERR_OTHER;
 					goto done;
 				}
-				ret = ltdb_index_add_element(module, msg2->dn,
+				ret = ltdb_index_add_element(module, msg2,
 							     el);
 				if (ret != LDB_SUCCESS) {
 					goto done;
@@ -881,7 +1238,7 @@ int ltdb_modify_internal(struct ldb_module *module,
 				el2->values = vals;
 				el2->num_values += el->num_values;
 
-				ret = ltdb_index_add_element(module, msg2->dn, el);
+				ret = ltdb_index_add_element(module, msg2, el);
 				if (ret != LDB_SUCCESS) {
 					goto done;
 				}
@@ -958,7 +1315,7 @@ int ltdb_modify_internal(struct ldb_module *module,
 				goto done;
 			}
 
-			ret = ltdb_index_add_element(module, msg2->dn, el);
+			ret = ltdb_index_add_element(module, msg2, el);
 			if (ret != LDB_SUCCESS) {
 				goto done;
 			}
@@ -1064,12 +1421,9 @@ static int ltdb_modify(struct ltdb_context *ctx)
 static int ltdb_rename(struct ltdb_context *ctx)
 {
 	struct ldb_module *module = ctx->module;
-	void *data = ldb_module_get_private(module);
-	struct ltdb_private *ltdb = talloc_get_type(data, struct ltdb_private);
 	struct ldb_request *req = ctx->req;
 	struct ldb_message *msg;
 	int ret = LDB_SUCCESS;
-	TDB_DATA tdb_key, tdb_key_old;
 
 	ldb_request_set_state(req, LDB_ASYNC_PENDING);
 
@@ -1092,25 +1446,14 @@ static int ltdb_rename(struct ltdb_context *ctx)
 
 	/* We need to, before changing the DB, check if the new DN
 	 * exists, so we can return this error to the caller with an
-	 * unmodified DB */
-	tdb_key = ltdb_key(module, req->op.rename.newdn);
-	if (!tdb_key.dptr) {
-		talloc_free(msg);
-		return LDB_ERR_OPERATIONS_ERROR;
-	}
-
-	tdb_key_old = ltdb_key(module, req->op.rename.olddn);
-	if (!tdb_key_old.dptr) {
-		talloc_free(msg);
-		talloc_free(tdb_key.dptr);
-		return LDB_ERR_OPERATIONS_ERROR;
-	}
-
-	/* Only declare a conflict if the new DN already exists, and it isn't a case change on the old DN */
-	if (tdb_key_old.dsize != tdb_key.dsize || memcmp(tdb_key.dptr, tdb_key_old.dptr, tdb_key.dsize) != 0) {
-		if (tdb_exists(ltdb->tdb, tdb_key)) {
-			talloc_free(tdb_key_old.dptr);
-			talloc_free(tdb_key.dptr);
+	 * unmodified DB.
+	 *
+	 * Only declare a conflict if the new DN already exists, and
+	 * it isn't a case change on the old DN */
+	if (ldb_dn_compare(req->op.rename.olddn,
+			   req->op.rename.newdn) != 0) {
+		ret = ltdb_search_base(module, req->op.rename.newdn);
+		if (ret == LDB_SUCCESS) {
 			ldb_asprintf_errstring(ldb_module_get_ctx(module),
 					       "Entry %s already exists",
 					       ldb_dn_get_linearized(req->op.rename.newdn));
@@ -1118,9 +1461,11 @@ static int ltdb_rename(struct ltdb_context *ctx)
 			talloc_free(msg);
 			return LDB_ERR_ENTRY_ALREADY_EXISTS;
 		}
+		if (ret != LDB_ERR_NO_SUCH_OBJECT) {
+			talloc_free(msg);
+			return ret;
+		}
 	}
-	talloc_free(tdb_key_old.dptr);
-	talloc_free(tdb_key.dptr);
 
 	/* Always delete first then add, to avoid conflicts with
 	 * unique indexes. We rely on the transaction to make this
@@ -1153,9 +1498,11 @@ static int ltdb_start_trans(struct ldb_module *module)
 {
 	void *data = ldb_module_get_private(module);
 	struct ltdb_private *ltdb = talloc_get_type(data, struct ltdb_private);
+	int ret;
 
-	if (tdb_transaction_start(ltdb->tdb) != 0) {
-		return ltdb_err_map(tdb_error(ltdb->tdb));
+	ret = ltdb->kv_ops->begin_write(ltdb);
+	if (ret != LDB_SUCCESS) {
+		return ret;
 	}
 
 	ltdb->in_transaction++;
@@ -1177,17 +1524,17 @@ static int ltdb_prepare_commit(struct ldb_module *module)
 
 	ret = ltdb_index_transaction_commit(module);
 	if (ret != LDB_SUCCESS) {
-		tdb_transaction_cancel(ltdb->tdb);
+		ltdb->kv_ops->abort_write(ltdb);
 		ltdb->in_transaction--;
 		return ret;
 	}
 
-	if (tdb_transaction_prepare_commit(ltdb->tdb) != 0) {
-		ret = ltdb_err_map(tdb_error(ltdb->tdb));
+	ret = ltdb->kv_ops->prepare_write(ltdb);
+	if (ret != LDB_SUCCESS) {
 		ltdb->in_transaction--;
 		ldb_asprintf_errstring(ldb_module_get_ctx(module),
-				       "Failure during tdb_transaction_prepare_commit(): %s -> %s",
-				       tdb_errorstr(ltdb->tdb),
+				       "Failure during prepare_write(): %s -> %s",
+				       ltdb->kv_ops->errorstr(ltdb),
 				       ldb_strerror(ret));
 		return ret;
 	}
@@ -1213,11 +1560,11 @@ static int ltdb_end_trans(struct ldb_module *module)
 	ltdb->in_transaction--;
 	ltdb->prepared_commit = false;
 
-	if (tdb_transaction_commit(ltdb->tdb) != 0) {
-		ret = ltdb_err_map(tdb_error(ltdb->tdb));
+	ret = ltdb->kv_ops->finish_write(ltdb);
+	if (ret != LDB_SUCCESS) {
 		ldb_asprintf_errstring(ldb_module_get_ctx(module),
-				       "Failure during tdb_transaction_commit(): %s -> %s",
-				       tdb_errorstr(ltdb->tdb),
+				       "Failure during finish_write(): %s -> %s",
+				       ltdb->kv_ops->errorstr(ltdb),
 				       ldb_strerror(ret));
 		return ret;
 	}
@@ -1233,11 +1580,11 @@ static int ltdb_del_trans(struct ldb_module *module)
 	ltdb->in_transaction--;
 
 	if (ltdb_index_transaction_cancel(module) != 0) {
-		tdb_transaction_cancel(ltdb->tdb);
-		return ltdb_err_map(tdb_error(ltdb->tdb));
+		ltdb->kv_ops->abort_write(ltdb);
+		return ltdb->kv_ops->error(ltdb);
 	}
 
-	tdb_transaction_cancel(ltdb->tdb);
+	ltdb->kv_ops->abort_write(ltdb);
 	return LDB_SUCCESS;
 }
 
@@ -1592,6 +1939,48 @@ static const struct ldb_module_ops ltdb_ops = {
 	.read_unlock       = ltdb_unlock_read,
 };
 
+/*
+  set up the ldb module on top of an opened key/value store
+*/
+int ltdb_init_store(struct ltdb_private *ltdb,
+		    const char *name,
+		    struct ldb_context *ldb,
+		    const char *options[],
+		    struct ldb_module **_module)
+{
+	struct ldb_module *module;
+
+	if (getenv("LDB_WARN_UNINDEXED")) {
+		ltdb->warn_unindexed = true;
+	}
+
+	if (getenv("LDB_WARN_REINDEX")) {
+		ltdb->warn_reindex = true;
+	}
+
+	ltdb->sequence_number = 0;
+
+	module = ldb_module_new(ldb, ldb, name, &ltdb_ops);
+	if (!module) {
+		ldb_oom(ldb);
+		talloc_free(ltdb);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	ldb_module_set_private(module, ltdb);
+	talloc_steal(module, ltdb);
+
+	if (ltdb_cache_load(module) != 0) {
+		ldb_asprintf_errstring(ldb,
+				       "Unable to load ltdb cache records for backend '%s'",
+				       name);
+		talloc_free(module);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	*_module = module;
+	return LDB_SUCCESS;
+}
+
 /*
   connect to the database
 */
@@ -1599,7 +1988,6 @@ static int ltdb_connect(struct ldb_context *ldb, const char *url,
 			unsigned int flags, const char *options[],
 			struct ldb_module **_module)
 {
-	struct ldb_module *module;
 	const char *path;
 	int tdb_flags, open_flags;
 	struct ltdb_private *ltdb;
@@ -1635,6 +2023,11 @@ static int ltdb_connect(struct ldb_context *ldb, const char *url,
 		tdb_flags |= TDB_NOMMAP;
 	}
 
+	/* a new database may grow beyond 4GB */
+	if (ldb_options_find(ldb, options, "large_offsets") != NULL) {
+		tdb_flags |= TDB_LARGE_OFFSETS;
+	}
+
 	if (flags & LDB_FLG_RDONLY) {
 		open_flags = O_RDONLY;
 	} else if (flags & LDB_FLG_DONT_CREATE_DB) {
@@ -1649,6 +2042,8 @@ static int ltdb_connect(struct ldb_context *ldb, const char *url,
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
+	ltdb->kv_ops = &key_value_ops;
+
 	/* note that we use quite a large default hash size */
 	ltdb->tdb = ltdb_wrap_open(ltdb, path, 10000,
 				   tdb_flags, open_flags,
@@ -1665,34 +2060,7 @@ static int ltdb_connect(struct ldb_context *ldb, const char *url,
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
-	if (getenv("LDB_WARN_UNINDEXED")) {
-		ltdb->warn_unindexed = true;
-	}
-
-	if (getenv("LDB_WARN_REINDEX")) {
-		ltdb->warn_reindex = true;
-	}
-
-	ltdb->sequence_number = 0;
-
-	module = ldb_module_new(ldb, ldb, "ldb_tdb backend", &ltdb_ops);
-	if (!module) {
-		ldb_oom(ldb);
-		talloc_free(ltdb);
-		return LDB_ERR_OPERATIONS_ERROR;
-	}
-	ldb_module_set_private(module, ltdb);
-	talloc_steal(module, ltdb);
-
-	if (ltdb_cache_load(module) != 0) {
-		ldb_asprintf_errstring(ldb,
-				       "Unable to load ltdb cache records of tdb '%s'", path);
-		talloc_free(module);
-		return LDB_ERR_OPERATIONS_ERROR;
-	}
-
-	*_module = module;
-	return LDB_SUCCESS;
+	return ltdb_init_store(ltdb, "ldb_tdb backend", ldb, options, _module);
 }
 
 int ldb_tdb_init(const char *version)
@@ -4,9 +4,53 @@
 #include "tdb.h"
 #include "ldb_module.h"
 
+struct ltdb_private;
+typedef int (*ldb_kv_traverse_fn)(struct ltdb_private *ltdb,
+				  struct ldb_val key, struct ldb_val data,
+				  void *ctx);
+
+/*
+  the key/value store below the ltdb code. Everything outside of the
+  open code and these functions is independent of tdb, so another
+  store can be plugged in by providing them.
+
+  Unless noted otherwise the functions return a ldb error code.
+*/
+struct kv_db_ops {
+	int (*store)(struct ltdb_private *ltdb, struct ldb_val key,
+		     struct ldb_val data, int flags);
+	int (*delete)(struct ltdb_private *ltdb, struct ldb_val key);
+	/* returns the number of records or -1, like tdb_traverse() */
+	int (*iterate)(struct ltdb_private *ltdb, ldb_kv_traverse_fn fn,
+		       void *ctx);
+	/* replace key by key2 from inside an iterate() callback */
+	int (*update_in_iterate)(struct ltdb_private *ltdb,
+				 struct ldb_val key, struct ldb_val key2,
+				 struct ldb_val data);
+	/* LDB_ERR_NO_SUCH_OBJECT if the key does not exist, otherwise
+	   the return value of the parser */
+	int (*fetch_and_parse)(struct ltdb_private *ltdb, struct ldb_val key,
+			       int (*parser)(struct ldb_val key,
+					     struct ldb_val data,
+					     void *private_data),
+			       void *ctx);
+	int (*lock_read)(struct ltdb_private *ltdb);
+	int (*unlock_read)(struct ltdb_private *ltdb);
+	int (*begin_write)(struct ltdb_private *ltdb);
+	int (*prepare_write)(struct ltdb_private *ltdb);
+	int (*abort_write)(struct ltdb_private *ltdb);
+	int (*finish_write)(struct ltdb_private *ltdb);
+	int (*error)(struct ltdb_private *ltdb);
+	const char * (*errorstr)(struct ltdb_private *ltdb);
+	const char * (*name)(struct ltdb_private *ltdb);
+	/* true if anyone changed the store since the last call */
+	bool (*has_changed)(struct ltdb_private *ltdb);
+};
+
 /* this private structure is used by the ltdb backend in the
    ldb_context */
 struct ltdb_private {
+	const struct kv_db_ops *kv_ops;
 	TDB_CONTEXT *tdb;
 	unsigned int connect_flags;
 	
@@ -20,6 +64,7 @@ struct ltdb_private {
 		struct ldb_message *indexlist;
 		bool one_level_indexes;
 		bool attribute_indexes;
+		const char *GUID_index_attribute;
 	} *cache;
 
 	int in_transaction;
@@ -46,6 +91,12 @@ struct ltdb_context {
 	struct ldb_dn *base;
 	enum ldb_scope scope;
 	const char * const *attrs;
+	/*
+	 * the attributes to unpack from the records: the requested
+	 * ones and the ones the filter looks at, NULL for all
+	 */
+	const char **unpack_attrs;
+	unsigned int num_unpack_attrs;
 	struct tevent_timer *timeout_event;
 
 	/* error handling */
@@ -59,6 +110,8 @@ struct ltdb_context {
 #define LTDB_IDXVERSION "@IDXVERSION"
 #define LTDB_IDXATTR    "@IDXATTR"
 #define LTDB_IDXONE     "@IDXONE"
+#define LTDB_IDXDN      "@IDXDN"
+#define LTDB_IDXGUID    "@IDXGUID"
 #define LTDB_BASEINFO   "@BASEINFO"
 #define LTDB_OPTIONS    "@OPTIONS"
 #define LTDB_ATTRIBUTES "@ATTRIBUTES"
@@ -70,6 +123,12 @@ struct ltdb_context {
 #define LTDB_MOD_TIMESTAMP "whenChanged"
 #define LTDB_OBJECTCLASS "objectClass"
 
+/* records keyed by GUID rather than by DN in @IDXGUID mode */
+#define LTDB_GUID_SIZE 16
+#define LTDB_GUID_KEY_PREFIX "GUID="
+#define LTDB_GUID_KEY_PREFIX_LEN (sizeof(LTDB_GUID_KEY_PREFIX) - 1)
+#define LTDB_GUID_KEY_SIZE (LTDB_GUID_SIZE + LTDB_GUID_KEY_PREFIX_LEN)
+
 /* The following definitions come from lib/ldb/ldb_tdb/ldb_cache.c  */
 
 int ltdb_cache_reload(struct ldb_module *module);
@@ -84,13 +143,20 @@ struct ldb_parse_tree;
 int ltdb_search_indexed(struct ltdb_context *ctx, uint32_t *);
 int ltdb_index_add_new(struct ldb_module *module, const struct ldb_message *msg);
 int ltdb_index_delete(struct ldb_module *module, const struct ldb_message *msg);
-int ltdb_index_del_element(struct ldb_module *module, struct ldb_dn *dn,
+int ltdb_index_del_element(struct ldb_module *module,
+			   const struct ldb_message *msg,
 			   struct ldb_message_element *el);
-int ltdb_index_add_element(struct ldb_module *module, struct ldb_dn *dn, 
+int ltdb_index_add_element(struct ldb_module *module,
+			   const struct ldb_message *msg,
 			   struct ldb_message_element *el);
-int ltdb_index_del_value(struct ldb_module *module, struct ldb_dn *dn,
+int ltdb_index_del_value(struct ldb_module *module,
+			 const struct ldb_message *msg,
 			 struct ldb_message_element *el, unsigned int v_idx);
 int ltdb_reindex(struct ldb_module *module);
+int ltdb_key_dn_from_idx(struct ldb_module *module,
+			 struct ltdb_private *ltdb,
+			 struct ldb_dn *dn,
+			 TDB_DATA *tdb_key);
 int ltdb_index_transaction_start(struct ldb_module *module);
 int ltdb_index_transaction_commit(struct ldb_module *module);
 int ltdb_index_transaction_cancel(struct ldb_module *module);
@@ -102,6 +168,19 @@ int ltdb_has_wildcard(struct ldb_module *module, const char *attr_name,
 void ltdb_search_dn1_free(struct ldb_module *module, struct ldb_message *msg);
 int ltdb_search_dn1(struct ldb_module *module, struct ldb_dn *dn, struct ldb_message *msg,
 		    unsigned int unpack_flags);
+int ltdb_search_key(struct ldb_module *module, struct ltdb_private *ltdb,
+		    TDB_DATA tdb_key, struct ldb_message *msg,
+		    unsigned int unpack_flags);
+int ltdb_search_key_parse(struct ldb_module *module,
+			  struct ltdb_private *ltdb,
+			  TDB_DATA tdb_key,
+			  const char * const *attrs,
+			  unsigned int num_attrs,
+			  int (*parser)(struct ldb_message *msg,
+					void *private_data),
+			  void *private_data);
+int ltdb_search_base(struct ldb_module *module, struct ldb_dn *dn);
+bool ltdb_key_exists(struct ltdb_private *ltdb, TDB_DATA key);
 int ltdb_filter_attrs(TALLOC_CTX *mem_ctx,
 		      const struct ldb_message *msg, const char * const *attrs,
 		      struct ldb_message **filtered_msg);
@@ -116,10 +195,20 @@ int ltdb_unlock_read(struct ldb_module *module);
  */
 bool ltdb_key_is_record(TDB_DATA key);
 TDB_DATA ltdb_key(struct ldb_module *module, struct ldb_dn *dn);
+TDB_DATA ltdb_key_msg(struct ldb_module *module,
+		      const struct ldb_message *msg);
+int ltdb_guid_to_key(struct ldb_module *module,
+		     struct ltdb_private *ltdb,
+		     const struct ldb_val *GUID_val,
+		     TDB_DATA *key);
 int ltdb_store(struct ldb_module *module, const struct ldb_message *msg, int flgs);
 int ltdb_modify_internal(struct ldb_module *module, const struct ldb_message *msg, struct ldb_request *req);
-int ltdb_delete_noindex(struct ldb_module *module, struct ldb_dn *dn);
+int ltdb_delete_noindex(struct ldb_module *module,
+			const struct ldb_message *msg);
 int ltdb_err_map(enum TDB_ERROR tdb_code);
+int ltdb_init_store(struct ltdb_private *ltdb, const char *name,
+		    struct ldb_context *ldb, const char *options[],
+		    struct ldb_module **_module);
 
 struct tdb_context *ltdb_wrap_open(TALLOC_CTX *mem_ctx,
 				   const char *path, int hash_size, int tdb_flags,
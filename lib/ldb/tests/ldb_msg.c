@@ -362,6 +362,129 @@ static void test_ldb_msg_find_common_values(void **state)
 }
 
 
+static void assert_found_at(struct ldb_message *msg,
+			    const char *attr,
+			    unsigned int i)
+{
+	struct ldb_message_element *el = ldb_msg_find_element(msg, attr);
+	assert_non_null(el);
+	assert_ptr_equal(el, &msg->elements[i]);
+}
+
+static void test_ldb_msg_find_element_index(void **state)
+{
+	int ret;
+	unsigned int i;
+	char name[20];
+	struct ldb_message_element *el;
+	struct ldb_message copy;
+	struct ldb_message *msg2;
+	struct ldb_context *ldb;
+	struct test_ctx *test_ctx = talloc_get_type_abort(*state,
+							  struct test_ctx);
+	struct ldb_message *msg = test_ctx->msg;
+
+	ldb = ldb_init(test_ctx, NULL);
+	assert_non_null(ldb);
+	msg->dn = ldb_dn_new(msg, ldb, "cn=test");
+	assert_non_null(msg->dn);
+
+	for (i = 0; i < 40; i++) {
+		snprintf(name, sizeof(name), "attr%u", i);
+		ret = ldb_msg_add_empty(msg, name, 0, NULL);
+		assert_int_equal(ret, LDB_SUCCESS);
+	}
+
+	/* the names are case insensitive */
+	assert_found_at(msg, "attr0", 0);
+	assert_found_at(msg, "ATTR39", 39);
+	assert_found_at(msg, "Attr17", 17);
+	assert_null(ldb_msg_find_element(msg, "attr40"));
+	assert_null(ldb_msg_find_element(msg, "attr"));
+
+	/* added elements are found, and the first of a name wins */
+	ret = ldb_msg_add_empty(msg, "ATTR3", 0, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_msg_add_empty(msg, "extra", 0, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_msg_add(msg, &msg->elements[20], 0);
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_found_at(msg, "attr3", 3);
+	assert_found_at(msg, "extra", 41);
+	assert_found_at(msg, "attr20", 20);
+	assert_int_equal(msg->num_elements, 43);
+
+	/* elements sorted or renamed in place are noticed */
+	el = &msg->elements[5];
+	el->name = talloc_strdup(msg->elements, "ATTR5");
+	assert_found_at(msg, "attr5", 5);
+
+	msg->elements[6] = msg->elements[7];
+	msg->elements[7].name = "attr6";
+	assert_found_at(msg, "attr6", 7);
+	assert_found_at(msg, "attr7", 6);
+
+	/* and so are elements removed directly */
+	msg->elements[8] = msg->elements[msg->num_elements - 1];
+	msg->num_elements--;
+	assert_found_at(msg, "attr20", 8);
+	assert_null(ldb_msg_find_element(msg, "attr8"));
+
+	ret = ldb_msg_rename_attr(msg, "attr9", "renamed");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_found_at(msg, "renamed", 9);
+	assert_null(ldb_msg_find_element(msg, "attr9"));
+
+	/* all elements of a name are removed */
+	ldb_msg_remove_attr(msg, "attr3");
+	assert_null(ldb_msg_find_element(msg, "attr3"));
+	assert_int_equal(msg->num_elements, 40);
+	assert_found_at(msg, "attr4", 3);
+	assert_found_at(msg, "extra", 39);
+	assert_found_at(msg, "attr20", 7);
+
+	el = ldb_msg_find_element(msg, "attr0");
+	ldb_msg_remove_element(msg, el);
+	assert_null(ldb_msg_find_element(msg, "attr0"));
+	assert_found_at(msg, "attr1", 0);
+
+	/* copies of the structure are searched element by element */
+	copy = *msg;
+	copy.elements = talloc_memdup(test_ctx, msg->elements,
+				      msg->num_elements * sizeof(*el));
+	assert_non_null(copy.elements);
+	copy.elements[0].name = "other";
+	assert_found_at(&copy, "other", 0);
+	assert_found_at(&copy, "attr39", 37);
+	assert_found_at(msg, "attr1", 0);
+
+	/* a shallow copy gets an index of its own */
+	msg2 = ldb_msg_copy_shallow(test_ctx, msg);
+	assert_non_null(msg2);
+	assert_found_at(msg2, "attr39", 37);
+	ret = ldb_msg_add_empty(msg2, "attr1a", 0, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_found_at(msg2, "attr1a", 39);
+	assert_null(ldb_msg_find_element(msg, "attr1a"));
+	assert_found_at(msg, "attr39", 37);
+
+	/* the index is dropped with the message or the DN */
+	talloc_free(msg2);
+	assert_found_at(msg, "attr39", 37);
+	ret = ldb_msg_add_empty(msg, "attr40", 0, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_found_at(msg, "attr40", 39);
+
+	TALLOC_FREE(msg->dn);
+	msg->dn = ldb_dn_new(msg, ldb, "cn=test2");
+	assert_non_null(msg->dn);
+	assert_found_at(msg, "attr40", 39);
+	ret = ldb_msg_add_empty(msg, "attr41", 0, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_found_at(msg, "attr41", 40);
+	assert_found_at(msg, "attr1", 0);
+}
+
 
 int main(int argc, const char **argv)
 {
@@ -373,6 +496,10 @@ int main(int argc, const char **argv)
 			test_ldb_msg_find_common_values,
 			ldb_msg_setup,
 			ldb_msg_teardown),
+		cmocka_unit_test_setup_teardown(
+			test_ldb_msg_find_element_index,
+			ldb_msg_setup,
+			ldb_msg_teardown),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
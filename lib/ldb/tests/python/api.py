@@ -616,77 +616,103 @@ class SearchTests(TestCase):
         self.filename = os.path.join(self.testdir, "search_test.ldb")
         self.l = ldb.Ldb(self.filename, options=["modules:rdn_name"])
 
-        self.l.add({"dn": "DC=SAMBA,DC=ORG", "name": b"samba.org"})
+        self.l.add({"dn": "DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd01",
+                    "name": b"samba.org"})
         self.l.add({"dn": "OU=ADMIN,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd02",
                     "name": b"Admins",
                     "x": "z", "y": "a"})
         self.l.add({"dn": "OU=USERS,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd03",
                     "name": b"Users",
                     "x": "z", "y": "a"})
         self.l.add({"dn": "OU=OU1,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd04",
                     "name": b"OU #1",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU2,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd05",
                     "name": b"OU #2",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU3,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd06",
                     "name": b"OU #3",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU4,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd07",
                     "name": b"OU #4",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU5,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd08",
                     "name": b"OU #5",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU6,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd09",
                     "name": b"OU #6",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU7,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd10",
                     "name": b"OU #7",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU8,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd11",
                     "name": b"OU #8",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU9,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd12",
                     "name": b"OU #9",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU10,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd13",
                     "name": b"OU #10",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU11,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd14",
                     "name": b"OU #10",
                     "x": "y", "y": "a"})
         self.l.add({"dn": "OU=OU12,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd15",
                     "name": b"OU #10",
                     "x": "y", "y": "b"})
         self.l.add({"dn": "OU=OU13,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd16",
                     "name": b"OU #10",
                     "x": "x", "y": "b"})
         self.l.add({"dn": "OU=OU14,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd17",
                     "name": b"OU #10",
                     "x": "x", "y": "b"})
         self.l.add({"dn": "OU=OU15,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd18",
                     "name": b"OU #10",
                     "x": "x", "y": "b"})
         self.l.add({"dn": "OU=OU16,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd19",
                     "name": b"OU #10",
                     "x": "x", "y": "b"})
         self.l.add({"dn": "OU=OU17,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd20",
                     "name": b"OU #10",
                     "x": "x", "y": "b"})
         self.l.add({"dn": "OU=OU18,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd21",
                     "name": b"OU #10",
                     "x": "x", "y": "b"})
         self.l.add({"dn": "OU=OU19,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd22",
                     "name": b"OU #10",
                     "x": "x", "y": "b"})
         self.l.add({"dn": "OU=OU20,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd23",
                     "name": b"OU #10",
                     "x": "x", "y": "b"})
         self.l.add({"dn": "OU=OU21,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd24",
                     "name": b"OU #10",
                     "x": "x", "y": "c"})
         self.l.add({"dn": "OU=OU22,DC=SAMBA,DC=ORG",
+                    "objectUUID": b"0123456789abcd25",
                     "name": b"OU #10",
                     "x": "x", "y": "c"})
 
@@ -893,6 +919,90 @@ class SearchTests(TestCase):
                               expression="(&(ou=ouX)(y=a))")
         self.assertEqual(len(res11), 0)
 
+    def test_subtree_and_smallest_last(self):
+        """Testing a search"""
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(&(y=a)(x=y)(ou=ou10))")
+        self.assertEqual(len(res11), 1)
+        self.assertEqual(str(res11[0].dn), "OU=OU10,DC=SAMBA,DC=ORG")
+
+    def test_subtree_and_none_last(self):
+        """Testing a search"""
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(&(y=a)(x=y)(ou=ouX))")
+        self.assertEqual(len(res11), 0)
+
+    def test_subtree_and_large(self):
+        """Testing a search"""
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(&(y=a)(x=y))")
+        self.assertEqual(len(res11), 11)
+
+    def test_subtree_and_unindexed(self):
+        """Testing a search"""
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(&(name=OU13)(x=x)(y=b))")
+        self.assertEqual(len(res11), 1)
+        self.assertEqual(str(res11[0].dn), "OU=OU13,DC=SAMBA,DC=ORG")
+
+    def test_subtree_and_dn(self):
+        """Testing a search"""
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(&(y=a)(x=y)"
+                              "(dn=OU=OU1,DC=SAMBA,DC=ORG))")
+        self.assertEqual(len(res11), 1)
+        self.assertEqual(str(res11[0].dn), "OU=OU1,DC=SAMBA,DC=ORG")
+
+    def test_subtree_and_attrs(self):
+        """Testing a search for other attributes than in the filter"""
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(&(name=OU13)(x=x))",
+                              attrs=["y", "objectUUID"])
+        self.assertEqual(len(res11), 1)
+        self.assertEqual(str(res11[0].dn), "OU=OU13,DC=SAMBA,DC=ORG")
+        self.assertEqual(len(res11[0]), 2)
+        self.assertEqual(str(res11[0]["y"]), "b")
+        self.assertEqual(res11[0]["objectUUID"][0], b"0123456789abcd16")
+        self.assertFalse("x" in res11[0])
+        self.assertFalse("name" in res11[0])
+
+    def test_subtree_unindexed_attrs(self):
+        """Testing a search on an unindexed attribute for other
+           attributes"""
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(|(name=OU13)(name=OU14))",
+                              attrs=["x", "distinguishedName"])
+        self.assertEqual(len(res11), 2)
+        for m in res11:
+            self.assertEqual(len(m), 2)
+            self.assertEqual(str(m["x"]), "x")
+            self.assertEqual(str(m["distinguishedName"]), str(m.dn))
+
+    def test_subtree_no_attrs(self):
+        """Testing a search for no attributes"""
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(x=x)",
+                              attrs=[])
+        self.assertEqual(len(res11), 10)
+        for m in res11:
+            self.assertEqual(len(m), 0)
+
 
 class IndexedSearchTests(SearchTests):
     """Test searches using the index, to ensure the index doesn't
@@ -904,6 +1014,126 @@ class IndexedSearchTests(SearchTests):
                     "@IDXONE": [b"1"]})
 
 
+class GUIDIndexedSearchTests(SearchTests):
+    """Test searches using the index, with the records stored under
+       their objectUUID, to ensure the GUID index doesn't break things"""
+    def setUp(self):
+        super(GUIDIndexedSearchTests, self).setUp()
+        # this moves the existing records to their GUID keys
+        self.l.add({"dn": "@INDEXLIST",
+                    "@IDXATTR": [b"x", b"y", b"ou"],
+                    "@IDXONE": [b"1"],
+                    "@IDXGUID": [b"objectUUID"]})
+
+    def test_dn_filter(self):
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(dn=OU=OU1,DC=SAMBA,DC=ORG)")
+        self.assertEqual(len(res11), 1)
+        self.assertEqual(res11[0]["objectUUID"][0], b"0123456789abcd04")
+
+    def test_add_existing_dn(self):
+        try:
+            self.l.add({"dn": "OU=OU1,DC=SAMBA,DC=ORG",
+                        "objectUUID": b"0123456789abcdff"})
+            self.fail("Should have failed adding an existing DN")
+        except ldb.LdbError as err:
+            enum = err.args[0]
+            self.assertEqual(enum, ldb.ERR_ENTRY_ALREADY_EXISTS)
+
+    def test_add_existing_guid(self):
+        try:
+            self.l.add({"dn": "OU=OUX,DC=SAMBA,DC=ORG",
+                        "objectUUID": b"0123456789abcd04"})
+            self.fail("Should have failed adding an existing GUID")
+        except ldb.LdbError as err:
+            enum = err.args[0]
+            self.assertEqual(enum, ldb.ERR_ENTRY_ALREADY_EXISTS)
+
+    def test_add_without_guid(self):
+        try:
+            self.l.add({"dn": "OU=OUX,DC=SAMBA,DC=ORG"})
+            self.fail("Should have failed adding a record without GUID")
+        except ldb.LdbError as err:
+            enum = err.args[0]
+            self.assertEqual(enum, ldb.ERR_CONSTRAINT_VIOLATION)
+
+    def test_modify_guid(self):
+        m = ldb.Message()
+        m.dn = ldb.Dn(self.l, "OU=OU1,DC=SAMBA,DC=ORG")
+        m["objectUUID"] = ldb.MessageElement(b"0123456789abcdff",
+                                             ldb.FLAG_MOD_REPLACE,
+                                             "objectUUID")
+        try:
+            self.l.modify(m)
+            self.fail("Should have failed modifying the GUID")
+        except ldb.LdbError as err:
+            enum = err.args[0]
+            self.assertEqual(enum, ldb.ERR_CONSTRAINT_VIOLATION)
+
+    def test_modify_indexed(self):
+        m = ldb.Message()
+        m.dn = ldb.Dn(self.l, "OU=OU1,DC=SAMBA,DC=ORG")
+        m["x"] = ldb.MessageElement(b"z", ldb.FLAG_MOD_REPLACE, "x")
+        self.l.modify(m)
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(x=z)")
+        self.assertEqual(len(res11), 3)
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(x=y)")
+        self.assertEqual(len(res11), 11)
+
+    def test_rename(self):
+        self.l.rename("OU=OU1,DC=SAMBA,DC=ORG", "OU=OU1X,DC=SAMBA,DC=ORG")
+
+        res11 = self.l.search(base="OU=OU1X,DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_BASE)
+        self.assertEqual(len(res11), 1)
+        self.assertEqual(res11[0]["objectUUID"][0], b"0123456789abcd04")
+        res11 = self.l.search(base="OU=OU1,DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_BASE)
+        self.assertEqual(len(res11), 0)
+
+        try:
+            self.l.rename("OU=OU2,DC=SAMBA,DC=ORG",
+                          "OU=OU1X,DC=SAMBA,DC=ORG")
+            self.fail("Should have failed renaming onto an existing DN")
+        except ldb.LdbError as err:
+            enum = err.args[0]
+            self.assertEqual(enum, ldb.ERR_ENTRY_ALREADY_EXISTS)
+
+    def test_delete(self):
+        self.l.delete("OU=OU2,DC=SAMBA,DC=ORG")
+
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(x=y)")
+        self.assertEqual(len(res11), 11)
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_ONELEVEL,
+                              expression="(y=a)")
+        self.assertEqual(len(res11), 12)
+
+    def test_dn_index_off(self):
+        # and back to records stored under their DN
+        m = ldb.Message()
+        m.dn = ldb.Dn(self.l, "@INDEXLIST")
+        m["@IDXGUID"] = ldb.MessageElement([], ldb.FLAG_MOD_DELETE,
+                                           "@IDXGUID")
+        self.l.modify(m)
+
+        res11 = self.l.search(base="OU=OU1,DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_BASE)
+        self.assertEqual(len(res11), 1)
+        res11 = self.l.search(base="DC=SAMBA,DC=ORG",
+                              scope=ldb.SCOPE_SUBTREE,
+                              expression="(|(x=y)(y=b))")
+        self.assertEqual(len(res11), 20)
+
+
 
 class DnTests(TestCase):
 
@@ -90,6 +90,18 @@ struct pthreadpool {
 	 */
 	int num_idle;
 
+	/*
+	 * Number of threads spinning for new jobs with the mutex
+	 * unlocked, see pthreadpool_spin()
+	 */
+	int num_spinning;
+
+	/*
+	 * How often an otherwise idle thread polls for new jobs
+	 * before it goes to sleep on the condvar
+	 */
+	unsigned spin_count;
+
 	/*
 	 * Condition variable indicating that we should quickly go
 	 * away making way for fork() without anybody waiting on
@@ -104,6 +116,22 @@ static pthread_once_t pthreadpool_atfork_initialized = PTHREAD_ONCE_INIT;
 
 static void pthreadpool_prep_atfork(void);
 
+/*
+ * Spinning only makes sense if the thread adding jobs can run at the
+ * same time as the spinning thread.
+ */
+#define PTHREADPOOL_SPIN_COUNT 1000
+
+static unsigned pthreadpool_spin_count(void)
+{
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (num_cpus < 2) {
+		return 0;
+	}
+	return PTHREADPOOL_SPIN_COUNT;
+}
+
 /*
  * Initialize a thread pool
  */
@@ -155,6 +183,8 @@ int pthreadpool_init(unsigned max_threads, struct pthreadpool **presult,
 	pool->num_threads = 0;
 	pool->max_threads = max_threads;
 	pool->num_idle = 0;
+	pool->num_spinning = 0;
+	pool->spin_count = pthreadpool_spin_count();
 	pool->prefork_cond = NULL;
 
 	ret = pthread_mutex_lock(&pthreadpools_mutex);
@@ -263,6 +293,7 @@ static void pthreadpool_child(void)
 
 		pool->num_threads = 0;
 		pool->num_idle = 0;
+		pool->num_spinning = 0;
 		pool->head = 0;
 		pool->num_jobs = 0;
 
@@ -429,6 +460,56 @@ static bool pthreadpool_put_job(struct pthreadpool *p,
 	return true;
 }
 
+/*
+ * Read a value that other threads modify under pool->mutex without
+ * taking the mutex. This is only used as a hint, the caller has to
+ * re-check with the mutex held.
+ */
+#define PTHREADPOOL_PEEK(x) (*(volatile __typeof__(x) *)&(x))
+
+static inline void pthreadpool_cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+/*
+ * Poll for new jobs for a short while before going to sleep on
+ * pool->condvar. If a new job arrives while we spin,
+ * pthreadpool_add_job() can skip the condvar signal and we avoid the
+ * futex wakeup and the context switch. This helps the typical smbd
+ * pattern of a client keeping a few requests in flight, where the
+ * next job arrives shortly after the previous one finished.
+ *
+ * pool->mutex must be locked and will be locked again on return.
+ */
+static void pthreadpool_spin(struct pthreadpool *pool)
+{
+	unsigned i;
+	int res;
+
+	pool->num_spinning += 1;
+
+	res = pthread_mutex_unlock(&pool->mutex);
+	assert(res == 0);
+
+	for (i = 0; i < pool->spin_count; i++) {
+		if ((PTHREADPOOL_PEEK(pool->num_jobs) != 0) ||
+		    PTHREADPOOL_PEEK(pool->shutdown)) {
+			break;
+		}
+		pthreadpool_cpu_relax();
+	}
+
+	res = pthread_mutex_lock(&pool->mutex);
+	assert(res == 0);
+
+	pool->num_spinning -= 1;
+}
+
 static void *pthreadpool_server(void *arg)
 {
 	struct pthreadpool *pool = (struct pthreadpool *)arg;
@@ -451,6 +532,11 @@ static void *pthreadpool_server(void *arg)
 		clock_gettime(CLOCK_REALTIME, &ts);
 		ts.tv_sec += 1;
 
+		if ((pool->num_jobs == 0) && !pool->shutdown &&
+		    (pool->spin_count != 0)) {
+			pthreadpool_spin(pool);
+		}
+
 		while ((pool->num_jobs == 0) && !pool->shutdown) {
 
 			pool->num_idle += 1;
@@ -552,6 +638,15 @@ int pthreadpool_add_job(struct pthreadpool *pool, int job_id,
 		return ENOMEM;
 	}
 
+	if (pool->num_jobs <= pool->num_spinning) {
+		/*
+		 * A spinning thread will pick up the job, no need to
+		 * wake or create a thread.
+		 */
+		pthread_mutex_unlock(&pool->mutex);
+		return 0;
+	}
+
 	if (pool->num_idle > 0) {
 		/*
 		 * We have idle threads, wake one.
@@ -29,6 +29,7 @@ static bool tdb_check_header(struct tdb_context *tdb, tdb_off_t *recovery)
 {
 	struct tdb_header hdr;
 	uint32_t h1, h2;
+	tdb_off_t recovery_start;
 
 	if (tdb->methods->tdb_read(tdb, 0, &hdr, sizeof(hdr), 0) == -1)
 		return false;
@@ -55,11 +56,28 @@ static bool tdb_check_header(struct tdb_context *tdb, tdb_off_t *recovery)
 	if (hdr.hash_size != tdb->hash_size)
 		goto corrupt;
 
-	if (hdr.recovery_start != 0 &&
-	    hdr.recovery_start < TDB_DATA_START(tdb->hash_size))
+	recovery_start = hdr.recovery_start;
+	if (TDB_LARGE_OFFSETS_P(tdb)) {
+		recovery_start = tdb_ofs_unpack(tdb, hdr.recovery_start64);
+	}
+
+	if (recovery_start != 0 &&
+	    recovery_start < TDB_DATA_START(tdb, tdb->hash_size))
 		goto corrupt;
 
-	*recovery = hdr.recovery_start;
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_HASH_TABLE) {
+		tdb_off_t hash_table = hdr.hash_table[0] |
+			((tdb_off_t)hdr.hash_table[1] << 32);
+
+		if (hdr.hash_chains != tdb->hash_chains ||
+		    hash_table != tdb->hash_table)
+			goto corrupt;
+		if (hash_table < TDB_DATA_START(tdb, tdb->hash_size) +
+		    TDB_REC_SIZE(tdb))
+			goto corrupt;
+	}
+
+	*recovery = recovery_start;
 	return true;
 
 corrupt:
@@ -73,55 +91,55 @@ static bool tdb_check_record(struct tdb_context *tdb,
 			     tdb_off_t off,
 			     const struct tdb_record *rec)
 {
-	tdb_off_t tailer;
+	uint32_t tailer;
 
 	/* Check rec->next: 0 or points to record offset, aligned. */
-	if (rec->next > 0 && rec->next < TDB_DATA_START(tdb->hash_size)){
+	if (rec->next > 0 && rec->next < TDB_DATA_START(tdb, tdb->hash_size)){
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
-			 "Record offset %u too small next %u\n",
-			 off, rec->next));
+			 "Record offset %ju too small next %ju\n",
+			 (uintmax_t)off, (uintmax_t)rec->next));
 		goto corrupt;
 	}
-	if (rec->next + sizeof(*rec) < rec->next) {
+	if (rec->next + TDB_REC_SIZE(tdb) < rec->next) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
-			 "Record offset %u too large next %u\n",
-			 off, rec->next));
+			 "Record offset %ju too large next %ju\n",
+			 (uintmax_t)off, (uintmax_t)rec->next));
 		goto corrupt;
 	}
 	if ((rec->next % TDB_ALIGNMENT) != 0) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
-			 "Record offset %u misaligned next %u\n",
-			 off, rec->next));
+			 "Record offset %ju misaligned next %ju\n",
+			 (uintmax_t)off, (uintmax_t)rec->next));
 		goto corrupt;
 	}
-	if (tdb->methods->tdb_oob(tdb, rec->next, sizeof(*rec), 0))
+	if (tdb->methods->tdb_oob(tdb, rec->next, TDB_REC_SIZE(tdb), 0))
 		goto corrupt;
 
 	/* Check rec_len: similar to rec->next, implies next record. */
 	if ((rec->rec_len % TDB_ALIGNMENT) != 0) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
-			 "Record offset %u misaligned length %u\n",
-			 off, rec->rec_len));
+			 "Record offset %ju misaligned length %u\n",
+			 (uintmax_t)off, rec->rec_len));
 		goto corrupt;
 	}
 	/* Must fit tailer. */
 	if (rec->rec_len < sizeof(tailer)) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
-			 "Record offset %u too short length %u\n",
-			 off, rec->rec_len));
+			 "Record offset %ju too short length %u\n",
+			 (uintmax_t)off, rec->rec_len));
 		goto corrupt;
 	}
 	/* OOB allows "right at the end" access, so this works for last rec. */
-	if (tdb->methods->tdb_oob(tdb, off, sizeof(*rec)+rec->rec_len, 0))
+	if (tdb->methods->tdb_oob(tdb, off, TDB_REC_SIZE(tdb)+rec->rec_len, 0))
 		goto corrupt;
 
 	/* Check tailer. */
-	if (tdb_ofs_read(tdb, off+sizeof(*rec)+rec->rec_len-sizeof(tailer),
+	if (tdb_u32_read(tdb, off+TDB_REC_SIZE(tdb)+rec->rec_len-sizeof(tailer),
 			 &tailer) == -1)
 		goto corrupt;
-	if (tailer != sizeof(*rec) + rec->rec_len) {
+	if (tailer != TDB_REC_SIZE(tdb) + rec->rec_len) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
-			 "Record offset %u invalid tailer\n", off));
+			 "Record offset %ju invalid tailer\n", (uintmax_t)off));
 		goto corrupt;
 	}
 
@@ -220,7 +238,7 @@ static void bit_flip(unsigned char bits[], unsigned int idx)
 /* We record offsets in a bitmap for the particular chain it should be in.  */
 static void record_offset(unsigned char bits[], tdb_off_t off)
 {
-	uint32_t h1 = off, h2 = 0;
+	uint32_t h1 = off, h2 = off >> 32;
 	unsigned int i;
 
 	/* We get two good hash values out of jhash2, so we use both.  Then
@@ -247,32 +265,34 @@ static bool tdb_check_used_record(struct tdb_context *tdb,
 		return false;
 
 	/* key + data + tailer must fit in record */
-	if (rec->key_len + rec->data_len + sizeof(tdb_off_t) > rec->rec_len) {
+	if (rec->key_len + rec->data_len + TDB_TAILER_SIZE > rec->rec_len) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
-			 "Record offset %u too short for contents\n", off));
+			 "Record offset %ju too short for contents\n",
+			 (uintmax_t)off));
 		return false;
 	}
 
-	key = get_bytes(tdb, off + sizeof(*rec), rec->key_len);
+	key = get_bytes(tdb, off + TDB_REC_SIZE(tdb), rec->key_len);
 	if (!key.dptr)
 		return false;
 
 	if (tdb->hash_fn(&key) != rec->full_hash) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
-			 "Record offset %u has incorrect hash\n", off));
+			 "Record offset %ju has incorrect hash\n",
+			 (uintmax_t)off));
 		goto fail_put_key;
 	}
 
 	/* Mark this offset as a known value for this hash bucket. */
-	record_offset(hashes[BUCKET(rec->full_hash)+1], off);
+	record_offset(hashes[CHAIN(rec->full_hash)+1], off);
 	/* And similarly if the next pointer is valid. */
 	if (rec->next)
-		record_offset(hashes[BUCKET(rec->full_hash)+1], rec->next);
+		record_offset(hashes[CHAIN(rec->full_hash)+1], rec->next);
 
 	/* If they supply a check function and this record isn't dead,
 	   get data and feed it. */
 	if (check && rec->magic != TDB_DEAD_MAGIC) {
-		data = get_bytes(tdb, off + sizeof(*rec) + rec->key_len,
+		data = get_bytes(tdb, off + TDB_REC_SIZE(tdb) + rec->key_len,
 				 rec->data_len);
 		if (!data.dptr)
 			goto fail_put_key;
@@ -335,6 +355,7 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 	bool found_recovery = false;
 	tdb_len_t dead;
 	bool locked;
+	bool found_table = false;
 
 	/* Read-only databases use no locking at all: it's best-effort.
 	 * We may have a write lock already, so skip that case too. */
@@ -349,12 +370,15 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 	/* Make sure we know true size of the underlying file. */
 	tdb->methods->tdb_oob(tdb, tdb->map_size, 1, 1);
 
+	if (!locked && tdb_hash_table_refresh(tdb) == -1)
+		goto unlock;
+
 	/* Header must be OK: also gets us the recovery ptr, if any. */
 	if (!tdb_check_header(tdb, &recovery_start))
 		goto unlock;
 
 	/* We should have the whole header, too. */
-	if (tdb->map_size < TDB_DATA_START(tdb->hash_size)) {
+	if (tdb->map_size < TDB_DATA_START(tdb, tdb->hash_size)) {
 		tdb->ecode = TDB_ERR_CORRUPT;
 		TDB_LOG((tdb, TDB_DEBUG_ERROR, "File too short for hashes\n"));
 		goto unlock;
@@ -362,33 +386,54 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 
 	/* One big malloc: pointers then bit arrays. */
 	hashes = (unsigned char **)calloc(
-			1, sizeof(hashes[0]) * (1+tdb->hash_size)
-			+ BITMAP_BITS / CHAR_BIT * (1+tdb->hash_size));
+			1, sizeof(hashes[0]) * (1+tdb->hash_chains)
+			+ BITMAP_BITS / CHAR_BIT * (1+tdb->hash_chains));
 	if (!hashes) {
 		tdb->ecode = TDB_ERR_OOM;
 		goto unlock;
 	}
 
 	/* Initialize pointers */
-	hashes[0] = (unsigned char *)(&hashes[1+tdb->hash_size]);
-	for (h = 1; h < 1+tdb->hash_size; h++)
+	hashes[0] = (unsigned char *)(&hashes[1+tdb->hash_chains]);
+	for (h = 1; h < 1+tdb->hash_chains; h++)
 		hashes[h] = hashes[h-1] + BITMAP_BITS / CHAR_BIT;
 
-	/* Freelist and hash headers are all in a row: read them. */
-	for (h = 0; h < 1+tdb->hash_size; h++) {
-		if (tdb_ofs_read(tdb, FREELIST_TOP + h*sizeof(tdb_off_t),
-				 &off) == -1)
+	/* Read the freelist and hash headers. */
+	for (h = 0; h < TDB_NUM_FREELISTS(tdb); h++) {
+		if (tdb_ofs_read(tdb, TDB_FREELIST_TOP(tdb, h), &off) == -1)
+			goto free;
+		if (off)
+			record_offset(hashes[0], off);
+	}
+	for (h = 1; h < 1+tdb->hash_chains; h++) {
+		if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, h-1), &off) == -1)
 			goto free;
 		if (off)
 			record_offset(hashes[h], off);
 	}
 
+	/* tdb_rehash() leaves the hash heads in the header empty */
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_HASH_TABLE) {
+		for (h = 1; h < 1+tdb->hash_size; h++) {
+			if (tdb_ofs_read(tdb,
+					 FREELIST_TOP + h*TDB_OFS_SIZE(tdb),
+					 &off) == -1)
+				goto free;
+			if (off != 0) {
+				tdb->ecode = TDB_ERR_CORRUPT;
+				TDB_LOG((tdb, TDB_DEBUG_ERROR,
+					 "Unused hash head %u is not empty\n",
+					 h-1));
+				goto free;
+			}
+		}
+	}
+
 	/* For each record, read it in and check it's ok. */
-	for (off = TDB_DATA_START(tdb->hash_size);
+	for (off = TDB_DATA_START(tdb, tdb->hash_size);
 	     off < tdb->map_size;
-	     off += sizeof(rec) + rec.rec_len) {
-		if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
-					   DOCONV()) == -1)
+	     off += TDB_REC_SIZE(tdb) + rec.rec_len) {
+		if (tdb_rec_read_raw(tdb, off, &rec) == -1)
 			goto free;
 		switch (rec.magic) {
 		case TDB_MAGIC:
@@ -409,36 +454,48 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 				break;
 			}
 			dead = tdb_dead_space(tdb, off);
-			if (dead < sizeof(rec))
+			if (dead < TDB_REC_SIZE(tdb))
 				goto corrupt;
 
 			TDB_LOG((tdb, TDB_DEBUG_ERROR,
-				 "Dead space at %u-%u (of %u)\n",
-				 off, off + dead, tdb->map_size));
-			rec.rec_len = dead - sizeof(rec);
+				 "Dead space at %ju-%ju (of %ju)\n",
+				 (uintmax_t)off, (uintmax_t)(off + dead),
+				 (uintmax_t)tdb->map_size));
+			rec.rec_len = dead - TDB_REC_SIZE(tdb);
 			break;
 		case TDB_RECOVERY_MAGIC:
 			if (recovery_start != off) {
 				TDB_LOG((tdb, TDB_DEBUG_ERROR,
-					 "Unexpected recovery record at offset %u\n",
-					 off));
+					 "Unexpected recovery record at offset %ju\n",
+					 (uintmax_t)off));
 				goto free;
 			}
 			found_recovery = true;
 			break;
+		case TDB_HASHTABLE_MAGIC:
+			if (!(tdb->feature_flags & TDB_FEATURE_FLAG_HASH_TABLE) ||
+			    off + TDB_REC_SIZE(tdb) != tdb->hash_table ||
+			    rec.rec_len < tdb->hash_chains * TDB_OFS_SIZE(tdb)) {
+				TDB_LOG((tdb, TDB_DEBUG_ERROR,
+					 "Unexpected hash table record at offset %ju\n",
+					 (uintmax_t)off));
+				goto free;
+			}
+			found_table = true;
+			break;
 		default: ;
 		corrupt:
 			tdb->ecode = TDB_ERR_CORRUPT;
 			TDB_LOG((tdb, TDB_DEBUG_ERROR,
-				 "Bad magic 0x%x at offset %u\n",
-				 rec.magic, off));
+				 "Bad magic 0x%x at offset %ju\n",
+				 rec.magic, (uintmax_t)off));
 			goto free;
 		}
 	}
 
 	/* Now, hashes should all be empty: each record exists and is referred
 	 * to by one other. */
-	for (h = 0; h < 1+tdb->hash_size; h++) {
+	for (h = 0; h < 1+tdb->hash_chains; h++) {
 		unsigned int i;
 		for (i = 0; i < BITMAP_BITS / CHAR_BIT; i++) {
 			if (hashes[h][i] != 0) {
@@ -453,8 +510,17 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 	/* We must have found recovery area if there was one. */
 	if (recovery_start != 0 && !found_recovery) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
-			 "Expected a recovery area at %u\n",
-			 recovery_start));
+			 "Expected a recovery area at %ju\n",
+			 (uintmax_t)recovery_start));
+		goto free;
+	}
+
+	/* And the hash table record, if the heads were moved. */
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_HASH_TABLE) &&
+	    !found_table) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR,
+			 "Expected a hash table at %ju\n",
+			 (uintmax_t)tdb->hash_table));
 		goto free;
 	}
 
@@ -31,48 +31,41 @@ static tdb_off_t tdb_dump_record(struct tdb_context *tdb, int hash,
 				 tdb_off_t offset)
 {
 	struct tdb_record rec;
-	tdb_off_t tailer_ofs, tailer;
+	tdb_off_t tailer_ofs;
+	uint32_t tailer;
 
-	if (tdb->methods->tdb_read(tdb, offset, (char *)&rec,
-				   sizeof(rec), DOCONV()) == -1) {
-		printf("ERROR: failed to read record at %u\n", offset);
+	if (tdb_rec_read_raw(tdb, offset, &rec) == -1) {
+		printf("ERROR: failed to read record at %ju\n",
+		       (uintmax_t)offset);
 		return 0;
 	}
 
-	printf(" rec: hash=%d offset=0x%08x next=0x%08x rec_len=%u "
+	printf(" rec: hash=%d offset=0x%08jx next=0x%08jx rec_len=%u "
 	       "key_len=%u data_len=%u full_hash=0x%08x magic=0x%08x\n",
-	       hash, offset, rec.next, rec.rec_len, rec.key_len, rec.data_len,
-	       rec.full_hash, rec.magic);
+	       hash, (uintmax_t)offset, (uintmax_t)rec.next, rec.rec_len,
+	       rec.key_len, rec.data_len, rec.full_hash, rec.magic);
 
-	tailer_ofs = offset + sizeof(rec) + rec.rec_len - sizeof(tdb_off_t);
+	tailer_ofs = offset + TDB_REC_SIZE(tdb) + rec.rec_len - TDB_TAILER_SIZE;
 
-	if (tdb_ofs_read(tdb, tailer_ofs, &tailer) == -1) {
-		printf("ERROR: failed to read tailer at %u\n", tailer_ofs);
+	if (tdb_u32_read(tdb, tailer_ofs, &tailer) == -1) {
+		printf("ERROR: failed to read tailer at %ju\n",
+		       (uintmax_t)tailer_ofs);
 		return rec.next;
 	}
 
-	if (tailer != rec.rec_len + sizeof(rec)) {
+	if (tailer != rec.rec_len + TDB_REC_SIZE(tdb)) {
 		printf("ERROR: tailer does not match record! tailer=%u totalsize=%u\n",
-				(unsigned int)tailer, (unsigned int)(rec.rec_len + sizeof(rec)));
+				(unsigned int)tailer, (unsigned int)(rec.rec_len + TDB_REC_SIZE(tdb)));
 	}
 	return rec.next;
 }
 
-static int tdb_dump_chain(struct tdb_context *tdb, int i)
+static void tdb_dump_list(struct tdb_context *tdb, int i, tdb_off_t top)
 {
-	tdb_off_t rec_ptr, top;
-
-	if (i == -1) {
-		top = FREELIST_TOP;
-	} else {
-		top = TDB_HASH_TOP(i);
-	}
-
-	if (tdb_lock(tdb, i, F_WRLCK) != 0)
-		return -1;
+	tdb_off_t rec_ptr;
 
 	if (tdb_ofs_read(tdb, top, &rec_ptr) == -1)
-		return tdb_unlock(tdb, i, F_WRLCK);
+		return;
 
 	if (rec_ptr)
 		printf("hash=%d\n", i);
@@ -80,14 +73,32 @@ static int tdb_dump_chain(struct tdb_context *tdb, int i)
 	while (rec_ptr) {
 		rec_ptr = tdb_dump_record(tdb, i, rec_ptr);
 	}
+}
+
+static int tdb_dump_chain(struct tdb_context *tdb, int i)
+{
+	int list = (i == -1) ? -1 : (int)BUCKET(i);
+	unsigned n;
+
+	if (tdb_lock(tdb, list, F_WRLCK) != 0)
+		return -1;
 
-	return tdb_unlock(tdb, i, F_WRLCK);
+	/* The lock makes sure we see the current hash table */
+	if (i == -1) {
+		for (n = 0; n < TDB_NUM_FREELISTS(tdb); n++) {
+			tdb_dump_list(tdb, i, TDB_FREELIST_TOP(tdb, n));
+		}
+	} else {
+		tdb_dump_list(tdb, i, TDB_HASH_TOP(tdb, i));
+	}
+
+	return tdb_unlock(tdb, list, F_WRLCK);
 }
 
 _PUBLIC_ void tdb_dump_all(struct tdb_context *tdb)
 {
 	int i;
-	for (i=0;i<tdb->hash_size;i++) {
+	for (i=0;i<tdb->hash_chains;i++) {
 		tdb_dump_chain(tdb, i);
 	}
 	printf("freelist:\n");
@@ -100,38 +111,42 @@ _PUBLIC_ int tdb_printfreelist(struct tdb_context *tdb)
 	long total_free = 0;
 	tdb_off_t offset, rec_ptr;
 	struct tdb_record rec;
+	unsigned list;
 
 	if ((ret = tdb_lock(tdb, -1, F_WRLCK)) != 0)
 		return ret;
 
-	offset = FREELIST_TOP;
-
-	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
-		tdb_unlock(tdb, -1, F_WRLCK);
-		return 0;
-	}
+	for (list = 0; list < TDB_NUM_FREELISTS(tdb); list++) {
+		offset = TDB_FREELIST_TOP(tdb, list);
 
-	printf("freelist top=[0x%08x]\n", rec_ptr );
-	while (rec_ptr) {
-		if (tdb->methods->tdb_read(tdb, rec_ptr, (char *)&rec,
-					   sizeof(rec), DOCONV()) == -1) {
+		/* read in the freelist top */
+		if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
 			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+			return 0;
 		}
 
-		if (rec.magic != TDB_FREE_MAGIC) {
-			printf("bad magic 0x%08x in free list\n", rec.magic);
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+		printf("freelist top=[0x%08jx]\n", (uintmax_t)rec_ptr );
+		while (rec_ptr) {
+			if (tdb_rec_read_raw(tdb, rec_ptr, &rec) == -1) {
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
+
+			if (rec.magic != TDB_FREE_MAGIC) {
+				printf("bad magic 0x%08x in free list\n",
+				       rec.magic);
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
+
+			printf("entry offset=[0x%08jx], rec.rec_len = [0x%08x (%u)] (end = 0x%08jx)\n",
+			       (uintmax_t)rec_ptr, rec.rec_len, rec.rec_len,
+			       (uintmax_t)(rec_ptr + rec.rec_len));
+			total_free += rec.rec_len;
+
+			/* move to the next record */
+			rec_ptr = rec.next;
 		}
-
-		printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%u)] (end = 0x%08x)\n",
-		       rec_ptr, rec.rec_len, rec.rec_len, rec_ptr + rec.rec_len);
-		total_free += rec.rec_len;
-
-		/* move to the next record */
-		rec_ptr = rec.next;
 	}
 	printf("total rec_len = [0x%08lx (%lu)]\n", total_free, total_free);
 
@@ -33,17 +33,40 @@
 */
 #define USE_RIGHT_MERGES 0
 
+/*
+ * With TDB_FEATURE_FLAG_FREELIST_CLASSES every record on free list c
+ * is at least tdb_freelist_min[c] bytes long, so an allocation can
+ * take the first record of any list above its own size class.
+ */
+static const tdb_len_t tdb_freelist_min[TDB_FREELIST_NUM_CLASSES] = {
+	0, 64, 128, 256, 512, 1024, 4096, 16384
+};
+
+/* how many records of its own size class an allocation looks at */
+#define TDB_FREELIST_MAX_WALK 16
+
+/* the free list a record of length rec_len belongs to */
+unsigned tdb_freelist_class(struct tdb_context *tdb, tdb_len_t rec_len)
+{
+	unsigned list = TDB_NUM_FREELISTS(tdb) - 1;
+
+	while (rec_len < tdb_freelist_min[list]) {
+		list--;
+	}
+	return list;
+}
+
 /* read a freelist record and check for simple errors */
 int tdb_rec_free_read(struct tdb_context *tdb, tdb_off_t off, struct tdb_record *rec)
 {
-	if (tdb->methods->tdb_read(tdb, off, rec, sizeof(*rec),DOCONV()) == -1)
+	if (tdb_rec_read_raw(tdb, off, rec) == -1)
 		return -1;
 
 	if (rec->magic == TDB_MAGIC) {
 		/* this happens when a app is showdown while deleting a record - we should
 		   not completely fail when this happens */
-		TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_rec_free_read non-free magic 0x%x at offset=%u - fixing\n",
-			 rec->magic, off));
+		TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_rec_free_read non-free magic 0x%x at offset=%ju - fixing\n",
+			 rec->magic, (uintmax_t)off));
 		rec->magic = TDB_FREE_MAGIC;
 		if (tdb_rec_write(tdb, off, rec) == -1)
 			return -1;
@@ -52,11 +75,11 @@ int tdb_rec_free_read(struct tdb_context *tdb, tdb_off_t off, struct tdb_record
 	if (rec->magic != TDB_FREE_MAGIC) {
 		/* Ensure ecode is set for log fn. */
 		tdb->ecode = TDB_ERR_CORRUPT;
-		TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_rec_free_read bad magic 0x%x at offset=%u\n",
-			   rec->magic, off));
+		TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_rec_free_read bad magic 0x%x at offset=%ju\n",
+			   rec->magic, (uintmax_t)off));
 		return -1;
 	}
-	if (tdb->methods->tdb_oob(tdb, rec->next, sizeof(*rec), 0) != 0)
+	if (tdb->methods->tdb_oob(tdb, rec->next, TDB_REC_SIZE(tdb), 0) != 0)
 		return -1;
 	return 0;
 }
@@ -79,7 +102,7 @@ static int remove_from_freelist(struct tdb_context *tdb, tdb_off_t off, tdb_off_
 		last_ptr = i;
 	}
 	tdb->ecode = TDB_ERR_CORRUPT;
-	TDB_LOG((tdb, TDB_DEBUG_FATAL,"remove_from_freelist: not on list at off=%u\n", off));
+	TDB_LOG((tdb, TDB_DEBUG_FATAL,"remove_from_freelist: not on list at off=%ju\n", (uintmax_t)off));
 	return -1;
 }
 #endif
@@ -89,11 +112,11 @@ static int remove_from_freelist(struct tdb_context *tdb, tdb_off_t off, tdb_off_
 static int update_tailer(struct tdb_context *tdb, tdb_off_t offset,
 			 const struct tdb_record *rec)
 {
-	tdb_off_t totalsize;
+	tdb_len_t totalsize;
 
 	/* Offset of tailer from record header */
-	totalsize = sizeof(*rec) + rec->rec_len;
-	return tdb_ofs_write(tdb, offset + totalsize - sizeof(tdb_off_t),
+	totalsize = TDB_REC_SIZE(tdb) + rec->rec_len;
+	return tdb_u32_write(tdb, offset + totalsize - TDB_TAILER_SIZE,
 			 &totalsize);
 }
 
@@ -106,22 +129,23 @@ static int read_record_on_left(struct tdb_context *tdb, tdb_off_t rec_ptr,
 			       struct tdb_record *left_r)
 {
 	tdb_off_t left_ptr;
-	tdb_off_t left_size;
+	tdb_len_t left_size;
 	struct tdb_record left_rec;
 	int ret;
 
-	left_ptr = rec_ptr - sizeof(tdb_off_t);
+	left_ptr = rec_ptr - TDB_TAILER_SIZE;
 
-	if (left_ptr <= TDB_DATA_START(tdb->hash_size)) {
+	if (left_ptr <= TDB_DATA_START(tdb, tdb->hash_size)) {
 		/* no record on the left */
 		return -1;
 	}
 
 	/* Read in tailer and jump back to header */
-	ret = tdb_ofs_read(tdb, left_ptr, &left_size);
+	ret = tdb_u32_read(tdb, left_ptr, &left_size);
 	if (ret == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL,
-			"tdb_free: left offset read failed at %u\n", left_ptr));
+			"tdb_free: left offset read failed at %ju\n",
+			(uintmax_t)left_ptr));
 		return -1;
 	}
 
@@ -136,17 +160,16 @@ static int read_record_on_left(struct tdb_context *tdb, tdb_off_t rec_ptr,
 
 	left_ptr = rec_ptr - left_size;
 
-	if (left_ptr < TDB_DATA_START(tdb->hash_size)) {
+	if (left_ptr < TDB_DATA_START(tdb, tdb->hash_size)) {
 		return -1;
 	}
 
 	/* Now read in the left record */
-	ret = tdb->methods->tdb_read(tdb, left_ptr, &left_rec,
-				     sizeof(left_rec), DOCONV());
+	ret = tdb_rec_read_raw(tdb, left_ptr, &left_rec);
 	if (ret == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL,
-			 "tdb_free: left read failed at %u (%u)\n",
-			 left_ptr, left_size));
+			 "tdb_free: left read failed at %ju (%u)\n",
+			 (uintmax_t)left_ptr, left_size));
 		return -1;
 	}
 
@@ -161,29 +184,40 @@ static int read_record_on_left(struct tdb_context *tdb, tdb_off_t rec_ptr,
  * This assumes that left_rec represents the record
  * directly to the left of right_rec and that this is
  * a freelist record.
+ *
+ * Return code:
+ *  -1 upon error
+ *   0 if the records were merged
+ *   1 if the merged record would be too large for rec_len, this
+ *     can only happen with TDB_FEATURE_FLAG_LARGE_OFFSETS.
  */
 static int merge_with_left_record(struct tdb_context *tdb,
 				  tdb_off_t left_ptr,
 				  struct tdb_record *left_rec,
 				  struct tdb_record *right_rec)
 {
+	tdb_len_t rec_len;
 	int ret;
 
-	left_rec->rec_len += sizeof(*right_rec) + right_rec->rec_len;
+	if (!tdb_add_len_t(left_rec->rec_len, TDB_REC_SIZE(tdb), &rec_len) ||
+	    !tdb_add_len_t(rec_len, right_rec->rec_len, &rec_len)) {
+		return 1;
+	}
+	left_rec->rec_len = rec_len;
 
 	ret = tdb_rec_write(tdb, left_ptr, left_rec);
 	if (ret == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL,
-			 "merge_with_left_record: update_left failed at %u\n",
-			 left_ptr));
+			 "merge_with_left_record: update_left failed at %ju\n",
+			 (uintmax_t)left_ptr));
 		return -1;
 	}
 
 	ret = update_tailer(tdb, left_ptr, left_rec);
 	if (ret == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL,
-			 "merge_with_left_record: update_tailer failed at %u\n",
-			 left_ptr));
+			 "merge_with_left_record: update_tailer failed at %ju\n",
+			 (uintmax_t)left_ptr));
 		return -1;
 	}
 
@@ -225,9 +259,12 @@ static int check_merge_with_left_record(struct tdb_context *tdb,
 
 	/* It's free - expand to include it. */
 	ret = merge_with_left_record(tdb, left_ptr, &left_rec, rec);
-	if (ret != 0) {
+	if (ret == -1) {
 		return -1;
 	}
+	if (ret == 1) {
+		return 0;
+	}
 
 	if (lp != NULL) {
 		*lp = left_ptr;
@@ -275,16 +312,18 @@ static int check_merge_ptr_with_left_record(struct tdb_context *tdb,
 
 	/* It's free - expand to include it. */
 
-	ret = tdb->methods->tdb_read(tdb, rec_ptr, &rec,
-				     sizeof(rec), DOCONV());
+	ret = tdb_rec_read_raw(tdb, rec_ptr, &rec);
 	if (ret != 0) {
 		return -1;
 	}
 
 	ret = merge_with_left_record(tdb, left_ptr, &left_rec, &rec);
-	if (ret != 0) {
+	if (ret == -1) {
 		return -1;
 	}
+	if (ret == 1) {
+		return 0;
+	}
 
 	if (next_ptr != NULL) {
 		*next_ptr = rec.next;
@@ -306,6 +345,7 @@ static int check_merge_ptr_with_left_record(struct tdb_context *tdb,
  */
 int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 {
+	tdb_off_t top;
 	int ret;
 
 	/* Allocation and tailer lock */
@@ -320,24 +360,24 @@ int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 
 #if USE_RIGHT_MERGES
 	/* Look right first (I'm an Australian, dammit) */
-	if (offset + sizeof(*rec) + rec->rec_len + sizeof(*rec) <= tdb->map_size) {
-		tdb_off_t right = offset + sizeof(*rec) + rec->rec_len;
+	if (offset + TDB_REC_SIZE(tdb) + rec->rec_len + TDB_REC_SIZE(tdb) <= tdb->map_size) {
+		tdb_off_t right = offset + TDB_REC_SIZE(tdb) + rec->rec_len;
 		struct tdb_record r;
 
-		if (tdb->methods->tdb_read(tdb, right, &r, sizeof(r), DOCONV()) == -1) {
-			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free: right read failed at %u\n", right));
+		if (tdb_rec_read_raw(tdb, right, &r) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free: right read failed at %ju\n", (uintmax_t)right));
 			goto left;
 		}
 
 		/* If it's free, expand to include it. */
 		if (r.magic == TDB_FREE_MAGIC) {
 			if (remove_from_freelist(tdb, right, r.next) == -1) {
-				TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free: right free failed at %u\n", right));
+				TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free: right free failed at %ju\n", (uintmax_t)right));
 				goto left;
 			}
-			rec->rec_len += sizeof(r) + r.rec_len;
+			rec->rec_len += TDB_REC_SIZE(tdb) + r.rec_len;
 			if (update_tailer(tdb, offset, rec) == -1) {
-				TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free: update_tailer failed at %u\n", offset));
+				TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free: update_tailer failed at %ju\n", (uintmax_t)offset));
 				goto fail;
 			}
 		}
@@ -357,11 +397,12 @@ left:
 	/* Nothing to merge, prepend to free list */
 
 	rec->magic = TDB_FREE_MAGIC;
+	top = TDB_FREELIST_TOP(tdb, tdb_freelist_class(tdb, rec->rec_len));
 
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec->next) == -1 ||
+	if (tdb_ofs_read(tdb, top, &rec->next) == -1 ||
 	    tdb_rec_write(tdb, offset, rec) == -1 ||
-	    tdb_ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free record write failed at offset=%u\n", offset));
+	    tdb_ofs_write(tdb, top, &offset) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free record write failed at offset=%ju\n", (uintmax_t)offset));
 		goto fail;
 	}
 
@@ -387,9 +428,12 @@ done:
  */
 static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 				  tdb_len_t length, tdb_off_t rec_ptr,
-				  struct tdb_record *rec, tdb_off_t last_ptr)
+				  struct tdb_record *rec, tdb_off_t last_ptr,
+				  unsigned list)
 {
-#define MIN_REC_SIZE (sizeof(struct tdb_record) + sizeof(tdb_off_t) + 8)
+#define MIN_REC_SIZE (TDB_REC_SIZE(tdb) + TDB_TAILER_SIZE + 8)
+	unsigned new_list;
+	tdb_off_t top = 0;
 
 	if (rec->rec_len < length + MIN_REC_SIZE) {
 		/* we have to grab the whole record */
@@ -408,16 +452,30 @@ static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 	}
 
 	/* we're going to just shorten the existing record */
-	rec->rec_len -= (length + sizeof(*rec));
+	rec->rec_len -= (length + TDB_REC_SIZE(tdb));
+
+	/* it might have become too small for its free list */
+	new_list = tdb_freelist_class(tdb, rec->rec_len);
+	if (new_list < list) {
+		top = TDB_FREELIST_TOP(tdb, new_list);
+		if (tdb_ofs_write(tdb, last_ptr, &rec->next) == -1 ||
+		    tdb_ofs_read(tdb, top, &rec->next) == -1) {
+			return 0;
+		}
+	}
+
 	if (tdb_rec_write(tdb, rec_ptr, rec) == -1) {
 		return 0;
 	}
+	if (new_list < list && tdb_ofs_write(tdb, top, &rec_ptr) == -1) {
+		return 0;
+	}
 	if (update_tailer(tdb, rec_ptr, rec) == -1) {
 		return 0;
 	}
 
 	/* and setup the new record */
-	rec_ptr += sizeof(*rec) + rec->rec_len;
+	rec_ptr += TDB_REC_SIZE(tdb) + rec->rec_len;
 
 	memset(rec, '\0', sizeof(*rec));
 	rec->rec_len = length;
@@ -434,41 +492,55 @@ static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 	return rec_ptr;
 }
 
-/* allocate some space from the free list. The offset returned points
-   to a unconnected tdb_record within the database with room for at
-   least length bytes of total data
+struct tdb_bestfit {
+	tdb_off_t rec_ptr, last_ptr;
+	tdb_len_t rec_len;
+	unsigned list;
+};
 
-   0 is returned if the space could not be allocated
+/*
+ * Move a free record that has grown by left merges to the list of
+ * its size class. Must have the freelist lock.
  */
-static tdb_off_t tdb_allocate_from_freelist(
-	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+static int tdb_freelist_move(struct tdb_context *tdb, tdb_off_t rec_ptr,
+			     struct tdb_record *rec, tdb_off_t last_ptr,
+			     unsigned new_list)
 {
-	tdb_off_t rec_ptr, last_ptr, newrec_ptr;
-	struct {
-		tdb_off_t rec_ptr, last_ptr;
-		tdb_len_t rec_len;
-	} bestfit;
-	float multiplier = 1.0;
-	bool merge_created_candidate;
-
-	/* over-allocate to reduce fragmentation */
-	length *= 1.25;
+	tdb_off_t top = TDB_FREELIST_TOP(tdb, new_list);
+
+	if (tdb_ofs_write(tdb, last_ptr, &rec->next) == -1 ||
+	    tdb_ofs_read(tdb, top, &rec->next) == -1 ||
+	    tdb_rec_write(tdb, rec_ptr, rec) == -1 ||
+	    tdb_ofs_write(tdb, top, &rec_ptr) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_freelist_move: failed "
+			 "to move record at %ju to list %u\n",
+			 (uintmax_t)rec_ptr, new_list));
+		return -1;
+	}
+	return 0;
+}
 
-	/* Extra bytes required for tailer */
-	length += sizeof(tdb_off_t);
-	length = TDB_ALIGN(length, TDB_ALIGNMENT);
+/*
+ * Look for the best fit for length bytes on free list "list",
+ * merging records with their left neighbours on the way. At most
+ * max_walk records are considered, 0 means no limit. Records that
+ * have outgrown the list are moved up, *candidate is set if that or
+ * a merge created a record we might have missed.
+ */
+static int tdb_freelist_walk(struct tdb_context *tdb, unsigned list,
+			     tdb_len_t length, unsigned max_walk,
+			     struct tdb_bestfit *bestfit, bool *candidate,
+			     struct tdb_record *rec)
+{
+	tdb_off_t rec_ptr, last_ptr;
+	float multiplier = 1.0;
+	unsigned walked = 0;
 
- again:
-	merge_created_candidate = false;
-	last_ptr = FREELIST_TOP;
+	last_ptr = TDB_FREELIST_TOP(tdb, list);
 
 	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1)
-		return 0;
-
-	bestfit.rec_ptr = 0;
-	bestfit.last_ptr = 0;
-	bestfit.rec_len = 0;
+	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1)
+		return -1;
 
 	/*
 	   this is a best fit allocation strategy. Originally we used
@@ -479,22 +551,23 @@ static tdb_off_t tdb_allocate_from_freelist(
 		int ret;
 		tdb_off_t left_ptr;
 		struct tdb_record left_rec;
+		unsigned rec_list;
 
 		if (tdb_rec_free_read(tdb, rec_ptr, rec) == -1) {
-			return 0;
+			return -1;
 		}
 
 		ret = check_merge_with_left_record(tdb, rec_ptr, rec,
 						   &left_ptr, &left_rec);
 		if (ret == -1) {
-			return 0;
+			return -1;
 		}
 		if (ret == 1) {
 			/* merged */
 			rec_ptr = rec->next;
 			ret = tdb_ofs_write(tdb, last_ptr, &rec->next);
 			if (ret == -1) {
-				return 0;
+				return -1;
 			}
 
 			/*
@@ -518,23 +591,43 @@ static tdb_off_t tdb_allocate_from_freelist(
 			 * This way we can avoid expanding the database.
 			 */
 
-			if (bestfit.rec_ptr == left_ptr) {
-				bestfit.rec_len = left_rec.rec_len;
+			if (bestfit->rec_ptr == left_ptr) {
+				bestfit->rec_len = left_rec.rec_len;
 			}
 
 			if (left_rec.rec_len > length) {
-				merge_created_candidate = true;
+				*candidate = true;
 			}
 
 			continue;
 		}
 
+		/*
+		 * Left merges don't move the enlarged record, we do
+		 * it when we come across it.
+		 */
+		rec_list = tdb_freelist_class(tdb, rec->rec_len);
+		if (rec_list > list) {
+			tdb_off_t next = rec->next;
+
+			if (tdb_freelist_move(tdb, rec_ptr, rec, last_ptr,
+					      rec_list) == -1) {
+				return -1;
+			}
+			if (rec->rec_len >= length) {
+				*candidate = true;
+			}
+			rec_ptr = next;
+			continue;
+		}
+
 		if (rec->rec_len >= length) {
-			if (bestfit.rec_ptr == 0 ||
-			    rec->rec_len < bestfit.rec_len) {
-				bestfit.rec_len = rec->rec_len;
-				bestfit.rec_ptr = rec_ptr;
-				bestfit.last_ptr = last_ptr;
+			if (bestfit->rec_ptr == 0 ||
+			    rec->rec_len < bestfit->rec_len) {
+				bestfit->rec_len = rec->rec_len;
+				bestfit->rec_ptr = rec_ptr;
+				bestfit->last_ptr = last_ptr;
+				bestfit->list = list;
 			}
 		}
 
@@ -546,8 +639,12 @@ static tdb_off_t tdb_allocate_from_freelist(
 		   stop searching if its also not too big. The
 		   definition of 'too big' changes as we scan
 		   through */
-		if (bestfit.rec_len > 0 &&
-		    bestfit.rec_len < length * multiplier) {
+		if (bestfit->rec_len > 0 &&
+		    bestfit->rec_len < length * multiplier) {
+			break;
+		}
+
+		if (max_walk != 0 && ++walked >= max_walk) {
 			break;
 		}
 
@@ -558,14 +655,85 @@ static tdb_off_t tdb_allocate_from_freelist(
 		multiplier *= 1.05;
 	}
 
+	return 0;
+}
+
+/* allocate some space from the free list. The offset returned points
+   to a unconnected tdb_record within the database with room for at
+   least length bytes of total data
+
+   0 is returned if the space could not be allocated
+ */
+static tdb_off_t tdb_allocate_from_freelist(
+	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+{
+	unsigned num_lists = TDB_NUM_FREELISTS(tdb);
+	struct tdb_bestfit bestfit;
+	bool merge_created_candidate;
+	unsigned list, i;
+
+	/* over-allocate to reduce fragmentation */
+	length *= 1.25;
+
+	/* Extra bytes required for tailer */
+	length += TDB_TAILER_SIZE;
+	length = TDB_ALIGN(length, TDB_ALIGNMENT);
+
+	list = tdb_freelist_class(tdb, length);
+
+ again:
+	merge_created_candidate = false;
+
+	bestfit.rec_ptr = 0;
+	bestfit.last_ptr = 0;
+	bestfit.rec_len = 0;
+	bestfit.list = 0;
+
+	/*
+	 * Every record on the lists above our size class is large
+	 * enough, so we only look at our own list for a bit and then
+	 * take the first record of the next non-empty larger list.
+	 * Only if those are all empty our own list is searched
+	 * completely.
+	 */
+	if (tdb_freelist_walk(tdb, list, length,
+			      (list + 1 < num_lists) ?
+			      TDB_FREELIST_MAX_WALK : 0,
+			      &bestfit, &merge_created_candidate,
+			      rec) == -1) {
+		return 0;
+	}
+	for (i = list + 1; i < num_lists && bestfit.rec_ptr == 0; i++) {
+		if (tdb_freelist_walk(tdb, i, length, 1, &bestfit,
+				      &merge_created_candidate, rec) == -1) {
+			return 0;
+		}
+	}
+	if (bestfit.rec_ptr == 0 && list + 1 < num_lists) {
+		if (tdb_freelist_walk(tdb, list, length, 0, &bestfit,
+				      &merge_created_candidate, rec) == -1) {
+			return 0;
+		}
+	}
+
+	/*
+	 * Before we expand the file, look for records that have grown
+	 * on the smaller lists by left merges.
+	 */
+	for (i = list; i > 0 && bestfit.rec_ptr == 0; i--) {
+		if (tdb_freelist_walk(tdb, i - 1, length, 0, &bestfit,
+				      &merge_created_candidate, rec) == -1) {
+			return 0;
+		}
+	}
+
 	if (bestfit.rec_ptr != 0) {
 		if (tdb_rec_free_read(tdb, bestfit.rec_ptr, rec) == -1) {
 			return 0;
 		}
 
-		newrec_ptr = tdb_allocate_ofs(tdb, length, bestfit.rec_ptr,
-					      rec, bestfit.last_ptr);
-		return newrec_ptr;
+		return tdb_allocate_ofs(tdb, length, bestfit.rec_ptr,
+					rec, bestfit.last_ptr, bestfit.list);
 	}
 
 	if (merge_created_candidate) {
@@ -574,7 +742,7 @@ static tdb_off_t tdb_allocate_from_freelist(
 
 	/* we didn't find enough space. See if we can expand the
 	   database and if we can then try again */
-	if (tdb_expand(tdb, length + sizeof(*rec)) == 0)
+	if (tdb_expand(tdb, length + TDB_REC_SIZE(tdb)) == 0)
 		goto again;
 
 	return 0;
@@ -675,6 +843,7 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 	tdb_off_t cur, next;
 	int count = 0;
 	int merged = 0;
+	unsigned list;
 	int ret;
 
 	ret = tdb_lock(tdb, -1, F_RDLCK);
@@ -682,32 +851,36 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 		return -1;
 	}
 
-	cur = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
-		tdb_off_t next2;
+	for (list = 0; list < TDB_NUM_FREELISTS(tdb); list++) {
+		cur = TDB_FREELIST_TOP(tdb, list);
+		while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
+			tdb_off_t next2;
 
-		count++;
-
-		ret = check_merge_ptr_with_left_record(tdb, next, &next2);
-		if (ret == -1) {
-			goto done;
-		}
-		if (ret == 1) {
-			/*
-			 * merged:
-			 * now let cur->next point to next2 instead of next
-			 */
+			count++;
 
-			ret = tdb_ofs_write(tdb, cur, &next2);
-			if (ret != 0) {
+			ret = check_merge_ptr_with_left_record(tdb, next,
+							       &next2);
+			if (ret == -1) {
 				goto done;
 			}
+			if (ret == 1) {
+				/*
+				 * merged:
+				 * now let cur->next point to next2
+				 * instead of next
+				 */
+
+				ret = tdb_ofs_write(tdb, cur, &next2);
+				if (ret != 0) {
+					goto done;
+				}
+
+				next = next2;
+				merged++;
+			}
 
-			next = next2;
-			merged++;
+			cur = next;
 		}
-
-		cur = next;
 	}
 
 	if (count_records != NULL) {
@@ -732,14 +905,17 @@ static int tdb_freelist_size_no_merge(struct tdb_context *tdb)
 {
 	tdb_off_t ptr;
 	int count=0;
+	unsigned list;
 
 	if (tdb_lock(tdb, -1, F_RDLCK) == -1) {
 		return -1;
 	}
 
-	ptr = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
-		count++;
+	for (list = 0; list < TDB_NUM_FREELISTS(tdb); list++) {
+		ptr = TDB_FREELIST_TOP(tdb, list);
+		while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
+			count++;
+		}
 	}
 
 	tdb_unlock(tdb, -1, F_RDLCK);
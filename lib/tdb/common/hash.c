@@ -343,3 +343,91 @@ _PUBLIC_ unsigned int tdb_jenkins_hash(TDB_DATA *key)
 {
 	return hashlittle(key->dptr, key->dsize);
 }
+
+/*
+ * A 32 bit hash in the xxHash32 construction, by Yann Collet. Keys of
+ * 16 bytes and more are consumed in four independent lanes of 4 bytes,
+ * which compilers turn into parallel (or vector) multiplies, instead
+ * of the long dependency chain of mix() above.
+ *
+ * The input is always read as little-endian words, so the hash (and
+ * with it the file format) is the same on all platforms.
+ */
+#define FAST_PRIME1 0x9E3779B1U
+#define FAST_PRIME2 0x85EBCA77U
+#define FAST_PRIME3 0xC2B2AE3DU
+#define FAST_PRIME4 0x27D4EB2FU
+#define FAST_PRIME5 0x165667B1U
+
+static inline uint32_t fast_read32(const uint8_t *p)
+{
+#if HASH_LITTLE_ENDIAN
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+#else
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+#endif
+}
+
+static inline uint32_t fast_round(uint32_t acc, uint32_t input)
+{
+	acc += input * FAST_PRIME2;
+	acc = rot(acc, 13);
+	return acc * FAST_PRIME1;
+}
+
+static uint32_t fast_hash(const uint8_t *p, size_t length)
+{
+	const uint8_t *end = p + length;
+	uint32_t h;
+
+	if (length >= 16) {
+		const uint8_t *limit = end - 16;
+		uint32_t v1 = FAST_PRIME1 + FAST_PRIME2;
+		uint32_t v2 = FAST_PRIME2;
+		uint32_t v3 = 0;
+		uint32_t v4 = -FAST_PRIME1;
+
+		do {
+			v1 = fast_round(v1, fast_read32(p));
+			v2 = fast_round(v2, fast_read32(p + 4));
+			v3 = fast_round(v3, fast_read32(p + 8));
+			v4 = fast_round(v4, fast_read32(p + 12));
+			p += 16;
+		} while (p <= limit);
+
+		h = rot(v1, 1) + rot(v2, 7) + rot(v3, 12) + rot(v4, 18);
+	} else {
+		h = FAST_PRIME5;
+	}
+
+	h += (uint32_t)length;
+
+	while (p + 4 <= end) {
+		h += fast_read32(p) * FAST_PRIME3;
+		h = rot(h, 17) * FAST_PRIME4;
+		p += 4;
+	}
+
+	while (p < end) {
+		h += (*p) * FAST_PRIME5;
+		h = rot(h, 11) * FAST_PRIME1;
+		p++;
+	}
+
+	h ^= h >> 15;
+	h *= FAST_PRIME2;
+	h ^= h >> 13;
+	h *= FAST_PRIME3;
+	h ^= h >> 16;
+
+	return h;
+}
+
+_PUBLIC_ unsigned int tdb_fast_hash(TDB_DATA *key)
+{
+	return fast_hash(key->dptr, key->dsize);
+}
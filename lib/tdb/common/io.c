@@ -29,11 +29,13 @@
 #include "tdb_private.h"
 
 /*
- * We prepend the mutex area, so fixup offsets. See mutex.c for details.
- * tdb->hdr_ofs is 0 or header.mutex_size.
+ * We prepend the mutex and seqlock areas, so fixup offsets. See mutex.c
+ * and seqlock.c for details.
+ * tdb->hdr_ofs is header.mutex_size + header.seqlock_size, or 0.
  *
- * Note: that we only have the 4GB limit of tdb_off_t for
+ * Note: that we only have the 4GB limit of the offsets for
  * tdb->map_size. The file size on disk can be 4GB + tdb->hdr_ofs!
+ * With TDB_FEATURE_FLAG_LARGE_OFFSETS the limit is TDB_MAX_OFFSET().
  */
 
 static bool tdb_adjust_offset(struct tdb_context *tdb, off_t *off)
@@ -144,8 +146,8 @@ static int tdb_oob(struct tdb_context *tdb, tdb_off_t off, tdb_len_t len,
 		if (!probe) {
 			/* Ensure ecode is set for log fn. */
 			tdb->ecode = TDB_ERR_IO;
-			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_oob off %u len %u wrap\n",
-				 off, len));
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_oob off %ju len %u wrap\n",
+				 (uintmax_t)off, len));
 		}
 		return -1;
 	}
@@ -156,8 +158,9 @@ static int tdb_oob(struct tdb_context *tdb, tdb_off_t off, tdb_len_t len,
 		if (!probe) {
 			/* Ensure ecode is set for log fn. */
 			tdb->ecode = TDB_ERR_IO;
-			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_oob len %u beyond internal malloc size %u\n",
-				 (int)(off + len), (int)tdb->map_size));
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_oob len %ju beyond internal malloc size %ju\n",
+				 (uintmax_t)(off + len),
+				 (uintmax_t)tdb->map_size));
 		}
 		return -1;
 	}
@@ -168,7 +171,9 @@ static int tdb_oob(struct tdb_context *tdb, tdb_off_t off, tdb_len_t len,
 	}
 
 	/* Beware >4G files! */
-	if ((tdb_off_t)st.st_size != st.st_size) {
+	if ((tdb_off_t)st.st_size != st.st_size ||
+	    (size_t)st.st_size != st.st_size ||
+	    (tdb_off_t)st.st_size > TDB_MAX_OFFSET(tdb)) {
 		/* Ensure ecode is set for log fn. */
 		tdb->ecode = TDB_ERR_IO;
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_oob len %llu too large!\n",
@@ -191,12 +196,13 @@ static int tdb_oob(struct tdb_context *tdb, tdb_off_t off, tdb_len_t len,
 		return -1;
 	}
 
-	if (st.st_size < (size_t)off + len) {
+	if ((tdb_off_t)st.st_size < off + len) {
 		if (!probe) {
 			/* Ensure ecode is set for log fn. */
 			tdb->ecode = TDB_ERR_IO;
-			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_oob len %u beyond eof at %u\n",
-				 (int)(off + len), (int)st.st_size));
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_oob len %ju beyond eof at %ju\n",
+				 (uintmax_t)(off + len),
+				 (uintmax_t)st.st_size));
 		}
 		return -1;
 	}
@@ -234,22 +240,23 @@ static int tdb_write(struct tdb_context *tdb, tdb_off_t off,
 			/* try once more */
 			tdb->ecode = TDB_ERR_IO;
 			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_write: wrote only "
-				 "%zi of %u bytes at %u, trying once more\n",
-				 written, len, off));
+				 "%zi of %u bytes at %ju, trying once more\n",
+				 written, len, (uintmax_t)off));
 			written = tdb_pwrite(tdb, (const char *)buf+written,
 					     len-written, off+written);
 		}
 		if (written == -1) {
 			/* Ensure ecode is set for log fn. */
 			tdb->ecode = TDB_ERR_IO;
-			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_write failed at %u "
-				 "len=%u (%s)\n", off, len, strerror(errno)));
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_write failed at %ju "
+				 "len=%u (%s)\n", (uintmax_t)off, len,
+				 strerror(errno)));
 			return -1;
 		} else if (written != (ssize_t)len) {
 			tdb->ecode = TDB_ERR_IO;
 			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_write: failed to "
-				 "write %u bytes at %u in two attempts\n",
-				 len, off));
+				 "write %u bytes at %ju in two attempts\n",
+				 len, (uintmax_t)off));
 			return -1;
 		}
 #endif
@@ -288,10 +295,10 @@ static int tdb_read(struct tdb_context *tdb, tdb_off_t off, void *buf,
 		if (ret != (ssize_t)len) {
 			/* Ensure ecode is set for log fn. */
 			tdb->ecode = TDB_ERR_IO;
-			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_read failed at %u "
-				 "len=%u ret=%zi (%s) map_size=%u\n",
-				 off, len, ret, strerror(errno),
-				 tdb->map_size));
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_read failed at %ju "
+				 "len=%u ret=%zi (%s) map_size=%ju\n",
+				 (uintmax_t)off, len, ret, strerror(errno),
+				 (uintmax_t)tdb->map_size));
 			return -1;
 		}
 #endif
@@ -312,15 +319,19 @@ static void tdb_next_hash_chain(struct tdb_context *tdb, uint32_t *chain)
 {
 	uint32_t h = *chain;
 	if (tdb->map_ptr) {
-		for (;h < tdb->hash_size;h++) {
-			if (0 != *(uint32_t *)(TDB_HASH_TOP(h) + (unsigned char *)tdb->map_ptr)) {
+		size_t ofs_size = TDB_OFS_SIZE(tdb);
+		for (;h < tdb->hash_chains;h++) {
+			const unsigned char *p = TDB_HASH_TOP(tdb, h) +
+				(unsigned char *)tdb->map_ptr;
+			if ((0 != *(const uint32_t *)p) ||
+			    (ofs_size > 4 && 0 != *(const uint32_t *)(p + 4))) {
 				break;
 			}
 		}
 	} else {
-		uint32_t off=0;
-		for (;h < tdb->hash_size;h++) {
-			if (tdb_ofs_read(tdb, TDB_HASH_TOP(h), &off) != 0 || off != 0) {
+		tdb_off_t off=0;
+		for (;h < tdb->hash_chains;h++) {
+			if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, h), &off) != 0 || off != 0) {
 				break;
 			}
 		}
@@ -375,8 +386,8 @@ int tdb_mmap(struct tdb_context *tdb)
 
 		if (tdb->map_ptr == MAP_FAILED) {
 			tdb->map_ptr = NULL;
-			TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_mmap failed for size %u (%s)\n",
-				 tdb->map_size, strerror(errno)));
+			TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_mmap failed for size %ju (%s)\n",
+				 (uintmax_t)tdb->map_size, strerror(errno)));
 #ifdef HAVE_INCOHERENT_MMAP
 			tdb->ecode = TDB_ERR_IO;
 			return -1;
@@ -407,8 +418,8 @@ static int tdb_expand_file(struct tdb_context *tdb, tdb_off_t size, tdb_off_t ad
 	if (!tdb_add_off_t(size, addition, &new_size)) {
 		tdb->ecode = TDB_ERR_OOM;
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "expand_file write "
-			"overflow detected current size[%u] addition[%u]!\n",
-			(unsigned)size, (unsigned)addition));
+			"overflow detected current size[%ju] addition[%ju]!\n",
+			(uintmax_t)size, (uintmax_t)addition));
 		errno = ENOSPC;
 		return -1;
 	}
@@ -455,8 +466,8 @@ static int tdb_expand_file(struct tdb_context *tdb, tdb_off_t size, tdb_off_t ad
 		}
 		if (written != 1) {
 			tdb->ecode = TDB_ERR_OOM;
-			TDB_LOG((tdb, TDB_DEBUG_FATAL, "expand_file to %u failed (%s)\n",
-				 (unsigned)new_size, strerror(errno)));
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "expand_file to %ju failed (%s)\n",
+				 (uintmax_t)new_size, strerror(errno)));
 			return -1;
 		}
 	}
@@ -521,11 +532,27 @@ fail:
 }
 
 
-/* You need 'size', this tells you how much you should expand by. */
-tdb_off_t tdb_expand_adjust(tdb_off_t map_size, tdb_off_t size, int page_size)
+/*
+ * You need 'size', this tells you how much you should expand by.
+ * 'max_map_size' is the largest map_size the file format can address.
+ */
+tdb_off_t tdb_expand_adjust(tdb_off_t map_size, tdb_off_t size,
+			    tdb_off_t max_map_size, int page_size)
 {
 	tdb_off_t new_size, top_size, increment;
-	tdb_off_t max_size = UINT32_MAX - map_size;
+	tdb_off_t max_size = max_map_size - map_size;
+
+	if (map_size > max_map_size) {
+		return size;
+	}
+
+	if (max_size > UINT32_MAX) {
+		/*
+		 * The new space becomes a single free record, its
+		 * rec_len is a 32 bit value.
+		 */
+		max_size = UINT32_MAX & ~((tdb_off_t)page_size - 1);
+	}
 
 	if (size > max_size) {
 		/*
@@ -572,12 +599,16 @@ tdb_off_t tdb_expand_adjust(tdb_off_t map_size, tdb_off_t size, int page_size)
 		goto overflow;
 	}
 
-	return TDB_ALIGN(new_size, page_size) - map_size;
+	new_size = TDB_ALIGN(new_size, page_size) - map_size;
+	if (new_size > max_size) {
+		goto overflow;
+	}
+	return new_size;
 
 overflow:
 	/*
-	 * Somewhere in between we went over 4GB. Make one big jump to
-	 * exactly 4GB database size.
+	 * Somewhere in between we went over the limit. Make one big
+	 * jump to exactly the maximum database size.
 	 */
 	return max_size;
 }
@@ -606,20 +637,23 @@ int tdb_expand(struct tdb_context *tdb, tdb_off_t size)
 	 *
 	 * The file on disk can be up to 4GB + tdb->hdr_ofs
 	 */
-	size = tdb_expand_adjust(tdb->map_size, size, tdb->page_size);
+	size = tdb_expand_adjust(tdb->map_size, size, TDB_MAX_OFFSET(tdb),
+				 tdb->page_size);
 
-	if (!tdb_add_off_t(tdb->map_size, size, &new_size)) {
+	if (!tdb_add_off_t(tdb->map_size, size, &new_size) ||
+	    new_size > TDB_MAX_OFFSET(tdb) ||
+	    size > UINT32_MAX) {
 		tdb->ecode = TDB_ERR_OOM;
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_expand "
-			"overflow detected current map_size[%u] size[%u]!\n",
-			(unsigned)tdb->map_size, (unsigned)size));
+			"overflow detected current map_size[%ju] size[%ju]!\n",
+			(uintmax_t)tdb->map_size, (uintmax_t)size));
 		goto fail;
 	}
 
 	/* form a new freelist record */
 	offset = tdb->map_size;
 	memset(&rec,'\0',sizeof(rec));
-	rec.rec_len = size - sizeof(rec);
+	rec.rec_len = size - TDB_REC_SIZE(tdb);
 
 	if (tdb->flags & TDB_INTERNAL) {
 		char *new_map_ptr;
@@ -662,16 +696,129 @@ int tdb_expand(struct tdb_context *tdb, tdb_off_t size)
 	return -1;
 }
 
+/*
+ * On disk an offset is one 32 bit word, or two words (low word
+ * first) with TDB_FEATURE_FLAG_LARGE_OFFSETS. Each word is stored in
+ * file byte order, so tdb_convert() works on both layouts. The
+ * pack/unpack helpers work on buffers in host byte order.
+ */
+void tdb_ofs_pack(struct tdb_context *tdb, tdb_off_t off, void *buf)
+{
+	uint32_t *p = (uint32_t *)buf;
+
+	p[0] = (uint32_t)off;
+	if (TDB_LARGE_OFFSETS_P(tdb)) {
+		p[1] = (uint32_t)(off >> 32);
+	}
+}
+
+tdb_off_t tdb_ofs_unpack(struct tdb_context *tdb, const void *buf)
+{
+	const uint32_t *p = (const uint32_t *)buf;
+	tdb_off_t off = p[0];
+
+	if (TDB_LARGE_OFFSETS_P(tdb)) {
+		off |= (tdb_off_t)p[1] << 32;
+	}
+	return off;
+}
+
 /* read/write a tdb_off_t */
 int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d)
 {
-	return tdb->methods->tdb_read(tdb, offset, (char*)d, sizeof(*d), DOCONV());
+	uint32_t buf[2];
+
+	if (tdb->methods->tdb_read(tdb, offset, buf, TDB_OFS_SIZE(tdb),
+				   DOCONV()) == -1) {
+		return -1;
+	}
+	*d = tdb_ofs_unpack(tdb, buf);
+	return 0;
 }
 
 int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d)
 {
-	tdb_off_t off = *d;
-	return tdb->methods->tdb_write(tdb, offset, CONVERT(off), sizeof(*d));
+	uint32_t buf[2] = { 0, 0 };
+
+	tdb_ofs_pack(tdb, *d, buf);
+	if (DOCONV()) {
+		tdb_convert(buf, sizeof(buf));
+	}
+	return tdb->methods->tdb_write(tdb, offset, buf, TDB_OFS_SIZE(tdb));
+}
+
+/*
+  find the hash chain heads. tdb_rehash() in another process may
+  have moved them, it holds the allrecord lock while doing so. So
+  this is called whenever we take the first chain or allrecord
+  lock, the layout can't change while we hold any of them.
+*/
+int tdb_hash_table_refresh(struct tdb_context *tdb)
+{
+	/* Only read rwlocks up to hash_table of the header */
+	struct tdb_header hdr;
+	size_t start = offsetof(struct tdb_header, rwlocks);
+	size_t end = offsetof(struct tdb_header, reserved);
+	uint32_t hash_chains;
+	tdb_off_t hash_table;
+	bool moved;
+
+	if (tdb->methods->tdb_read(tdb, start, (char *)&hdr + start,
+				   end - start, DOCONV()) == -1) {
+		return -1;
+	}
+
+	moved = (hdr.rwlocks == TDB_FEATURE_FLAG_MAGIC) &&
+		(hdr.feature_flags & TDB_FEATURE_FLAG_HASH_TABLE);
+	if (moved) {
+		hash_chains = hdr.hash_chains;
+		hash_table = hdr.hash_table[0] |
+			((tdb_off_t)hdr.hash_table[1] << 32);
+	} else {
+		hash_chains = tdb->hash_size;
+		hash_table = FREELIST_TOP + TDB_OFS_SIZE(tdb);
+	}
+
+	if (hash_chains == tdb->hash_chains &&
+	    hash_table == tdb->hash_table) {
+		return 0;
+	}
+
+	if (hash_chains == 0 || hash_chains % tdb->hash_size != 0 ||
+	    hash_chains > UINT32_MAX / TDB_OFS_SIZE(tdb) ||
+	    hash_table < FREELIST_TOP + TDB_OFS_SIZE(tdb)) {
+		tdb->ecode = TDB_ERR_CORRUPT;
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_hash_table_refresh: "
+			 "invalid hash table %u at %ju\n",
+			 hash_chains, (uintmax_t)hash_table));
+		return -1;
+	}
+
+	/* This also maps the new table if another process expanded */
+	if (tdb->methods->tdb_oob(tdb, hash_table,
+				  hash_chains * TDB_OFS_SIZE(tdb), 0) != 0) {
+		return -1;
+	}
+
+	tdb->feature_flags &= ~TDB_FEATURE_FLAG_HASH_TABLE;
+	if (moved) {
+		tdb->feature_flags |= TDB_FEATURE_FLAG_HASH_TABLE;
+	}
+	tdb->hash_chains = hash_chains;
+	tdb->hash_table = hash_table;
+	return 0;
+}
+
+/* read/write a 32 bit value like a record tailer or the seqnum */
+int tdb_u32_read(struct tdb_context *tdb, tdb_off_t offset, uint32_t *d)
+{
+	return tdb->methods->tdb_read(tdb, offset, (char*)d, sizeof(*d), DOCONV());
+}
+
+int tdb_u32_write(struct tdb_context *tdb, tdb_off_t offset, uint32_t *d)
+{
+	uint32_t v = *d;
+	return tdb->methods->tdb_write(tdb, offset, CONVERT(v), sizeof(*d));
 }
 
 
@@ -730,24 +877,75 @@ int tdb_parse_data(struct tdb_context *tdb, TDB_DATA key,
 	return result;
 }
 
+/*
+ * Convert between struct tdb_record and the on-disk record header of
+ * TDB_REC_SIZE(tdb) bytes, both in host byte order.
+ */
+void tdb_rec_unpack(struct tdb_context *tdb, const void *buf,
+		    struct tdb_record *rec)
+{
+	const uint32_t *p = (const uint32_t *)buf;
+
+	rec->next = tdb_ofs_unpack(tdb, p);
+	p += TDB_OFS_SIZE(tdb) / sizeof(uint32_t);
+	rec->rec_len = p[0];
+	rec->key_len = p[1];
+	rec->data_len = p[2];
+	rec->full_hash = p[3];
+	rec->magic = p[4];
+}
+
+void tdb_rec_pack(struct tdb_context *tdb, const struct tdb_record *rec,
+		  void *buf)
+{
+	uint32_t *p = (uint32_t *)buf;
+
+	tdb_ofs_pack(tdb, rec->next, p);
+	p += TDB_OFS_SIZE(tdb) / sizeof(uint32_t);
+	p[0] = rec->rec_len;
+	p[1] = rec->key_len;
+	p[2] = rec->data_len;
+	p[3] = rec->full_hash;
+	p[4] = rec->magic;
+}
+
+/* read a record header without any sanity checks */
+int tdb_rec_read_raw(struct tdb_context *tdb, tdb_off_t offset,
+		     struct tdb_record *rec)
+{
+	uint32_t buf[7];
+
+	if (tdb->methods->tdb_read(tdb, offset, buf, TDB_REC_SIZE(tdb),
+				   DOCONV()) == -1) {
+		return -1;
+	}
+	tdb_rec_unpack(tdb, buf, rec);
+	return 0;
+}
+
 /* read/write a record */
 int tdb_rec_read(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 {
-	if (tdb->methods->tdb_read(tdb, offset, rec, sizeof(*rec),DOCONV()) == -1)
+	if (tdb_rec_read_raw(tdb, offset, rec) == -1)
 		return -1;
 	if (TDB_BAD_MAGIC(rec)) {
 		/* Ensure ecode is set for log fn. */
 		tdb->ecode = TDB_ERR_CORRUPT;
-		TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_rec_read bad magic 0x%x at offset=%u\n", rec->magic, offset));
+		TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_rec_read bad magic 0x%x at offset=%ju\n", rec->magic, (uintmax_t)offset));
 		return -1;
 	}
-	return tdb->methods->tdb_oob(tdb, rec->next, sizeof(*rec), 0);
+	return tdb->methods->tdb_oob(tdb, rec->next, TDB_REC_SIZE(tdb), 0);
 }
 
 int tdb_rec_write(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 {
-	struct tdb_record r = *rec;
-	return tdb->methods->tdb_write(tdb, offset, CONVERT(r), sizeof(r));
+	uint32_t buf[7];
+
+	tdb_rec_pack(tdb, rec, buf);
+	if (DOCONV()) {
+		tdb_convert(buf, TDB_REC_SIZE(tdb));
+	}
+	return tdb->methods->tdb_write(tdb, offset, buf, TDB_REC_SIZE(tdb));
 }
 
 static const struct tdb_methods io_methods = {
@@ -213,8 +213,8 @@ int tdb_brlock(struct tdb_context *tdb,
 		 * EAGAIN is an expected return from non-blocking
 		 * locks. */
 		if (!(flags & TDB_LOCK_PROBE) && errno != EAGAIN) {
-			TDB_LOG((tdb, TDB_DEBUG_TRACE,"tdb_brlock failed (fd=%d) at offset %u rw_type=%d flags=%d len=%zu\n",
-				 tdb->fd, offset, rw_type, flags, len));
+			TDB_LOG((tdb, TDB_DEBUG_TRACE,"tdb_brlock failed (fd=%d) at offset %ju rw_type=%d flags=%d len=%zu\n",
+				 tdb->fd, (uintmax_t)offset, rw_type, flags, len));
 		}
 		return -1;
 	}
@@ -235,8 +235,8 @@ int tdb_brunlock(struct tdb_context *tdb,
 	} while (ret == -1 && errno == EINTR);
 
 	if (ret == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_TRACE,"tdb_brunlock failed (fd=%d) at offset %u rw_type=%u len=%zu\n",
-			 tdb->fd, offset, rw_type, len));
+		TDB_LOG((tdb, TDB_DEBUG_TRACE,"tdb_brunlock failed (fd=%d) at offset %ju rw_type=%u len=%zu\n",
+			 tdb->fd, (uintmax_t)offset, rw_type, len));
 	}
 	return ret;
 }
@@ -312,6 +312,7 @@ int tdb_allrecord_upgrade(struct tdb_context *tdb)
 	if (ret == 0) {
 		tdb->allrecord_lock.ltype = F_WRLCK;
 		tdb->allrecord_lock.off = 0;
+		tdb_seqlock_allrecord_begin(tdb);
 		return 0;
 	}
 fail:
@@ -364,6 +365,7 @@ int tdb_nest_lock(struct tdb_context *tdb, uint32_t offset, int ltype,
 				}
 			}
 			new_lck->ltype = F_WRLCK;
+			tdb_seqlock_chain_begin(tdb, offset);
 		}
 		/*
 		 * Just increment the in-memory struct, posix locks
@@ -398,6 +400,10 @@ int tdb_nest_lock(struct tdb_context *tdb, uint32_t offset, int ltype,
 	new_lck->ltype = ltype;
 	tdb->num_lockrecs++;
 
+	if (ltype == F_WRLCK) {
+		tdb_seqlock_chain_begin(tdb, offset);
+	}
+
 	return 0;
 }
 
@@ -489,6 +495,15 @@ static int tdb_lock_list(struct tdb_context *tdb, int list, int ltype,
 		}
 		return tdb_lock_list(tdb, list, ltype, waitflag);
 	}
+
+	/* Someone might have done a tdb_rehash() meanwhile. */
+	if (ret == 0 && check && tdb_hash_table_refresh(tdb) == -1) {
+		tdb_nest_unlock(tdb, lock_offset(list), ltype, false);
+		return -1;
+	}
+	if (ret == 0 && check) {
+		tdb_seqlock_refreshed(tdb);
+	}
 	return ret;
 }
 
@@ -545,6 +560,11 @@ int tdb_nest_unlock(struct tdb_context *tdb, uint32_t offset, int ltype,
 	 * anyway.
 	 */
 
+	/* Readers must not see an even counter while we still write. */
+	if (lck->ltype == F_WRLCK) {
+		tdb_seqlock_chain_end(tdb, offset);
+	}
+
 	if (mark_lock) {
 		ret = 0;
 	} else {
@@ -716,6 +736,10 @@ int tdb_allrecord_lock(struct tdb_context *tdb, int ltype,
 	tdb->allrecord_lock.ltype = upgradable ? F_WRLCK : ltype;
 	tdb->allrecord_lock.off = upgradable;
 
+	if (ltype == F_WRLCK) {
+		tdb_seqlock_allrecord_begin(tdb);
+	}
+
 	if (tdb_needs_recovery(tdb)) {
 		bool mark = flags & TDB_LOCK_MARK_ONLY;
 		tdb_allrecord_unlock(tdb, ltype, mark);
@@ -731,6 +755,11 @@ int tdb_allrecord_lock(struct tdb_context *tdb, int ltype,
 		return tdb_allrecord_lock(tdb, ltype, flags, upgradable);
 	}
 
+	if (tdb_hash_table_refresh(tdb) == -1) {
+		tdb_allrecord_unlock(tdb, ltype, flags & TDB_LOCK_MARK_ONLY);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -762,6 +791,12 @@ int tdb_allrecord_unlock(struct tdb_context *tdb, int ltype, bool mark_lock)
 		return 0;
 	}
 
+	/* An upgradable lock (.off == 1) is a read lock until upgraded */
+	if (tdb->allrecord_lock.ltype == F_WRLCK &&
+	    tdb->allrecord_lock.off == 0) {
+		tdb_seqlock_allrecord_end(tdb);
+	}
+
 	if (!mark_lock) {
 		int ret;
 
@@ -1005,6 +1040,9 @@ void tdb_release_transaction_locks(struct tdb_context *tdb)
 		if (lck->off == ACTIVE_LOCK) {
 			tdb->lockrecs[active++] = *lck;
 		} else {
+			if (lck->ltype == F_WRLCK) {
+				tdb_seqlock_chain_end(tdb, lck->off);
+			}
 			tdb_brunlock(tdb, lck->ltype, lck->off, 1);
 		}
 	}
@@ -106,8 +106,11 @@ static bool tdb_mutex_index(struct tdb_context *tdb, off_t off, off_t len,
 	 * to be locked. See lock_offset() where the freelist is -1 vs the
 	 * "+1" in TDB_HASH_TOP(). Because the mutex array is represented in
 	 * the tdb file itself as data, we need to adjust the offset here.
+	 *
+	 * The lock offsets don't depend on the size of the hash chain
+	 * heads, lock_offset() always uses a stride of 4 bytes.
 	 */
-	const off_t freelist_lock_ofs = FREELIST_TOP - sizeof(tdb_off_t);
+	const off_t freelist_lock_ofs = FREELIST_TOP - 4;
 
 	if (!tdb_have_mutexes(tdb)) {
 		return false;
@@ -124,7 +127,7 @@ static bool tdb_mutex_index(struct tdb_context *tdb, off_t off, off_t len,
 		/* tdb not initialized yet, called from tdb_open_ex() */
 		return false;
 	}
-	if (off >= TDB_DATA_START(tdb->hash_size)) {
+	if (off >= TDB_DATA_START(tdb, tdb->hash_size)) {
 		/* Single record lock from traverses */
 		return false;
 	}
@@ -133,7 +136,7 @@ static bool tdb_mutex_index(struct tdb_context *tdb, off_t off, off_t len,
 	 * Now we know it's a freelist or hash chain lock. Those are always 4
 	 * byte aligned. Paranoia check.
 	 */
-	if ((off % sizeof(tdb_off_t)) != 0) {
+	if ((off % 4) != 0) {
 		abort();
 	}
 
@@ -141,7 +144,7 @@ static bool tdb_mutex_index(struct tdb_context *tdb, off_t off, off_t len,
 	 * Re-index the fcntl offset into an offset into the mutex array
 	 */
 	off -= freelist_lock_ofs; /* rebase to index 0 */
-	off /= sizeof(tdb_off_t); /* 0 for freelist 1-n for hashchain */
+	off /= 4; /* 0 for freelist 1-n for hashchain */
 
 	*idx = off;
 	return true;
@@ -58,7 +58,11 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 	size_t size;
 	int ret = -1;
 
-	/* We make it up in memory, then write it out if not internal */
+	/*
+	 * We make it up in memory, then write it out if not internal.
+	 * This is big enough for 64 bit offsets, the real size is
+	 * calculated once we know the feature flags.
+	 */
 	size = sizeof(struct tdb_header) + (hash_size+1)*sizeof(tdb_off_t);
 	if (!(newdb = (struct tdb_header *)calloc(size, 1))) {
 		tdb->ecode = TDB_ERR_OOM;
@@ -85,6 +89,23 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 		newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX;
 	}
 
+	if (tdb->flags & TDB_LARGE_OFFSETS) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_LARGE_OFFSETS;
+	}
+
+	if (tdb->flags & TDB_FREELIST_CLASSES) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_FREELIST_CLASSES;
+	}
+
+	if (tdb->flags & TDB_RECOVERY_CHECKSUM) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_RECOVERY_CSUM;
+	}
+
+	/* Silently ignored if we don't have the seqlock code */
+	if (tdb->flags & TDB_SEQLOCK) {
+		newdb->feature_flags |= TDB_SUPPORTED_SEQLOCK;
+	}
+
 	/*
 	 * If we have any features we add the FEATURE_FLAG_MAGIC, overwriting the
 	 * TDB_HASH_RWLOCK_MAGIC above.
@@ -101,6 +122,10 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 	 */
 	tdb->feature_flags = newdb->feature_flags;
 	tdb->hash_size = newdb->hash_size;
+	tdb->hash_chains = newdb->hash_size;
+	tdb->hash_table = FREELIST_TOP + TDB_OFS_SIZE(tdb);
+
+	size = FREELIST_TOP + TDB_HASHTABLE_SIZE(tdb);
 
 	if (tdb->flags & TDB_INTERNAL) {
 		tdb->map_size = size;
@@ -116,9 +141,16 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 	if (ftruncate(tdb->fd, 0) == -1)
 		goto fail;
 
+	tdb->hdr_ofs = 0;
+
 	if (newdb->feature_flags & TDB_FEATURE_FLAG_MUTEX) {
 		newdb->mutex_size = tdb_mutex_size(tdb);
-		tdb->hdr_ofs = newdb->mutex_size;
+		tdb->hdr_ofs += newdb->mutex_size;
+	}
+
+	if (newdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) {
+		newdb->seqlock_size = tdb_seqlock_size(tdb);
+		tdb->hdr_ofs += newdb->seqlock_size;
 	}
 
 	/* This creates an endian-converted header, as if read from disk */
@@ -130,29 +162,31 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 	if (!tdb_write_all(tdb->fd, newdb, size))
 		goto fail;
 
-	if (newdb->feature_flags & TDB_FEATURE_FLAG_MUTEX) {
+	if (tdb->hdr_ofs != 0) {
 
 		/*
-		 * Now we init the mutex area
-		 * followed by a second header.
+		 * Now we init the mutex area, the seqlock counters
+		 * start as zero, followed by a second header.
 		 */
 
 		ret = ftruncate(
 			tdb->fd,
-			newdb->mutex_size + sizeof(struct tdb_header));
+			tdb->hdr_ofs + sizeof(struct tdb_header));
 		if (ret == -1) {
 			goto fail;
 		}
-		ret = tdb_mutex_init(tdb);
-		if (ret == -1) {
-			goto fail;
+		if (tdb_have_mutexes(tdb)) {
+			ret = tdb_mutex_init(tdb);
+			if (ret == -1) {
+				goto fail;
+			}
 		}
 
 		/*
-		 * Write a second header behind the mutexes. That's the area
-		 * that will be mmapp'ed.
+		 * Write a second header behind the mutexes and
+		 * counters. That's the area that will be mmapp'ed.
 		 */
-		ret = lseek(tdb->fd, newdb->mutex_size, SEEK_SET);
+		ret = lseek(tdb->fd, tdb->hdr_ofs, SEEK_SET);
 		if (ret == -1) {
 			goto fail;
 		}
@@ -209,6 +243,12 @@ static bool check_header_hash(struct tdb_context *tdb,
 			      struct tdb_header *header,
 			      bool default_hash, uint32_t *m1, uint32_t *m2)
 {
+	const tdb_hash_func hashes[] = {
+		tdb_old_hash, tdb_jenkins_hash, tdb_fast_hash
+	};
+	tdb_hash_func hash_fn = tdb->hash_fn;
+	size_t i;
+
 	tdb_header_hash(tdb, m1, m2);
 	if (header->magic1_hash == *m1 &&
 	    header->magic2_hash == *m2) {
@@ -219,12 +259,17 @@ static bool check_header_hash(struct tdb_context *tdb,
 	if (!default_hash)
 		return false;
 
-	/* Otherwise, try the other inbuilt hash. */
-	if (tdb->hash_fn == tdb_old_hash)
-		tdb->hash_fn = tdb_jenkins_hash;
-	else
-		tdb->hash_fn = tdb_old_hash;
-	return check_header_hash(tdb, header, false, m1, m2);
+	/* Otherwise, try the other inbuilt hashes. */
+	for (i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++) {
+		if (hashes[i] == hash_fn) {
+			continue;
+		}
+		tdb->hash_fn = hashes[i];
+		if (check_header_hash(tdb, header, false, m1, m2)) {
+			return true;
+		}
+	}
+	return false;
 }
 
 static bool tdb_mutex_open_ok(struct tdb_context *tdb,
@@ -319,11 +364,15 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 	tdb_io_init(tdb);
 
 	if (tdb_flags & TDB_INTERNAL) {
-		tdb_flags |= TDB_INCOMPATIBLE_HASH;
+		/* Nothing else has to read it, use the best hash */
+		tdb_flags |= TDB_INCOMPATIBLE_HASH|TDB_FAST_HASH;
 	}
 	if (tdb_flags & TDB_MUTEX_LOCKING) {
 		tdb_flags |= TDB_INCOMPATIBLE_HASH;
 	}
+	if (tdb_flags & TDB_FAST_HASH) {
+		tdb_flags |= TDB_INCOMPATIBLE_HASH;
+	}
 
 	tdb->fd = -1;
 #ifdef TDB_TRACE
@@ -371,7 +420,9 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		hash_alg = "the user defined";
 	} else {
 		/* This controls what we use when creating a tdb. */
-		if (tdb->flags & TDB_INCOMPATIBLE_HASH) {
+		if (tdb->flags & TDB_FAST_HASH) {
+			tdb->hash_fn = tdb_fast_hash;
+		} else if (tdb->flags & TDB_INCOMPATIBLE_HASH) {
 			tdb->hash_fn = tdb_jenkins_hash;
 		} else {
 			tdb->hash_fn = tdb_old_hash;
@@ -485,7 +536,7 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 	/* internal databases don't mmap or lock, and start off cleared */
 	if (tdb->flags & TDB_INTERNAL) {
 		tdb->flags |= (TDB_NOLOCK | TDB_NOMMAP);
-		tdb->flags &= ~TDB_CLEAR_IF_FIRST;
+		tdb->flags &= ~(TDB_CLEAR_IF_FIRST|TDB_SEQLOCK);
 		if (tdb_new_database(tdb, &header, hash_size) != 0) {
 			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: tdb_new_database failed!"));
 			goto fail;
@@ -621,6 +672,32 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		goto fail;
 	}
 
+	/*
+	 * The on-disk format decides about the offset size,
+	 * tdb_get_flags() reports what we actually use.
+	 */
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_LARGE_OFFSETS) {
+		tdb->flags |= TDB_LARGE_OFFSETS;
+	} else {
+		tdb->flags &= ~TDB_LARGE_OFFSETS;
+	}
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_FREELIST_CLASSES) {
+		tdb->flags |= TDB_FREELIST_CLASSES;
+	} else {
+		tdb->flags &= ~TDB_FREELIST_CLASSES;
+	}
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CSUM) {
+		tdb->flags |= TDB_RECOVERY_CHECKSUM;
+	} else {
+		tdb->flags &= ~TDB_RECOVERY_CHECKSUM;
+	}
+
+	/* The hash table in the header, see tdb_hash_table_refresh() */
+	tdb->hash_chains = tdb->hash_size;
+	tdb->hash_table = FREELIST_TOP + TDB_OFS_SIZE(tdb);
+
+	tdb->hdr_ofs = 0;
+
 	if (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX) {
 		if (!tdb_mutex_open_ok(tdb, &header)) {
 			errno = EINVAL;
@@ -636,6 +713,21 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		tdb->hdr_ofs = header.mutex_size;
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) {
+		if (header.seqlock_size != tdb_seqlock_size(tdb)) {
+			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: "
+				 "seqlock size changed from %u to %u in %s\n",
+				 (unsigned int)header.seqlock_size,
+				 (unsigned int)tdb_seqlock_size(tdb), name));
+			errno = EINVAL;
+			goto fail;
+		}
+		tdb->hdr_ofs += header.seqlock_size;
+		tdb->flags |= TDB_SEQLOCK;
+	} else {
+		tdb->flags &= ~TDB_SEQLOCK;
+	}
+
 	if ((header.magic1_hash == 0) && (header.magic2_hash == 0)) {
 		/* older TDB without magic hash references */
 		tdb->hash_fn = tdb_old_hash;
@@ -656,6 +748,12 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		goto fail;
 	}
 
+	if (tdb->hash_fn == tdb_fast_hash) {
+		tdb->flags |= TDB_FAST_HASH;
+	} else {
+		tdb->flags &= ~TDB_FAST_HASH;
+	}
+
 	/* Is it already in the open list?  If so, fail. */
 	if (tdb_already_open(tdb->device, tdb->inode)) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: "
@@ -678,6 +776,15 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		goto fail;
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_HASH_TABLE) {
+		tdb->feature_flags &= ~TDB_FEATURE_FLAG_HASH_TABLE;
+		ret = tdb_hash_table_refresh(tdb);
+		if (ret == -1) {
+			errno = EIO;
+			goto fail;
+		}
+	}
+
 	if (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX) {
 		if (!(tdb->flags & TDB_NOLOCK)) {
 			ret = tdb_mutex_mmap(tdb);
@@ -687,6 +794,14 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		}
 	}
 
+	/* read only opens don't lock, so they read without counters */
+	if (tdb_have_seqlocks(tdb) && !tdb->read_only) {
+		ret = tdb_seqlock_mmap(tdb);
+		if (ret != 0) {
+			goto fail;
+		}
+	}
+
 	if (locked) {
 		if (tdb_nest_unlock(tdb, ACTIVE_LOCK, F_WRLCK, false) == -1) {
 			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: "
@@ -756,6 +871,7 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		else
 			tdb_munmap(tdb);
 	}
+	tdb_seqlock_munmap(tdb);
 	if (tdb->fd != -1)
 		if (close(tdb->fd) != 0)
 			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: failed to close tdb->fd on error!\n"));
@@ -799,6 +915,7 @@ _PUBLIC_ int tdb_close(struct tdb_context *tdb)
 	}
 
 	tdb_mutex_munmap(tdb);
+	tdb_seqlock_munmap(tdb);
 
 	SAFE_FREE(tdb->name);
 	if (tdb->fd != -1) {
@@ -57,14 +57,14 @@ static bool looks_like_valid_record(struct tdb_context *tdb,
 		return false;
 
 	/* Next pointer must make some sense. */
-	if (rec->next > 0 && rec->next < TDB_DATA_START(tdb->hash_size))
+	if (rec->next > 0 && rec->next < TDB_DATA_START(tdb, tdb->hash_size))
 		return false;
 
-	if (tdb->methods->tdb_oob(tdb, rec->next, sizeof(*rec), 1))
+	if (tdb->methods->tdb_oob(tdb, rec->next, TDB_REC_SIZE(tdb), 1))
 		return false;
 
 	key->dsize = rec->key_len;
-	key->dptr = tdb_alloc_read(tdb, off + sizeof(*rec), key->dsize);
+	key->dptr = tdb_alloc_read(tdb, off + TDB_REC_SIZE(tdb), key->dsize);
 	if (!key->dptr)
 		return false;
 
@@ -111,7 +111,7 @@ static bool walk_record(struct tdb_context *tdb,
 
 	data.dsize = f->rec.data_len;
 	data.dptr = tdb_alloc_read(tdb,
-				   f->head + sizeof(f->rec) + f->rec.key_len,
+				   f->head + TDB_REC_SIZE(tdb) + f->rec.key_len,
 				   data.dsize);
 	if (!data.dptr) {
 		if (tdb->ecode == TDB_ERR_OOM)
@@ -211,7 +211,7 @@ _PUBLIC_ int tdb_rescue(struct tdb_context *tdb,
 			void *private_data)
 {
 	struct found_table found = { NULL, 0, 0 };
-	tdb_off_t h, off, i;
+	tdb_off_t h, off, i, num_free = TDB_NUM_FREELISTS(tdb);
 	tdb_log_func oldlog = tdb->log.log_fn;
 	struct tdb_record rec;
 	TDB_DATA key;
@@ -230,15 +230,19 @@ _PUBLIC_ int tdb_rescue(struct tdb_context *tdb,
 	/* Make sure we know true size of the underlying file. */
 	tdb->methods->tdb_oob(tdb, tdb->map_size, 1, 1);
 
+	/* Best effort: the hash table may have been moved meanwhile. */
+	if (!locked) {
+		tdb_hash_table_refresh(tdb);
+	}
+
 	/* Suppress logging, since we anticipate errors. */
 	tdb->log.log_fn = logging_suppressed;
 
 	/* Now walk entire db looking for records. */
-	for (off = TDB_DATA_START(tdb->hash_size);
+	for (off = TDB_DATA_START(tdb, tdb->hash_size);
 	     off < tdb->map_size;
 	     off += TDB_ALIGNMENT) {
-		if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
-					   DOCONV()) == -1)
+		if (tdb_rec_read_raw(tdb, off, &rec) == -1)
 			continue;
 
 		if (looks_like_valid_record(tdb, off, &rec, &key)) {
@@ -249,28 +253,27 @@ _PUBLIC_ int tdb_rescue(struct tdb_context *tdb,
 	}
 
 	/* Walk hash chains to positive vet. */
-	for (h = 0; h < 1+tdb->hash_size; h++) {
+	for (h = 0; h < num_free+tdb->hash_chains; h++) {
 		bool slow_chase = false;
-		tdb_off_t slow_off = FREELIST_TOP + h*sizeof(tdb_off_t);
+		tdb_off_t slow_off = (h < num_free) ? TDB_FREELIST_TOP(tdb, h)
+			: TDB_HASH_TOP(tdb, h-num_free);
 
-		if (tdb_ofs_read(tdb, FREELIST_TOP + h*sizeof(tdb_off_t),
-				 &off) == -1)
+		if (tdb_ofs_read(tdb, slow_off, &off) == -1)
 			continue;
 
 		while (off && off != slow_off) {
-			if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
-						   DOCONV()) != 0) {
+			if (tdb_rec_read_raw(tdb, off, &rec) != 0) {
 				break;
 			}
 
-			/* 0 is the free list, rest are hash chains. */
-			if (h == 0) {
+			/* First the free lists, rest are hash chains. */
+			if (h < num_free) {
 				/* Don't mark garbage as free. */
 				if (rec.magic != TDB_FREE_MAGIC) {
 					break;
 				}
 				mark_free_area(&found, off,
-					       sizeof(rec) + rec.rec_len);
+					       TDB_REC_SIZE(tdb) + rec.rec_len);
 			} else {
 				found_in_hashchain(&found, off);
 			}
@@ -288,10 +291,9 @@ _PUBLIC_ int tdb_rescue(struct tdb_context *tdb,
 
 	/* Recovery area: must be marked as free, since it often has old
 	 * records in there! */
-	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, &off) == 0 && off != 0) {
-		if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
-					   DOCONV()) == 0) {
-			mark_free_area(&found, off, sizeof(rec) + rec.rec_len);
+	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD(tdb), &off) == 0 && off != 0) {
+		if (tdb_rec_read_raw(tdb, off, &rec) == 0) {
+			mark_free_area(&found, off, TDB_REC_SIZE(tdb) + rec.rec_len);
 		}
 	}
 
@@ -0,0 +1,477 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   trivial database library
+
+     ** NOTE! The following LGPL license applies to the tdb
+     ** library. This does NOT imply that all of Samba is released
+     ** under the LGPL
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "tdb_private.h"
+
+#ifdef USE_TDB_SEQLOCK
+
+/*
+ * With TDB_FEATURE_FLAG_SEQLOCK tdb_fetch(), tdb_parse_record() and
+ * tdb_exists() don't take the chain lock, they look at the mmap and
+ * check afterwards that no writer was active meanwhile.
+ *
+ * Every chain lock has a sequence counter. A process taking a chain
+ * write lock makes the counter odd, it makes it even again before
+ * dropping the lock. The global counter does the same for allrecord
+ * write locks, which also cover transaction commits, tdb_rehash() and
+ * recovery. A reader reads both counters, walks the chain and copies
+ * the data. If both counters were even and are unchanged afterwards,
+ * no writer touched the chain and the copy is consistent. If a writer
+ * is active we take the chain lock like before and wait for it.
+ *
+ * The counters can't live in the tdb itself: a transaction commit
+ * writes back whole blocks and would overwrite them with old values.
+ * So like the mutexes they are stored in front of the tdb data, right
+ * behind the mutex area if there is one. If this area starts the
+ * file, it starts with the tdb header, see tdb_open_ex().
+ *
+ * The counters are only modified while holding the corresponding
+ * lock, so plain stores are enough. If a process dies while writing,
+ * the counter stays odd and readers take the lock until the next
+ * writer bumps it again.
+ */
+
+struct tdb_seqlocks {
+	/* only used if the seqlock area starts the file */
+	struct tdb_header hdr;
+
+	/* allrecord write locks and recovery */
+	uint32_t global;
+
+	/* one counter per chain lock, indexed by BUCKET(hash) */
+	uint32_t chains[1];
+};
+
+/* Retries before we give up and wait in the chain lock */
+#define TDB_SEQLOCK_RETRIES 3
+
+/*
+ * Larger records are parsed under the chain lock, directly from the
+ * mmap. Copying them would cost more than the lock.
+ */
+#define TDB_SEQLOCK_MAX_COPY 16384
+
+bool tdb_have_seqlocks(struct tdb_context *tdb)
+{
+	return ((tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) != 0);
+}
+
+size_t tdb_seqlock_size(struct tdb_context *tdb)
+{
+	size_t seqlock_size;
+
+	if (!tdb_have_seqlocks(tdb)) {
+		return 0;
+	}
+
+	seqlock_size = sizeof(struct tdb_seqlocks);
+	seqlock_size += tdb->hash_size * sizeof(uint32_t);
+
+	return TDB_ALIGN(seqlock_size, tdb->page_size);
+}
+
+int tdb_seqlock_mmap(struct tdb_context *tdb)
+{
+	size_t len;
+	void *ptr;
+
+	len = tdb_seqlock_size(tdb);
+	if (len == 0) {
+		return 0;
+	}
+
+	if (tdb->seqlocks != NULL) {
+		return 0;
+	}
+
+	ptr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FILE,
+		   tdb->fd, tdb_mutex_size(tdb));
+	if (ptr == MAP_FAILED) {
+		return -1;
+	}
+	tdb->seqlocks = (struct tdb_seqlocks *)ptr;
+
+	return 0;
+}
+
+int tdb_seqlock_munmap(struct tdb_context *tdb)
+{
+	size_t len;
+	int ret;
+
+	SAFE_FREE(tdb->seqlock_buf);
+
+	len = tdb_seqlock_size(tdb);
+	if (len == 0 || tdb->seqlocks == NULL) {
+		return 0;
+	}
+
+	ret = munmap(tdb->seqlocks, len);
+	if (ret == -1) {
+		return -1;
+	}
+	tdb->seqlocks = NULL;
+
+	return 0;
+}
+
+/*
+ * Make the counter odd when a writer starts. If it is odd already, a
+ * writer died: change it anyway, a reader might have started before.
+ */
+static void tdb_seqlock_begin(volatile uint32_t *seq)
+{
+	uint32_t s = *seq;
+
+	*seq = s + ((s & 1) ? 2 : 1);
+	__sync_synchronize();
+}
+
+static void tdb_seqlock_end(volatile uint32_t *seq)
+{
+	uint32_t s = *seq;
+
+	__sync_synchronize();
+	*seq = s + ((s & 1) ? 1 : 2);
+}
+
+/*
+ * Map a lock offset to its counter, only the chain locks have one.
+ */
+static volatile uint32_t *tdb_seqlock_chain(struct tdb_context *tdb,
+					    uint32_t off)
+{
+	uint32_t list;
+
+	/* list -1, the freelist, is at FREELIST_TOP - 4 */
+	if (tdb->seqlocks == NULL || off < FREELIST_TOP) {
+		return NULL;
+	}
+
+	list = (off - FREELIST_TOP) / 4;
+	if (list >= tdb->hash_size) {
+		return NULL;
+	}
+
+	return &tdb->seqlocks->chains[list];
+}
+
+void tdb_seqlock_chain_begin(struct tdb_context *tdb, uint32_t off)
+{
+	volatile uint32_t *seq = tdb_seqlock_chain(tdb, off);
+
+	if (seq != NULL) {
+		tdb_seqlock_begin(seq);
+	}
+}
+
+void tdb_seqlock_chain_end(struct tdb_context *tdb, uint32_t off)
+{
+	volatile uint32_t *seq = tdb_seqlock_chain(tdb, off);
+
+	if (seq != NULL) {
+		tdb_seqlock_end(seq);
+	}
+}
+
+/*
+ * Recovery can run inside a transaction commit, so the global counter
+ * is only changed by the outermost caller.
+ */
+void tdb_seqlock_allrecord_begin(struct tdb_context *tdb)
+{
+	if (tdb->seqlocks == NULL) {
+		return;
+	}
+	if (tdb->seqlock_writers++ == 0) {
+		tdb_seqlock_begin(&tdb->seqlocks->global);
+	}
+}
+
+void tdb_seqlock_allrecord_end(struct tdb_context *tdb)
+{
+	if (tdb->seqlocks == NULL || tdb->seqlock_writers == 0) {
+		return;
+	}
+	if (--tdb->seqlock_writers == 0) {
+		tdb_seqlock_end(&tdb->seqlocks->global);
+	}
+}
+
+/*
+ * Called with the first chain lock held, after tdb_hash_table_refresh().
+ * The layout of the hash table can only change with the global counter,
+ * so lock-free readers can rely on it until the counter changes.
+ */
+void tdb_seqlock_refreshed(struct tdb_context *tdb)
+{
+	if (tdb->seqlocks == NULL || (tdb->flags & TDB_NOLOCK)) {
+		return;
+	}
+	tdb->seqlock_global = tdb->seqlocks->global;
+}
+
+/*
+ * Return a pointer to len bytes at off in the mmap, or NULL if they
+ * are beyond the end of the file. The data might be changing under
+ * us, the caller has to validate what it found.
+ */
+static const unsigned char *tdb_seqlock_ptr(struct tdb_context *tdb,
+					    tdb_off_t off, tdb_len_t len)
+{
+	if (off + len < off) {
+		return NULL;
+	}
+	if (off + len > tdb->map_size) {
+		/* Someone else expanded the file, remap */
+		if (tdb->methods->tdb_oob(tdb, off, len, 1) != 0) {
+			return NULL;
+		}
+		if (tdb->map_ptr == NULL) {
+			return NULL;
+		}
+	}
+	return off + (const unsigned char *)tdb->map_ptr;
+}
+
+/*
+ * Walk the chain without locks. Returns 0 and the data in
+ * tdb->seqlock_buf if the key was found, -1 if it does not exist and
+ * -2 if what we read does not make sense or is too large to copy.
+ */
+static int tdb_seqlock_find(struct tdb_context *tdb, TDB_DATA key,
+			    uint32_t hash, bool copy, tdb_len_t *data_len)
+{
+	const unsigned char *p;
+	uint32_t buf[7];
+	struct tdb_record rec;
+	tdb_off_t rec_ptr;
+	tdb_off_t loops = tdb->map_size / TDB_REC_SIZE(tdb);
+
+	p = tdb_seqlock_ptr(tdb, TDB_HASH_TOP(tdb, hash), TDB_OFS_SIZE(tdb));
+	if (p == NULL) {
+		return -2;
+	}
+	memcpy(buf, p, TDB_OFS_SIZE(tdb));
+	if (DOCONV()) {
+		tdb_convert(buf, TDB_OFS_SIZE(tdb));
+	}
+	rec_ptr = tdb_ofs_unpack(tdb, buf);
+
+	while (rec_ptr != 0) {
+		tdb_len_t len;
+
+		if (loops-- == 0) {
+			return -2;
+		}
+
+		p = tdb_seqlock_ptr(tdb, rec_ptr, TDB_REC_SIZE(tdb));
+		if (p == NULL) {
+			return -2;
+		}
+		memcpy(buf, p, TDB_REC_SIZE(tdb));
+		if (DOCONV()) {
+			tdb_convert(buf, TDB_REC_SIZE(tdb));
+		}
+		tdb_rec_unpack(tdb, buf, &rec);
+
+		if (TDB_BAD_MAGIC(&rec)) {
+			return -2;
+		}
+
+		if (TDB_DEAD(&rec) || hash != rec.full_hash ||
+		    key.dsize != rec.key_len) {
+			rec_ptr = rec.next;
+			continue;
+		}
+
+		if (!tdb_add_len_t(rec.key_len, rec.data_len, &len)) {
+			return -2;
+		}
+		p = tdb_seqlock_ptr(tdb, rec_ptr + TDB_REC_SIZE(tdb), len);
+		if (p == NULL) {
+			return -2;
+		}
+		if (memcmp(p, key.dptr, key.dsize) != 0) {
+			rec_ptr = rec.next;
+			continue;
+		}
+
+		*data_len = rec.data_len;
+		if (!copy) {
+			return 0;
+		}
+
+		if (rec.data_len > TDB_SEQLOCK_MAX_COPY) {
+			return -2;
+		}
+		if (tdb->seqlock_buf == NULL) {
+			tdb->seqlock_buf = (unsigned char *)malloc(
+				TDB_SEQLOCK_MAX_COPY);
+			if (tdb->seqlock_buf == NULL) {
+				return -2;
+			}
+		}
+		memcpy(tdb->seqlock_buf, p + rec.key_len, rec.data_len);
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * Look up a key without taking the chain lock and hand a copy of the
+ * data to the parser, parser==NULL just checks for existence. Returns
+ * false if the caller has to do the lookup under the chain lock: the
+ * db is not mmapped, we are in a transaction or writers were active.
+ */
+bool tdb_seqlock_parse_record(struct tdb_context *tdb, TDB_DATA key,
+			      uint32_t hash,
+			      int (*parser)(TDB_DATA key, TDB_DATA data,
+					    void *private_data),
+			      void *private_data, int *result)
+{
+	volatile uint32_t *global, *chain;
+	enum TDB_ERROR ecode = tdb->ecode;
+	int i;
+
+	if (tdb->seqlocks == NULL || tdb->map_ptr == NULL ||
+	    tdb->transaction != NULL || (tdb->flags & TDB_NOLOCK)) {
+		return false;
+	}
+
+	global = &tdb->seqlocks->global;
+	chain = &tdb->seqlocks->chains[BUCKET(hash)];
+
+	for (i = 0; i < TDB_SEQLOCK_RETRIES; i++) {
+		uint32_t g = *global;
+		uint32_t c = *chain;
+		tdb_len_t data_len = 0;
+		TDB_DATA data;
+		int ret;
+
+		if ((g & 1) || (c & 1)) {
+			/* A writer is active, wait for it in the lock */
+			break;
+		}
+		if (g != tdb->seqlock_global) {
+			/* The hash table might have moved */
+			break;
+		}
+
+		__sync_synchronize();
+
+		ret = tdb_seqlock_find(tdb, key, hash, parser != NULL,
+				       &data_len);
+
+		__sync_synchronize();
+
+		if (*global != g || *chain != c) {
+			continue;
+		}
+
+		if (ret == -2) {
+			/* Let the locked path report corruption */
+			break;
+		}
+
+		if (ret == -1) {
+			tdb->ecode = TDB_ERR_NOEXIST;
+			*result = -1;
+			return true;
+		}
+
+		tdb->ecode = ecode;
+
+		if (parser == NULL) {
+			*result = 0;
+			return true;
+		}
+
+		data.dptr = tdb->seqlock_buf;
+		data.dsize = data_len;
+		*result = parser(key, data, private_data);
+		return true;
+	}
+
+	tdb->ecode = ecode;
+	return false;
+}
+
+#else
+
+size_t tdb_seqlock_size(struct tdb_context *tdb)
+{
+	return 0;
+}
+
+bool tdb_have_seqlocks(struct tdb_context *tdb)
+{
+	return false;
+}
+
+int tdb_seqlock_mmap(struct tdb_context *tdb)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int tdb_seqlock_munmap(struct tdb_context *tdb)
+{
+	return 0;
+}
+
+void tdb_seqlock_chain_begin(struct tdb_context *tdb, uint32_t off)
+{
+	return;
+}
+
+void tdb_seqlock_chain_end(struct tdb_context *tdb, uint32_t off)
+{
+	return;
+}
+
+void tdb_seqlock_allrecord_begin(struct tdb_context *tdb)
+{
+	return;
+}
+
+void tdb_seqlock_allrecord_end(struct tdb_context *tdb)
+{
+	return;
+}
+
+void tdb_seqlock_refreshed(struct tdb_context *tdb)
+{
+	return;
+}
+
+bool tdb_seqlock_parse_record(struct tdb_context *tdb, TDB_DATA key,
+			      uint32_t hash,
+			      int (*parser)(TDB_DATA key, TDB_DATA data,
+					    void *private_data),
+			      void *private_data, int *result)
+{
+	return false;
+}
+
+#endif
@@ -22,8 +22,10 @@
 	"Header offset/logical size: %zu/%zu\n" \
 	"Number of records: %zu\n" \
 	"Incompatible hash: %s\n" \
+	"Hash function: %s\n" \
 	"Active/supported feature flags: 0x%08x/0x%08x\n" \
 	"Robust mutexes locking: %s\n" \
+	"Large offsets: %s\n" \
 	"Smallest/average/largest keys: %zu/%zu/%zu\n" \
 	"Smallest/average/largest data: %zu/%zu/%zu\n" \
 	"Smallest/average/largest padding: %zu/%zu/%zu\n" \
@@ -43,6 +45,20 @@ struct tally {
 	size_t num;
 };
 
+static const char *tdb_hash_name(struct tdb_context *tdb)
+{
+	if (tdb->hash_fn == tdb_old_hash) {
+		return "old";
+	}
+	if (tdb->hash_fn == tdb_jenkins_hash) {
+		return "jenkins";
+	}
+	if (tdb->hash_fn == tdb_fast_hash) {
+		return "fast";
+	}
+	return "user defined";
+}
+
 static void tally_init(struct tally *tally)
 {
 	tally->total = 0;
@@ -74,7 +90,7 @@ static size_t get_hash_length(struct tdb_context *tdb, unsigned int i)
 	tdb_off_t rec_ptr;
 	size_t count = 0;
 
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(i), &rec_ptr) == -1)
+	if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, i), &rec_ptr) == -1)
 		return 0;
 
 	/* keep looking until we find the right record */
@@ -110,6 +126,10 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		locked = true;
 	}
 
+	if (!locked && tdb_hash_table_refresh(tdb) == -1) {
+		return NULL;
+	}
+
 	if (tdb_recovery_area(tdb, tdb->methods, &rec_off, &recovery) != 0) {
 		goto unlock;
 	}
@@ -122,11 +142,10 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 	tally_init(&hashval);
 	tally_init(&uncoal);
 
-	for (off = TDB_DATA_START(tdb->hash_size);
+	for (off = TDB_DATA_START(tdb, tdb->hash_size);
 	     off < tdb->map_size - 1;
-	     off += sizeof(rec) + rec.rec_len) {
-		if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
-					   DOCONV()) == -1)
+	     off += TDB_REC_SIZE(tdb) + rec.rec_len) {
+		if (tdb_rec_read_raw(tdb, off, &rec) == -1)
 			goto unlock;
 		switch (rec.magic) {
 		case TDB_MAGIC:
@@ -138,6 +157,11 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 				tally_add(&uncoal, unc - 1);
 			unc = 0;
 			break;
+		case TDB_HASHTABLE_MAGIC:
+			if (unc > 1)
+				tally_add(&uncoal, unc - 1);
+			unc = 0;
+			break;
 		case TDB_FREE_MAGIC:
 			tally_add(&freet, rec.rec_len);
 			unc++;
@@ -149,7 +173,7 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 			/* If it's a valid recovery, we can trust rec_len. */
 			if (off != rec_off) {
 				rec.rec_len = tdb_dead_space(tdb, off)
-					- sizeof(rec);
+					- TDB_REC_SIZE(tdb);
 			}
 			/* Fall through */
 		case TDB_DEAD_MAGIC:
@@ -157,15 +181,15 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 			break;
 		default:
 			TDB_LOG((tdb, TDB_DEBUG_ERROR,
-				 "Unexpected record magic 0x%x at offset %u\n",
-				 rec.magic, off));
+				 "Unexpected record magic 0x%x at offset %ju\n",
+				 rec.magic, (uintmax_t)off));
 			goto unlock;
 		}
 	}
 	if (unc > 1)
 		tally_add(&uncoal, unc - 1);
 
-	for (off = 0; off < tdb->hash_size; off++)
+	for (off = 0; off < tdb->hash_chains; off++)
 		tally_add(&hashval, get_hash_length(tdb, off));
 
 	file_size = tdb->hdr_ofs + tdb->map_size;
@@ -174,9 +198,12 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		 (unsigned long long)file_size, keys.total+data.total,
 		 (size_t)tdb->hdr_ofs, (size_t)tdb->map_size,
 		 keys.num,
-		 (tdb->hash_fn == tdb_jenkins_hash)?"yes":"no",
+		 (tdb->hash_fn == tdb_jenkins_hash ||
+		  tdb->hash_fn == tdb_fast_hash)?"yes":"no",
+		 tdb_hash_name(tdb),
 		 (unsigned)tdb->feature_flags, TDB_SUPPORTED_FEATURE_FLAGS,
 		 (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX)?"yes":"no",
+		 TDB_LARGE_OFFSETS_P(tdb)?"yes":"no",
 		 keys.min, tally_mean(&keys), keys.max,
 		 data.min, tally_mean(&data), data.max,
 		 extra.min, tally_mean(&extra), extra.max,
@@ -194,9 +221,9 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		 freet.total * 100.0 / file_size,
 		 dead.total * 100.0 / file_size,
 		 (keys.num + freet.num + dead.num)
-		 * (sizeof(struct tdb_record) + sizeof(uint32_t))
+		 * (TDB_REC_SIZE(tdb) + TDB_TAILER_SIZE)
 		 * 100.0 / file_size,
-		 tdb->hash_size * sizeof(tdb_off_t)
+		 tdb->hash_chains * TDB_OFS_SIZE(tdb)
 		 * 100.0 / file_size);
 	if (len == -1) {
 		goto unlock;
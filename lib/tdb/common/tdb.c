@@ -35,7 +35,7 @@ _PUBLIC_ TDB_DATA tdb_null;
 */
 _PUBLIC_ void tdb_increment_seqnum_nonblock(struct tdb_context *tdb)
 {
-	tdb_off_t seqnum=0;
+	uint32_t seqnum=0;
 
 	if (!(tdb->flags & TDB_SEQNUM)) {
 		return;
@@ -44,9 +44,9 @@ _PUBLIC_ void tdb_increment_seqnum_nonblock(struct tdb_context *tdb)
 	/* we ignore errors from this, as we have no sane way of
 	   dealing with them.
 	*/
-	tdb_ofs_read(tdb, TDB_SEQNUM_OFS, &seqnum);
+	tdb_u32_read(tdb, TDB_SEQNUM_OFS, &seqnum);
 	seqnum++;
-	tdb_ofs_write(tdb, TDB_SEQNUM_OFS, &seqnum);
+	tdb_u32_write(tdb, TDB_SEQNUM_OFS, &seqnum);
 }
 
 /*
@@ -87,7 +87,7 @@ static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 	tdb_off_t rec_ptr;
 
 	/* read in the hash top */
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1)
+	if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, hash), &rec_ptr) == -1)
 		return 0;
 
 	/* keep looking until we find the right record */
@@ -97,7 +97,7 @@ static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 
 		if (!TDB_DEAD(r) && hash==r->full_hash
 		    && key.dsize==r->key_len
-		    && tdb_parse_data(tdb, key, rec_ptr + sizeof(*r),
+		    && tdb_parse_data(tdb, key, rec_ptr + TDB_REC_SIZE(tdb),
 				      r->key_len, tdb_key_compare,
 				      NULL) == 0) {
 			return rec_ptr;
@@ -118,7 +118,7 @@ static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 tdb_off_t tdb_find_lock_hash(struct tdb_context *tdb, TDB_DATA key, uint32_t hash, int locktype,
 			   struct tdb_record *rec)
 {
-	uint32_t rec_ptr;
+	tdb_off_t rec_ptr;
 
 	if (tdb_lock(tdb, BUCKET(hash), locktype) == -1)
 		return 0;
@@ -191,12 +191,12 @@ static int tdb_update_hash(struct tdb_context *tdb, TDB_DATA key,
 	}
 
 	/* must be long enough key, data and tailer */
-	if (rec.rec_len < key.dsize + dbufs_len + sizeof(tdb_off_t)) {
+	if (rec.rec_len < key.dsize + dbufs_len + TDB_TAILER_SIZE) {
 		tdb->ecode = TDB_SUCCESS; /* Not really an error */
 		return -1;
 	}
 
-	ofs = rec_ptr + sizeof(rec) + rec.key_len;
+	ofs = rec_ptr + TDB_REC_SIZE(tdb) + rec.key_len;
 
 	for (i=0; i<num_dbufs; i++) {
 		TDB_DATA dbuf = dbufs[i];
@@ -218,6 +218,26 @@ static int tdb_update_hash(struct tdb_context *tdb, TDB_DATA key,
 	return 0;
 }
 
+struct tdb_fetch_state {
+	struct tdb_context *tdb;
+	TDB_DATA data;
+};
+
+static int tdb_fetch_parser(TDB_DATA key, TDB_DATA data, void *private_data)
+{
+	struct tdb_fetch_state *state = private_data;
+
+	/* some systems don't like zero length malloc */
+	state->data.dptr = (unsigned char *)malloc(data.dsize ? data.dsize : 1);
+	if (state->data.dptr == NULL) {
+		state->tdb->ecode = TDB_ERR_OOM;
+		return -1;
+	}
+	memcpy(state->data.dptr, data.dptr, data.dsize);
+	state->data.dsize = data.dsize;
+	return 0;
+}
+
 /* find an entry in the database given a key */
 /* If an entry doesn't exist tdb_err will be set to
  * TDB_ERR_NOEXIST. If a key has no data attached
@@ -230,13 +250,21 @@ static TDB_DATA _tdb_fetch(struct tdb_context *tdb, TDB_DATA key)
 	struct tdb_record rec;
 	TDB_DATA ret;
 	uint32_t hash;
+	struct tdb_fetch_state state = { .tdb = tdb };
+	int result;
 
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
+
+	if (tdb_seqlock_parse_record(tdb, key, hash, tdb_fetch_parser,
+				     &state, &result)) {
+		return (result == 0) ? state.data : tdb_null;
+	}
+
 	if (!(rec_ptr = tdb_find_lock_hash(tdb,key,hash,F_RDLCK,&rec)))
 		return tdb_null;
 
-	ret.dptr = tdb_alloc_read(tdb, rec_ptr + sizeof(rec) + rec.key_len,
+	ret.dptr = tdb_alloc_read(tdb, rec_ptr + TDB_REC_SIZE(tdb) + rec.key_len,
 				  rec.data_len);
 	ret.dsize = rec.data_len;
 	tdb_unlock(tdb, BUCKET(rec.full_hash), F_RDLCK);
@@ -266,6 +294,9 @@ _PUBLIC_ TDB_DATA tdb_fetch(struct tdb_context *tdb, TDB_DATA key)
  * This is interesting for all readers of potentially large data structures in
  * the tdb records, ldb indexes being one example.
  *
+ * With TDB_SEQLOCK small records are looked up without the chain lock, the
+ * parser gets a private copy of the data then. See seqlock.c.
+ *
  * Return -1 if the record was not found.
  */
 
@@ -282,6 +313,12 @@ _PUBLIC_ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
 
+	if (tdb_seqlock_parse_record(tdb, key, hash, parser, private_data,
+				     &ret)) {
+		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, ret);
+		return ret;
+	}
+
 	if (!(rec_ptr = tdb_find_lock_hash(tdb,key,hash,F_RDLCK,&rec))) {
 		/* record not found */
 		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, -1);
@@ -290,7 +327,7 @@ _PUBLIC_ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 	}
 	tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, 0);
 
-	ret = tdb_parse_data(tdb, key, rec_ptr + sizeof(rec) + rec.key_len,
+	ret = tdb_parse_data(tdb, key, rec_ptr + TDB_REC_SIZE(tdb) + rec.key_len,
 			     rec.data_len, parser, private_data);
 
 	tdb_unlock(tdb, BUCKET(rec.full_hash), F_RDLCK);
@@ -307,6 +344,11 @@ _PUBLIC_ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 static int tdb_exists_hash(struct tdb_context *tdb, TDB_DATA key, uint32_t hash)
 {
 	struct tdb_record rec;
+	int ret;
+
+	if (tdb_seqlock_parse_record(tdb, key, hash, NULL, NULL, &ret)) {
+		return (ret == 0) ? 1 : 0;
+	}
 
 	if (tdb_find_lock_hash(tdb, key, hash, F_RDLCK, &rec) == 0)
 		return 0;
@@ -342,7 +384,7 @@ int tdb_do_delete(struct tdb_context *tdb, tdb_off_t rec_ptr, struct tdb_record
 		return -1;
 
 	/* find previous record in hash chain */
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(rec->full_hash), &i) == -1)
+	if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, rec->full_hash), &i) == -1)
 		return -1;
 	for (last_ptr = 0; i != rec_ptr; last_ptr = i, i = lastrec.next)
 		if (tdb_rec_read(tdb, i, &lastrec) == -1)
@@ -350,7 +392,7 @@ int tdb_do_delete(struct tdb_context *tdb, tdb_off_t rec_ptr, struct tdb_record
 
 	/* unlink it: next ptr is at start of record. */
 	if (last_ptr == 0)
-		last_ptr = TDB_HASH_TOP(rec->full_hash);
+		last_ptr = TDB_HASH_TOP(tdb, rec->full_hash);
 	if (tdb_ofs_write(tdb, last_ptr, &rec->next) == -1)
 		return -1;
 
@@ -367,7 +409,7 @@ static int tdb_count_dead(struct tdb_context *tdb, uint32_t hash)
 	struct tdb_record rec;
 
 	/* read in the hash top */
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1)
+	if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, hash), &rec_ptr) == -1)
 		return 0;
 
 	while (rec_ptr) {
@@ -399,7 +441,7 @@ int tdb_purge_dead(struct tdb_context *tdb, uint32_t hash)
 	}
 
 	/* read in the hash top */
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1)
+	if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, hash), &rec_ptr) == -1)
 		goto fail;
 
 	while (rec_ptr) {
@@ -455,8 +497,8 @@ static int tdb_delete_hash(struct tdb_context *tdb, TDB_DATA key, uint32_t hash)
 		/*
 		 * Just mark the record as dead.
 		 */
-		ret = tdb_ofs_write(
-			tdb, rec_ptr + offsetof(struct tdb_record, magic),
+		ret = tdb_u32_write(
+			tdb, rec_ptr + TDB_REC_MAGIC_OFS(tdb),
 			&magic);
 	}
 	else {
@@ -494,9 +536,9 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 	tdb_off_t best_last_ptr = 0;
 	struct tdb_record best = { .rec_len = UINT32_MAX };
 
-	length += sizeof(tdb_off_t); /* tailer */
+	length += TDB_TAILER_SIZE;
 
-	last_ptr = TDB_HASH_TOP(hash);
+	last_ptr = TDB_HASH_TOP(tdb, hash);
 
 	/* read in the hash top */
 	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1)
@@ -595,7 +637,7 @@ static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 	}
 
 	/* Read hash top into next ptr */
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec.next) == -1)
+	if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, hash), &rec.next) == -1)
 		goto fail;
 
 	rec.key_len = key.dsize;
@@ -610,7 +652,7 @@ static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 	if (ret == -1) {
 		goto fail;
 	}
-	ofs += sizeof(rec);
+	ofs += TDB_REC_SIZE(tdb);
 
 	ret = tdb->methods->tdb_write(tdb, ofs, key.dptr, key.dsize);
 	if (ret == -1) {
@@ -631,7 +673,7 @@ static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 		ofs += dbufs[i].dsize;
 	}
 
-	ret = tdb_ofs_write(tdb, TDB_HASH_TOP(hash), &rec_ptr);
+	ret = tdb_ofs_write(tdb, TDB_HASH_TOP(tdb, hash), &rec_ptr);
 	if (ret == -1) {
 		/* Need to tdb_unallocate() here */
 		goto fail;
@@ -769,15 +811,15 @@ _PUBLIC_ tdb_log_func tdb_log_fn(struct tdb_context *tdb)
 */
 _PUBLIC_ int tdb_get_seqnum(struct tdb_context *tdb)
 {
-	tdb_off_t seqnum=0;
+	uint32_t seqnum=0;
 
-	tdb_ofs_read(tdb, TDB_SEQNUM_OFS, &seqnum);
+	tdb_u32_read(tdb, TDB_SEQNUM_OFS, &seqnum);
 	return seqnum;
 }
 
 _PUBLIC_ int tdb_hash_size(struct tdb_context *tdb)
 {
-	return tdb->hash_size;
+	return tdb->hash_chains;
 }
 
 _PUBLIC_ size_t tdb_map_size(struct tdb_context *tdb)
@@ -856,7 +898,9 @@ _PUBLIC_ void tdb_enable_seqnum(struct tdb_context *tdb)
 static int tdb_free_region(struct tdb_context *tdb, tdb_off_t offset, ssize_t length)
 {
 	struct tdb_record rec;
-	if (length <= sizeof(rec)) {
+	tdb_off_t len = length;
+
+	if (length <= TDB_REC_SIZE(tdb)) {
 		/* the region is not worth adding */
 		return 0;
 	}
@@ -864,11 +908,22 @@ static int tdb_free_region(struct tdb_context *tdb, tdb_off_t offset, ssize_t le
 		TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_free_region: adding region beyond end of file\n"));
 		return -1;
 	}
-	memset(&rec,'\0',sizeof(rec));
-	rec.rec_len = length - sizeof(rec);
-	if (tdb_free(tdb, offset, &rec) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_free_region: failed to add free record\n"));
-		return -1;
+
+	/*
+	 * rec_len is 32 bit, with TDB_FEATURE_FLAG_LARGE_OFFSETS the
+	 * region might need to be split into several records.
+	 */
+	while (len > TDB_REC_SIZE(tdb)) {
+		tdb_off_t chunk = MIN(len, UINT32_MAX & ~(TDB_ALIGNMENT - 1));
+
+		memset(&rec,'\0',sizeof(rec));
+		rec.rec_len = chunk - TDB_REC_SIZE(tdb);
+		if (tdb_free(tdb, offset, &rec) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_free_region: failed to add free record\n"));
+			return -1;
+		}
+		offset += chunk;
+		len -= chunk;
 	}
 	return 0;
 }
@@ -878,7 +933,8 @@ static int tdb_free_region(struct tdb_context *tdb, tdb_off_t offset, ssize_t le
   very fast by using a allrecord lock. The entire data portion of the
   file becomes a single entry in the freelist.
 
-  This code carefully steps around the recovery area, leaving it alone
+  This code carefully steps around the recovery area and a hash table
+  moved by tdb_rehash(), leaving them alone
  */
 _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 {
@@ -887,6 +943,11 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 	ssize_t data_len;
 	tdb_off_t recovery_head;
 	tdb_len_t recovery_size = 0;
+	struct {
+		tdb_off_t start;
+		tdb_off_t end;
+	} keep[2];
+	int num_keep = 0;
 
 	if (tdb_lockall(tdb) != 0) {
 		return -1;
@@ -898,60 +959,79 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 	   if so. We don't want to lose this as otherwise each
 	   tdb_wipe_all() in a transaction will increase the size of
 	   the tdb by the size of the recovery area */
-	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, &recovery_head) == -1) {
+	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD(tdb), &recovery_head) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wipe_all: failed to read recovery head\n"));
 		goto failed;
 	}
 
 	if (recovery_head != 0) {
 		struct tdb_record rec;
-		if (tdb->methods->tdb_read(tdb, recovery_head, &rec, sizeof(rec), DOCONV()) == -1) {
+		if (tdb_rec_read_raw(tdb, recovery_head, &rec) == -1) {
 			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wipe_all: failed to read recovery record\n"));
 			return -1;
 		}
-		recovery_size = rec.rec_len + sizeof(rec);
+		recovery_size = rec.rec_len + TDB_REC_SIZE(tdb);
 	}
 
 	/* wipe the hashes */
-	for (i=0;i<tdb->hash_size;i++) {
-		if (tdb_ofs_write(tdb, TDB_HASH_TOP(i), &offset) == -1) {
+	for (i=0;i<tdb->hash_chains;i++) {
+		if (tdb_ofs_write(tdb, TDB_HASH_TOP(tdb, i), &offset) == -1) {
 			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write hash %d\n", i));
 			goto failed;
 		}
 	}
 
-	/* wipe the freelist */
-	if (tdb_ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist\n"));
-		goto failed;
-	}
-
-	/* add all the rest of the file to the freelist, possibly leaving a gap
-	   for the recovery area */
-	if (recovery_size == 0) {
-		/* the simple case - the whole file can be used as a freelist */
-		data_len = (tdb->map_size - TDB_DATA_START(tdb->hash_size));
-		if (tdb_free_region(tdb, TDB_DATA_START(tdb->hash_size), data_len) != 0) {
+	/* wipe the freelists */
+	for (i=0;i<TDB_NUM_FREELISTS(tdb);i++) {
+		if (tdb_ofs_write(tdb, TDB_FREELIST_TOP(tdb, i), &offset) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist %u\n", i));
 			goto failed;
 		}
-	} else {
-		/* we need to add two freelist entries - one on either
-		   side of the recovery area
-
-		   Note that we cannot shift the recovery area during
-		   this operation. Only the transaction.c code may
-		   move the recovery area or we risk subtle data
-		   corruption
-		*/
-		data_len = (recovery_head - TDB_DATA_START(tdb->hash_size));
-		if (tdb_free_region(tdb, TDB_DATA_START(tdb->hash_size), data_len) != 0) {
+	}
+
+	/* add all the rest of the file to the freelist, leaving gaps
+	   for the recovery area and the hash table record
+
+	   Note that we cannot shift the recovery area during this
+	   operation. Only the transaction.c code may move the
+	   recovery area or we risk subtle data corruption
+	*/
+	if (recovery_size != 0) {
+		keep[num_keep].start = recovery_head;
+		keep[num_keep].end = recovery_head + recovery_size;
+		num_keep++;
+	}
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_HASH_TABLE) {
+		struct tdb_record rec;
+		tdb_off_t table_rec = tdb->hash_table - TDB_REC_SIZE(tdb);
+
+		if (tdb_rec_read_raw(tdb, table_rec, &rec) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wipe_all: failed to read hash table record\n"));
 			goto failed;
 		}
-		/* and the 2nd free list entry after the recovery area - if any */
-		data_len = tdb->map_size - (recovery_head+recovery_size);
-		if (tdb_free_region(tdb, recovery_head+recovery_size, data_len) != 0) {
+		keep[num_keep].start = table_rec;
+		keep[num_keep].end = table_rec + TDB_REC_SIZE(tdb) +
+			rec.rec_len;
+		num_keep++;
+	}
+	if (num_keep == 2 && keep[1].start < keep[0].start) {
+		tdb_off_t start = keep[0].start, end = keep[0].end;
+		keep[0] = keep[1];
+		keep[1].start = start;
+		keep[1].end = end;
+	}
+
+	offset = TDB_DATA_START(tdb, tdb->hash_size);
+	for (i=0; i<num_keep; i++) {
+		data_len = keep[i].start - offset;
+		if (tdb_free_region(tdb, offset, data_len) != 0) {
 			goto failed;
 		}
+		offset = keep[i].end;
+	}
+	data_len = tdb->map_size - offset;
+	if (tdb_free_region(tdb, offset, data_len) != 0) {
+		goto failed;
 	}
 
 	tdb_increment_seqnum_nonblock(tdb);
@@ -1059,6 +1139,210 @@ _PUBLIC_ int tdb_repack(struct tdb_context *tdb)
 	return 0;
 }
 
+/*
+  link all records of the current hash chains into heads[], which
+  has new_chains entries
+ */
+static int tdb_rehash_chains(struct tdb_context *tdb, tdb_off_t *heads,
+			     uint32_t new_chains)
+{
+	tdb_off_t max_records = tdb->map_size / TDB_REC_SIZE(tdb);
+	tdb_off_t num_records = 0;
+	uint32_t i;
+
+	for (i = 0; i < tdb->hash_chains; i++) {
+		tdb_off_t rec_ptr;
+
+		if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, i), &rec_ptr) == -1) {
+			return -1;
+		}
+
+		while (rec_ptr != 0) {
+			struct tdb_record rec;
+			uint32_t chain;
+
+			if (tdb_rec_read(tdb, rec_ptr, &rec) == -1) {
+				return -1;
+			}
+
+			/* Detect loops, we would hang forever */
+			if (++num_records > max_records) {
+				tdb->ecode = TDB_ERR_CORRUPT;
+				TDB_LOG((tdb, TDB_DEBUG_FATAL,
+					 "tdb_rehash: loop in hash chain %u\n",
+					 i));
+				return -1;
+			}
+
+			chain = rec.full_hash % new_chains;
+			if (tdb_ofs_write(tdb, rec_ptr, &heads[chain]) == -1) {
+				return -1;
+			}
+			heads[chain] = rec_ptr;
+			rec_ptr = rec.next;
+		}
+	}
+
+	return 0;
+}
+
+/*
+  change the number of hash chains of a tdb. This runs as a
+  transaction, other processes can keep the tdb open and pick up
+  the new hash table with their next lock.
+ */
+_PUBLIC_ int tdb_rehash(struct tdb_context *tdb, uint32_t hash_size)
+{
+	size_t ofs_size = TDB_OFS_SIZE(tdb);
+	tdb_off_t old_table, new_table;
+	uint32_t old_chains, feature_flags, i;
+	uint32_t hdr[3] = { 0, 0, 0 };
+	tdb_off_t *heads = NULL;
+	uint8_t *buf = NULL;
+	tdb_len_t table_len;
+
+	tdb_trace(tdb, "tdb_rehash");
+
+	if (hash_size == 0 || hash_size % tdb->hash_size != 0 ||
+	    hash_size > (UINT32_MAX - TDB_ALIGNMENT) / ofs_size) {
+		tdb->ecode = TDB_ERR_EINVAL;
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_rehash: invalid hash "
+			 "size %u, must be a multiple of %u\n",
+			 hash_size, tdb->hash_size));
+		return -1;
+	}
+
+	if (tdb_transaction_start(tdb) != 0) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, __location__ " Failed to start transaction\n"));
+		return -1;
+	}
+
+	old_chains = tdb->hash_chains;
+	old_table = tdb->hash_table;
+	if (hash_size == old_chains) {
+		tdb_transaction_cancel(tdb);
+		return 0;
+	}
+
+	table_len = hash_size * ofs_size;
+	heads = (tdb_off_t *)calloc(hash_size, sizeof(tdb_off_t));
+	buf = (uint8_t *)malloc(table_len);
+	if (heads == NULL || buf == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		goto fail;
+	}
+
+	/*
+	 * With the original size the heads go back into the header,
+	 * otherwise they live in a record of their own.
+	 */
+	if (hash_size == tdb->hash_size) {
+		new_table = FREELIST_TOP + ofs_size;
+		feature_flags = tdb->feature_flags &
+			~TDB_FEATURE_FLAG_HASH_TABLE;
+	} else {
+		struct tdb_record rec;
+		tdb_off_t rec_ptr;
+
+		rec_ptr = tdb_allocate(tdb, 0, table_len, &rec);
+		if (rec_ptr == 0) {
+			goto fail;
+		}
+		rec.next = 0;
+		rec.key_len = 0;
+		rec.data_len = table_len;
+		rec.full_hash = 0;
+		rec.magic = TDB_HASHTABLE_MAGIC;
+		if (tdb_rec_write(tdb, rec_ptr, &rec) == -1) {
+			goto fail;
+		}
+		new_table = rec_ptr + TDB_REC_SIZE(tdb);
+		feature_flags = tdb->feature_flags |
+			TDB_FEATURE_FLAG_HASH_TABLE;
+	}
+
+	if (tdb_rehash_chains(tdb, heads, hash_size) == -1) {
+		goto fail;
+	}
+
+	for (i = 0; i < hash_size; i++) {
+		tdb_ofs_pack(tdb, heads[i], buf + i * ofs_size);
+	}
+	if (DOCONV()) {
+		tdb_convert(buf, table_len);
+	}
+	if (tdb->methods->tdb_write(tdb, new_table, buf, table_len) == -1) {
+		goto fail;
+	}
+
+	/* Get rid of the old table */
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_HASH_TABLE) {
+		struct tdb_record rec;
+		tdb_off_t rec_ptr = old_table - TDB_REC_SIZE(tdb);
+
+		if (tdb_rec_read_raw(tdb, rec_ptr, &rec) == -1 ||
+		    tdb_free(tdb, rec_ptr, &rec) == -1) {
+			goto fail;
+		}
+	} else {
+		memset(buf, 0, old_chains * ofs_size);
+		if (tdb->methods->tdb_write(tdb, old_table, buf,
+					    old_chains * ofs_size) == -1) {
+			goto fail;
+		}
+	}
+
+	/* hash_chains and hash_table in struct tdb_header */
+	if (feature_flags & TDB_FEATURE_FLAG_HASH_TABLE) {
+		hdr[0] = hash_size;
+		hdr[1] = (uint32_t)new_table;
+		hdr[2] = (uint32_t)(new_table >> 32);
+	}
+	if (DOCONV()) {
+		tdb_convert(hdr, sizeof(hdr));
+	}
+	if (tdb->methods->tdb_write(tdb,
+				    offsetof(struct tdb_header, hash_chains),
+				    hdr, sizeof(hdr)) == -1) {
+		goto fail;
+	}
+	if (feature_flags != 0) {
+		uint32_t magic = TDB_FEATURE_FLAG_MAGIC;
+
+		if (tdb_u32_write(tdb, offsetof(struct tdb_header, rwlocks),
+				  &magic) == -1) {
+			goto fail;
+		}
+	}
+	if (tdb_u32_write(tdb, offsetof(struct tdb_header, feature_flags),
+			  &feature_flags) == -1) {
+		goto fail;
+	}
+
+	tdb->feature_flags = feature_flags;
+	tdb->hash_chains = hash_size;
+	tdb->hash_table = new_table;
+	if (tdb_transaction_hash_heads(tdb) == -1) {
+		goto fail;
+	}
+
+	SAFE_FREE(heads);
+	SAFE_FREE(buf);
+
+	if (tdb_transaction_commit(tdb) != 0) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, __location__ " Failed to commit\n"));
+		return -1;
+	}
+
+	return 0;
+
+fail:
+	SAFE_FREE(heads);
+	SAFE_FREE(buf);
+	tdb_transaction_cancel(tdb);
+	return -1;
+}
+
 /* Even on files, we can get partial writes due to signals. */
 bool tdb_write_all(int fd, const void *buf, size_t count)
 {
@@ -1084,6 +1368,17 @@ bool tdb_add_off_t(tdb_off_t a, tdb_off_t b, tdb_off_t *pret)
 	return true;
 }
 
+bool tdb_add_len_t(tdb_len_t a, tdb_len_t b, tdb_len_t *pret)
+{
+	tdb_len_t ret = a + b;
+
+	if ((ret < a) || (ret < b)) {
+		return false;
+	}
+	*pret = ret;
+	return true;
+}
+
 #ifdef TDB_TRACE
 static void tdb_trace_write(struct tdb_context *tdb, const char *str)
 {
@@ -1095,10 +1390,10 @@ static void tdb_trace_write(struct tdb_context *tdb, const char *str)
 
 static void tdb_trace_start(struct tdb_context *tdb)
 {
-	tdb_off_t seqnum=0;
-	char msg[sizeof(tdb_off_t) * 4 + 1];
+	uint32_t seqnum=0;
+	char msg[sizeof(uint32_t) * 4 + 1];
 
-	tdb_ofs_read(tdb, TDB_SEQNUM_OFS, &seqnum);
+	tdb_u32_read(tdb, TDB_SEQNUM_OFS, &seqnum);
 	snprintf(msg, sizeof(msg), "%u ", seqnum);
 	tdb_trace_write(tdb, msg);
 }
@@ -1144,7 +1439,7 @@ void tdb_trace(struct tdb_context *tdb, const char *op)
 
 void tdb_trace_seqnum(struct tdb_context *tdb, uint32_t seqnum, const char *op)
 {
-	char msg[sizeof(tdb_off_t) * 4 + 1];
+	char msg[sizeof(uint32_t) * 4 + 1];
 
 	snprintf(msg, sizeof(msg), "%u ", seqnum);
 	tdb_trace_write(tdb, msg);
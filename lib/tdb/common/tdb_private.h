@@ -39,7 +39,7 @@
 #endif
 
 typedef uint32_t tdb_len_t;
-typedef uint32_t tdb_off_t;
+typedef uint64_t tdb_off_t;
 
 #ifndef offsetof
 #define offsetof(t,f) ((unsigned int)&((t *)0)->f)
@@ -51,6 +51,7 @@ typedef uint32_t tdb_off_t;
 #define TDB_FREE_MAGIC (~TDB_MAGIC)
 #define TDB_DEAD_MAGIC (0xFEE1DEAD)
 #define TDB_RECOVERY_MAGIC (0xf53bc0e7U)
+#define TDB_HASHTABLE_MAGIC (0xf53bc0e8U)
 #define TDB_RECOVERY_INVALID_MAGIC (0x0)
 #define TDB_HASH_RWLOCK_MAGIC (0xbad1a51U)
 #define TDB_FEATURE_FLAG_MAGIC (0xbad1a52U)
@@ -61,20 +62,76 @@ typedef uint32_t tdb_off_t;
 #define TDB_BYTEREV(x) (((((x)&0xff)<<24)|((x)&0xFF00)<<8)|(((x)>>8)&0xFF00)|((x)>>24))
 #define TDB_DEAD(r) ((r)->magic == TDB_DEAD_MAGIC)
 #define TDB_BAD_MAGIC(r) ((r)->magic != TDB_MAGIC && !TDB_DEAD(r))
-#define TDB_HASH_TOP(hash) (FREELIST_TOP + (BUCKET(hash)+1)*sizeof(tdb_off_t))
-#define TDB_HASHTABLE_SIZE(tdb) ((tdb->hash_size+1)*sizeof(tdb_off_t))
-#define TDB_DATA_START(hash_size) (TDB_HASH_TOP(hash_size-1) + sizeof(tdb_off_t))
-#define TDB_RECOVERY_HEAD offsetof(struct tdb_header, recovery_start)
+#define TDB_HASH_TOP(tdb, hash) \
+	((tdb)->hash_table + CHAIN(hash)*TDB_OFS_SIZE(tdb))
+#define TDB_HASHTABLE_SIZE(tdb) ((tdb->hash_size+1)*TDB_OFS_SIZE(tdb))
+#define TDB_DATA_START(tdb, hash_size) \
+	(FREELIST_TOP + ((hash_size)+1)*TDB_OFS_SIZE(tdb))
+#define TDB_RECOVERY_HEAD(tdb) (TDB_LARGE_OFFSETS_P(tdb) ? \
+	offsetof(struct tdb_header, recovery_start64) : \
+	offsetof(struct tdb_header, recovery_start))
 #define TDB_SEQNUM_OFS    offsetof(struct tdb_header, sequence_number)
 #define TDB_PAD_BYTE 0x42
 #define TDB_PAD_U32  0x42424242
 
 #define TDB_FEATURE_FLAG_MUTEX 0x00000001
+#define TDB_FEATURE_FLAG_LARGE_OFFSETS 0x00000002
+#define TDB_FEATURE_FLAG_HASH_TABLE 0x00000004
+#define TDB_FEATURE_FLAG_SEQLOCK 0x00000008
+#define TDB_FEATURE_FLAG_FREELIST_CLASSES 0x00000010
+#define TDB_FEATURE_FLAG_RECOVERY_CSUM 0x00000020
+
+/*
+ * Processes without the seqlock code would write without bumping the
+ * counters, so unlike the mutexes the feature can't be ignored.
+ */
+#ifdef USE_TDB_SEQLOCK
+#define TDB_SUPPORTED_SEQLOCK TDB_FEATURE_FLAG_SEQLOCK
+#else
+#define TDB_SUPPORTED_SEQLOCK 0
+#endif
 
 #define TDB_SUPPORTED_FEATURE_FLAGS ( \
 	TDB_FEATURE_FLAG_MUTEX | \
+	TDB_FEATURE_FLAG_LARGE_OFFSETS | \
+	TDB_FEATURE_FLAG_HASH_TABLE | \
+	TDB_SUPPORTED_SEQLOCK | \
+	TDB_FEATURE_FLAG_FREELIST_CLASSES | \
+	TDB_FEATURE_FLAG_RECOVERY_CSUM | \
 	0)
 
+/*
+ * With TDB_FEATURE_FLAG_FREELIST_CLASSES free records are kept on
+ * TDB_FREELIST_NUM_CLASSES lists by size, see tdb_freelist_class(). List
+ * 0 is the classic one at FREELIST_TOP, the heads of the others are
+ * stored in header.freelists.
+ */
+#define TDB_FREELIST_NUM_CLASSES 8
+#define TDB_NUM_FREELISTS(tdb) \
+	(((tdb)->feature_flags & TDB_FEATURE_FLAG_FREELIST_CLASSES) ? \
+	 TDB_FREELIST_NUM_CLASSES : 1)
+#define TDB_FREELIST_TOP(tdb, c) ((c) == 0 ? FREELIST_TOP : \
+	offsetof(struct tdb_header, freelists) + ((c)-1)*TDB_OFS_SIZE(tdb))
+
+/*
+ * With TDB_FEATURE_FLAG_LARGE_OFFSETS all file offsets (hash chain
+ * heads, the "next" pointers of records and the recovery area
+ * pointer) are stored as two 32 bit words, low word first. The
+ * record header grows from 24 to 28 bytes. Lengths, the record
+ * tailer and the sequence number stay 32 bit.
+ */
+#define TDB_LARGE_OFFSETS_P(tdb) \
+	(((tdb)->feature_flags & TDB_FEATURE_FLAG_LARGE_OFFSETS) != 0)
+#define TDB_OFS_SIZE(tdb) (TDB_LARGE_OFFSETS_P(tdb) ? 8 : 4)
+#define TDB_REC_SIZE(tdb) (TDB_LARGE_OFFSETS_P(tdb) ? 28 : 24)
+#define TDB_TAILER_SIZE sizeof(tdb_len_t)
+#define TDB_MAX_OFFSET(tdb) \
+	(TDB_LARGE_OFFSETS_P(tdb) ? (tdb_off_t)INT64_MAX : (tdb_off_t)UINT32_MAX)
+
+/* offsets of the 32 bit fields in the on-disk record header */
+#define TDB_REC_REC_LEN_OFS(tdb) (TDB_OFS_SIZE(tdb))
+#define TDB_REC_MAGIC_OFS(tdb) (TDB_OFS_SIZE(tdb) + 16)
+
 /* NB assumes there is a local variable called "tdb" that is the
  * current context, also takes doubly-parenthesized print-style
  * argument. */
@@ -144,12 +201,24 @@ void tdb_trace_2rec_retrec(struct tdb_context *tdb, const char *op,
  */
 #define BUCKET(hash) ((hash) % tdb->hash_size)
 
+/*
+ * tdb_rehash() can give a database more hash chains than it was
+ * created with. The number of chains is always a multiple of
+ * hash_size, so all records of a chain are protected by the chain
+ * lock BUCKET(hash). TDB_FEATURE_FLAG_HASH_TABLE is set once the
+ * chain heads have been moved out of the header into a record with
+ * TDB_HASHTABLE_MAGIC, see tdb_hash_table_refresh().
+ */
+#define CHAIN(hash) ((hash) % tdb->hash_chains)
+
 #define DOCONV() (tdb->flags & TDB_CONVERT)
 #define CONVERT(x) (DOCONV() ? tdb_convert(&x, sizeof(x)) : &x)
 
 
 /* the body of the database is made of one tdb_record for the free space
-   plus a separate data list for each hash value */
+   plus a separate data list for each hash value. This is the unpacked
+   form, see tdb_rec_read() and tdb_rec_write() for the on-disk
+   layout. */
 struct tdb_record {
 	tdb_off_t next; /* offset of the next record in the list */
 	tdb_len_t rec_len; /* total byte length of record */
@@ -175,14 +244,22 @@ struct tdb_header {
 	char magic_food[32]; /* for /etc/magic */
 	uint32_t version; /* version of the code */
 	uint32_t hash_size; /* number of hash entries */
-	tdb_off_t rwlocks; /* obsolete - kept to detect old formats */
-	tdb_off_t recovery_start; /* offset of transaction recovery region */
-	tdb_off_t sequence_number; /* used when TDB_SEQNUM is set */
+	uint32_t rwlocks; /* obsolete - kept to detect old formats */
+	uint32_t recovery_start; /* offset of transaction recovery region */
+	uint32_t sequence_number; /* used when TDB_SEQNUM is set */
 	uint32_t magic1_hash; /* hash of TDB_MAGIC_FOOD. */
 	uint32_t magic2_hash; /* hash of TDB_MAGIC. */
 	uint32_t feature_flags;
-	tdb_len_t mutex_size; /* set if TDB_FEATURE_FLAG_MUTEX is set */
-	tdb_off_t reserved[25];
+	uint32_t mutex_size; /* set if TDB_FEATURE_FLAG_MUTEX is set */
+	/* recovery_start with TDB_FEATURE_FLAG_LARGE_OFFSETS */
+	uint32_t recovery_start64[2];
+	/* set if TDB_FEATURE_FLAG_HASH_TABLE is set */
+	uint32_t hash_chains; /* number of hash chains */
+	uint32_t hash_table[2]; /* offset of the hash chain heads */
+	uint32_t seqlock_size; /* set if TDB_FEATURE_FLAG_SEQLOCK is set */
+	/* free list heads 1..7 with TDB_FEATURE_FLAG_FREELIST_CLASSES */
+	uint32_t freelists[14];
+	uint32_t reserved[5];
 };
 
 struct tdb_lock_type {
@@ -193,7 +270,7 @@ struct tdb_lock_type {
 
 struct tdb_traverse_lock {
 	struct tdb_traverse_lock *next;
-	uint32_t off;
+	tdb_off_t off;
 	uint32_t list;
 	int lock_rw;
 };
@@ -217,12 +294,13 @@ struct tdb_methods {
 };
 
 struct tdb_mutexes;
+struct tdb_seqlocks;
 
 struct tdb_context {
 	char *name; /* the name of the database */
 	void *map_ptr; /* where it is currently mapped */
 	int fd; /* open file descriptor for the database */
-	tdb_len_t map_size; /* how much space has been mapped */
+	tdb_off_t map_size; /* how much space has been mapped */
 	int read_only; /* opened read-only */
 	int traverse_read; /* read-only traversal */
 	int traverse_write; /* read-write traversal */
@@ -231,11 +309,17 @@ struct tdb_context {
 	struct tdb_lock_type *lockrecs; /* only real locks, all with count>0 */
 	int lockrecs_array_length;
 
-	tdb_off_t hdr_ofs; /* this is 0 or header.mutex_size */
+	tdb_off_t hdr_ofs; /* header.mutex_size + header.seqlock_size */
 	struct tdb_mutexes *mutexes; /* mmap of the mutex area */
+	struct tdb_seqlocks *seqlocks; /* mmap of the seqlock counters */
+	uint32_t seqlock_global; /* global counter the hash table is valid for */
+	uint32_t seqlock_writers; /* nesting of the global counter */
+	unsigned char *seqlock_buf; /* copy of the data for lock-free reads */
 
 	enum TDB_ERROR ecode; /* error code for last tdb error */
 	uint32_t hash_size;
+	uint32_t hash_chains; /* a multiple of hash_size */
+	tdb_off_t hash_table; /* offset of the first chain head */
 	uint32_t feature_flags;
 	uint32_t flags; /* the flags passed to tdb_open */
 	struct tdb_traverse_lock travlocks; /* current traversal locks */
@@ -290,17 +374,26 @@ int tdb_write_lock_record(struct tdb_context *tdb, tdb_off_t off);
 int tdb_write_unlock_record(struct tdb_context *tdb, tdb_off_t off);
 int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
+int tdb_u32_read(struct tdb_context *tdb, tdb_off_t offset, uint32_t *d);
+int tdb_u32_write(struct tdb_context *tdb, tdb_off_t offset, uint32_t *d);
+void tdb_ofs_pack(struct tdb_context *tdb, tdb_off_t off, void *buf);
+tdb_off_t tdb_ofs_unpack(struct tdb_context *tdb, const void *buf);
 void *tdb_convert(void *buf, uint32_t size);
 int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
+unsigned tdb_freelist_class(struct tdb_context *tdb, tdb_len_t rec_len);
 tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 		       struct tdb_record *rec);
-int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
-int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_lock_record(struct tdb_context *tdb, tdb_off_t off);
 int tdb_unlock_record(struct tdb_context *tdb, tdb_off_t off);
 bool tdb_needs_recovery(struct tdb_context *tdb);
 int tdb_rec_read(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
+int tdb_rec_read_raw(struct tdb_context *tdb, tdb_off_t offset,
+		     struct tdb_record *rec);
 int tdb_rec_write(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
+void tdb_rec_unpack(struct tdb_context *tdb, const void *buf,
+		    struct tdb_record *rec);
+void tdb_rec_pack(struct tdb_context *tdb, const struct tdb_record *rec,
+		  void *buf);
 int tdb_do_delete(struct tdb_context *tdb, tdb_off_t rec_ptr, struct tdb_record *rec);
 unsigned char *tdb_alloc_read(struct tdb_context *tdb, tdb_off_t offset, tdb_len_t len);
 int tdb_parse_data(struct tdb_context *tdb, TDB_DATA key,
@@ -315,20 +408,36 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 			tdb_off_t *p_last_ptr);
 int tdb_purge_dead(struct tdb_context *tdb, uint32_t hash);
 void tdb_io_init(struct tdb_context *tdb);
+int tdb_hash_table_refresh(struct tdb_context *tdb);
 int tdb_expand(struct tdb_context *tdb, tdb_off_t size);
-tdb_off_t tdb_expand_adjust(tdb_off_t map_size, tdb_off_t size, int page_size);
+tdb_off_t tdb_expand_adjust(tdb_off_t map_size, tdb_off_t size,
+			    tdb_off_t max_map_size, int page_size);
 int tdb_rec_free_read(struct tdb_context *tdb, tdb_off_t off,
 		      struct tdb_record *rec);
 bool tdb_write_all(int fd, const void *buf, size_t count);
 int tdb_transaction_recover(struct tdb_context *tdb);
+int tdb_transaction_hash_heads(struct tdb_context *tdb);
 void tdb_header_hash(struct tdb_context *tdb,
 		     uint32_t *magic1_hash, uint32_t *magic2_hash);
 unsigned int tdb_old_hash(TDB_DATA *key);
 size_t tdb_dead_space(struct tdb_context *tdb, tdb_off_t off);
 bool tdb_add_off_t(tdb_off_t a, tdb_off_t b, tdb_off_t *pret);
-
-/* tdb_off_t and tdb_len_t right now are both uint32_t */
-#define tdb_add_len_t tdb_add_off_t
+bool tdb_add_len_t(tdb_len_t a, tdb_len_t b, tdb_len_t *pret);
+
+size_t tdb_seqlock_size(struct tdb_context *tdb);
+bool tdb_have_seqlocks(struct tdb_context *tdb);
+int tdb_seqlock_mmap(struct tdb_context *tdb);
+int tdb_seqlock_munmap(struct tdb_context *tdb);
+void tdb_seqlock_chain_begin(struct tdb_context *tdb, uint32_t off);
+void tdb_seqlock_chain_end(struct tdb_context *tdb, uint32_t off);
+void tdb_seqlock_allrecord_begin(struct tdb_context *tdb);
+void tdb_seqlock_allrecord_end(struct tdb_context *tdb);
+void tdb_seqlock_refreshed(struct tdb_context *tdb);
+bool tdb_seqlock_parse_record(struct tdb_context *tdb, TDB_DATA key,
+			      uint32_t hash,
+			      int (*parser)(TDB_DATA key, TDB_DATA data,
+					    void *private_data),
+			      void *private_data, int *result);
 
 size_t tdb_mutex_size(struct tdb_context *tdb);
 bool tdb_have_mutexes(struct tdb_context *tdb);
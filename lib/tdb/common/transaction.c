@@ -72,8 +72,13 @@
     into a linearised buffer in the transaction recovery area, then
     marking the transaction recovery area with a magic value to
     indicate a valid recovery record. In total 4 fsync/msync calls are
-    needed per commit to prevent race conditions. It might be possible
-    to reduce this to 3 or even 2 with some more work.
+    needed per commit to prevent race conditions.
+
+  - with TDB_FEATURE_FLAG_RECOVERY_CSUM the recovery data is written
+    together with the magic and a checksum of the data, which is
+    checked before the data is used for recovery. This saves the sync
+    between writing the data and the magic, 3 fsync/msync calls are
+    needed per commit.
 
   - check for a valid recovery record on open of the tdb, while the
     open lock is held. Automatically recover from the transaction
@@ -109,8 +114,10 @@
 */
 struct tdb_transaction {
 	/* we keep a mirrored copy of the tdb hash heads here so
-	   tdb_next_hash_chain() can operate efficiently */
-	uint32_t *hash_heads;
+	   tdb_next_hash_chain() can operate efficiently. This is in
+	   the on-disk format, TDB_OFS_SIZE() bytes per head, the
+	   freelist head first */
+	uint8_t *hash_heads;
 
 	/* the original io methods - used to do IOs to the real db */
 	const struct tdb_methods *io_methods;
@@ -137,7 +144,7 @@ struct tdb_transaction {
 	tdb_off_t magic_offset;
 
 	/* old file size before transaction */
-	tdb_len_t old_map_size;
+	tdb_off_t old_map_size;
 
 	/* did we expand in this transaction */
 	bool expanded;
@@ -195,7 +202,7 @@ static int transaction_read(struct tdb_context *tdb, tdb_off_t off, void *buf,
 	return 0;
 
 fail:
-	TDB_LOG((tdb, TDB_DEBUG_FATAL, "transaction_read: failed at off=%u len=%u\n", off, len));
+	TDB_LOG((tdb, TDB_DEBUG_FATAL, "transaction_read: failed at off=%ju len=%u\n", (uintmax_t)off, len));
 	tdb->ecode = TDB_ERR_IO;
 	tdb->transaction->transaction_error = 1;
 	return -1;
@@ -224,10 +231,17 @@ static int transaction_write(struct tdb_context *tdb, tdb_off_t off,
 
 	/* if the write is to a hash head, then update the transaction
 	   hash heads */
-	if (len == sizeof(tdb_off_t) && off >= FREELIST_TOP &&
-	    off < FREELIST_TOP+TDB_HASHTABLE_SIZE(tdb)) {
-		uint32_t chain = (off-FREELIST_TOP) / sizeof(tdb_off_t);
-		memcpy(&tdb->transaction->hash_heads[chain], buf, len);
+	if (len == TDB_OFS_SIZE(tdb)) {
+		tdb_off_t table_size = tdb->hash_chains * TDB_OFS_SIZE(tdb);
+
+		if (off == FREELIST_TOP) {
+			memcpy(tdb->transaction->hash_heads, buf, len);
+		} else if (off >= tdb->hash_table &&
+			   off < tdb->hash_table + table_size) {
+			memcpy(&tdb->transaction->hash_heads[
+				       off - tdb->hash_table + len],
+			       buf, len);
+		}
 	}
 
 	/* break it up into block sized chunks */
@@ -266,18 +280,20 @@ static int transaction_write(struct tdb_context *tdb, tdb_off_t off,
 
 	/* allocate and fill a block? */
 	if (tdb->transaction->blocks[blk] == NULL) {
+		tdb_off_t blk_ofs = (tdb_off_t)blk * tdb->transaction->block_size;
+
 		tdb->transaction->blocks[blk] = (uint8_t *)calloc(tdb->transaction->block_size, 1);
 		if (tdb->transaction->blocks[blk] == NULL) {
 			tdb->ecode = TDB_ERR_OOM;
 			tdb->transaction->transaction_error = 1;
 			return -1;
 		}
-		if (tdb->transaction->old_map_size > blk * tdb->transaction->block_size) {
+		if (tdb->transaction->old_map_size > blk_ofs) {
 			tdb_len_t len2 = tdb->transaction->block_size;
-			if (len2 + (blk * tdb->transaction->block_size) > tdb->transaction->old_map_size) {
-				len2 = tdb->transaction->old_map_size - (blk * tdb->transaction->block_size);
+			if (len2 + blk_ofs > tdb->transaction->old_map_size) {
+				len2 = tdb->transaction->old_map_size - blk_ofs;
 			}
-			if (tdb->transaction->io_methods->tdb_read(tdb, blk * tdb->transaction->block_size,
+			if (tdb->transaction->io_methods->tdb_read(tdb, blk_ofs,
 								   tdb->transaction->blocks[blk],
 								   len2, 0) != 0) {
 				SAFE_FREE(tdb->transaction->blocks[blk]);
@@ -301,8 +317,9 @@ static int transaction_write(struct tdb_context *tdb, tdb_off_t off,
 	return 0;
 
 fail:
-	TDB_LOG((tdb, TDB_DEBUG_FATAL, "transaction_write: failed at off=%u len=%u\n",
-		 (blk*tdb->transaction->block_size) + off, len));
+	TDB_LOG((tdb, TDB_DEBUG_FATAL, "transaction_write: failed at off=%ju len=%u\n",
+		 (uintmax_t)((tdb_off_t)blk*tdb->transaction->block_size) + off,
+		 len));
 	tdb->transaction->transaction_error = 1;
 	return -1;
 }
@@ -363,9 +380,19 @@ static int transaction_write_existing(struct tdb_context *tdb, tdb_off_t off,
 static void transaction_next_hash_chain(struct tdb_context *tdb, uint32_t *chain)
 {
 	uint32_t h = *chain;
-	for (;h < tdb->hash_size;h++) {
+	size_t ofs_size = TDB_OFS_SIZE(tdb);
+	for (;h < tdb->hash_chains;h++) {
 		/* the +1 takes account of the freelist */
-		if (0 != tdb->transaction->hash_heads[h+1]) {
+		const uint8_t *head = tdb->transaction->hash_heads +
+			(h+1) * ofs_size;
+		size_t i;
+
+		for (i = 0; i < ofs_size; i++) {
+			if (head[i] != 0) {
+				break;
+			}
+		}
+		if (i < ofs_size) {
 			break;
 		}
 	}
@@ -429,6 +456,35 @@ _PUBLIC_ bool tdb_transaction_active(struct tdb_context *tdb)
 	return (tdb->transaction != NULL);
 }
 
+/*
+  (re)load the copy of the freelist and hash chain heads, this is
+  also needed after tdb_rehash() moved the chains
+*/
+int tdb_transaction_hash_heads(struct tdb_context *tdb)
+{
+	uint8_t *heads;
+	size_t ofs_size = TDB_OFS_SIZE(tdb);
+
+	heads = (uint8_t *)calloc(tdb->hash_chains+1, ofs_size);
+	if (heads == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		return -1;
+	}
+	if (tdb->methods->tdb_read(tdb, FREELIST_TOP, heads,
+				   ofs_size, 0) != 0 ||
+	    tdb->methods->tdb_read(tdb, tdb->hash_table, heads + ofs_size,
+				   tdb->hash_chains * ofs_size, 0) != 0) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_start: failed to read hash heads\n"));
+		tdb->ecode = TDB_ERR_IO;
+		free(heads);
+		return -1;
+	}
+
+	SAFE_FREE(tdb->transaction->hash_heads);
+	tdb->transaction->hash_heads = heads;
+	return 0;
+}
+
 /*
   start a tdb transaction. No token is returned, as only a single
   transaction is allowed to be pending per tdb_context
@@ -509,16 +565,7 @@ static int _tdb_transaction_start(struct tdb_context *tdb,
 
 	/* setup a copy of the hash table heads so the hash scan in
 	   traverse can be fast */
-	tdb->transaction->hash_heads = (uint32_t *)
-		calloc(tdb->hash_size+1, sizeof(uint32_t));
-	if (tdb->transaction->hash_heads == NULL) {
-		tdb->ecode = TDB_ERR_OOM;
-		goto fail;
-	}
-	if (tdb->methods->tdb_read(tdb, FREELIST_TOP, tdb->transaction->hash_heads,
-				   TDB_HASHTABLE_SIZE(tdb), 0) != 0) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_start: failed to read hash heads\n"));
-		tdb->ecode = TDB_ERR_IO;
+	if (tdb_transaction_hash_heads(tdb) != 0) {
 		goto fail;
 	}
 
@@ -559,7 +606,7 @@ _PUBLIC_ int tdb_transaction_start_nonblock(struct tdb_context *tdb)
 /*
   sync to disk
 */
-static int transaction_sync(struct tdb_context *tdb, tdb_off_t offset, tdb_len_t length)
+static int transaction_sync(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t length)
 {
 	if (tdb->flags & TDB_NOSYNC) {
 		return 0;
@@ -627,12 +674,17 @@ static int _tdb_transaction_cancel(struct tdb_context *tdb)
 		}
 	}
 
-	/* This also removes the OPEN_LOCK, if we have it. */
-	tdb_release_transaction_locks(tdb);
-
 	/* restore the normal io methods */
 	tdb->methods = tdb->transaction->io_methods;
 
+	/* we might have done (and committed) a tdb_rehash() */
+	if (tdb_hash_table_refresh(tdb) == -1) {
+		ret = -1;
+	}
+
+	/* This also removes the OPEN_LOCK, if we have it. */
+	tdb_release_transaction_locks(tdb);
+
 	SAFE_FREE(tdb->transaction->hash_heads);
 	SAFE_FREE(tdb->transaction);
 
@@ -656,16 +708,19 @@ static bool tdb_recovery_size(struct tdb_context *tdb, tdb_len_t *result)
 	tdb_len_t recovery_size = 0;
 	int i;
 
-	recovery_size = sizeof(uint32_t);
+	recovery_size = TDB_TAILER_SIZE;
 	for (i=0;i<tdb->transaction->num_blocks;i++) {
 		tdb_len_t block_size;
-		if (i * tdb->transaction->block_size >= tdb->transaction->old_map_size) {
+		if ((tdb_off_t)i * tdb->transaction->block_size >=
+		    tdb->transaction->old_map_size) {
 			break;
 		}
 		if (tdb->transaction->blocks[i] == NULL) {
 			continue;
 		}
-		if (!tdb_add_len_t(recovery_size, 2*sizeof(tdb_off_t),
+		/* offset and length header of each block */
+		if (!tdb_add_len_t(recovery_size,
+				   TDB_OFS_SIZE(tdb) + sizeof(uint32_t),
 				   &recovery_size)) {
 			return false;
 		}
@@ -689,7 +744,9 @@ int tdb_recovery_area(struct tdb_context *tdb,
 		      tdb_off_t *recovery_offset,
 		      struct tdb_record *rec)
 {
-	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, recovery_offset) == -1) {
+	uint32_t buf[7];
+
+	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD(tdb), recovery_offset) == -1) {
 		return -1;
 	}
 
@@ -698,10 +755,11 @@ int tdb_recovery_area(struct tdb_context *tdb,
 		return 0;
 	}
 
-	if (methods->tdb_read(tdb, *recovery_offset, rec, sizeof(*rec),
+	if (methods->tdb_read(tdb, *recovery_offset, buf, TDB_REC_SIZE(tdb),
 			      DOCONV()) == -1) {
 		return -1;
 	}
+	tdb_rec_unpack(tdb, buf, rec);
 
 	/* ignore invalid recovery regions: can happen in crash */
 	if (rec->magic != TDB_RECOVERY_MAGIC &&
@@ -724,6 +782,7 @@ static int tdb_recovery_allocate(struct tdb_context *tdb,
 	struct tdb_record rec;
 	const struct tdb_methods *methods = tdb->transaction->io_methods;
 	tdb_off_t recovery_head, new_end;
+	uint32_t head[2] = { 0, 0 };
 
 	if (tdb_recovery_area(tdb, methods, &recovery_head, &rec) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_recovery_allocate: failed to read recovery head\n"));
@@ -746,7 +805,7 @@ static int tdb_recovery_allocate(struct tdb_context *tdb,
 
 	/* If recovery area in middle of file, we need a new one. */
 	if (recovery_head == 0
-	    || recovery_head + sizeof(rec) + rec.rec_len != tdb->map_size) {
+	    || recovery_head + TDB_REC_SIZE(tdb) + rec.rec_len != tdb->map_size) {
 		/* we need to free up the old recovery area, then allocate a
 		   new one at the end of the file. Note that we cannot use
 		   tdb_allocate() to allocate the new one as that might return
@@ -780,10 +839,11 @@ static int tdb_recovery_allocate(struct tdb_context *tdb,
 	/* Expand by more than we need, so we don't do it often. */
 	*recovery_max_size = tdb_expand_adjust(tdb->map_size,
 					       *recovery_size,
+					       TDB_MAX_OFFSET(tdb),
 					       tdb->page_size)
-		- sizeof(rec);
+		- TDB_REC_SIZE(tdb);
 
-	if (!tdb_add_off_t(recovery_head, sizeof(rec), &new_end) ||
+	if (!tdb_add_off_t(recovery_head, TDB_REC_SIZE(tdb), &new_end) ||
 	    !tdb_add_off_t(new_end, *recovery_max_size, &new_end)) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_recovery_allocate: "
 			 "overflow recovery area\n"));
@@ -806,13 +866,16 @@ static int tdb_recovery_allocate(struct tdb_context *tdb,
 
 	/* write the recovery header offset and sync - we can sync without a race here
 	   as the magic ptr in the recovery record has not been set */
-	CONVERT(recovery_head);
-	if (methods->tdb_write(tdb, TDB_RECOVERY_HEAD,
-			       &recovery_head, sizeof(tdb_off_t)) == -1) {
+	tdb_ofs_pack(tdb, recovery_head, head);
+	if (DOCONV()) {
+		tdb_convert(head, sizeof(head));
+	}
+	if (methods->tdb_write(tdb, TDB_RECOVERY_HEAD(tdb),
+			       head, TDB_OFS_SIZE(tdb)) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_recovery_allocate: failed to write recovery head\n"));
 		return -1;
 	}
-	if (transaction_write_existing(tdb, TDB_RECOVERY_HEAD, &recovery_head, sizeof(tdb_off_t)) == -1) {
+	if (transaction_write_existing(tdb, TDB_RECOVERY_HEAD(tdb), head, TDB_OFS_SIZE(tdb)) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_recovery_allocate: failed to write recovery head\n"));
 		return -1;
 	}
@@ -821,6 +884,19 @@ static int tdb_recovery_allocate(struct tdb_context *tdb,
 }
 
 
+/*
+  checksum of the recovery data with TDB_FEATURE_FLAG_RECOVERY_CSUM,
+  stored in the full_hash field of the recovery record
+*/
+static uint32_t tdb_recovery_csum(const unsigned char *data, tdb_len_t len)
+{
+	TDB_DATA d;
+
+	d.dptr = discard_const_p(unsigned char, data);
+	d.dsize = len;
+	return tdb_jenkins_hash(&d);
+}
+
 /*
   setup the recovery data that will be used on a crash during commit
 */
@@ -830,9 +906,13 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 	tdb_len_t recovery_size;
 	unsigned char *data, *p;
 	const struct tdb_methods *methods = tdb->transaction->io_methods;
-	struct tdb_record *rec;
-	tdb_off_t recovery_offset, recovery_max_size;
+	struct tdb_record rec;
+	tdb_off_t recovery_offset;
+	tdb_len_t recovery_max_size;
 	tdb_off_t old_map_size = tdb->transaction->old_map_size;
+	size_t rec_size = TDB_REC_SIZE(tdb);
+	size_t ofs_size = TDB_OFS_SIZE(tdb);
+	bool csum = (tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CSUM);
 	uint32_t magic, tailer;
 	int i;
 
@@ -844,24 +924,15 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 		return -1;
 	}
 
-	data = (unsigned char *)malloc(recovery_size + sizeof(*rec));
+	data = (unsigned char *)malloc(recovery_size + rec_size);
 	if (data == NULL) {
 		tdb->ecode = TDB_ERR_OOM;
 		return -1;
 	}
 
-	rec = (struct tdb_record *)data;
-	memset(rec, 0, sizeof(*rec));
-
-	rec->magic    = TDB_RECOVERY_INVALID_MAGIC;
-	rec->data_len = recovery_size;
-	rec->rec_len  = recovery_max_size;
-	rec->key_len  = old_map_size;
-	CONVERT(*rec);
-
 	/* build the recovery data into a single blob to allow us to do a single
 	   large write, which should be more efficient */
-	p = data + sizeof(*rec);
+	p = data + rec_size;
 	for (i=0;i<tdb->transaction->num_blocks;i++) {
 		tdb_off_t offset;
 		tdb_len_t length;
@@ -870,7 +941,7 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 			continue;
 		}
 
-		offset = i * tdb->transaction->block_size;
+		offset = (tdb_off_t)i * tdb->transaction->block_size;
 		length = tdb->transaction->block_size;
 		if (i == tdb->transaction->num_blocks-1) {
 			length = tdb->transaction->last_block_size;
@@ -885,37 +956,65 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 			tdb->ecode = TDB_ERR_CORRUPT;
 			return -1;
 		}
-		memcpy(p, &offset, 4);
-		memcpy(p+4, &length, 4);
-		if (DOCONV()) {
-			tdb_convert(p, 8);
+		{
+			uint32_t hdr[3];
+
+			tdb_ofs_pack(tdb, offset, hdr);
+			hdr[ofs_size / sizeof(uint32_t)] = length;
+			if (DOCONV()) {
+				tdb_convert(hdr, ofs_size + 4);
+			}
+			memcpy(p, hdr, ofs_size + 4);
 		}
 		/* the recovery area contains the old data, not the
 		   new data, so we have to call the original tdb_read
 		   method to get it */
-		if (methods->tdb_read(tdb, offset, p + 8, length, 0) != 0) {
+		if (methods->tdb_read(tdb, offset, p + ofs_size + 4, length,
+				      0) != 0) {
 			free(data);
 			tdb->ecode = TDB_ERR_IO;
 			return -1;
 		}
-		p += 8 + length;
+		p += ofs_size + 4 + length;
 	}
 
 	/* and the tailer */
-	tailer = sizeof(*rec) + recovery_max_size;
+	tailer = rec_size + recovery_max_size;
 	memcpy(p, &tailer, 4);
 	if (DOCONV()) {
 		tdb_convert(p, 4);
 	}
 
+	memset(&rec, 0, sizeof(rec));
+
+	rec.magic    = TDB_RECOVERY_INVALID_MAGIC;
+	rec.data_len = recovery_size;
+	rec.rec_len  = recovery_max_size;
+	rec.key_len  = old_map_size;
+	if (TDB_LARGE_OFFSETS_P(tdb)) {
+		/* key_len is too small to hold the old map size */
+		rec.next = old_map_size;
+	}
+	if (csum) {
+		/* a partially written record won't be used, see
+		 * tdb_transaction_recover() */
+		rec.magic = TDB_RECOVERY_MAGIC;
+		rec.full_hash = tdb_recovery_csum(data + rec_size,
+						  recovery_size);
+	}
+	tdb_rec_pack(tdb, &rec, data);
+	if (DOCONV()) {
+		tdb_convert(data, rec_size);
+	}
+
 	/* write the recovery data to the recovery area */
-	if (methods->tdb_write(tdb, recovery_offset, data, sizeof(*rec) + recovery_size) == -1) {
+	if (methods->tdb_write(tdb, recovery_offset, data, rec_size + recovery_size) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_setup_recovery: failed to write recovery data\n"));
 		free(data);
 		tdb->ecode = TDB_ERR_IO;
 		return -1;
 	}
-	if (transaction_write_existing(tdb, recovery_offset, data, sizeof(*rec) + recovery_size) == -1) {
+	if (transaction_write_existing(tdb, recovery_offset, data, rec_size + recovery_size) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_setup_recovery: failed to write secondary recovery data\n"));
 		free(data);
 		tdb->ecode = TDB_ERR_IO;
@@ -925,18 +1024,23 @@ static int transaction_setup_recovery(struct tdb_context *tdb,
 	/* as we don't have ordered writes, we have to sync the recovery
 	   data before we update the magic to indicate that the recovery
 	   data is present */
-	if (transaction_sync(tdb, recovery_offset, sizeof(*rec) + recovery_size) == -1) {
+	if (transaction_sync(tdb, recovery_offset, rec_size + recovery_size) == -1) {
 		free(data);
 		return -1;
 	}
 
 	free(data);
 
+	*magic_offset = recovery_offset + TDB_REC_MAGIC_OFS(tdb);
+
+	if (csum) {
+		/* the magic was part of the data */
+		return 0;
+	}
+
 	magic = TDB_RECOVERY_MAGIC;
 	CONVERT(magic);
 
-	*magic_offset = recovery_offset + offsetof(struct tdb_record, magic);
-
 	if (methods->tdb_write(tdb, *magic_offset, &magic, sizeof(magic)) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_setup_recovery: failed to write recovery magic\n"));
 		tdb->ecode = TDB_ERR_IO;
@@ -1074,17 +1178,21 @@ static bool repack_worthwhile(struct tdb_context *tdb)
 	tdb_off_t ptr;
 	struct tdb_record rec;
 	tdb_len_t total = 0, largest = 0;
+	unsigned list;
 
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &ptr) == -1) {
-		return false;
-	}
+	for (list = 0; list < TDB_NUM_FREELISTS(tdb); list++) {
+		if (tdb_ofs_read(tdb, TDB_FREELIST_TOP(tdb, list),
+				 &ptr) == -1) {
+			return false;
+		}
 
-	while (ptr != 0 && tdb_rec_free_read(tdb, ptr, &rec) == 0) {
-		total += rec.rec_len;
-		if (rec.rec_len > largest) {
-			largest = rec.rec_len;
+		while (ptr != 0 && tdb_rec_free_read(tdb, ptr, &rec) == 0) {
+			total += rec.rec_len;
+			if (rec.rec_len > largest) {
+				largest = rec.rec_len;
+			}
+			ptr = rec.next;
 		}
-		ptr = rec.next;
 	}
 
 	return total > largest * 2;
@@ -1142,7 +1250,7 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 			continue;
 		}
 
-		offset = i * tdb->transaction->block_size;
+		offset = (tdb_off_t)i * tdb->transaction->block_size;
 		length = tdb->transaction->block_size;
 		if (i == tdb->transaction->num_blocks-1) {
 			length = tdb->transaction->last_block_size;
@@ -1214,11 +1322,14 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 {
 	tdb_off_t recovery_head, recovery_eof;
 	unsigned char *data, *p;
-	uint32_t zero = 0;
+	size_t ofs_size = TDB_OFS_SIZE(tdb);
+	bool csum = (tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CSUM);
+	tdb_off_t zero = 0;
+	uint32_t zero_magic = 0;
 	struct tdb_record rec;
 
 	/* find the recovery area */
-	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, &recovery_head) == -1) {
+	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD(tdb), &recovery_head) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to read recovery head\n"));
 		tdb->ecode = TDB_ERR_IO;
 		return -1;
@@ -1230,8 +1341,7 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 	}
 
 	/* read the recovery record */
-	if (tdb->methods->tdb_read(tdb, recovery_head, &rec,
-				   sizeof(rec), DOCONV()) == -1) {
+	if (tdb_rec_read_raw(tdb, recovery_head, &rec) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to read recovery record\n"));
 		tdb->ecode = TDB_ERR_IO;
 		return -1;
@@ -1249,6 +1359,16 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 	}
 
 	recovery_eof = rec.key_len;
+	if (TDB_LARGE_OFFSETS_P(tdb)) {
+		recovery_eof = rec.next;
+	}
+
+	if (csum &&
+	    (rec.data_len > rec.rec_len ||
+	     tdb->methods->tdb_oob(tdb, recovery_head + TDB_REC_SIZE(tdb),
+				   rec.data_len, 1) != 0)) {
+		goto incomplete;
+	}
 
 	data = (unsigned char *)malloc(rec.data_len);
 	if (data == NULL) {
@@ -1258,31 +1378,50 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 	}
 
 	/* read the full recovery data */
-	if (tdb->methods->tdb_read(tdb, recovery_head + sizeof(rec), data,
+	if (tdb->methods->tdb_read(tdb, recovery_head + TDB_REC_SIZE(tdb), data,
 				   rec.data_len, 0) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to read recovery data\n"));
 		tdb->ecode = TDB_ERR_IO;
+		free(data);
 		return -1;
 	}
 
-	/* recover the file data */
+	/*
+	 * With a single sync for the recovery data and the magic we
+	 * might have crashed before all of it was on disk. The data
+	 * is only written after that sync, so there's nothing to undo.
+	 */
+	if (csum && tdb_recovery_csum(data, rec.data_len) != rec.full_hash) {
+		free(data);
+		goto incomplete;
+	}
+
+	/* recover the file data, lock-free readers have to retry */
+	tdb_seqlock_allrecord_begin(tdb);
 	p = data;
-	while (p+8 < data + rec.data_len) {
-		uint32_t ofs, len;
+	while (p + ofs_size + 4 < data + rec.data_len) {
+		uint32_t hdr[3];
+		tdb_off_t ofs;
+		uint32_t len;
+
+		memcpy(hdr, p, ofs_size + 4);
 		if (DOCONV()) {
-			tdb_convert(p, 8);
+			tdb_convert(hdr, ofs_size + 4);
 		}
-		memcpy(&ofs, p, 4);
-		memcpy(&len, p+4, 4);
+		ofs = tdb_ofs_unpack(tdb, hdr);
+		len = hdr[ofs_size / sizeof(uint32_t)];
+		p += ofs_size + 4;
 
-		if (tdb->methods->tdb_write(tdb, ofs, p+8, len) == -1) {
+		if (tdb->methods->tdb_write(tdb, ofs, p, len) == -1) {
+			tdb_seqlock_allrecord_end(tdb);
 			free(data);
-			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to recover %u bytes at offset %u\n", len, ofs));
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to recover %u bytes at offset %ju\n", len, (uintmax_t)ofs));
 			tdb->ecode = TDB_ERR_IO;
 			return -1;
 		}
-		p += 8 + len;
+		p += len;
 	}
+	tdb_seqlock_allrecord_end(tdb);
 
 	free(data);
 
@@ -1294,7 +1433,7 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 
 	/* if the recovery area is after the recovered eof then remove it */
 	if (recovery_eof <= recovery_head) {
-		if (tdb_ofs_write(tdb, TDB_RECOVERY_HEAD, &zero) == -1) {
+		if (tdb_ofs_write(tdb, TDB_RECOVERY_HEAD(tdb), &zero) == -1) {
 			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to remove recovery head\n"));
 			tdb->ecode = TDB_ERR_IO;
 			return -1;
@@ -1302,8 +1441,8 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 	}
 
 	/* remove the recovery magic */
-	if (tdb_ofs_write(tdb, recovery_head + offsetof(struct tdb_record, magic),
-			  &zero) == -1) {
+	if (tdb_u32_write(tdb, recovery_head + TDB_REC_MAGIC_OFS(tdb),
+			  &zero_magic) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to remove recovery magic\n"));
 		tdb->ecode = TDB_ERR_IO;
 		return -1;
@@ -1315,11 +1454,25 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 		return -1;
 	}
 
-	TDB_LOG((tdb, TDB_DEBUG_TRACE, "tdb_transaction_recover: recovered %u byte database\n",
-		 recovery_eof));
+	TDB_LOG((tdb, TDB_DEBUG_TRACE, "tdb_transaction_recover: recovered %ju byte database\n",
+		 (uintmax_t)recovery_eof));
 
 	/* all done */
 	return 0;
+
+incomplete:
+	TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_transaction_recover: ignoring "
+		 "incomplete recovery data at %ju\n", (uintmax_t)recovery_head));
+
+	if (tdb_u32_write(tdb, recovery_head + TDB_REC_MAGIC_OFS(tdb),
+			  &zero_magic) == -1 ||
+	    transaction_sync(tdb, recovery_head + TDB_REC_MAGIC_OFS(tdb),
+			     sizeof(zero_magic)) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to remove recovery magic\n"));
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
+	return 0;
 }
 
 /* Any I/O failures we say "needs recovery". */
@@ -1329,7 +1482,7 @@ bool tdb_needs_recovery(struct tdb_context *tdb)
 	struct tdb_record rec;
 
 	/* find the recovery area */
-	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, &recovery_head) == -1) {
+	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD(tdb), &recovery_head) == -1) {
 		return true;
 	}
 
@@ -1339,8 +1492,7 @@ bool tdb_needs_recovery(struct tdb_context *tdb)
 	}
 
 	/* read the recovery record */
-	if (tdb->methods->tdb_read(tdb, recovery_head, &rec,
-				   sizeof(rec), DOCONV()) == -1) {
+	if (tdb_rec_read_raw(tdb, recovery_head, &rec) == -1) {
 		return true;
 	}
 
@@ -37,7 +37,7 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 	int want_next = (tlock->off != 0);
 
 	/* Lock each chain from the start one. */
-	for (; tlock->list < tdb->hash_size; tlock->list++) {
+	for (; tlock->list < tdb->hash_chains; tlock->list++) {
 		if (!tlock->off && tlock->list != 0) {
 			/* this is an optimisation for the common case where
 			   the hash chain is empty, which is particularly
@@ -68,17 +68,17 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 			   system (testing using ldbtest).
 			*/
 			tdb->methods->next_hash_chain(tdb, &tlock->list);
-			if (tlock->list == tdb->hash_size) {
+			if (tlock->list == tdb->hash_chains) {
 				continue;
 			}
 		}
 
-		if (tdb_lock(tdb, tlock->list, tlock->lock_rw) == -1)
+		if (tdb_lock(tdb, BUCKET(tlock->list), tlock->lock_rw) == -1)
 			return TDB_NEXT_LOCK_ERR;
 
 		/* No previous record?  Start at top of chain. */
 		if (!tlock->off) {
-			if (tdb_ofs_read(tdb, TDB_HASH_TOP(tlock->list),
+			if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, tlock->list),
 				     &tlock->off) == -1)
 				goto fail;
 		} else {
@@ -121,7 +121,7 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 			    tdb_do_delete(tdb, current, rec) != 0)
 				goto fail;
 		}
-		tdb_unlock(tdb, tlock->list, tlock->lock_rw);
+		tdb_unlock(tdb, BUCKET(tlock->list), tlock->lock_rw);
 		want_next = 0;
 	}
 	/* We finished iteration without finding anything */
@@ -130,7 +130,7 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 
  fail:
 	tlock->off = 0;
-	if (tdb_unlock(tdb, tlock->list, tlock->lock_rw) != 0)
+	if (tdb_unlock(tdb, BUCKET(tlock->list), tlock->lock_rw) != 0)
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_next_lock: On error unlock failed!\n"));
 	return TDB_NEXT_LOCK_ERR;
 }
@@ -181,7 +181,7 @@ static int tdb_traverse_internal(struct tdb_context *tdb,
 
 			if (key.dptr == NULL) {
 				ret = -1;
-				if (tdb_unlock(tdb, tl->list, tl->lock_rw)
+				if (tdb_unlock(tdb, BUCKET(tl->list), tl->lock_rw)
 				    != 0) {
 					goto out;
 				}
@@ -201,11 +201,11 @@ static int tdb_traverse_internal(struct tdb_context *tdb,
 		}
 		count++;
 		/* now read the full record */
-		nread = tdb->methods->tdb_read(tdb, tl->off + sizeof(rec),
+		nread = tdb->methods->tdb_read(tdb, tl->off + TDB_REC_SIZE(tdb),
 					       key.dptr, full_len, 0);
 		if (nread == -1) {
 			ret = -1;
-			if (tdb_unlock(tdb, tl->list, tl->lock_rw) != 0)
+			if (tdb_unlock(tdb, BUCKET(tl->list), tl->lock_rw) != 0)
 				goto out;
 			if (tdb_unlock_record(tdb, tl->off) != 0)
 				TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_traverse: key.dptr == NULL and unlock_record failed!\n"));
@@ -218,7 +218,7 @@ static int tdb_traverse_internal(struct tdb_context *tdb,
 		tdb_trace_1rec_retrec(tdb, "traverse", key, dbuf);
 
 		/* Drop chain lock, call out */
-		if (tdb_unlock(tdb, tl->list, tl->lock_rw) != 0) {
+		if (tdb_unlock(tdb, BUCKET(tl->list), tl->lock_rw) != 0) {
 			ret = -1;
 			goto out;
 		}
@@ -325,12 +325,12 @@ _PUBLIC_ TDB_DATA tdb_firstkey(struct tdb_context *tdb)
 	}
 	/* now read the key */
 	key.dsize = rec.key_len;
-	key.dptr =tdb_alloc_read(tdb,tdb->travlocks.off+sizeof(rec),key.dsize);
+	key.dptr =tdb_alloc_read(tdb,tdb->travlocks.off+TDB_REC_SIZE(tdb),key.dsize);
 
 	tdb_trace_retrec(tdb, "tdb_firstkey", key);
 
 	/* Unlock the hash chain of the record we just read. */
-	if (tdb_unlock(tdb, tdb->travlocks.list, tdb->travlocks.lock_rw) != 0)
+	if (tdb_unlock(tdb, BUCKET(tdb->travlocks.list), tdb->travlocks.lock_rw) != 0)
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_firstkey: error occurred while tdb_unlocking!\n"));
 	return key;
 }
@@ -346,10 +346,10 @@ _PUBLIC_ TDB_DATA tdb_nextkey(struct tdb_context *tdb, TDB_DATA oldkey)
 
 	/* Is locked key the old key?  If so, traverse will be reliable. */
 	if (tdb->travlocks.off) {
-		if (tdb_lock(tdb,tdb->travlocks.list,tdb->travlocks.lock_rw))
+		if (tdb_lock(tdb, BUCKET(tdb->travlocks.list), tdb->travlocks.lock_rw))
 			return tdb_null;
 		if (tdb_rec_read(tdb, tdb->travlocks.off, &rec) == -1
-		    || !(k = tdb_alloc_read(tdb,tdb->travlocks.off+sizeof(rec),
+		    || !(k = tdb_alloc_read(tdb,tdb->travlocks.off+TDB_REC_SIZE(tdb),
 					    rec.key_len))
 		    || memcmp(k, oldkey.dptr, oldkey.dsize) != 0) {
 			/* No, it wasn't: unlock it and start from scratch */
@@ -359,11 +359,18 @@ _PUBLIC_ TDB_DATA tdb_nextkey(struct tdb_context *tdb, TDB_DATA oldkey)
 				SAFE_FREE(k);
 				return tdb_null;
 			}
-			if (tdb_unlock(tdb, tdb->travlocks.list, tdb->travlocks.lock_rw) != 0) {
+			if (tdb_unlock(tdb, BUCKET(tdb->travlocks.list), tdb->travlocks.lock_rw) != 0) {
 				SAFE_FREE(k);
 				return tdb_null;
 			}
 			tdb->travlocks.off = 0;
+		} else {
+			/*
+			 * The chain might have been moved by a
+			 * tdb_rehash() since the last call, the lock
+			 * is the same.
+			 */
+			tdb->travlocks.list = CHAIN(rec.full_hash);
 		}
 
 		SAFE_FREE(k);
@@ -376,7 +383,7 @@ _PUBLIC_ TDB_DATA tdb_nextkey(struct tdb_context *tdb, TDB_DATA oldkey)
 			tdb_trace_1rec_retrec(tdb, "tdb_nextkey", oldkey, tdb_null);
 			return tdb_null;
 		}
-		tdb->travlocks.list = BUCKET(rec.full_hash);
+		tdb->travlocks.list = CHAIN(rec.full_hash);
 		if (tdb_lock_record(tdb, tdb->travlocks.off) != 0) {
 			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_nextkey: lock_record failed (%s)!\n", strerror(errno)));
 			return tdb_null;
@@ -389,16 +396,208 @@ _PUBLIC_ TDB_DATA tdb_nextkey(struct tdb_context *tdb, TDB_DATA oldkey)
 	off = tdb_next_lock(tdb, &tdb->travlocks, &rec);
 	if (off != TDB_NEXT_LOCK_ERR && off != 0) {
 		key.dsize = rec.key_len;
-		key.dptr = tdb_alloc_read(tdb, tdb->travlocks.off+sizeof(rec),
+		key.dptr = tdb_alloc_read(tdb, tdb->travlocks.off+TDB_REC_SIZE(tdb),
 					  key.dsize);
 		/* Unlock the chain of this new record */
-		if (tdb_unlock(tdb, tdb->travlocks.list, tdb->travlocks.lock_rw) != 0)
+		if (tdb_unlock(tdb, BUCKET(tdb->travlocks.list), tdb->travlocks.lock_rw) != 0)
 			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_nextkey: WARNING tdb_unlock failed!\n"));
 	}
 	/* Unlock the chain of old record */
-	if (tdb_unlock(tdb, oldlist, tdb->travlocks.lock_rw) != 0)
+	if (tdb_unlock(tdb, BUCKET(oldlist), tdb->travlocks.lock_rw) != 0)
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_nextkey: WARNING tdb_unlock failed!\n"));
 	tdb_trace_1rec_retrec(tdb, "tdb_nextkey", oldkey, key);
 	return key;
 }
 
+
+/*
+  A snapshot is a private copy of all live records, taken under the
+  allrecord read lock. The records of each hash chain are stored back
+  to back as key length, data length, key and data, chain_ofs[i] is
+  where chain i starts in buf.
+*/
+struct tdb_snapshot {
+	struct tdb_context *tdb;
+	uint32_t num_chains;
+	size_t *chain_ofs;
+	uint8_t *buf;
+	size_t buf_len;
+	size_t buf_size;
+};
+
+#define TDB_SNAPSHOT_REC_HDR (2 * sizeof(tdb_len_t))
+
+static int tdb_snapshot_chain(struct tdb_snapshot *snap, uint32_t list)
+{
+	struct tdb_context *tdb = snap->tdb;
+	struct tdb_record rec;
+	tdb_off_t off, max_recs, num_recs = 0;
+
+	/* Bound the walk so that a loop in a corrupt chain ends */
+	max_recs = tdb->map_size / TDB_REC_SIZE(tdb);
+
+	if (tdb_ofs_read(tdb, TDB_HASH_TOP(tdb, list), &off) == -1) {
+		return -1;
+	}
+
+	while (off != 0) {
+		tdb_len_t full_len;
+		size_t needed;
+
+		if (tdb_rec_read(tdb, off, &rec) == -1) {
+			return -1;
+		}
+		if (++num_recs > max_recs) {
+			tdb->ecode = TDB_ERR_CORRUPT;
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_snapshot: "
+				 "loop detected in chain %u.\n", list));
+			return -1;
+		}
+		if (TDB_DEAD(&rec)) {
+			off = rec.next;
+			continue;
+		}
+		if (!tdb_add_len_t(rec.key_len, rec.data_len, &full_len)) {
+			tdb->ecode = TDB_ERR_CORRUPT;
+			return -1;
+		}
+
+		needed = snap->buf_len + TDB_SNAPSHOT_REC_HDR + full_len;
+		if (needed > snap->buf_size) {
+			size_t new_size = MAX(needed, snap->buf_size * 2);
+			uint8_t *new_buf;
+
+			new_buf = (uint8_t *)realloc(snap->buf, new_size);
+			if (new_buf == NULL) {
+				tdb->ecode = TDB_ERR_OOM;
+				return -1;
+			}
+			snap->buf = new_buf;
+			snap->buf_size = new_size;
+		}
+
+		memcpy(snap->buf + snap->buf_len, &rec.key_len,
+		       sizeof(tdb_len_t));
+		memcpy(snap->buf + snap->buf_len + sizeof(tdb_len_t),
+		       &rec.data_len, sizeof(tdb_len_t));
+		if (tdb->methods->tdb_read(
+			    tdb, off + TDB_REC_SIZE(tdb),
+			    snap->buf + snap->buf_len + TDB_SNAPSHOT_REC_HDR,
+			    full_len, 0) == -1) {
+			return -1;
+		}
+		snap->buf_len = needed;
+		off = rec.next;
+	}
+
+	return 0;
+}
+
+/*
+  take a consistent copy of the database. The allrecord read lock is
+  only held while the records are copied, writers are blocked for that
+  time only, not while the callbacks of tdb_snapshot_traverse() run.
+*/
+_PUBLIC_ struct tdb_snapshot *tdb_snapshot(struct tdb_context *tdb)
+{
+	struct tdb_snapshot *snap;
+	uint32_t i;
+
+	tdb_trace(tdb, "tdb_snapshot");
+
+	snap = (struct tdb_snapshot *)calloc(1, sizeof(*snap));
+	if (snap == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		return NULL;
+	}
+	snap->tdb = tdb;
+
+	if (tdb_lockall_read(tdb) == -1) {
+		free(snap);
+		return NULL;
+	}
+
+	/* The hash table is up to date while we hold the lock */
+	snap->num_chains = tdb->hash_chains;
+	snap->chain_ofs = (size_t *)calloc(snap->num_chains + 1,
+					   sizeof(size_t));
+	if (snap->chain_ofs == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		goto fail;
+	}
+
+	for (i = 0; i < snap->num_chains; i++) {
+		snap->chain_ofs[i] = snap->buf_len;
+		if (tdb_snapshot_chain(snap, i) == -1) {
+			goto fail;
+		}
+	}
+	snap->chain_ofs[i] = snap->buf_len;
+
+	tdb_unlockall_read(tdb);
+	return snap;
+
+fail:
+	tdb_unlockall_read(tdb);
+	tdb_snapshot_free(snap);
+	return NULL;
+}
+
+_PUBLIC_ uint32_t tdb_snapshot_num_chains(struct tdb_snapshot *snap)
+{
+	return snap->num_chains;
+}
+
+/*
+  traverse the records of a snapshot in the hash chains
+  [first_chain, first_chain + num_chains). No lock is held and the
+  snapshot is not modified, so several ranges of one snapshot can be
+  traversed at the same time, e.g. from different threads.
+*/
+_PUBLIC_ int tdb_snapshot_traverse(struct tdb_snapshot *snap,
+				   uint32_t first_chain, uint32_t num_chains,
+				   tdb_traverse_func fn, void *private_data)
+{
+	size_t ofs, end;
+	int count = 0;
+
+	if (first_chain >= snap->num_chains) {
+		return 0;
+	}
+	num_chains = MIN(num_chains, snap->num_chains - first_chain);
+
+	ofs = snap->chain_ofs[first_chain];
+	end = snap->chain_ofs[first_chain + num_chains];
+
+	while (ofs < end) {
+		TDB_DATA key, dbuf;
+		tdb_len_t key_len, data_len;
+
+		memcpy(&key_len, snap->buf + ofs, sizeof(tdb_len_t));
+		memcpy(&data_len, snap->buf + ofs + sizeof(tdb_len_t),
+		       sizeof(tdb_len_t));
+
+		key.dptr = snap->buf + ofs + TDB_SNAPSHOT_REC_HDR;
+		key.dsize = key_len;
+		dbuf.dptr = key.dptr + key_len;
+		dbuf.dsize = data_len;
+		ofs += TDB_SNAPSHOT_REC_HDR + key_len + data_len;
+
+		count++;
+		if (fn && fn(snap->tdb, key, dbuf, private_data)) {
+			break;
+		}
+	}
+
+	return count;
+}
+
+_PUBLIC_ void tdb_snapshot_free(struct tdb_snapshot *snap)
+{
+	if (snap == NULL) {
+		return;
+	}
+	SAFE_FREE(snap->chain_ofs);
+	SAFE_FREE(snap->buf);
+	free(snap);
+}
@@ -84,6 +84,15 @@ extern "C" {
 #define TDB_MUTEX_LOCKING 4096 /** optimized locking using robust mutexes if supported,
                                    only with tdb >= 1.3.0 and TDB_CLEAR_IF_FIRST
                                    after checking tdb_runtime_check_for_robust_mutexes() */
+#define TDB_LARGE_OFFSETS 8192 /** Create the db with 64 bit offsets, allowing it to grow beyond 4GB.
+                                   Can't be opened by tdb < 1.3.16 */
+#define TDB_SEQLOCK 16384 /** Create the db with sequence counters, small records are read
+                             without taking the chain lock. Can't be opened by tdb < 1.3.18 */
+#define TDB_FREELIST_CLASSES 32768 /** Create the db with free lists by size class for faster
+                                      allocations. Can't be opened by tdb < 1.3.19 */
+#define TDB_RECOVERY_CHECKSUM 65536 /** Create the db with a checksummed transaction recovery area,
+                                       saving one fsync per commit. Can't be opened by tdb < 1.3.20 */
+#define TDB_FAST_HASH 131072 /** Better and faster hashing with tdb_fast_hash(). Can't be opened by tdb < 1.3.22 */
 
 /** The tdb error codes */
 enum TDB_ERROR {TDB_SUCCESS=0, TDB_ERR_CORRUPT, TDB_ERR_IO, TDB_ERR_LOCK, 
@@ -152,6 +161,30 @@ struct tdb_logging_context {
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_LARGE_OFFSETS - Create the database with 64 bit offsets,
+ *                                             so it can grow beyond 4GB. Ignored for an
+ *                                             existing database, can't be opened by tdb < 1.3.16.\n
+ *                         TDB_SEQLOCK - Create the database with per chain sequence
+ *                                       counters, tdb_fetch(), tdb_parse_record() and
+ *                                       tdb_exists() then don't lock unless a writer is
+ *                                       active. Ignored for an existing database, can't
+ *                                       be opened by tdb < 1.3.18.\n
+ *                         TDB_FREELIST_CLASSES - Create the database with free lists by
+ *                                                size class, making allocations in
+ *                                                fragmented databases O(1) on average.
+ *                                                Ignored for an existing database,
+ *                                                can't be opened by tdb < 1.3.19.\n
+ *                         TDB_RECOVERY_CHECKSUM - Create the database with a checksum
+ *                                                 over the transaction recovery data,
+ *                                                 which saves one of the four fsync
+ *                                                 calls per transaction commit. Ignored
+ *                                                 for an existing database, can't be
+ *                                                 opened by tdb < 1.3.20.\n
+ *                         TDB_FAST_HASH - Create the database with tdb_fast_hash(),
+ *                                         which is faster than the jenkins hash of
+ *                                         TDB_INCOMPATIBLE_HASH. Ignored for an
+ *                                         existing database, can't be opened by
+ *                                         tdb < 1.3.22.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
@@ -193,6 +226,30 @@ struct tdb_context *tdb_open(const char *name, int hash_size, int tdb_flags,
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_LARGE_OFFSETS - Create the database with 64 bit offsets,
+ *                                             so it can grow beyond 4GB. Ignored for an
+ *                                             existing database, can't be opened by tdb < 1.3.16.\n
+ *                         TDB_SEQLOCK - Create the database with per chain sequence
+ *                                       counters, tdb_fetch(), tdb_parse_record() and
+ *                                       tdb_exists() then don't lock unless a writer is
+ *                                       active. Ignored for an existing database, can't
+ *                                       be opened by tdb < 1.3.18.\n
+ *                         TDB_FREELIST_CLASSES - Create the database with free lists by
+ *                                                size class, making allocations in
+ *                                                fragmented databases O(1) on average.
+ *                                                Ignored for an existing database,
+ *                                                can't be opened by tdb < 1.3.19.\n
+ *                         TDB_RECOVERY_CHECKSUM - Create the database with a checksum
+ *                                                 over the transaction recovery data,
+ *                                                 which saves one of the four fsync
+ *                                                 calls per transaction commit. Ignored
+ *                                                 for an existing database, can't be
+ *                                                 opened by tdb < 1.3.20.\n
+ *                         TDB_FAST_HASH - Create the database with tdb_fast_hash(),
+ *                                         which is faster than the jenkins hash of
+ *                                         TDB_INCOMPATIBLE_HASH. Ignored for an
+ *                                         existing database, can't be opened by
+ *                                         tdb < 1.3.22.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
@@ -307,6 +364,9 @@ TDB_DATA tdb_fetch(struct tdb_context *tdb, TDB_DATA key);
  * call other tdb routines from within the parser. Also, for good performance
  * you should make the parser fast to allow parallel operations.
  *
+ * @note With TDB_SEQLOCK small records are read without a lock, the parser
+ * then gets a private copy of the data.
+ *
  * @param[in]  tdb      The tdb to parse the record.
  *
  * @param[in]  key      The key to parse.
@@ -480,6 +540,81 @@ int tdb_traverse(struct tdb_context *tdb, tdb_traverse_func fn, void *private_da
  */
 int tdb_traverse_read(struct tdb_context *tdb, tdb_traverse_func fn, void *private_data);
 
+struct tdb_snapshot;
+
+/**
+ * @brief Take a snapshot of the entire database.
+ *
+ * All records are copied into memory under a read lock on the whole
+ * database, which is released again before this returns. Writers are
+ * only blocked while the records are copied, the snapshot can then be
+ * traversed with tdb_snapshot_traverse() without holding any lock.
+ *
+ * @param[in]  tdb      The database to take the snapshot of.
+ *
+ * @return              The snapshot, NULL on error with error code set.
+ *                      It has to be freed with tdb_snapshot_free().
+ *
+ * @note The snapshot takes as much memory as the keys and data of all
+ *       records together.
+ *
+ * @see tdb_snapshot_traverse()
+ */
+struct tdb_snapshot *tdb_snapshot(struct tdb_context *tdb);
+
+/**
+ * @brief Get the number of hash chains in a snapshot.
+ *
+ * @param[in]  snap     The snapshot to use.
+ *
+ * @return              The number of hash chains the database had when
+ *                      the snapshot was taken.
+ */
+uint32_t tdb_snapshot_num_chains(struct tdb_snapshot *snap);
+
+/**
+ * @brief Traverse a range of hash chains of a snapshot.
+ *
+ * The function fn(tdb, key, data, state) is called on each record in
+ * the hash chains first_chain to first_chain + num_chains - 1 of the
+ * snapshot, chains beyond the end are ignored. A non-zero return value
+ * from fn() stops the traversal. No lock is held while fn() runs, it
+ * may modify the database, changes are not visible in the snapshot.
+ *
+ * The snapshot is not modified, so different ranges of one snapshot can
+ * be traversed in parallel, for example in several threads. The tdb
+ * context given to fn() must not be used by more than one thread at a
+ * time then.
+ *
+ * @warning The data buffer given to the callback fn does NOT meet the
+ * alignment restrictions malloc gives you.
+ *
+ * @param[in]  snap     The snapshot to traverse.
+ *
+ * @param[in]  first_chain The first hash chain to traverse.
+ *
+ * @param[in]  num_chains The number of hash chains to traverse.
+ *
+ * @param[in]  fn       The function to call on each entry.
+ *
+ * @param[in]  private_data The private data which should be passed to the
+ *                          traversing function.
+ *
+ * @return              The record count traversed.
+ *
+ * @see tdb_snapshot_num_chains()
+ */
+int tdb_snapshot_traverse(struct tdb_snapshot *snap,
+			  uint32_t first_chain, uint32_t num_chains,
+			  tdb_traverse_func fn, void *private_data);
+
+/**
+ * @brief Free a snapshot.
+ *
+ * @param[in]  snap     The snapshot to free, may be NULL.
+ */
+void tdb_snapshot_free(struct tdb_snapshot *snap);
+
 /**
  * @brief Check if an entry in the database exists.
  *
@@ -785,10 +920,41 @@ int tdb_get_seqnum(struct tdb_context *tdb);
  *
  * @param[in]  tdb      The database to get the hash size from.
  *
- * @return              The hash size.
+ * @return              The hash size, this is the number of hash chains
+ *                      set by tdb_rehash() if it was used.
  */
 int tdb_hash_size(struct tdb_context *tdb);
 
+/**
+ * @brief Change the number of hash chains of a database.
+ *
+ * The hash size given to tdb_open() can't be changed, as it also
+ * defines the locks. But the hash chains can be split further, this
+ * makes lookups in a database which has grown much larger than
+ * expected fast again. The records are not copied, only relinked.
+ *
+ * This runs as a transaction, other processes can keep the database
+ * open and use it at the same time. They pick up the new hash table
+ * with their next lock. A tdb_traverse_read() running in another
+ * process at the same time may miss or repeat records.
+ *
+ * @param[in]  tdb      The database to change.
+ *
+ * @param[in]  hash_size The new number of hash chains, this must be a
+ *                      multiple of the hash size the database was
+ *                      created with. Using that hash size itself moves
+ *                      the hash chains back to their original place.
+ *
+ * @return              0 on success, -1 on error with error code set.
+ *
+ * @note A database with more hash chains can't be opened by tdb
+ *       versions older than 1.3.17.
+ *
+ * @see tdb_hash_size()
+ * @see tdb_transaction_start()
+ */
+int tdb_rehash(struct tdb_context *tdb, uint32_t hash_size);
+
 /**
  * @brief Get the map size.
  *
@@ -856,6 +1022,19 @@ void tdb_increment_seqnum_nonblock(struct tdb_context *tdb);
  */
 unsigned int tdb_jenkins_hash(TDB_DATA *key);
 
+/**
+ * @brief Create a hash of the key, faster than tdb_jenkins_hash().
+ *
+ * This is the hash used for databases created with TDB_FAST_HASH. It
+ * is a 32 bit xxHash, which handles longer keys in four independent
+ * lanes.
+ *
+ * @param[in]  key      The key to hash
+ *
+ * @return              The hash.
+ */
+unsigned int tdb_fast_hash(TDB_DATA *key);
+
 /**
  * @brief Check the consistency of the database.
  *
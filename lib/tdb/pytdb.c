@@ -770,6 +770,11 @@ PyObject* module_init(void)
 	PyModule_AddIntConstant(m, "ALLOW_NESTING", TDB_ALLOW_NESTING);
 	PyModule_AddIntConstant(m, "DISALLOW_NESTING", TDB_DISALLOW_NESTING);
 	PyModule_AddIntConstant(m, "INCOMPATIBLE_HASH", TDB_INCOMPATIBLE_HASH);
+	PyModule_AddIntConstant(m, "LARGE_OFFSETS", TDB_LARGE_OFFSETS);
+	PyModule_AddIntConstant(m, "SEQLOCK", TDB_SEQLOCK);
+	PyModule_AddIntConstant(m, "FREELIST_CLASSES", TDB_FREELIST_CLASSES);
+	PyModule_AddIntConstant(m, "RECOVERY_CHECKSUM", TDB_RECOVERY_CHECKSUM);
+	PyModule_AddIntConstant(m, "FAST_HASH", TDB_FAST_HASH);
 
 	PyModule_AddStringConstant(m, "__docformat__", "restructuredText");
 
@@ -10,6 +10,7 @@
 #include "../common/check.c"
 #include "../common/hash.c"
 #include "../common/mutex.c"
+#include "../common/seqlock.c"
 #include "tap-interface.h"
 #include <stdlib.h>
 #include "logging.h"
@@ -35,8 +36,8 @@ static int tdb_expand_file_sparse(struct tdb_context *tdb,
 			errno = ENOSPC;
 		}
 		if (written != 1) {
-			TDB_LOG((tdb, TDB_DEBUG_FATAL, "expand_file to %d failed (%s)\n",
-				 size+addition, strerror(errno)));
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "expand_file to %ju failed (%s)\n",
+				 (uintmax_t)(size+addition), strerror(errno)));
 			return -1;
 		}
 	}
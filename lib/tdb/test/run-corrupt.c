@@ -10,6 +10,7 @@
 #include "../common/check.c"
 #include "../common/hash.c"
 #include "../common/mutex.c"
+#include "../common/seqlock.c"
 #include "tap-interface.h"
 #include <stdlib.h>
 #include "logging.h"
@@ -76,20 +77,25 @@ static void check_test(struct tdb_context *tdb)
 			abort();
 	}
 
-	/* This is how many bytes we expect to be verifiable. */
+	/* This is how many bits we expect to be verifiable. */
 	/* From the file header. */
 	verifiable = strlen(TDB_MAGIC_FOOD) + 1
-		+ 2 * sizeof(uint32_t) + 2 * sizeof(tdb_off_t)
+		+ 3 * sizeof(uint32_t) + TDB_OFS_SIZE(tdb)
 		+ 2 * sizeof(uint32_t);
 	/* From the free list chain and hash chains. */
-	verifiable += 3 * sizeof(tdb_off_t);
+	verifiable += 3 * TDB_OFS_SIZE(tdb);
 	/* From the record headers & tailer */
-	verifiable += 5 * (sizeof(struct tdb_record) + sizeof(uint32_t));
+	verifiable += 5 * (TDB_REC_SIZE(tdb) + sizeof(uint32_t));
 	/* The free block: we ignore datalen, keylen, full_hash. */
-	verifiable += sizeof(struct tdb_record) - 3*sizeof(uint32_t) +
+	verifiable += TDB_REC_SIZE(tdb) - 3*sizeof(uint32_t) +
 		sizeof(uint32_t);
 	/* Our check function verifies the key and data. */
 	verifiable += ksize + dsize;
+	verifiable *= CHAR_BIT;
+	/* With feature flags, a hash table moved by tdb_rehash() is
+	 * expected if its bit is set. */
+	if (tdb->feature_flags != 0)
+		verifiable += 1;
 
 	/* Flip one bit at a time, make sure it detects verifiable bytes. */
 	for (i = 0, corrupt = 0; i < tdb->map_size * CHAR_BIT; i++) {
@@ -101,15 +107,15 @@ static void check_test(struct tdb_context *tdb)
 			corrupt++;
 		tdb_flip_bit(tdb, i);
 	}
-	ok(corrupt == verifiable * CHAR_BIT, "corrupt %u should be %u",
-	   corrupt, verifiable * CHAR_BIT);
+	ok(corrupt == verifiable, "corrupt %u should be %u",
+	   corrupt, verifiable);
 }
 
 int main(int argc, char *argv[])
 {
 	struct tdb_context *tdb;
 
-	plan_tests(4);
+	plan_tests(8);
 	/* This should use mmap. */
 	tdb = tdb_open_ex("run-corrupt.tdb", 2, TDB_CLEAR_IF_FIRST,
 			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
@@ -128,5 +134,24 @@ int main(int argc, char *argv[])
 	check_test(tdb);
 	tdb_close(tdb);
 
+	/* The same with 64 bit offsets. */
+	tdb = tdb_open_ex("run-corrupt.tdb", 2,
+			  TDB_CLEAR_IF_FIRST|TDB_LARGE_OFFSETS,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+
+	if (!tdb)
+		abort();
+	check_test(tdb);
+	tdb_close(tdb);
+
+	tdb = tdb_open_ex("run-corrupt.tdb", 2,
+			  TDB_CLEAR_IF_FIRST|TDB_NOMMAP|TDB_LARGE_OFFSETS,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+
+	if (!tdb)
+		abort();
+	check_test(tdb);
+	tdb_close(tdb);
+
 	return exit_status();
 }
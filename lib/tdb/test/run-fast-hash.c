@@ -0,0 +1,242 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/summary.c"
+#include "../common/mutex.c"
+#include "../common/seqlock.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define TEST_DBNAME "run-fast-hash.tdb"
+#define NUM_KEYS 50000
+#define NUM_CHAINS 10007
+#define NUM_ROUNDS 20
+
+/*
+ * Keys shaped like the ones Samba stores: a struct file_id in
+ * locking.tdb and brlock.tdb, a binary SID in the idmap and winbind
+ * caches and a case folded DN as used as key by ldb_tdb.
+ */
+enum key_shape { FILE_ID, SID, DN, NUM_SHAPES };
+
+static const char *shape_names[] = { "file_id", "sid", "dn" };
+
+struct key_buf {
+	uint8_t buf[128];
+	TDB_DATA key;
+};
+
+static void make_key(struct key_buf *k, enum key_shape shape, unsigned i)
+{
+	uint64_t file_id[3];
+	uint32_t sub_auths[5];
+	int len;
+
+	switch (shape) {
+	case FILE_ID:
+		file_id[0] = 0xfd01;
+		file_id[1] = 1000000 + i * 17;
+		file_id[2] = 0;
+		memcpy(k->buf, file_id, sizeof(file_id));
+		k->key.dsize = sizeof(file_id);
+		break;
+	case SID:
+		/* S-1-5-21-x-y-z-rid */
+		k->buf[0] = 1;
+		k->buf[1] = 5;
+		memset(k->buf + 2, 0, 5);
+		k->buf[7] = 5;
+		sub_auths[0] = 21;
+		sub_auths[1] = 3522374325U;
+		sub_auths[2] = 1429434532U;
+		sub_auths[3] = 2816287452U;
+		sub_auths[4] = 1000 + i;
+		memcpy(k->buf + 8, sub_auths, sizeof(sub_auths));
+		k->key.dsize = 8 + sizeof(sub_auths);
+		break;
+	default:
+		len = snprintf((char *)k->buf, sizeof(k->buf),
+			       "DN=CN=USER%u,CN=USERS,DC=SAMBA,DC=EXAMPLE,"
+			       "DC=COM", i);
+		k->key.dsize = len + 1;
+		break;
+	}
+	k->key.dptr = k->buf;
+}
+
+static double timeval_elapsed(const struct timeval *tv)
+{
+	struct timeval tv2;
+
+	gettimeofday(&tv2, NULL);
+	return (tv2.tv_sec - tv->tv_sec) +
+		(tv2.tv_usec - tv->tv_usec) * 1.0e-6;
+}
+
+/* nanoseconds per hash, the best of a few runs */
+static double time_hash(tdb_hash_func hash_fn, struct key_buf *keys)
+{
+	volatile unsigned int sink = 0;
+	double best = 0.0;
+	unsigned r, i;
+
+	for (r = 0; r < NUM_ROUNDS; r++) {
+		struct timeval start;
+		double elapsed;
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < NUM_KEYS; i++) {
+			sink += hash_fn(&keys[i].key);
+		}
+		elapsed = timeval_elapsed(&start);
+		if (r == 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	return best * 1.0e9 / NUM_KEYS;
+}
+
+/* The longest hash chain we get for the keys */
+static unsigned max_chain(tdb_hash_func hash_fn, struct key_buf *keys)
+{
+	unsigned *chains;
+	unsigned i, max = 0;
+
+	chains = calloc(NUM_CHAINS, sizeof(unsigned));
+	if (chains == NULL) {
+		return UINT_MAX;
+	}
+	for (i = 0; i < NUM_KEYS; i++) {
+		unsigned c = hash_fn(&keys[i].key) % NUM_CHAINS;
+
+		chains[c]++;
+		max = MAX(max, chains[c]);
+	}
+	free(chains);
+	return max;
+}
+
+static bool hash_is(const char *str, unsigned int expected)
+{
+	TDB_DATA key;
+
+	key.dptr = discard_const_p(uint8_t, str);
+	key.dsize = strlen(str);
+	return tdb_fast_hash(&key) == expected;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	struct key_buf *keys;
+	struct tdb_header header;
+	unsigned shape, i;
+	char *summary;
+	int fd;
+
+	plan_tests(NUM_SHAPES * 2 + 15);
+
+	/* xxHash32 test vectors, with seed 0 */
+	ok1(hash_is("", 0x02CC5D05));
+	ok1(hash_is("abc", 0x32D153FF));
+	ok1(hash_is("Nobody inspects the spammish repetition", 0xE2293B2F));
+
+	keys = calloc(NUM_KEYS, sizeof(*keys));
+	ok1(keys);
+	if (keys == NULL) {
+		return exit_status();
+	}
+
+	for (shape = 0; shape < NUM_SHAPES; shape++) {
+		unsigned max_jenkins, max_fast;
+
+		for (i = 0; i < NUM_KEYS; i++) {
+			make_key(&keys[i], shape, i);
+		}
+
+		max_jenkins = max_chain(tdb_jenkins_hash, keys);
+		max_fast = max_chain(tdb_fast_hash, keys);
+		ok(max_fast <= max_jenkins * 2,
+		   "%s keys: longest chain %u with the fast hash, "
+		   "%u with jenkins", shape_names[shape], max_fast,
+		   max_jenkins);
+
+		diag("%s keys of %zu bytes: old %.1fns, jenkins %.1fns, "
+		     "fast %.1fns per hash", shape_names[shape],
+		     keys[0].key.dsize,
+		     time_hash(tdb_old_hash, keys),
+		     time_hash(tdb_jenkins_hash, keys),
+		     time_hash(tdb_fast_hash, keys));
+
+		/* The same keys have to end up in the same chains */
+		tdb = tdb_open_ex(TEST_DBNAME, 1031,
+				  TDB_CLEAR_IF_FIRST|TDB_FAST_HASH,
+				  O_CREAT|O_TRUNC|O_RDWR, 0600,
+				  &taplogctx, NULL);
+		for (i = 0; tdb && i < 1000; i++) {
+			if (tdb_store(tdb, keys[i].key, keys[i].key,
+				      TDB_INSERT) != 0) {
+				break;
+			}
+		}
+		ok1(tdb && i == 1000 && tdb_check(tdb, NULL, NULL) == 0);
+		if (tdb) {
+			tdb_close(tdb);
+		}
+	}
+
+	/* The hash is found again on open */
+	tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0, &taplogctx, NULL);
+	ok1(tdb);
+	if (tdb == NULL) {
+		return exit_status();
+	}
+	ok1(tdb->hash_fn == tdb_fast_hash);
+	ok1(tdb_get_flags(tdb) & TDB_FAST_HASH);
+	ok1(tdb_exists(tdb, keys[0].key));
+	summary = tdb_summary(tdb);
+	ok1(summary && strstr(summary, "Hash function: fast\n"));
+	free(summary);
+	tdb_close(tdb);
+
+	/* An explicit other hash function is refused */
+	tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0, &taplogctx,
+			  tdb_jenkins_hash);
+	ok1(tdb == NULL && errno == EINVAL);
+
+	/* Versions without the magic hash check refuse it, too */
+	fd = open(TEST_DBNAME, O_RDONLY);
+	ok1(fd != -1 && read(fd, &header, sizeof(header)) == sizeof(header));
+	ok1(header.rwlocks == TDB_HASH_RWLOCK_MAGIC);
+	close(fd);
+
+	/* Without TDB_FAST_HASH the other hashes are used as before */
+	tdb = tdb_open_ex(TEST_DBNAME, 1031,
+			  TDB_CLEAR_IF_FIRST|TDB_INCOMPATIBLE_HASH,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb && tdb->hash_fn == tdb_jenkins_hash &&
+	    !(tdb_get_flags(tdb) & TDB_FAST_HASH));
+	if (tdb) {
+		tdb_close(tdb);
+	}
+
+	/* Internal databases use it by default */
+	tdb = tdb_open_ex(NULL, 1031, TDB_INTERNAL, O_CREAT|O_RDWR, 0600,
+			  &taplogctx, NULL);
+	ok1(tdb && tdb->hash_fn == tdb_fast_hash);
+	if (tdb) {
+		tdb_close(tdb);
+	}
+
+	free(keys);
+	return exit_status();
+}
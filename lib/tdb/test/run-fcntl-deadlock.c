@@ -10,6 +10,7 @@
 #include "../common/check.c"
 #include "../common/hash.c"
 #include "../common/mutex.c"
+#include "../common/seqlock.c"
 #include "replace.h"
 #include "system/filesys.h"
 #include "system/time.h"
@@ -0,0 +1,211 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/freelistcheck.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/seqlock.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define TEST_DBNAME "run-freelist-classes.tdb"
+#define NUM_FILES 10000
+#define NUM_OPS 200000
+#define MAX_ENTRIES 16
+#define ENTRY_SIZE 96
+
+/*
+ * Simulate the open/close churn on locking.tdb: a record per open
+ * file that grows and shrinks by a share mode entry with every
+ * open and close of a handle, and is deleted with the last close.
+ */
+struct churn {
+	unsigned entries[NUM_FILES];
+	unsigned gens[NUM_FILES];
+	uint8_t buf[64 + MAX_ENTRIES * ENTRY_SIZE];
+};
+
+static TDB_DATA file_key(unsigned *buf, unsigned i)
+{
+	TDB_DATA key;
+
+	/* like a struct file_id: dev, inode, extid */
+	buf[0] = 0x803;
+	buf[1] = i * 2654435761U;
+	buf[2] = 0;
+	buf[3] = i;
+	key.dptr = (uint8_t *)buf;
+	key.dsize = 4 * sizeof(unsigned);
+	return key;
+}
+
+static TDB_DATA file_data(struct churn *c, unsigned i)
+{
+	TDB_DATA data;
+
+	data.dsize = 64 + c->entries[i] * ENTRY_SIZE;
+	memset(c->buf, (i + c->gens[i]) & 0xff, data.dsize);
+	data.dptr = c->buf;
+	return data;
+}
+
+static bool churn_one(struct tdb_context *tdb, struct churn *c)
+{
+	unsigned kbuf[4];
+	unsigned i = random() % NUM_FILES;
+	TDB_DATA key = file_key(kbuf, i);
+
+	if (c->entries[i] == 0 ||
+	    (c->entries[i] < MAX_ENTRIES && random() % 2 == 0)) {
+		/* open */
+		c->entries[i] += 1;
+	} else if (c->entries[i] == 1) {
+		/* last close */
+		c->entries[i] = 0;
+		return tdb_delete(tdb, key) == 0;
+	} else {
+		c->entries[i] -= 1;
+	}
+	c->gens[i] += 1;
+
+	return tdb_store(tdb, key, file_data(c, i), TDB_REPLACE) == 0;
+}
+
+static bool verify(struct tdb_context *tdb, struct churn *c)
+{
+	unsigned kbuf[4];
+	unsigned i;
+
+	for (i = 0; i < NUM_FILES; i++) {
+		TDB_DATA key = file_key(kbuf, i);
+		TDB_DATA data = tdb_fetch(tdb, key);
+		bool same;
+
+		if (c->entries[i] == 0) {
+			same = (data.dptr == NULL);
+		} else {
+			TDB_DATA expect = file_data(c, i);
+
+			same = (data.dsize == expect.dsize) &&
+				(memcmp(data.dptr, expect.dptr,
+					data.dsize) == 0);
+		}
+		free(data.dptr);
+		if (!same) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Every free record has to be at least as large as its list demands */
+static bool lists_sorted(struct tdb_context *tdb)
+{
+	unsigned list;
+
+	for (list = 0; list < TDB_NUM_FREELISTS(tdb); list++) {
+		struct tdb_record rec;
+		tdb_off_t ptr;
+
+		if (tdb_ofs_read(tdb, TDB_FREELIST_TOP(tdb, list),
+				 &ptr) == -1) {
+			return false;
+		}
+		while (ptr != 0) {
+			if (tdb_rec_free_read(tdb, ptr, &rec) == -1 ||
+			    rec.rec_len < tdb_freelist_min[list]) {
+				return false;
+			}
+			ptr = rec.next;
+		}
+	}
+	return true;
+}
+
+static double timeval_elapsed(const struct timeval *tv)
+{
+	struct timeval tv2;
+
+	gettimeofday(&tv2, NULL);
+	return (tv2.tv_sec - tv->tv_sec) +
+		(tv2.tv_usec - tv->tv_usec) * 1.0e-6;
+}
+
+int main(int argc, char *argv[])
+{
+	int flags[] = { 0, TDB_FREELIST_CLASSES,
+			TDB_FREELIST_CLASSES|TDB_LARGE_OFFSETS|TDB_CONVERT };
+	unsigned i;
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 14);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		struct tdb_context *tdb;
+		struct churn *c;
+		struct timeval start;
+		double elapsed;
+		unsigned n;
+		int num_free;
+		bool success = true;
+
+		/* Without locking the allocator dominates the timing */
+		c = calloc(1, sizeof(*c));
+		tdb = tdb_open_ex(TEST_DBNAME, 1031,
+				  TDB_CLEAR_IF_FIRST|TDB_INCOMPATIBLE_HASH|
+				  TDB_NOLOCK|flags[i],
+				  O_CREAT|O_TRUNC|O_RDWR, 0600,
+				  &taplogctx, NULL);
+		ok1(tdb && c);
+		if (!tdb || !c) {
+			continue;
+		}
+		ok1((tdb_get_flags(tdb) & TDB_FREELIST_CLASSES) ==
+		    (flags[i] & TDB_FREELIST_CLASSES));
+
+		srandom(1);
+		gettimeofday(&start, NULL);
+		for (n = 0; n < NUM_OPS && success; n++) {
+			success = churn_one(tdb, c);
+		}
+		elapsed = timeval_elapsed(&start);
+		ok1(success);
+		ok1(verify(tdb, c));
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		ok1(tdb_validate_freelist(tdb, &num_free) == 0);
+		ok1(lists_sorted(tdb));
+
+		diag("flags 0x%x: %u operations in %f seconds, "
+		     "file size %ju, %d free records", flags[i], NUM_OPS,
+		     elapsed, (uintmax_t)tdb->map_size, num_free);
+
+		/* Transactions and repacking keep the lists in shape */
+		ok1(tdb_repack(tdb) == 0);
+		ok1(verify(tdb, c));
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		ok1(lists_sorted(tdb));
+
+		ok1(tdb_wipe_all(tdb) == 0);
+		ok1(tdb_freelist_size(tdb) >= 1);
+		tdb_close(tdb);
+
+		/* The format is taken from the file */
+		tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0,
+				  &taplogctx, NULL);
+		ok1(tdb && (tdb_get_flags(tdb) & TDB_FREELIST_CLASSES) ==
+		    (flags[i] & TDB_FREELIST_CLASSES));
+		if (tdb) {
+			tdb_close(tdb);
+		}
+		free(c);
+	}
+
+	return exit_status();
+}
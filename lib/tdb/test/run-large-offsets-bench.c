@@ -0,0 +1,139 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/seqlock.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_RECORDS 50000
+#define NUM_LOOKUPS 200000
+
+static double timeval_elapsed2(const struct timeval *tv1, const struct timeval *tv2)
+{
+	return (tv2->tv_sec - tv1->tv_sec) +
+	       (tv2->tv_usec - tv1->tv_usec)*1.0e-6;
+}
+
+static double timeval_elapsed(const struct timeval *tv)
+{
+	struct timeval tv2;
+	gettimeofday(&tv2, NULL);
+	return timeval_elapsed2(tv, &tv2);
+}
+
+static int parser(TDB_DATA key, TDB_DATA data, void *private_data)
+{
+	unsigned *found = private_data;
+	*found += data.dsize;
+	return 0;
+}
+
+static struct tdb_context *fill_tdb(const char *name, int tdb_flags)
+{
+	struct tdb_context *tdb;
+	unsigned i;
+	char buf[20];
+	TDB_DATA key;
+
+	tdb = tdb_open_ex(name, 10007,
+			  TDB_CLEAR_IF_FIRST|TDB_NOLOCK|tdb_flags,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	if (tdb == NULL) {
+		return NULL;
+	}
+
+	key.dptr = (uint8_t *)buf;
+
+	for (i = 0; i < NUM_RECORDS; i++) {
+		key.dsize = snprintf(buf, sizeof(buf), "key%u", i);
+		if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+			tdb_close(tdb);
+			return NULL;
+		}
+	}
+
+	return tdb;
+}
+
+static double bench_lookups(struct tdb_context *tdb)
+{
+	struct timeval start;
+	unsigned found = 0;
+	unsigned i;
+	char buf[20];
+	TDB_DATA key;
+
+	key.dptr = (uint8_t *)buf;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_LOOKUPS; i++) {
+		key.dsize = snprintf(buf, sizeof(buf), "key%u",
+				     (i * 7919) % NUM_RECORDS);
+		if (tdb_parse_record(tdb, key, parser, &found) != 0) {
+			return -1.0;
+		}
+	}
+	return timeval_elapsed(&start);
+}
+
+/*
+ * Compare the lookup speed of the default format with the one of
+ * TDB_LARGE_OFFSETS, which has 4 bytes larger record headers and
+ * hash chain heads. Both are run alternately a few times and the
+ * best run is reported, to reduce the noise.
+ */
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb_small, *tdb_large;
+	double best_small = 0.0, best_large = 0.0;
+	bool success = true;
+	int i;
+
+	plan_tests(3);
+
+	tdb_small = fill_tdb("run-large-offsets-bench.tdb", 0);
+	ok(tdb_small, "filling the default format should succeed");
+	tdb_large = fill_tdb("run-large-offsets-bench-large.tdb",
+			     TDB_LARGE_OFFSETS);
+	ok(tdb_large, "filling with TDB_LARGE_OFFSETS should succeed");
+	if (tdb_small == NULL || tdb_large == NULL) {
+		return exit_status();
+	}
+
+	for (i = 0; i < 5; i++) {
+		double elapsed;
+
+		elapsed = bench_lookups(tdb_small);
+		success = success && (elapsed >= 0.0);
+		if (i == 0 || elapsed < best_small) {
+			best_small = elapsed;
+		}
+
+		elapsed = bench_lookups(tdb_large);
+		success = success && (elapsed >= 0.0);
+		if (i == 0 || elapsed < best_large) {
+			best_large = elapsed;
+		}
+	}
+	ok(success, "all lookups should succeed");
+
+	diag("%u lookups: default format %f seconds, "
+	     "large offsets %f seconds (%+.1f%%)",
+	     NUM_LOOKUPS, best_small, best_large,
+	     (best_large - best_small) * 100.0 / best_small);
+
+	tdb_close(tdb_small);
+	tdb_close(tdb_large);
+
+	return exit_status();
+}
@@ -0,0 +1,147 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/seqlock.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_TESTS 31
+
+static int tdb_expand_file_sparse(struct tdb_context *tdb,
+				  tdb_off_t size,
+				  tdb_off_t addition)
+{
+	if (tdb->read_only || tdb->traverse_read) {
+		tdb->ecode = TDB_ERR_RDONLY;
+		return -1;
+	}
+
+	if (tdb_ftruncate(tdb, size+addition) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "expand_file to %ju failed (%s)\n",
+			 (uintmax_t)(size+addition), strerror(errno)));
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct tdb_methods large_io_methods = {
+	tdb_read,
+	tdb_write,
+	tdb_next_hash_chain,
+	tdb_oob,
+	tdb_expand_file_sparse
+};
+
+static int test_traverse(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+			 void *_data)
+{
+	TDB_DATA *expect = _data;
+	ok1(key.dsize == strlen("hi"));
+	ok1(memcmp(key.dptr, "hi", strlen("hi")) == 0);
+	ok1(data.dsize == expect->dsize);
+	ok1(memcmp(data.dptr, expect->dptr, data.dsize) == 0);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	TDB_DATA key, orig_data, data;
+	uint32_t hashval;
+	tdb_off_t rec_ptr;
+	struct tdb_record rec;
+	int ret;
+
+	plan_tests(NUM_TESTS);
+
+	if (sizeof(size_t) < sizeof(uint64_t)) {
+		/* We can't map a file beyond 4GB. */
+		for (ret = 0; ret < NUM_TESTS; ret++)
+			ok1(1);
+		return exit_status();
+	}
+
+	key.dsize = strlen("hi");
+	key.dptr = discard_const_p(uint8_t, "hi");
+	orig_data.dsize = strlen("world");
+	orig_data.dptr = discard_const_p(uint8_t, "world");
+
+	/* The old format can't grow beyond 4GB. */
+	tdb = tdb_open_ex("run-large-offsets.tdb", 1024, TDB_CLEAR_IF_FIRST,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	tdb->methods = &large_io_methods;
+	ok1(!(tdb_get_flags(tdb) & TDB_LARGE_OFFSETS));
+	ok1(TDB_REC_SIZE(tdb) == 24);
+
+	ok1(tdb_expand(tdb, 2500000000U) == 0);
+	ok1(tdb->map_size <= UINT32_MAX);
+	ok1(tdb_expand(tdb, 2500000000U) == -1);
+	tdb_close(tdb);
+
+	tdb = tdb_open_ex("run-large-offsets.tdb", 1024,
+			  TDB_CLEAR_IF_FIRST|TDB_LARGE_OFFSETS,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	tdb->methods = &large_io_methods;
+	ok1(tdb_get_flags(tdb) & TDB_LARGE_OFFSETS);
+	ok1(TDB_REC_SIZE(tdb) == 28);
+
+	/*
+	 * This is a single free record spanning the 4GB border,
+	 * a single expansion is limited to a 32 bit record length.
+	 */
+	ok1(tdb_expand(tdb, 2500000000U) == 0);
+	ok1(tdb->map_size > UINT32_MAX);
+
+	/* Put an entry in, it is taken from the end of the free record. */
+	ok1(tdb_store(tdb, key, orig_data, TDB_INSERT) == 0);
+
+	hashval = tdb->hash_fn(&key);
+	rec_ptr = tdb_find_lock_hash(tdb, key, hashval, F_RDLCK, &rec);
+	ok1(rec_ptr > UINT32_MAX);
+	tdb_unlock(tdb, BUCKET(rec.full_hash), F_RDLCK);
+
+	data = tdb_fetch(tdb, key);
+	ok1(data.dsize == strlen("world"));
+	ok1(memcmp(data.dptr, "world", strlen("world")) == 0);
+	free(data.dptr);
+
+	ok1(tdb_traverse(tdb, test_traverse, &orig_data) == 1);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	/* Transactions, including the recovery area, beyond 4GB. */
+	ok1(tdb_delete(tdb, key) == 0);
+	ok1(tdb_transaction_start(tdb) == 0);
+	ok1(tdb_store(tdb, key, orig_data, TDB_INSERT) == 0);
+	ok1(tdb_transaction_commit(tdb) == 0);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+	tdb_close(tdb);
+
+	/* The format is taken from the file, not from the flags. */
+	tdb = tdb_open_ex("run-large-offsets.tdb", 1024, 0,
+			  O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	tdb->methods = &large_io_methods;
+	ok1(tdb_get_flags(tdb) & TDB_LARGE_OFFSETS);
+
+	data = tdb_fetch(tdb, key);
+	ok1(data.dsize == strlen("world"));
+	ok1(memcmp(data.dptr, "world", strlen("world")) == 0);
+	free(data.dptr);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+	tdb_close(tdb);
+
+	return exit_status();
+}
@@ -0,0 +1,213 @@
+#include "../common/tdb_private.h"
+static int fdatasync_count(int fd);
+#define fdatasync fdatasync_count
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/seqlock.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+#undef fdatasync
+
+#define TEST_DBNAME "run-recovery-checksum.tdb"
+
+static int num_syncs;
+
+static int fdatasync_count(int fd)
+{
+	num_syncs++;
+	return fdatasync(fd);
+}
+
+static TDB_DATA string_data(const char *str)
+{
+	TDB_DATA d;
+
+	d.dptr = discard_const_p(uint8_t, str);
+	d.dsize = strlen(str);
+	return d;
+}
+
+static bool fetch_is(struct tdb_context *tdb, const char *str)
+{
+	TDB_DATA data = tdb_fetch(tdb, string_data("key"));
+	bool same;
+
+	same = (data.dsize == strlen(str)) &&
+		(memcmp(data.dptr, str, data.dsize) == 0);
+	free(data.dptr);
+	return same;
+}
+
+static struct tdb_context *create(int tdb_flags)
+{
+	struct tdb_context *tdb;
+	char buf[20];
+	int i;
+
+	tdb = tdb_open_ex(TEST_DBNAME, 7, tdb_flags,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	if (tdb == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < 20; i++) {
+		TDB_DATA key;
+
+		key.dptr = (uint8_t *)buf;
+		key.dsize = snprintf(buf, sizeof(buf), "filler%d", i);
+		if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+			tdb_close(tdb);
+			return NULL;
+		}
+	}
+	if (tdb_store(tdb, string_data("key"), string_data("old"),
+		      TDB_INSERT) != 0) {
+		tdb_close(tdb);
+		return NULL;
+	}
+	return tdb;
+}
+
+static int commit_syncs(struct tdb_context *tdb, const char *str)
+{
+	int before = num_syncs;
+
+	if (tdb_transaction_start(tdb) != 0 ||
+	    tdb_store(tdb, string_data("key"), string_data(str),
+		      TDB_REPLACE) != 0 ||
+	    tdb_transaction_commit(tdb) != 0) {
+		return -1;
+	}
+	return num_syncs - before;
+}
+
+/* Die in the middle of the commit, after the recovery data is written */
+static bool die_after_prepare(void)
+{
+	struct tdb_context *tdb;
+	int status;
+	pid_t child;
+
+	child = fork();
+	if (child == 0) {
+		tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0,
+				  &taplogctx, NULL);
+		if (tdb == NULL ||
+		    tdb_transaction_start(tdb) != 0 ||
+		    tdb_store(tdb, string_data("key"), string_data("new"),
+			      TDB_REPLACE) != 0 ||
+		    tdb_transaction_prepare_commit(tdb) != 0) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+	return waitpid(child, &status, 0) == child &&
+		WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Find the recovery data and the last block saved in it */
+static bool find_recovery(int fd, uint32_t *head, uint32_t *data_len,
+			  uint32_t *block_ofs, uint32_t *block_len)
+{
+	uint32_t rec[6], hdr[2];
+	uint32_t p;
+
+	if (pread(fd, head, 4, offsetof(struct tdb_header,
+					recovery_start)) != 4 ||
+	    *head == 0 ||
+	    pread(fd, rec, sizeof(rec), *head) != sizeof(rec) ||
+	    rec[5] != TDB_RECOVERY_MAGIC) {
+		return false;
+	}
+	*data_len = rec[3];
+
+	/* offset and length of each block, followed by the data */
+	for (p = 0; p + 12 < *data_len; p += 8 + hdr[1]) {
+		if (pread(fd, hdr, sizeof(hdr), *head + 24 + p) !=
+		    sizeof(hdr)) {
+			return false;
+		}
+		*block_ofs = hdr[0];
+		*block_len = hdr[1];
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	uint32_t head, data_len, block_ofs, block_len;
+	int plain, csum, fd;
+	uint8_t garbage[2048];
+	uint8_t c;
+
+	plan_tests(19);
+
+	/* The checksum saves the sync before writing the magic */
+	tdb = create(TDB_DEFAULT);
+	ok1(tdb);
+	plain = commit_syncs(tdb, "plain");
+	ok1(plain > 0);
+	tdb_close(tdb);
+
+	tdb = create(TDB_RECOVERY_CHECKSUM);
+	ok1(tdb);
+	ok1(tdb_get_flags(tdb) & TDB_RECOVERY_CHECKSUM);
+	ok1(tdb->feature_flags & TDB_FEATURE_FLAG_RECOVERY_CSUM);
+	csum = commit_syncs(tdb, "csum");
+	diag("syncs per commit: %d without checksum, %d with checksum",
+	     plain, csum);
+	ok1(csum == plain - 1);
+	ok1(fetch_is(tdb, "csum"));
+	tdb_close(tdb);
+
+	/*
+	 * A complete recovery area is used: simulate the data writes
+	 * being interrupted by overwriting part of the saved data.
+	 */
+	ok1(die_after_prepare());
+	fd = open(TEST_DBNAME, O_RDWR);
+	ok1(find_recovery(fd, &head, &data_len, &block_ofs, &block_len));
+	memset(garbage, 0xff, sizeof(garbage));
+	ok1(pwrite(fd, garbage, MIN(block_len / 2, sizeof(garbage)),
+		   block_ofs + block_len / 2) > 0);
+	close(fd);
+
+	tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(fetch_is(tdb, "csum"));
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+	tdb_close(tdb);
+
+	/*
+	 * A partially written recovery area is ignored: the commit
+	 * can't have started to write the data yet.
+	 */
+	ok1(die_after_prepare());
+	fd = open(TEST_DBNAME, O_RDWR);
+	ok1(find_recovery(fd, &head, &data_len, &block_ofs, &block_len));
+	ok1(pread(fd, &c, 1, head + 24 + 8) == 1);
+	c ^= 0xff;
+	ok1(pwrite(fd, &c, 1, head + 24 + 8) == 1);
+	close(fd);
+
+	tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0, &taplogctx, NULL);
+	ok1(tdb && fetch_is(tdb, "csum") && !tdb_needs_recovery(tdb));
+	ok1(tdb && tdb_check(tdb, NULL, NULL) == 0);
+	if (tdb) {
+		tdb_close(tdb);
+	}
+
+	return exit_status();
+}
@@ -0,0 +1,221 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/seqlock.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+
+#define TEST_DBNAME "run-rehash.tdb"
+#define HASH_SIZE 7
+#define NUM_RECORDS 1000
+#define NUM_LOOKUPS 20000
+
+static TDB_DATA make_key(char *buf, size_t buflen, unsigned i)
+{
+	TDB_DATA key;
+
+	key.dptr = (uint8_t *)buf;
+	key.dsize = snprintf(buf, buflen, "key%u", i);
+	return key;
+}
+
+static bool store_records(struct tdb_context *tdb, unsigned start,
+			  unsigned num)
+{
+	char buf[20];
+	unsigned i;
+
+	for (i = start; i < start + num; i++) {
+		TDB_DATA key = make_key(buf, sizeof(buf), i);
+
+		if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool fetch_records(struct tdb_context *tdb, unsigned num)
+{
+	char buf[20];
+	unsigned i;
+
+	for (i = 0; i < num; i++) {
+		TDB_DATA key = make_key(buf, sizeof(buf), i);
+		TDB_DATA data = tdb_fetch(tdb, key);
+		bool same;
+
+		same = (data.dsize == key.dsize) &&
+			(memcmp(data.dptr, key.dptr, key.dsize) == 0);
+		free(data.dptr);
+		if (!same) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static double time_lookups(struct tdb_context *tdb)
+{
+	struct timeval start, end;
+	char buf[20];
+	unsigned i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_LOOKUPS; i++) {
+		TDB_DATA key = make_key(buf, sizeof(buf),
+					(i * 7919) % NUM_RECORDS);
+		tdb_exists(tdb, key);
+	}
+	gettimeofday(&end, NULL);
+
+	return (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) * 1.0e-6;
+}
+
+/*
+ * The child opens the database before the parent rehashes it, it
+ * has to pick up the new hash table with its next lock.
+ */
+static int do_child(int to, int from)
+{
+	struct tdb_context *tdb;
+	char c = 0;
+
+	tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0,
+			  &taplogctx, NULL);
+	if (tdb == NULL) {
+		return 1;
+	}
+	if (!fetch_records(tdb, NUM_RECORDS)) {
+		return 2;
+	}
+
+	write(to, &c, sizeof(c));
+	read(from, &c, sizeof(c));
+
+	if (!fetch_records(tdb, NUM_RECORDS)) {
+		return 3;
+	}
+	if (tdb_hash_size(tdb) != HASH_SIZE * 16) {
+		return 4;
+	}
+	if (!store_records(tdb, NUM_RECORDS, NUM_RECORDS)) {
+		return 5;
+	}
+	if (tdb_check(tdb, NULL, NULL) != 0) {
+		return 6;
+	}
+	tdb_close(tdb);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int flags[] = { 0, TDB_NOMMAP, TDB_LARGE_OFFSETS|TDB_CONVERT };
+	unsigned i;
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 28);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		struct tdb_context *tdb;
+		int fromchild[2], tochild[2];
+		double before, after;
+		int status;
+		pid_t child;
+		char c;
+
+		tdb = tdb_open_ex(TEST_DBNAME, HASH_SIZE,
+				  TDB_CLEAR_IF_FIRST|flags[i],
+				  O_CREAT|O_TRUNC|O_RDWR, 0600,
+				  &taplogctx, NULL);
+		ok1(tdb);
+		if (!tdb) {
+			continue;
+		}
+		ok1(store_records(tdb, 0, NUM_RECORDS));
+		before = time_lookups(tdb);
+
+		/* Invalid sizes. */
+		ok1(tdb_rehash(tdb, 0) == -1);
+		ok1(tdb_rehash(tdb, HASH_SIZE * 16 + 1) == -1);
+		ok1(tdb_error(tdb) == TDB_ERR_EINVAL);
+		tdb_close(tdb);
+
+		/* The child must not inherit our open tdb */
+		ok1(pipe(fromchild) == 0);
+		ok1(pipe(tochild) == 0);
+		child = fork();
+		if (child == 0) {
+			close(fromchild[0]);
+			close(tochild[1]);
+			exit(do_child(fromchild[1], tochild[0]));
+		}
+		close(fromchild[1]);
+		close(tochild[0]);
+
+		read(fromchild[0], &c, sizeof(c));
+		tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0,
+				  &taplogctx, NULL);
+		ok1(tdb_rehash(tdb, HASH_SIZE * 16) == 0);
+		write(tochild[1], &c, sizeof(c));
+
+		ok1(waitpid(child, &status, 0) == child);
+		ok1(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		close(fromchild[0]);
+		close(tochild[1]);
+
+		ok1(tdb_hash_size(tdb) == HASH_SIZE * 16);
+		ok1(fetch_records(tdb, 2 * NUM_RECORDS));
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		ok1(tdb_traverse(tdb, NULL, NULL) == 2 * NUM_RECORDS);
+
+		/* Remove the records the child added again. */
+		ok1(tdb_transaction_start(tdb) == 0);
+		ok1(tdb_wipe_all(tdb) == 0);
+		ok1(store_records(tdb, 0, NUM_RECORDS));
+		ok1(tdb_transaction_commit(tdb) == 0);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+		after = time_lookups(tdb);
+		diag("%u lookups in %u records: %u chains %f seconds, "
+		     "%u chains %f seconds", NUM_LOOKUPS, NUM_RECORDS,
+		     HASH_SIZE, before, HASH_SIZE * 16, after);
+
+		/* The hash table is kept on reopen. */
+		tdb_close(tdb);
+		tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0,
+				  &taplogctx, NULL);
+		ok1(tdb);
+		if (!tdb) {
+			continue;
+		}
+		ok1(tdb_hash_size(tdb) == HASH_SIZE * 16);
+
+		/* Shrinking works, too. */
+		ok1(tdb_rehash(tdb, HASH_SIZE * 4) == 0);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		ok1(tdb_traverse(tdb, NULL, NULL) == NUM_RECORDS);
+
+		/* Back to the original place in the header */
+		ok1(tdb_rehash(tdb, HASH_SIZE) == 0);
+		ok1(!(tdb->feature_flags & TDB_FEATURE_FLAG_HASH_TABLE));
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		ok1(fetch_records(tdb, NUM_RECORDS));
+		tdb_close(tdb);
+	}
+
+	return exit_status();
+}
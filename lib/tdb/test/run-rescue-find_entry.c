@@ -11,6 +11,7 @@
 #include "../common/hash.c"
 #include "../common/rescue.c"
 #include "../common/mutex.c"
+#include "../common/seqlock.c"
 #include "tap-interface.h"
 #include <stdlib.h>
 #include "logging.h"
@@ -0,0 +1,372 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/seqlock.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+
+#define TEST_DBNAME "run-seqlock.tdb"
+#define HASH_SIZE 7
+#define NUM_KEYS 100
+#define NUM_GENERATIONS 200
+#define NUM_RECORDS 10000
+#define NUM_LOOKUPS 200000
+
+struct parse_state {
+	struct tdb_context *tdb;
+	uint32_t list;
+	bool locked;
+	bool valid;
+	unsigned gen;
+};
+
+static TDB_DATA make_key(char *buf, size_t buflen, unsigned i)
+{
+	TDB_DATA key;
+
+	key.dptr = (uint8_t *)buf;
+	key.dsize = snprintf(buf, buflen, "key%u", i);
+	return key;
+}
+
+/* Both halves are the same, a torn read would show up */
+static TDB_DATA make_data(char *buf, size_t buflen, unsigned gen)
+{
+	TDB_DATA data;
+
+	data.dptr = (uint8_t *)buf;
+	data.dsize = snprintf(buf, buflen, "%08u:%08u", gen, gen);
+	return data;
+}
+
+static bool data_valid(TDB_DATA data, unsigned *gen)
+{
+	if (data.dsize != 17 || data.dptr[8] != ':' ||
+	    memcmp(data.dptr, data.dptr + 9, 8) != 0) {
+		return false;
+	}
+	*gen = strtoul((const char *)data.dptr + 9, NULL, 10);
+	return true;
+}
+
+static int parse_check(TDB_DATA key, TDB_DATA data, void *private_data)
+{
+	struct parse_state *state = private_data;
+
+	state->locked = (find_nestlock(state->tdb,
+				       lock_offset(state->list)) != NULL);
+	state->valid = data_valid(data, &state->gen);
+	return 0;
+}
+
+static int parse_key(struct tdb_context *tdb, unsigned i,
+		     struct parse_state *state)
+{
+	char buf[20];
+	TDB_DATA key = make_key(buf, sizeof(buf), i);
+
+	state->tdb = tdb;
+	state->list = BUCKET(tdb->hash_fn(&key));
+	state->locked = false;
+	state->valid = false;
+	return tdb_parse_record(tdb, key, parse_check, state);
+}
+
+static bool store_keys(struct tdb_context *tdb, unsigned num, unsigned gen)
+{
+	char kbuf[20], dbuf[20];
+	unsigned i;
+
+	for (i = 0; i < num; i++) {
+		TDB_DATA key = make_key(kbuf, sizeof(kbuf), i);
+		TDB_DATA data = make_data(dbuf, sizeof(dbuf), gen);
+
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static volatile uint32_t *chain_counter(struct tdb_context *tdb, unsigned i)
+{
+	char buf[20];
+	TDB_DATA key = make_key(buf, sizeof(buf), i);
+
+	return &tdb->seqlocks->chains[BUCKET(tdb->hash_fn(&key))];
+}
+
+/*
+ * Keep rewriting, deleting and re-adding all records, with
+ * transactions and a tdb_rehash() in between, while the parent reads.
+ */
+static int do_writer(int tdb_flags, int from)
+{
+	struct tdb_context *tdb;
+	char kbuf[20], dbuf[20];
+	unsigned gen, i;
+	char c;
+
+	if (read(from, &c, sizeof(c)) != sizeof(c)) {
+		return 1;
+	}
+
+	tdb = tdb_open_ex(TEST_DBNAME, 0, tdb_flags, O_RDWR, 0,
+			  &taplogctx, NULL);
+	if (tdb == NULL) {
+		return 2;
+	}
+
+	for (gen = 2; gen <= NUM_GENERATIONS; gen++) {
+		if (gen == NUM_GENERATIONS / 2) {
+			if (tdb_rehash(tdb, HASH_SIZE * 4) != 0) {
+				return 3;
+			}
+		}
+
+		if (gen % 10 == 0) {
+			if (tdb_transaction_start(tdb) != 0) {
+				return 4;
+			}
+			if (!store_keys(tdb, NUM_KEYS, gen)) {
+				return 5;
+			}
+			if (tdb_transaction_commit(tdb) != 0) {
+				return 6;
+			}
+			continue;
+		}
+
+		for (i = 0; i < NUM_KEYS; i++) {
+			TDB_DATA key = make_key(kbuf, sizeof(kbuf), i);
+			TDB_DATA data = make_data(dbuf, sizeof(dbuf), gen);
+
+			if ((i + gen) % 7 == 0 && tdb_delete(tdb, key) != 0) {
+				return 7;
+			}
+			if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+				return 8;
+			}
+		}
+	}
+
+	tdb_close(tdb);
+	return 0;
+}
+
+static double time_lookups(struct tdb_context *tdb)
+{
+	struct parse_state state;
+	struct timeval start, end;
+	unsigned i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_LOOKUPS; i++) {
+		if (parse_key(tdb, (i * 7919) % NUM_RECORDS, &state) != 0 ||
+		    !state.valid) {
+			return -1.0;
+		}
+	}
+	gettimeofday(&end, NULL);
+
+	return (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) * 1.0e-6;
+}
+
+static struct tdb_context *fill_bench(const char *name, int tdb_flags)
+{
+	struct tdb_context *tdb;
+
+	tdb = tdb_open_ex(name, 10007, TDB_CLEAR_IF_FIRST|tdb_flags,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	if (tdb == NULL) {
+		return NULL;
+	}
+	if (!store_keys(tdb, NUM_RECORDS, 1)) {
+		tdb_close(tdb);
+		return NULL;
+	}
+	return tdb;
+}
+
+/*
+ * Compare lookups with and without TDB_SEQLOCK in a single process,
+ * each one is run a few times and the best run is reported.
+ */
+static void bench(void)
+{
+	struct tdb_context *tdb_lock, *tdb_seq;
+	double best_lock = 0.0, best_seq = 0.0;
+	bool success = true;
+	int i;
+
+	tdb_lock = fill_bench("run-seqlock-bench.tdb", 0);
+	tdb_seq = fill_bench("run-seqlock-bench-seq.tdb", TDB_SEQLOCK);
+	ok(tdb_lock && tdb_seq, "filling the benchmark dbs should succeed");
+	if (tdb_lock == NULL || tdb_seq == NULL) {
+		return;
+	}
+
+	for (i = 0; i < 5; i++) {
+		double elapsed;
+
+		elapsed = time_lookups(tdb_lock);
+		success = success && (elapsed >= 0.0);
+		if (i == 0 || elapsed < best_lock) {
+			best_lock = elapsed;
+		}
+
+		elapsed = time_lookups(tdb_seq);
+		success = success && (elapsed >= 0.0);
+		if (i == 0 || elapsed < best_seq) {
+			best_seq = elapsed;
+		}
+	}
+	ok(success, "all benchmark lookups should succeed");
+
+	diag("%u lookups: chain locks %f seconds, seqlocks %f seconds",
+	     NUM_LOOKUPS, best_lock, best_seq);
+
+	tdb_close(tdb_lock);
+	tdb_close(tdb_seq);
+}
+
+int main(int argc, char *argv[])
+{
+	int flags[] = { TDB_SEQLOCK,
+			TDB_SEQLOCK|TDB_LARGE_OFFSETS|TDB_CONVERT,
+			TDB_SEQLOCK|TDB_MUTEX_LOCKING|TDB_CLEAR_IF_FIRST };
+	unsigned num_flags = sizeof(flags) / sizeof(flags[0]);
+	unsigned i;
+
+	if (!tdb_runtime_check_for_robust_mutexes()) {
+		num_flags -= 1;
+	}
+
+	plan_tests(num_flags * 25 + 2);
+
+	for (i = 0; i < num_flags; i++) {
+		struct tdb_context *tdb;
+		struct parse_state state;
+		char kbuf[20];
+		TDB_DATA key, data;
+		volatile uint32_t *counter;
+		unsigned lockless = 0, locked = 0, bad = 0, j, gen;
+		int tochild[2], status;
+		pid_t child, waited;
+		char c = 0;
+
+		/* The child must not inherit an open tdb */
+		ok1(pipe(tochild) == 0);
+		child = fork();
+		if (child == 0) {
+			close(tochild[1]);
+			exit(do_writer(flags[i] & ~TDB_CONVERT, tochild[0]));
+		}
+		close(tochild[0]);
+
+		tdb = tdb_open_ex(TEST_DBNAME, HASH_SIZE, flags[i],
+				  O_CREAT|O_TRUNC|O_RDWR, 0600,
+				  &taplogctx, NULL);
+		ok1(tdb);
+		if (!tdb) {
+			close(tochild[1]);
+			waitpid(child, &status, 0);
+			continue;
+		}
+		ok1(tdb_get_flags(tdb) & TDB_SEQLOCK);
+		ok1(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK);
+		ok1(store_keys(tdb, NUM_KEYS, 1));
+
+		/* Without writers no chain lock is taken */
+		ok1(parse_key(tdb, 0, &state) == 0);
+		ok1(state.valid && state.gen == 1 && !state.locked);
+
+		key = make_key(kbuf, sizeof(kbuf), 1);
+		data = tdb_fetch(tdb, key);
+		ok1(data_valid(data, &gen) && gen == 1);
+		free(data.dptr);
+		ok1(tdb_exists(tdb, key));
+
+		key = make_key(kbuf, sizeof(kbuf), NUM_KEYS);
+		ok1(tdb_exists(tdb, key) == 0);
+		ok1(parse_key(tdb, NUM_KEYS, &state) == -1);
+		ok1(tdb_error(tdb) == TDB_ERR_NOEXIST);
+
+		/* With a writer active we wait for it in the lock */
+		counter = chain_counter(tdb, 0);
+		key = make_key(kbuf, sizeof(kbuf), 0);
+		ok1(tdb_chainlock(tdb, key) == 0);
+		ok1(*counter & 1);
+		ok1(parse_key(tdb, 0, &state) == 0);
+		ok1(state.valid && state.locked);
+		ok1(tdb_chainunlock(tdb, key) == 0);
+		ok1((*counter & 1) == 0);
+
+		/* Now read while the child writes */
+		write(tochild[1], &c, sizeof(c));
+		close(tochild[1]);
+
+		while ((waited = waitpid(child, &status, WNOHANG)) == 0) {
+			for (j = 0; j < NUM_KEYS; j++) {
+				if (parse_key(tdb, j, &state) == -1) {
+					continue;
+				}
+				if (!state.valid) {
+					bad++;
+				}
+				if (state.locked) {
+					locked++;
+				} else {
+					lockless++;
+				}
+			}
+		}
+		diag("%u lookups without lock, %u with lock, %u bad",
+		     lockless, locked, bad);
+		ok1(bad == 0);
+		ok1(waited == child && WIFEXITED(status) &&
+		    WEXITSTATUS(status) == 0);
+
+		ok1(tdb_hash_size(tdb) == HASH_SIZE * 4);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		for (j = 0, bad = 0; j < NUM_KEYS; j++) {
+			if (parse_key(tdb, j, &state) != 0 || !state.valid ||
+			    state.gen != NUM_GENERATIONS || state.locked) {
+				bad++;
+			}
+		}
+		ok1(bad == 0);
+		tdb_close(tdb);
+
+		/* The format is taken from the file */
+		tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDONLY, 0,
+				  &taplogctx, NULL);
+		ok1(tdb && (tdb_get_flags(tdb) & TDB_SEQLOCK));
+		if (tdb) {
+			key = make_key(kbuf, sizeof(kbuf), 0);
+			data = tdb_fetch(tdb, key);
+			ok1(data_valid(data, &gen) && gen == NUM_GENERATIONS);
+			free(data.dptr);
+			tdb_close(tdb);
+		} else {
+			ok1(0);
+		}
+	}
+
+	bench();
+
+	return exit_status();
+}
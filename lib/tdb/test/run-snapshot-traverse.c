@@ -0,0 +1,275 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/seqlock.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+
+#define TEST_DBNAME "run-snapshot-traverse.tdb"
+#define HASH_SIZE 131
+#define NUM_RECORDS 1000
+#define NUM_RANGES 4
+
+struct count_state {
+	unsigned seen[NUM_RECORDS];
+	unsigned bad;
+	unsigned locked;
+};
+
+struct writer_state {
+	struct count_state count;
+	pid_t child;
+	int tochild;
+	int status;
+	bool waited;
+};
+
+static TDB_DATA make_key(char *buf, size_t buflen, unsigned i)
+{
+	TDB_DATA key;
+
+	key.dptr = (uint8_t *)buf;
+	key.dsize = snprintf(buf, buflen, "key%u", i);
+	return key;
+}
+
+static bool store_records(struct tdb_context *tdb, const char *prefix)
+{
+	char kbuf[20], dbuf[20];
+	unsigned i;
+
+	for (i = 0; i < NUM_RECORDS; i++) {
+		TDB_DATA key = make_key(kbuf, sizeof(kbuf), i);
+		TDB_DATA data;
+
+		data.dptr = (uint8_t *)dbuf;
+		data.dsize = snprintf(dbuf, sizeof(dbuf), "%s%u", prefix, i);
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Every record has to show its original data */
+static int count_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		    void *private_data)
+{
+	struct count_state *state = private_data;
+	char buf[30];
+	unsigned i;
+
+	if (tdb->num_lockrecs != 0 || tdb->allrecord_lock.count != 0) {
+		state->locked++;
+	}
+
+	if (key.dsize < 4 || key.dsize >= sizeof(buf) ||
+	    memcmp(key.dptr, "key", 3) != 0) {
+		state->bad++;
+		return 0;
+	}
+	memcpy(buf, key.dptr, key.dsize);
+	buf[key.dsize] = '\0';
+	i = strtoul(buf + 3, NULL, 10);
+	if (i >= NUM_RECORDS) {
+		state->bad++;
+		return 0;
+	}
+
+	snprintf(buf, sizeof(buf), "old%u", i);
+	if (data.dsize != strlen(buf) ||
+	    memcmp(data.dptr, buf, data.dsize) != 0) {
+		state->bad++;
+	}
+	state->seen[i]++;
+	return 0;
+}
+
+static bool all_seen_once(struct count_state *state)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_RECORDS; i++) {
+		if (state->seen[i] != 1) {
+			return false;
+		}
+	}
+	return state->bad == 0 && state->locked == 0;
+}
+
+/* Lock and delete every record in another process, without waiting */
+static int do_writer(int from)
+{
+	struct tdb_context *tdb;
+	char kbuf[20];
+	unsigned i;
+	char c;
+
+	if (read(from, &c, sizeof(c)) != sizeof(c)) {
+		return 1;
+	}
+
+	tdb = tdb_open_ex(TEST_DBNAME, 0, 0, O_RDWR, 0, &taplogctx, NULL);
+	if (tdb == NULL) {
+		return 1;
+	}
+	for (i = 0; i < NUM_RECORDS; i++) {
+		TDB_DATA key = make_key(kbuf, sizeof(kbuf), i);
+
+		if (tdb_chainlock_nonblock(tdb, key) != 0) {
+			return 2;
+		}
+		if (tdb_delete(tdb, key) != 0) {
+			return 3;
+		}
+		if (tdb_chainunlock(tdb, key) != 0) {
+			return 4;
+		}
+	}
+	if (tdb_lockall_nonblock(tdb) != 0) {
+		return 5;
+	}
+	tdb_unlockall(tdb);
+	tdb_close(tdb);
+	return 0;
+}
+
+/* Let the writer run to the end while the first record is looked at */
+static int writer_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		     void *private_data)
+{
+	struct writer_state *state = private_data;
+	char c = 0;
+
+	if (!state->waited) {
+		state->waited = true;
+		write(state->tochild, &c, sizeof(c));
+		waitpid(state->child, &state->status, 0);
+	}
+	return count_fn(tdb, key, data, &state->count);
+}
+
+static int stop_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		   void *private_data)
+{
+	return 1;
+}
+
+static double timeval_elapsed(const struct timeval *tv)
+{
+	struct timeval tv2;
+
+	gettimeofday(&tv2, NULL);
+	return (tv2.tv_sec - tv->tv_sec) +
+		(tv2.tv_usec - tv->tv_usec) * 1.0e-6;
+}
+
+int main(int argc, char *argv[])
+{
+	int flags[] = { 0, TDB_NOMMAP, TDB_LARGE_OFFSETS|TDB_CONVERT };
+	unsigned i;
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 18);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		struct tdb_context *tdb;
+		struct tdb_snapshot *snap;
+		struct count_state *state;
+		struct writer_state *wstate;
+		struct timeval start;
+		uint32_t num_chains, chain, per_range;
+		double elapsed;
+		char kbuf[20];
+		int tochild[2], count;
+
+		state = calloc(1, sizeof(*state));
+		wstate = calloc(1, sizeof(*wstate));
+
+		/* The child must not inherit an open tdb */
+		ok1(state && wstate && pipe(tochild) == 0);
+		wstate->child = fork();
+		if (wstate->child == 0) {
+			close(tochild[1]);
+			exit(do_writer(tochild[0]));
+		}
+		close(tochild[0]);
+		wstate->tochild = tochild[1];
+
+		tdb = tdb_open_ex(TEST_DBNAME, HASH_SIZE, flags[i],
+				  O_CREAT|O_TRUNC|O_RDWR, 0600,
+				  &taplogctx, NULL);
+		ok1(tdb);
+		if (!tdb) {
+			continue;
+		}
+		ok1(store_records(tdb, "old"));
+		ok1(tdb_delete(tdb, make_key(kbuf, sizeof(kbuf), 0)) == 0);
+		ok1(store_records(tdb, "old"));
+
+		gettimeofday(&start, NULL);
+		snap = tdb_snapshot(tdb);
+		elapsed = timeval_elapsed(&start);
+		ok1(snap);
+		if (!snap) {
+			tdb_close(tdb);
+			continue;
+		}
+		diag("snapshot of %u records in %f seconds", NUM_RECORDS,
+		     elapsed);
+		num_chains = tdb_snapshot_num_chains(snap);
+		ok1(num_chains == HASH_SIZE);
+		ok1(tdb->num_lockrecs == 0 && tdb->allrecord_lock.count == 0);
+
+		/* Changes after the snapshot are not visible in it */
+		ok1(store_records(tdb, "new"));
+		ok1(tdb_snapshot_traverse(snap, 0, num_chains, count_fn,
+					  state) == NUM_RECORDS);
+		ok1(all_seen_once(state));
+
+		/* The ranges together cover everything once */
+		memset(state, 0, sizeof(*state));
+		per_range = (num_chains + NUM_RANGES - 1) / NUM_RANGES;
+		for (chain = 0, count = 0; chain < num_chains;
+		     chain += per_range) {
+			count += tdb_snapshot_traverse(snap, chain, per_range,
+						       count_fn, state);
+		}
+		ok1(count == NUM_RECORDS);
+		ok1(all_seen_once(state));
+		ok1(tdb_snapshot_traverse(snap, num_chains, 1,
+					  count_fn, state) == 0);
+		ok1(tdb_snapshot_traverse(snap, 0, num_chains,
+					  stop_fn, NULL) == 1);
+
+		/*
+		 * Another process can lock and change every record
+		 * while we are in the middle of the traversal.
+		 */
+		ok1(tdb_snapshot_traverse(snap, 0, UINT32_MAX, writer_fn,
+					  wstate) == NUM_RECORDS);
+		ok1(wstate->waited && WIFEXITED(wstate->status) &&
+		    WEXITSTATUS(wstate->status) == 0);
+		ok1(all_seen_once(&wstate->count));
+		ok1(tdb_traverse_read(tdb, NULL, NULL) == 0);
+
+		close(wstate->tochild);
+		tdb_snapshot_free(snap);
+		tdb_close(tdb);
+		free(state);
+		free(wstate);
+	}
+
+	return exit_status();
+}
@@ -38,6 +38,7 @@ static inline int fake_fdatasync(int fd)
 #include "../common/check.c"
 #include "../common/hash.c"
 #include "../common/mutex.c"
+#include "../common/seqlock.c"
 #include "tap-interface.h"
 #include <stdlib.h>
 #include "logging.h"
@@ -84,10 +85,10 @@ int main(int argc, char *argv[])
 	for (i = 0; i < 1000; i++)
 		write_record(tdb, getpagesize(), &data);
 
-	tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, &off);
-	tdb_read(tdb, off, &rec, sizeof(rec), DOCONV());
+	tdb_ofs_read(tdb, TDB_RECOVERY_HEAD(tdb), &off);
+	tdb_rec_read_raw(tdb, off, &rec);
 	diag("TDB size = %zu, recovery = %llu-%llu",
-	     (size_t)tdb->map_size, (unsigned long long)off, (unsigned long long)(off + sizeof(rec) + rec.rec_len));
+	     (size_t)tdb->map_size, (unsigned long long)off, (unsigned long long)(off + TDB_REC_SIZE(tdb) + rec.rec_len));
 
 	/* We should only be about 5 times larger than largest record. */
 	ok1(tdb->map_size < 6 * i * getpagesize());
@@ -108,10 +109,10 @@ int main(int argc, char *argv[])
 			tdb_repack(tdb);
 	}
 
-	tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, &off);
-	tdb_read(tdb, off, &rec, sizeof(rec), DOCONV());
+	tdb_ofs_read(tdb, TDB_RECOVERY_HEAD(tdb), &off);
+	tdb_rec_read_raw(tdb, off, &rec);
 	diag("TDB size = %zu, recovery = %llu-%llu",
-	     (size_t)tdb->map_size, (unsigned long long)off, (unsigned long long)(off + sizeof(rec) + rec.rec_len));
+	     (size_t)tdb->map_size, (unsigned long long)off, (unsigned long long)(off + TDB_REC_SIZE(tdb) + rec.rec_len));
 
 	/* We should only be about 4 times larger than largest record. */
 	ok1(tdb->map_size < 5 * i * getpagesize());
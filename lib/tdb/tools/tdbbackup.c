@@ -105,13 +105,14 @@ static int test_fn(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, void *state)
   this function is also used for restore
 */
 static int backup_tdb(const char *old_name, const char *new_name,
-		      int hash_size, int nolock)
+		      int hash_size, int nolock, int large)
 {
 	TDB_CONTEXT *tdb;
 	TDB_CONTEXT *tdb_new;
 	char *tmp_name;
 	struct stat st;
 	int count1, count2;
+	int new_flags = TDB_DEFAULT;
 
 	tmp_name = add_suffix(new_name, ".tmp");
 
@@ -132,11 +133,21 @@ static int backup_tdb(const char *old_name, const char *new_name,
 		return 1;
 	}
 
+	/* keep 64 bit offsets, or convert to them if asked to */
+	if (large || (tdb_get_flags(tdb) & TDB_LARGE_OFFSETS)) {
+		new_flags |= TDB_LARGE_OFFSETS;
+	}
+
+	/* keep the optional on-disk features */
+	new_flags |= (tdb_get_flags(tdb) &
+		      (TDB_SEQLOCK|TDB_FREELIST_CLASSES|
+		       TDB_RECOVERY_CHECKSUM|TDB_FAST_HASH));
+
 	/* create the new tdb */
 	unlink(tmp_name);
 	tdb_new = tdb_open_ex(tmp_name,
 			      hash_size ? hash_size : tdb_hash_size(tdb),
-			      TDB_DEFAULT,
+			      new_flags,
 			      O_RDWR|O_CREAT|O_EXCL, st.st_mode & 0777,
 			      &log_ctx, NULL);
 	if (!tdb_new) {
@@ -251,7 +262,7 @@ static int verify_tdb(const char *fname, const char *bak_name)
 	/* count is < 0 means an error */
 	if (count < 0) {
 		printf("restoring %s\n", fname);
-		return backup_tdb(bak_name, fname, 0, 0);
+		return backup_tdb(bak_name, fname, 0, 0, 0);
 	}
 
 	printf("%s : %d records\n", fname, count);
@@ -282,6 +293,7 @@ static void usage(void)
 	printf("   -v            verify mode (restore if corrupt)\n");
 	printf("   -n hashsize   set the new hash size for the backup\n");
 	printf("   -l            open without locking to back up mutex dbs\n");
+	printf("   -L            use 64 bit offsets for the backup (tdb >= 1.3.16)\n");
 }
 
  int main(int argc, char *argv[])
@@ -292,11 +304,12 @@ static void usage(void)
 	int verify = 0;
 	int hashsize = 0;
 	int nolock = 0;
+	int large = 0;
 	const char *suffix = ".bak";
 
 	log_ctx.log_fn = tdb_log;
 
-	while ((c = getopt(argc, argv, "vhs:n:l")) != -1) {
+	while ((c = getopt(argc, argv, "vhs:n:lL")) != -1) {
 		switch (c) {
 		case 'h':
 			usage();
@@ -313,6 +326,9 @@ static void usage(void)
 		case 'l':
 			nolock = 1;
 			break;
+		case 'L':
+			large = 1;
+			break;
 		}
 	}
 
@@ -337,7 +353,7 @@ static void usage(void)
 		} else {
 			if (file_newer(fname, bak_name) &&
 			    backup_tdb(fname, bak_name, hashsize,
-				       nolock) != 0) {
+				       nolock, large) != 0) {
 				ret = 1;
 			}
 		}
@@ -65,6 +65,7 @@ enum commands {
 	CMD_SYSTEM,
 	CMD_CHECK,
 	CMD_REPACK,
+	CMD_REHASH,
 	CMD_QUIT,
 	CMD_HELP
 };
@@ -105,6 +106,7 @@ COMMAND_TABLE cmd_table[] = {
 	{"q",		CMD_QUIT},
 	{"!",		CMD_SYSTEM},
 	{"repack",	CMD_REPACK},
+	{"rehash",	CMD_REHASH},
 	{NULL,		CMD_HELP}
 };
 
@@ -240,6 +242,7 @@ static void help(void)
 "  freelist_size        : print the number of records in the freelist\n"
 "  check                : check the integrity of an opened database\n"
 "  repack               : repack the database\n"
+"  rehash    hashsize   : change the number of hash chains\n"
 "  speed                : perform speed tests on the database\n"
 "  ! command            : execute system command\n"
 "  1 | first            : print the first record\n"
@@ -695,6 +698,22 @@ static void check_db(TDB_CONTEXT *the_tdb)
 		       tdbcount);
 }
 
+static void rehash_db(const char *hash_size)
+{
+	unsigned size = hash_size ? atoi(hash_size) : 0;
+
+	if (size == 0) {
+		terror("need a hash size");
+		return;
+	}
+	if (tdb_rehash(tdb, size) == -1) {
+		printf("Rehashing to %u hash chains failed: %s\n",
+		       size, tdb_errorstr(tdb));
+		return;
+	}
+	printf("The database has %d hash chains now.\n", tdb_hash_size(tdb));
+}
+
 static int do_command(void)
 {
 	COMMAND_TABLE *ctp = cmd_table;
@@ -752,6 +771,10 @@ static int do_command(void)
 			bIterate = 0;
 			tdb_repack(tdb);
 			return 0;
+		case CMD_REHASH:
+			bIterate = 0;
+			rehash_db(arg1);
+			return 0;
 		case CMD_TRANSACTION_CANCEL:
 			bIterate = 0;
 			tdb_transaction_cancel(tdb);
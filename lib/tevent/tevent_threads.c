@@ -311,6 +311,7 @@ void tevent_thread_proxy_schedule(struct tevent_thread_proxy *tp,
 	int ret;
 	char c;
 	ssize_t written;
+	bool need_wakeup;
 
 	ret = pthread_mutex_lock(&tp->mutex);
 	if (ret != 0) {
@@ -338,13 +339,22 @@ void tevent_thread_proxy_schedule(struct tevent_thread_proxy *tp,
 		im_entry->private_ptr = talloc_move(im_entry, pptr);
 	}
 
+	/*
+	 * pipe_read_handler() empties tp->im_list under tp->mutex,
+	 * so if there are pending entries the dest_ev_ctx has already
+	 * been notified and will pick up this one with them.
+	 */
+	need_wakeup = (tp->im_list == NULL);
+
 	DLIST_ADD(tp->im_list, im_entry);
 
-	/* And notify the dest_ev_ctx to wake up. */
-	c = '\0';
-	do {
-		written = write(tp->write_fd, &c, 1);
-	} while (written == -1 && errno == EINTR);
+	if (need_wakeup) {
+		/* And notify the dest_ev_ctx to wake up. */
+		c = '\0';
+		do {
+			written = write(tp->write_fd, &c, 1);
+		} while (written == -1 && errno == EINTR);
+	}
 
   end:
 
@@ -451,6 +461,7 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 {
 #ifdef HAVE_PTHREAD
 	struct tevent_context *ev;
+	bool need_wakeup;
 	int ret;
 
 	ret = pthread_mutex_lock(&tctx->event_ctx_mutex);
@@ -488,6 +499,15 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 		abort();
 	}
 
+	/*
+	 * tevent_common_threaded_activate_immediate() moves all
+	 * scheduled immediates in one go. If the list is not empty,
+	 * the thread that added the first entry takes care of the
+	 * wakeup, so a burst of completions only costs one write to
+	 * the wakeup fd and one wakeup of the main thread.
+	 */
+	need_wakeup = (ev->scheduled_immediates == NULL);
+
 	DLIST_ADD_END(ev->scheduled_immediates, im);
 
 	ret = pthread_mutex_unlock(&ev->scheduled_mutex);
@@ -510,7 +530,9 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 	 * than a noncontended one. So I'd opt for the lower footprint
 	 * initially. Maybe we have to change that later.
 	 */
-	tevent_common_wakeup_fd(tctx->wakeup_fd);
+	if (need_wakeup) {
+		tevent_common_wakeup_fd(tctx->wakeup_fd);
+	}
 #else
 	/*
 	 * tevent_threaded_context_create() returned NULL with ENOSYS...
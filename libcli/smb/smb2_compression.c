@@ -0,0 +1,205 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB2 compression
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "../libcli/smb/smb_common.h"
+#include "../lib/compression/lzxpress.h"
+#include "lib/util/iov_buf.h"
+
+/*
+ * We only implement the unchained SMB2 COMPRESSION_TRANSFORM_HEADER
+ * (MS-SMB2 2.2.42) with the plain LZ77 algorithm (MS-XCA 2.3).
+ */
+bool smb2_compression_algorithm_supported(uint16_t algorithm)
+{
+	switch (algorithm) {
+	case SMB2_COMPRESSION_LZ77:
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Compresses the PDU described by vector[0..count-1].
+ *
+ * All elements except the last one are sent uncompressed
+ * (they are typically the SMB2 header and the fixed body part),
+ * only the last element is compressed.
+ *
+ * The caller should check if the result is actually smaller
+ * than the input.
+ */
+NTSTATUS smb2_compression_compress_pdu(TALLOC_CTX *mem_ctx,
+				       uint16_t algorithm,
+				       const struct iovec *vector,
+				       int count,
+				       DATA_BLOB *out)
+{
+	const struct iovec *last = NULL;
+	ssize_t prefix_len;
+	size_t max_len;
+	uint8_t *buf = NULL;
+	ssize_t c_len;
+	int i;
+
+	*out = data_blob_null;
+
+	if (!smb2_compression_algorithm_supported(algorithm)) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (count < 1) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	last = &vector[count - 1];
+	if (last->iov_len == 0 || last->iov_len > UINT32_MAX / 2) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	prefix_len = iov_buflen(vector, count - 1);
+	if (prefix_len == -1 || prefix_len > UINT32_MAX) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	/*
+	 * lzxpress_compress() needs one 32-bit indicator
+	 * for every 32 literals, plus the leading and the
+	 * trailing indicator in the worst case.
+	 */
+	max_len = SMB2_COMP_TF_HDR_SIZE + prefix_len;
+	max_len += last->iov_len + last->iov_len / 8 + 8;
+
+	buf = talloc_array(mem_ctx, uint8_t, max_len);
+	if (buf == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	SIVAL(buf, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+	SIVAL(buf, SMB2_COMP_TF_ORIGINAL_SIZE, last->iov_len);
+	SSVAL(buf, SMB2_COMP_TF_ALGORITHM, algorithm);
+	SSVAL(buf, SMB2_COMP_TF_FLAGS, SMB2_COMP_TF_FLAGS_NONE);
+	SIVAL(buf, SMB2_COMP_TF_OFFSET, prefix_len);
+
+	iov_buf(vector, count - 1,
+		buf + SMB2_COMP_TF_HDR_SIZE, prefix_len);
+
+	c_len = lzxpress_compress(last->iov_base,
+				  last->iov_len,
+				  buf + SMB2_COMP_TF_HDR_SIZE + prefix_len,
+				  max_len - SMB2_COMP_TF_HDR_SIZE - prefix_len);
+	if (c_len <= 0) {
+		TALLOC_FREE(buf);
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	*out = data_blob_const(buf, SMB2_COMP_TF_HDR_SIZE + prefix_len + c_len);
+	return NT_STATUS_OK;
+}
+
+/*
+ * Decompresses a PDU starting with an SMB2 COMPRESSION_TRANSFORM_HEADER.
+ *
+ * The whole buffer is expected to belong to the compressed PDU,
+ * out is allocated on mem_ctx and holds the uncompressed
+ * (not yet verified) SMB2 message(s).
+ */
+NTSTATUS smb2_compression_decompress_pdu(TALLOC_CTX *mem_ctx,
+					 uint16_t algorithm,
+					 const uint8_t *buf,
+					 size_t buflen,
+					 size_t max_size,
+					 DATA_BLOB *out)
+{
+	uint32_t original_size;
+	uint16_t comp_algorithm;
+	uint16_t flags;
+	uint32_t offset;
+	size_t c_len;
+	size_t full_size;
+	uint8_t *out_buf = NULL;
+	ssize_t ret;
+
+	*out = data_blob_null;
+
+	if (buflen < SMB2_COMP_TF_HDR_SIZE) {
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+
+	if (IVAL(buf, SMB2_COMP_TF_PROTOCOL_ID) != SMB2_COMP_TF_MAGIC) {
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+
+	original_size = IVAL(buf, SMB2_COMP_TF_ORIGINAL_SIZE);
+	comp_algorithm = SVAL(buf, SMB2_COMP_TF_ALGORITHM);
+	flags = SVAL(buf, SMB2_COMP_TF_FLAGS);
+	offset = IVAL(buf, SMB2_COMP_TF_OFFSET);
+
+	/*
+	 * Only the negotiated algorithm is allowed
+	 * and we don't support chained compression.
+	 */
+	if (comp_algorithm != algorithm) {
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+	if (!smb2_compression_algorithm_supported(comp_algorithm)) {
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+	if (flags != SMB2_COMP_TF_FLAGS_NONE) {
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+
+	buf += SMB2_COMP_TF_HDR_SIZE;
+	buflen -= SMB2_COMP_TF_HDR_SIZE;
+
+	if (offset > buflen) {
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+	c_len = buflen - offset;
+
+	full_size = (size_t)offset + original_size;
+	if (full_size > max_size) {
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+	if (original_size == 0 || c_len == 0) {
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+
+	out_buf = talloc_array(mem_ctx, uint8_t, full_size);
+	if (out_buf == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	memcpy(out_buf, buf, offset);
+
+	ret = lzxpress_decompress(buf + offset,
+				  c_len,
+				  out_buf + offset,
+				  original_size);
+	if (ret != original_size) {
+		TALLOC_FREE(out_buf);
+		return NT_STATUS_INVALID_NETWORK_RESPONSE;
+	}
+
+	*out = data_blob_const(out_buf, full_size);
+	return NT_STATUS_OK;
+}
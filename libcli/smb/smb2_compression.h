@@ -0,0 +1,40 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB2 compression
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LIBCLI_SMB_SMB2_COMPRESSION_H_
+#define _LIBCLI_SMB_SMB2_COMPRESSION_H_
+
+struct iovec;
+
+bool smb2_compression_algorithm_supported(uint16_t algorithm);
+
+NTSTATUS smb2_compression_compress_pdu(TALLOC_CTX *mem_ctx,
+				       uint16_t algorithm,
+				       const struct iovec *vector,
+				       int count,
+				       DATA_BLOB *out);
+NTSTATUS smb2_compression_decompress_pdu(TALLOC_CTX *mem_ctx,
+					 uint16_t algorithm,
+					 const uint8_t *buf,
+					 size_t buflen,
+					 size_t max_size,
+					 DATA_BLOB *out);
+
+#endif /* _LIBCLI_SMB_SMB2_COMPRESSION_H_ */
@@ -67,6 +67,10 @@ struct tevent_req *smb2cli_read_send(TALLOC_CTX *mem_ctx,
 	SBVAL(fixed, 32, minimum_count);
 	SBVAL(fixed, 40, remaining_bytes);
 
+	if (smb2cli_conn_get_compression(conn) != SMB2_COMPRESSION_NONE) {
+		SCVAL(fixed, 3, SMB2_READFLAG_REQUEST_COMPRESSED);
+	}
+
 	subreq = smb2cli_req_send(state, ev, conn, SMB2_OP_READ,
 				  0, 0, /* flags */
 				  timeout_msec,
@@ -114,6 +114,7 @@ struct smbXcli_conn {
 			uint32_t capabilities;
 			uint16_t security_mode;
 			struct GUID guid;
+			uint16_t compression;
 		} client;
 
 		struct {
@@ -127,6 +128,7 @@ struct smbXcli_conn {
 			NTTIME start_time;
 			DATA_BLOB gss_blob;
 			uint16_t cipher;
+			uint16_t compression;
 		} server;
 
 		uint64_t mid;
@@ -2800,6 +2802,26 @@ void smb2cli_conn_set_io_priority(struct smbXcli_conn *conn,
 	conn->smb2.io_priority = io_priority;
 }
 
+uint16_t smb2cli_conn_get_compression(struct smbXcli_conn *conn)
+{
+	if (conn->protocol < PROTOCOL_SMB3_11) {
+		return SMB2_COMPRESSION_NONE;
+	}
+
+	return conn->smb2.server.compression;
+}
+
+/*
+ * This needs to be called before the negotiate
+ * request is sent, SMB2_COMPRESSION_NONE (the default)
+ * means compression is not offered to the server.
+ */
+void smb2cli_conn_set_compression(struct smbXcli_conn *conn,
+				  uint16_t algorithm)
+{
+	conn->smb2.client.compression = algorithm;
+}
+
 uint32_t smb2cli_conn_cc_chunk_len(struct smbXcli_conn *conn)
 {
 	return conn->smb2.cc_chunk_len;
@@ -3448,7 +3470,12 @@ static struct smbXcli_session* smbXcli_session_by_uid(struct smbXcli_conn *conn,
 	return s;
 }
 
+/*
+ * A decompressed message is allocated on buf_ctx,
+ * it needs to have the same lifetime as buf.
+ */
 static NTSTATUS smb2cli_inbuf_parse_compound(struct smbXcli_conn *conn,
+					     TALLOC_CTX *buf_ctx,
 					     uint8_t *buf,
 					     size_t buflen,
 					     TALLOC_CTX *mem_ctx,
@@ -3539,6 +3566,52 @@ static NTSTATUS smb2cli_inbuf_parse_compound(struct smbXcli_conn *conn,
 			len = enc_len;
 		}
 
+		if (len >= 4 && IVAL(hdr, 0) == SMB2_COMP_TF_MAGIC) {
+			DATA_BLOB out = data_blob_null;
+			NTSTATUS status;
+
+			if (conn->smb2.server.compression ==
+			    SMB2_COMPRESSION_NONE)
+			{
+				DEBUG(10, ("Got SMB2_COMPRESSION_TRANSFORM "
+					   "header, but not negotiated\n"));
+				goto inval;
+			}
+
+			/*
+			 * The compressed message needs to cover
+			 * the whole (decrypted) PDU.
+			 */
+			if (taken != tf_len || taken + len != buflen) {
+				DEBUG(10, ("SMB2_COMPRESSION_TRANSFORM header "
+					   "at offset %d of %d bytes\n",
+					   (int)taken, (int)buflen));
+				goto inval;
+			}
+
+			status = smb2_compression_decompress_pdu(
+						buf_ctx,
+						conn->smb2.server.compression,
+						hdr, len,
+						0x00FFFFFF,
+						&out);
+			if (!NT_STATUS_IS_OK(status)) {
+				DEBUG(10, ("Decompression failed: %s\n",
+					   nt_errstr(status)));
+				TALLOC_FREE(iov);
+				return status;
+			}
+
+			first_hdr = out.data;
+			buflen = out.length;
+			taken = 0;
+			if (tf != NULL) {
+				verified_buflen = buflen;
+			}
+			hdr = first_hdr;
+			len = buflen;
+		}
+
 		/*
 		 * We need the header plus the body length field
 		 */
@@ -3645,6 +3718,7 @@ static NTSTATUS smb2cli_conn_dispatch_incoming(struct smbXcli_conn *conn,
 	size_t inbuf_len = smb_len_tcp(inbuf);
 
 	status = smb2cli_inbuf_parse_compound(conn,
+					      inbuf,
 					      inbuf + NBT_HDR_SIZE,
 					      inbuf_len,
 					      tmp_mem,
@@ -4740,6 +4814,23 @@ static struct tevent_req *smbXcli_negprot_smb2_subreq(struct smbXcli_negprot_sta
 			return NULL;
 		}
 
+		if (state->conn->max_protocol >= PROTOCOL_SMB3_11 &&
+		    state->conn->smb2.client.compression !=
+		    SMB2_COMPRESSION_NONE)
+		{
+			SSVAL(p, 0, 1); /* CompressionAlgorithmCount */
+			SSVAL(p, 2, 0); /* Padding */
+			SIVAL(p, 4, 0); /* Flags */
+			SSVAL(p, 8, state->conn->smb2.client.compression);
+
+			b = data_blob_const(p, 10);
+			status = smb2_negotiate_context_add(state, &c,
+					SMB2_COMPRESSION_CAPABILITIES, b);
+			if (!NT_STATUS_IS_OK(status)) {
+				return NULL;
+			}
+		}
+
 		status = smb2_negotiate_context_push(state, &b, c);
 		if (!NT_STATUS_IS_OK(status)) {
 			return NULL;
@@ -4805,6 +4896,7 @@ static void smbXcli_negprot_smb2_done(struct tevent_req *subreq)
 	uint16_t hash_selected;
 	struct hc_sha512state sctx;
 	struct smb2_negotiate_context *cipher = NULL;
+	struct smb2_negotiate_context *compression = NULL;
 	struct iovec sent_iov[3];
 	static const struct smb2cli_req_expected_response expected[] = {
 	{
@@ -5025,6 +5117,46 @@ static void smbXcli_negprot_smb2_done(struct tevent_req *subreq)
 		}
 	}
 
+	compression = smb2_negotiate_context_find(&c,
+					SMB2_COMPRESSION_CAPABILITIES);
+	if (compression != NULL &&
+	    conn->protocol >= PROTOCOL_SMB3_11 &&
+	    conn->smb2.client.compression != SMB2_COMPRESSION_NONE)
+	{
+		uint16_t algorithm_count;
+		uint16_t algorithm_selected;
+
+		if (compression->data.length < 8) {
+			tevent_req_nterror(req,
+					NT_STATUS_INVALID_NETWORK_RESPONSE);
+			return;
+		}
+
+		algorithm_count = SVAL(compression->data.data, 0);
+
+		if (algorithm_count != 1) {
+			tevent_req_nterror(req,
+					NT_STATUS_INVALID_NETWORK_RESPONSE);
+			return;
+		}
+
+		if (compression->data.length != (8 + 2 * algorithm_count)) {
+			tevent_req_nterror(req,
+					NT_STATUS_INVALID_NETWORK_RESPONSE);
+			return;
+		}
+
+		algorithm_selected = SVAL(compression->data.data, 8);
+
+		if (algorithm_selected == conn->smb2.client.compression) {
+			conn->smb2.server.compression = algorithm_selected;
+		} else if (algorithm_selected != SMB2_COMPRESSION_NONE) {
+			tevent_req_nterror(req,
+					NT_STATUS_INVALID_NETWORK_RESPONSE);
+			return;
+		}
+	}
+
 	/* First we hash the request */
 	smb2cli_req_get_sent_iov(subreq, sent_iov);
 	samba_SHA512_Init(&sctx);
@@ -373,6 +373,9 @@ uint16_t smb2cli_conn_get_cur_credits(struct smbXcli_conn *conn);
 uint8_t smb2cli_conn_get_io_priority(struct smbXcli_conn *conn);
 void smb2cli_conn_set_io_priority(struct smbXcli_conn *conn,
 				  uint8_t io_priority);
+uint16_t smb2cli_conn_get_compression(struct smbXcli_conn *conn);
+void smb2cli_conn_set_compression(struct smbXcli_conn *conn,
+				  uint16_t algorithm);
 uint32_t smb2cli_conn_cc_chunk_len(struct smbXcli_conn *conn);
 void smb2cli_conn_set_cc_chunk_len(struct smbXcli_conn *conn,
 				   uint32_t chunk_len);
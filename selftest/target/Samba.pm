@@ -339,7 +339,7 @@ sub get_interface($)
     $interfaces{"localnt4dc2"} = 3;
     $interfaces{"localnt4member3"} = 4;
     $interfaces{"localshare4"} = 5;
-
+    $interfaces{"asynccrypto"} = 6;
     $interfaces{"localktest6"} = 7;
     $interfaces{"maptoguest"} = 8;
     $interfaces{"localnt4dc9"} = 9;
@@ -367,6 +367,7 @@ sub get_interface($)
     $interfaces{"fakednsforwarder2"} = 37;
     $interfaces{"s4member_dflt"} = 38;
     $interfaces{"vampire2000dc"} = 39;
+    $interfaces{"preforkdc"} = 40;
 
     # update lib/socket_wrapper/socket_wrapper.c
     #  #define MAX_WRAPPED_INTERFACES 40
@@ -190,6 +190,8 @@ sub setup_env($$$)
 		return $self->setup_fileserver("$path/fileserver");
 	} elsif ($envname eq "maptoguest") {
 		return $self->setup_maptoguest("$path/maptoguest");
+	} elsif ($envname eq "async_crypto") {
+		return $self->setup_async_crypto("$path/async_crypto");
 	} elsif ($envname eq "ktest") {
 		return $self->setup_ktest("$path/ktest");
 	} elsif ($envname eq "nt4_member") {
@@ -1142,6 +1144,33 @@ ntlm auth = yes
 	return $vars;
 }
 
+sub setup_async_crypto($$)
+{
+	my ($self, $path) = @_;
+
+	print "PROVISIONING server with async crypto...";
+
+	my $options = "
+	smbd:async crypto = yes
+	server multi channel support = yes
+";
+
+	my $vars = $self->provision($path, "WORKGROUP",
+				    "asynccrypto",
+				    "asynccryptopass",
+				    $options);
+
+	$vars or return undef;
+
+	if (not $self->check_or_start($vars, "yes", "no", "yes")) {
+	       return undef;
+	}
+
+	$self->{vars}->{async_crypto} = $vars;
+
+	return $vars;
+}
+
 sub stop_sig_term($$) {
 	my ($self, $pid) = @_;
 	kill("USR1", $pid) or kill("ALRM", $pid) or warn("Unable to kill $pid: $!");
@@ -1891,6 +1920,9 @@ sub provision($$$$$$$$$)
 	copy = tmp
 	aio read size = 1
 	aio write size = 1
+[io_uring]
+	copy = tmp
+	vfs objects = io_uring
 
 [print\$]
 	copy = tmp
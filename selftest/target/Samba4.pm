@@ -1529,6 +1529,45 @@ sub provision_fl2000dc($$)
 	return $ret;
 }
 
+sub provision_ad_dc_prefork($$)
+{
+	my ($self, $prefix) = @_;
+
+	print "PROVISIONING PRE-FORKING DC...\n";
+	my $extra_conf_options = "
+	prefork children = 4
+";
+	my $ret = $self->provision($prefix,
+				   "domain controller",
+				   "preforkdc",
+				   "PREFORKDOMAIN",
+				   "prefork.samba.example.com",
+				   "2008",
+				   "locDCpass40",
+				   undef,
+				   undef,
+				   $extra_conf_options,
+				   "",
+				   undef);
+	unless ($ret) {
+		return undef;
+	}
+
+	unless($self->add_wins_config("$prefix/private")) {
+		warn("Unable to add wins configuration");
+		return undef;
+	}
+	$ret->{DC_SERVER} = $ret->{SERVER};
+	$ret->{DC_SERVER_IP} = $ret->{SERVER_IP};
+	$ret->{DC_SERVER_IPV6} = $ret->{SERVER_IPV6};
+	$ret->{DC_NETBIOSNAME} = $ret->{NETBIOSNAME};
+	$ret->{DC_USERNAME} = $ret->{USERNAME};
+	$ret->{DC_PASSWORD} = $ret->{PASSWORD};
+	$ret->{DC_REALM} = $ret->{REALM};
+
+	return $ret;
+}
+
 sub provision_fl2003dc($$$)
 {
 	my ($self, $prefix, $dcvars) = @_;
@@ -2122,6 +2161,8 @@ sub setup_env($$$)
 		return $self->setup_ad_dc("$path/ad_dc");
 	} elsif ($envname eq "ad_dc_no_nss") {
 		return $self->setup_ad_dc("$path/ad_dc_no_nss", "no_nss");
+	} elsif ($envname eq "ad_dc_prefork") {
+		return $self->setup_ad_dc_prefork("$path/ad_dc_prefork");
 	} elsif ($envname eq "ad_member_rfc2307") {
 		if (not defined($self->{vars}->{ad_dc_ntvfs})) {
 			$self->setup_ad_dc_ntvfs("$path/ad_dc_ntvfs");
@@ -2524,6 +2565,22 @@ sub setup_ad_dc($$)
 	return $env;
 }
 
+sub setup_ad_dc_prefork($$)
+{
+	my ($self, $path) = @_;
+
+	my $env = $self->provision_ad_dc_prefork($path);
+	if (defined $env) {
+	        if (not defined($self->check_or_start($env, "prefork"))) {
+		        return undef;
+		}
+
+		$self->{vars}->{ad_dc_prefork} = $env;
+	}
+
+	return $env;
+}
+
 sub setup_none($$)
 {
 	my ($self, $path) = @_;
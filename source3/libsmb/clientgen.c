@@ -217,6 +217,10 @@ struct cli_state *cli_state_create(TALLOC_CTX *mem_ctx,
 		goto error;
 	}
 
+	if (lp_parm_bool(-1, "libsmb", "compression", false)) {
+		smb2cli_conn_set_compression(cli->conn, SMB2_COMPRESSION_LZ77);
+	}
+
 	cli->smb1.pid = (uint32_t)getpid();
 	cli->smb1.vc_num = cli->smb1.pid;
 	cli->smb1.session = smbXcli_session_create(cli, cli->conn);
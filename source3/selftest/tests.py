@@ -57,6 +57,7 @@ finally:
 have_libarchive = ("HAVE_LIBARCHIVE" in config_hash)
 have_linux_kernel_oplocks = ("HAVE_KERNEL_OPLOCKS_LINUX" in config_hash)
 have_inotify = ("HAVE_INOTIFY" in config_hash)
+have_liburing = ("HAVE_LIBURING" in config_hash)
 
 plantestsuite("samba3.blackbox.success", "nt4_dc:local", [os.path.join(samba3srcdir, "script/tests/test_success.sh")])
 plantestsuite("samba3.blackbox.failure", "nt4_dc:local", [os.path.join(samba3srcdir, "script/tests/test_failure.sh")])
@@ -475,6 +476,18 @@ for t in tests:
     elif t == "raw.read":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/aio -U$USERNAME%$PASSWORD', 'aio')
+        if have_liburing:
+            plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/io_uring -U$USERNAME%$PASSWORD', 'io_uring')
+        plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -U$USERNAME%$PASSWORD')
+    elif t == "raw.write":
+        plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
+        if have_liburing:
+            plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/io_uring -U$USERNAME%$PASSWORD', 'io_uring')
+        plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -U$USERNAME%$PASSWORD')
+    elif t == "smb2.read":
+        plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
+        if have_liburing:
+            plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/io_uring -U$USERNAME%$PASSWORD', 'io_uring')
         plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -U$USERNAME%$PASSWORD')
     elif t == "raw.search":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
@@ -522,6 +535,13 @@ for t in tests:
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
         plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -U$USERNAME%$PASSWORD')
 
+# "smbd:async crypto = yes" signs and encrypts large responses and
+# decrypts large requests on worker threads, smb2.session.bind_large_io
+# sends large encrypted writes through two channels at once
+for t in ["smb2.read", "smb2.session"]:
+    plansmbtorture4testsuite(t, "async_crypto", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD --signing=required', 'sign')
+    plansmbtorture4testsuite(t, "async_crypto", '//$SERVER_IP/tmpenc -U$USERNAME%$PASSWORD', 'enc')
+
 
 test = 'rpc.lsa.lookupsids'
 auth_options = ["", "ntlm", "spnego", "spnego,ntlm" ]
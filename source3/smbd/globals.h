@@ -459,6 +459,12 @@ struct smbXsrv_connection {
 			size_t pktlen;
 			uint8_t *pktbuf;
 		} request_read_state;
+		/*
+		 * An incoming request which is decrypted on a
+		 * worker thread. We don't read the next request
+		 * from the socket before it got dispatched.
+		 */
+		struct smbd_smb2_request *decrypt_req;
 		struct smbd_smb2_send_queue *send_queue;
 		size_t send_queue_len;
 
@@ -526,6 +532,7 @@ struct smbXsrv_connection {
 			uint32_t max_read;
 			uint32_t max_write;
 			uint16_t cipher;
+			uint16_t compression;
 		} server;
 
 		struct smbXsrv_preauth preauth;
@@ -685,6 +692,8 @@ struct smbd_smb2_send_queue {
 	TALLOC_CTX *mem_ctx;
 };
 
+struct smbd_smb2_crypto_state;
+
 struct smbd_smb2_request {
 	struct smbd_smb2_request *prev, *next;
 
@@ -707,6 +716,8 @@ struct smbd_smb2_request {
 	bool was_encrypted;
 	/* Should we encrypt? */
 	bool do_encryption;
+	/* Did the client ask for a compressed response? */
+	bool compress_response;
 	struct tevent_timer *async_te;
 	bool compound_related;
 
@@ -750,6 +761,13 @@ struct smbd_smb2_request {
 	 */
 	struct tevent_req *subreq;
 
+	/*
+	 * Decryption of the request or signing or
+	 * encryption of the response running on
+	 * a worker thread.
+	 */
+	struct smbd_smb2_crypto_state *crypto_state;
+
 #define SMBD_SMB2_TF_IOV_OFS 0
 #define SMBD_SMB2_HDR_IOV_OFS 1
 #define SMBD_SMB2_BODY_IOV_OFS 2
@@ -757,6 +775,14 @@ struct smbd_smb2_request {
 
 #define SMBD_SMB2_NUM_IOV_PER_REQ 4
 
+/*
+ * Responses within a compound chain are padded to 8 bytes. READ
+ * buffers are allocated with this much slack, so that the padding
+ * can be added in place instead of copying the read data into a
+ * new buffer in smbd_smb2_request_done_ex().
+ */
+#define SMBD_SMB2_READ_PAD_SLACK 7
+
 #define SMBD_SMB2_IOV_IDX_OFS(req,dir,idx,ofs) \
 	(&req->dir.vector[(idx)+(ofs)])
 
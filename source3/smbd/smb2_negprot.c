@@ -147,6 +147,7 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 	struct smb2_negotiate_contexts in_c = { .num_contexts = 0, };
 	struct smb2_negotiate_context *in_preauth = NULL;
 	struct smb2_negotiate_context *in_cipher = NULL;
+	struct smb2_negotiate_context *in_compression = NULL;
 	struct smb2_negotiate_contexts out_c = { .num_contexts = 0, };
 	DATA_BLOB out_negotiate_context_blob = data_blob_null;
 	uint32_t out_negotiate_context_offset = 0;
@@ -296,6 +297,8 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 	}
 	in_cipher = smb2_negotiate_context_find(&in_c,
 					SMB2_ENCRYPTION_CAPABILITIES);
+	in_compression = smb2_negotiate_context_find(&in_c,
+					SMB2_COMPRESSION_CAPABILITIES);
 
 	/* negprot_spnego() returns a the server guid in the first 16 bytes */
 	negprot_spnego_blob = negprot_spnego(req, xconn);
@@ -512,6 +515,67 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 		xconn->smb2.server.cipher = SMB2_ENCRYPTION_AES128_CCM;
 	}
 
+	if (protocol >= PROTOCOL_SMB3_11 && in_compression != NULL) {
+		size_t needed = 8;
+		uint16_t algorithm_count;
+		const uint8_t *p;
+		uint8_t buf[10];
+		DATA_BLOB b;
+		size_t i;
+		bool lz77_supported = false;
+		bool enabled;
+
+		enabled = lp_parm_bool(-1, "smbd", "compression", false);
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		algorithm_count = SVAL(in_compression->data.data, 0);
+
+		if (algorithm_count == 0) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		p = in_compression->data.data + needed;
+		needed += algorithm_count * 2;
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		for (i=0; i < algorithm_count; i++) {
+			uint16_t v;
+
+			v = SVAL(p, 0);
+			p += 2;
+
+			if (v == SMB2_COMPRESSION_LZ77) {
+				lz77_supported = true;
+			}
+		}
+
+		xconn->smb2.server.compression = SMB2_COMPRESSION_NONE;
+		if (enabled && lz77_supported) {
+			xconn->smb2.server.compression = SMB2_COMPRESSION_LZ77;
+		}
+
+		SSVAL(buf, 0, 1); /* CompressionAlgorithmCount */
+		SSVAL(buf, 2, 0); /* Padding */
+		SIVAL(buf, 4, 0); /* Flags */
+		SSVAL(buf, 8, xconn->smb2.server.compression);
+
+		b = data_blob_const(buf, sizeof(buf));
+		status = smb2_negotiate_context_add(req, &out_c,
+					SMB2_COMPRESSION_CAPABILITIES, b);
+		if (!NT_STATUS_IS_OK(status)) {
+			return smbd_smb2_request_error(req, status);
+		}
+	}
+
 	if (protocol >= PROTOCOL_SMB2_22 &&
 	    xconn->client->server_multi_channel_enabled)
 	{
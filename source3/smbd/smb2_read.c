@@ -94,6 +94,11 @@ NTSTATUS smbd_smb2_request_process_read(struct smbd_smb2_request *req)
 		return smbd_smb2_request_error(req, NT_STATUS_FILE_CLOSED);
 	}
 
+	if ((in_flags & SMB2_READFLAG_REQUEST_COMPRESSED) &&
+	    (xconn->smb2.server.compression != SMB2_COMPRESSION_NONE)) {
+		req->compress_response = true;
+	}
+
 	subreq = smbd_smb2_read_send(req, req->sconn->ev_ctx,
 				     req, in_fsp,
 				     in_flags,
@@ -161,6 +166,26 @@ static void smbd_smb2_request_read_done(struct tevent_req *subreq)
 
 	outdyn = out_data_buffer;
 
+	if ((req->out.vector_count >= (2 * SMBD_SMB2_NUM_IOV_PER_REQ)) &&
+	    (outdyn.length != 0)) {
+		size_t next_command_ofs = out_data_offset + outdyn.length;
+		size_t pad_size = (8 - (next_command_ofs % 8)) % 8;
+
+		/*
+		 * Within a compound chain the response needs to be
+		 * padded to 8 bytes. Our read buffers have room for
+		 * that, so pad in place instead of letting
+		 * smbd_smb2_request_done_ex() copy the whole data
+		 * into a new buffer.
+		 */
+		if ((pad_size != 0) &&
+		    (talloc_get_size(outdyn.data) >= outdyn.length + pad_size))
+		{
+			memset(outdyn.data + outdyn.length, 0, pad_size);
+			outdyn.length += pad_size;
+		}
+	}
+
 	error = smbd_smb2_request_done(req, outbody, &outdyn);
 	if (!NT_STATUS_IS_OK(error)) {
 		smbd_server_connection_terminate(req->xconn,
@@ -337,6 +362,7 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	 * We cannot use sendfile if...
 	 * We were not configured to do so OR
 	 * Signing is active OR
+	 * The response should be compressed OR
 	 * This is a compound SMB2 operation OR
 	 * fsp is a STREAM file OR
 	 * We're using a write cache OR
@@ -350,6 +376,7 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	if (!lp__use_sendfile(SNUM(fsp->conn)) ||
 	    smb2req->do_signing ||
 	    smb2req->do_encryption ||
+	    smb2req->compress_response ||
 	    smb2req->in.vector_count >= (2*SMBD_SMB2_NUM_IOV_PER_REQ) ||
 	    (fsp->base_fsp != NULL) ||
 	    (fsp->wcp != NULL) ||
@@ -423,6 +450,28 @@ NTSTATUS smb2_read_complete(struct tevent_req *req, ssize_t nread, int err)
 	return NT_STATUS_OK;
 }
 
+/*
+ * Allocate a read buffer with room for the compound padding,
+ * see smbd_smb2_request_read_done().
+ */
+static DATA_BLOB smbd_smb2_read_alloc_buffer(TALLOC_CTX *mem_ctx,
+					     uint32_t in_length)
+{
+	DATA_BLOB blob;
+
+	if (in_length == 0) {
+		return data_blob_null;
+	}
+
+	blob = data_blob_talloc(mem_ctx, NULL,
+				in_length + SMBD_SMB2_READ_PAD_SLACK);
+	if (blob.data == NULL) {
+		return data_blob_null;
+	}
+	blob.length = in_length;
+	return blob;
+}
+
 static bool smbd_smb2_read_cancel(struct tevent_req *req)
 {
 	struct smbd_smb2_read_state *state =
@@ -483,7 +532,7 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 	if (IS_IPC(smbreq->conn)) {
 		struct tevent_req *subreq = NULL;
 
-		state->out_data = data_blob_talloc(state, NULL, in_length);
+		state->out_data = smbd_smb2_read_alloc_buffer(state, in_length);
 		if (in_length > 0 && tevent_req_nomem(state->out_data.data, req)) {
 			return tevent_req_post(req, ev);
 		}
@@ -561,7 +610,7 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 	}
 
 	/* Ok, read into memory. Allocate the out buffer. */
-	state->out_data = data_blob_talloc(state, NULL, in_length);
+	state->out_data = smbd_smb2_read_alloc_buffer(state, in_length);
 	if (in_length > 0 && tevent_req_nomem(state->out_data.data, req)) {
 		return tevent_req_post(req, ev);
 	}
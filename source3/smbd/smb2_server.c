@@ -31,6 +31,7 @@
 #include "lib/util/iov_buf.h"
 #include "auth.h"
 #include "lib/crypto/sha512.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 
 static void smbd_smb2_connection_handler(struct tevent_context *ev,
 					 struct tevent_fd *fde,
@@ -261,8 +262,45 @@ static bool smb2_setup_nbt_length(struct iovec *vector, int count)
 	return true;
 }
 
+enum smbd_smb2_crypto_op {
+	SMBD_SMB2_CRYPTO_SIGN,
+	SMBD_SMB2_CRYPTO_ENCRYPT,
+	SMBD_SMB2_CRYPTO_DECRYPT,
+};
+
+struct smbd_smb2_crypto_state {
+	DATA_BLOB key;
+	enum smbd_smb2_crypto_op op;
+	uint16_t cipher;
+	enum protocol_types protocol;
+	struct iovec *vector;
+	int count;
+	NTSTATUS status;
+	/*
+	 * The incoming buffer for SMBD_SMB2_CRYPTO_DECRYPT.
+	 */
+	struct iovec tf_iov[2];
+	uint8_t *inbuf;
+	size_t inbuf_len;
+	NTTIME now;
+	/*
+	 * The request was talloc_free'd while
+	 * the worker thread was still running.
+	 */
+	bool orphaned;
+};
+
 static int smbd_smb2_request_destructor(struct smbd_smb2_request *req)
 {
+	if (req->crypto_state != NULL) {
+		/*
+		 * A worker thread still operates on our
+		 * buffers, smbd_smb2_request_crypto_done()
+		 * will free us later.
+		 */
+		req->crypto_state->orphaned = true;
+		return -1;
+	}
 	if (req->first_key.length > 0) {
 		data_blob_clear_free(&req->first_key);
 	}
@@ -315,6 +353,7 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 					       NTTIME now,
 					       uint8_t *buf,
 					       size_t buflen,
+					       bool decrypted,
 					       struct smbd_smb2_request *req,
 					       struct iovec **piov,
 					       int *pnum_iov)
@@ -419,18 +458,76 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 			tf_iov[1].iov_base = (void *)hdr;
 			tf_iov[1].iov_len = enc_len;
 
-			status = smb2_signing_decrypt_pdu(s->global->decryption_key,
-							  xconn->smb2.server.cipher,
-							  tf_iov, 2);
-			if (!NT_STATUS_IS_OK(status)) {
-				TALLOC_FREE(iov_alloc);
-				return status;
+			/*
+			 * The caller may already have decrypted a
+			 * buffer consisting of a single
+			 * SMB2_TRANSFORM message on a worker thread.
+			 */
+			if (!decrypted) {
+				status = smb2_signing_decrypt_pdu(
+					s->global->decryption_key,
+					xconn->smb2.server.cipher,
+					tf_iov, 2);
+				if (!NT_STATUS_IS_OK(status)) {
+					TALLOC_FREE(iov_alloc);
+					return status;
+				}
 			}
 
 			verified_buflen = taken + enc_len;
 			len = enc_len;
 		}
 
+		if (len >= 4 && IVAL(hdr, 0) == SMB2_COMP_TF_MAGIC) {
+			DATA_BLOB out = data_blob_null;
+			NTSTATUS status;
+
+			if (xconn->smb2.server.compression ==
+			    SMB2_COMPRESSION_NONE)
+			{
+				DEBUG(10, ("Got SMB2_COMPRESSION_TRANSFORM "
+					   "header, but not negotiated\n"));
+				goto inval;
+			}
+
+			/*
+			 * The compressed message needs to cover
+			 * the whole (decrypted) PDU, so that we can
+			 * continue with the uncompressed buffer.
+			 */
+			if (taken != tf_len || taken + len != buflen) {
+				DEBUG(1, ("SMB2_COMPRESSION_TRANSFORM header "
+					  "at offset %d of %d bytes\n",
+					  (int)taken, (int)buflen));
+				goto inval;
+			}
+
+			/*
+			 * Don't allow more than a client could send
+			 * us without compression over direct TCP.
+			 */
+			status = smb2_compression_decompress_pdu(
+						mem_ctx,
+						xconn->smb2.server.compression,
+						hdr, len,
+						0x00FFFFFF,
+						&out);
+			if (!NT_STATUS_IS_OK(status)) {
+				DEBUG(1, ("Decompression failed: %s\n",
+					  nt_errstr(status)));
+				goto inval;
+			}
+
+			first_hdr = out.data;
+			buflen = out.length;
+			taken = 0;
+			if (tf != NULL) {
+				verified_buflen = buflen;
+			}
+			hdr = first_hdr;
+			len = buflen;
+		}
+
 		/*
 		 * We need the header plus the body length field
 		 */
@@ -586,6 +683,7 @@ static NTSTATUS smbd_smb2_request_create(struct smbXsrv_connection *xconn,
 						now,
 						inpdu,
 						size,
+						false,
 						req, &req->in.vector,
 						&req->in.vector_count);
 	if (!NT_STATUS_IS_OK(status)) {
@@ -2729,13 +2827,18 @@ static void smbd_smb2_request_reply_update_counts(struct smbd_smb2_request *req)
 	}
 }
 
+static NTSTATUS smbd_smb2_request_queue_reply(struct smbd_smb2_request *req);
+static NTSTATUS smbd_smb2_request_compress(struct smbd_smb2_request *req);
+static bool smbd_smb2_request_crypto_async_possible(
+	struct smbd_smb2_request *req);
+static NTSTATUS smbd_smb2_request_crypto_async(struct smbd_smb2_request *req);
+
 static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
 	int first_idx = 1;
 	struct iovec *firsttf = SMBD_SMB2_IDX_TF_IOV(req,out,first_idx);
 	struct iovec *outhdr = SMBD_SMB2_OUT_HDR_IOV(req);
-	struct iovec *outdyn = SMBD_SMB2_OUT_DYN_IOV(req);
 	NTSTATUS status;
 	bool ok;
 
@@ -2874,6 +2977,10 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	   is a final reply for an async operation). */
 	smb2_calculate_credits(req, req);
 
+	if (smbd_smb2_request_crypto_async_possible(req)) {
+		return smbd_smb2_request_crypto_async(req);
+	}
+
 	/*
 	 * now check if we need to sign the current response
 	 */
@@ -2928,6 +3035,15 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		req->preauth = NULL;
 	}
 
+	return smbd_smb2_request_queue_reply(req);
+}
+
+static NTSTATUS smbd_smb2_request_queue_reply(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct iovec *outdyn = SMBD_SMB2_IDX_DYN_IOV(req,out,1);
+	NTSTATUS status;
+
 	/* I am a sick, sick man... :-). Sendfile hack ... JRA. */
 	if (req->out.vector_count < (2*SMBD_SMB2_NUM_IOV_PER_REQ) &&
 	    outdyn->iov_base == NULL && outdyn->iov_len != 0) {
@@ -2936,6 +3052,11 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		req->out.vector_count -= 1;
 	}
 
+	status = smbd_smb2_request_compress(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
 	/*
 	 * We're done with this request -
 	 * move it off the "being processed" queue.
@@ -2956,6 +3077,472 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	return NT_STATUS_OK;
 }
 
+/*
+ * Only responses with at least this much payload are
+ * compressed, smaller ones hardly gain anything.
+ */
+#define SMBD_SMB2_COMPRESSION_MIN_SIZE 4096
+
+static NTSTATUS smbd_smb2_request_compress(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct iovec *firsttf = SMBD_SMB2_IDX_TF_IOV(req,out,1);
+	struct iovec *outhdr = SMBD_SMB2_IDX_HDR_IOV(req,out,1);
+	struct iovec *outdyn = SMBD_SMB2_IDX_DYN_IOV(req,out,1);
+	DATA_BLOB blob = data_blob_null;
+	ssize_t len;
+	NTSTATUS status;
+	int i;
+	bool ok;
+
+	if (!req->compress_response) {
+		return NT_STATUS_OK;
+	}
+	if (xconn->smb2.server.compression == SMB2_COMPRESSION_NONE) {
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * We only compress single (already signed) responses,
+	 * we never compress encrypted responses, as that
+	 * would leak information about the plaintext
+	 * via the message length.
+	 */
+	if (req->out.vector_count != 1 + SMBD_SMB2_NUM_IOV_PER_REQ) {
+		return NT_STATUS_OK;
+	}
+	if (firsttf->iov_len != 0) {
+		return NT_STATUS_OK;
+	}
+	if ((outdyn->iov_base == NULL) ||
+	    (outdyn->iov_len < SMBD_SMB2_COMPRESSION_MIN_SIZE)) {
+		return NT_STATUS_OK;
+	}
+
+	len = iov_buflen(outhdr, SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+	if (len == -1) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+
+	status = smb2_compression_compress_pdu(req,
+					       xconn->smb2.server.compression,
+					       outhdr,
+					       SMBD_SMB2_NUM_IOV_PER_REQ - 1,
+					       &blob);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	if (blob.length >= len) {
+		/* not worth it, send it uncompressed */
+		data_blob_free(&blob);
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * The SMB2_COMPRESSION_TRANSFORM message replaces
+	 * the whole response, we use the (empty) transform
+	 * vector for it.
+	 */
+	firsttf->iov_base = (void *)blob.data;
+	firsttf->iov_len = blob.length;
+	for (i = 0; i < SMBD_SMB2_NUM_IOV_PER_REQ - 1; i++) {
+		outhdr[i].iov_len = 0;
+	}
+
+	ok = smb2_setup_nbt_length(req->out.vector, req->out.vector_count);
+	if (!ok) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+
+	return NT_STATUS_OK;
+}
+
+/*
+ * Only messages with at least this much payload are
+ * signed, encrypted or decrypted on a worker thread,
+ * for smaller ones the thread handoff costs more than
+ * it saves.
+ */
+#define SMBD_SMB2_ASYNC_CRYPTO_MIN_SIZE (64*1024)
+
+static bool smbd_smb2_crypto_async_enabled(struct smbd_server_connection *sconn);
+
+static bool smbd_smb2_request_crypto_async_possible(
+	struct smbd_smb2_request *req)
+{
+	struct smbd_server_connection *sconn = req->sconn;
+	struct iovec *firsttf = SMBD_SMB2_IDX_TF_IOV(req,out,1);
+	struct iovec *outdyn = SMBD_SMB2_IDX_DYN_IOV(req,out,1);
+
+	if ((firsttf->iov_len != SMB2_TF_HDR_SIZE) && !req->do_signing) {
+		return false;
+	}
+
+	/*
+	 * Compound chains and the negprot/session setup
+	 * responses that feed the preauth hash are
+	 * processed synchronously.
+	 */
+	if (req->out.vector_count != 1 + SMBD_SMB2_NUM_IOV_PER_REQ) {
+		return false;
+	}
+	if (req->preauth != NULL) {
+		return false;
+	}
+
+	if ((outdyn->iov_base == NULL) ||
+	    (outdyn->iov_len < SMBD_SMB2_ASYNC_CRYPTO_MIN_SIZE)) {
+		return false;
+	}
+
+	return smbd_smb2_crypto_async_enabled(sconn);
+}
+
+static bool smbd_smb2_crypto_async_enabled(struct smbd_server_connection *sconn)
+{
+	int ret;
+
+	/*
+	 * smb2_signing_*_pdu() call DEBUG(5, ...),
+	 * the debug code is not thread safe.
+	 */
+	if (CHECK_DEBUGLVL(5)) {
+		return false;
+	}
+
+	if (!lp_parm_bool(-1, "smbd", "async crypto", false)) {
+		return false;
+	}
+
+	if (sconn->pool == NULL) {
+		ret = pthreadpool_tevent_init(sconn, lp_aio_max_threads(),
+					      &sconn->pool);
+		if (ret != 0) {
+			DBG_WARNING("pthreadpool_tevent_init failed: %s\n",
+				    strerror(ret));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void smbd_smb2_request_crypto_do(void *private_data);
+static void smbd_smb2_request_crypto_done(struct tevent_req *subreq);
+
+/*
+ * Sign or encrypt the response on a worker thread of
+ * sconn->pool. The response is queued for sending once
+ * the thread is done, in smbd_smb2_request_crypto_done().
+ */
+static NTSTATUS smbd_smb2_request_crypto_async(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct iovec *firsttf = SMBD_SMB2_IDX_TF_IOV(req,out,1);
+	struct iovec *outhdr = SMBD_SMB2_IDX_HDR_IOV(req,out,1);
+	struct smbd_smb2_crypto_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+
+	state = talloc_zero(req, struct smbd_smb2_crypto_state);
+	if (state == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
+		state->key = req->first_key;
+		req->first_key = data_blob_null;
+		talloc_steal(state, state->key.data);
+		state->op = SMBD_SMB2_CRYPTO_ENCRYPT;
+		state->cipher = xconn->smb2.server.cipher;
+		state->vector = firsttf;
+		state->count = req->out.vector_count - 1;
+	} else {
+		struct smbXsrv_session *x = req->session;
+		DATA_BLOB signing_key = smbd_smb2_signing_key(x, xconn);
+
+		state->key = data_blob_dup_talloc(state, signing_key);
+		if (state->key.data == NULL) {
+			TALLOC_FREE(state);
+			return NT_STATUS_NO_MEMORY;
+		}
+		state->op = SMBD_SMB2_CRYPTO_SIGN;
+		state->protocol = xconn->protocol;
+		state->vector = outhdr;
+		state->count = SMBD_SMB2_NUM_IOV_PER_REQ - 1;
+	}
+
+	subreq = pthreadpool_tevent_job_send(state, req->sconn->ev_ctx,
+					     req->sconn->pool,
+					     smbd_smb2_request_crypto_do,
+					     state);
+	if (subreq == NULL) {
+		data_blob_clear_free(&state->key);
+		TALLOC_FREE(state);
+		return NT_STATUS_NO_MEMORY;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_request_crypto_done, req);
+
+	req->crypto_state = state;
+
+	/*
+	 * The response is complete, so there's nothing left to
+	 * cancel or wait for, and req->current_idx already points
+	 * past the out vector. Move it off the "being processed"
+	 * queue, so the code walking it doesn't look at it.
+	 * The worker thread only uses its own copy of the key.
+	 */
+	DLIST_REMOVE(xconn->smb2.requests, req);
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_request_crypto_do(void *private_data)
+{
+	struct smbd_smb2_crypto_state *state = talloc_get_type_abort(
+		private_data, struct smbd_smb2_crypto_state);
+
+	switch (state->op) {
+	case SMBD_SMB2_CRYPTO_SIGN:
+		state->status = smb2_signing_sign_pdu(state->key,
+						      state->protocol,
+						      state->vector,
+						      state->count);
+		break;
+	case SMBD_SMB2_CRYPTO_ENCRYPT:
+		state->status = smb2_signing_encrypt_pdu(state->key,
+							 state->cipher,
+							 state->vector,
+							 state->count);
+		break;
+	case SMBD_SMB2_CRYPTO_DECRYPT:
+		state->status = smb2_signing_decrypt_pdu(state->key,
+							 state->cipher,
+							 state->vector,
+							 state->count);
+		break;
+	}
+}
+
+static void smbd_smb2_request_crypto_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *req = tevent_req_callback_data(
+		subreq, struct smbd_smb2_request);
+	struct smbd_smb2_crypto_state *state = req->crypto_state;
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+
+	req->crypto_state = NULL;
+	data_blob_clear_free(&state->key);
+
+	if (state->orphaned) {
+		/*
+		 * Our connection is gone,
+		 * just cleanup.
+		 */
+		TALLOC_FREE(req);
+		return;
+	}
+
+	if (ret != 0) {
+		status = map_nt_error_from_unix(ret);
+	} else {
+		status = state->status;
+	}
+	TALLOC_FREE(state);
+
+	if (NT_STATUS_IS_OK(status)) {
+		status = smbd_smb2_request_queue_reply(req);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(req->xconn,
+						 nt_errstr(status));
+		return;
+	}
+}
+
+/*
+ * Decrypt a large incoming request on a worker thread, this
+ * mainly helps large WRITE requests. While the request is
+ * being decrypted we don't read further requests from this
+ * connection, so requests of a channel are still processed
+ * in order, but the channels of a multi-channel session
+ * (and other connections served by this process) don't have
+ * to wait for the decryption.
+ */
+static bool smbd_smb2_request_decrypt_async_possible(
+	struct smbXsrv_connection *xconn,
+	NTTIME now,
+	const uint8_t *buf,
+	size_t buflen)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	struct smbXsrv_session *session = NULL;
+	uint32_t enc_len;
+	uint64_t uid;
+
+	if (buflen < SMBD_SMB2_ASYNC_CRYPTO_MIN_SIZE) {
+		return false;
+	}
+
+	if (IVAL(buf, 0) != SMB2_TF_MAGIC) {
+		return false;
+	}
+
+	if (xconn->protocol < PROTOCOL_SMB2_24) {
+		return false;
+	}
+	if (xconn->smb2.server.cipher == 0) {
+		return false;
+	}
+
+	/*
+	 * Only a buffer consisting of exactly one
+	 * SMB2_TRANSFORM message is handled here,
+	 * smbd_smb2_inbuf_parse_compound() deals with
+	 * everything else and all error cases.
+	 */
+	enc_len = IVAL(buf, SMB2_TF_MSG_SIZE);
+	if (SMB2_TF_HDR_SIZE + (size_t)enc_len != buflen) {
+		return false;
+	}
+
+	uid = BVAL(buf, SMB2_TF_SESSION_ID);
+	(void)smb2srv_session_lookup_conn(xconn, uid, now, &session);
+	if (session == NULL) {
+		return false;
+	}
+	if (session->global->decryption_key.length == 0) {
+		return false;
+	}
+
+	return smbd_smb2_crypto_async_enabled(sconn);
+}
+
+static NTSTATUS smbd_smb2_request_process_incoming(
+	struct smbXsrv_connection *xconn,
+	struct smbd_smb2_request *req,
+	NTTIME now,
+	uint8_t *pktbuf,
+	size_t pktlen,
+	bool decrypted,
+	size_t unread_bytes);
+static void smbd_smb2_request_decrypt_done(struct tevent_req *subreq);
+
+static NTSTATUS smbd_smb2_request_decrypt_async(
+	struct smbXsrv_connection *xconn,
+	struct smbd_smb2_request *req,
+	NTTIME now,
+	uint8_t *buf,
+	size_t buflen)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	struct smbd_smb2_crypto_state *state = NULL;
+	struct smbXsrv_session *session = NULL;
+	struct tevent_req *subreq = NULL;
+	uint64_t uid;
+
+	uid = BVAL(buf, SMB2_TF_SESSION_ID);
+	(void)smb2srv_session_lookup_conn(xconn, uid, now, &session);
+	if (session == NULL) {
+		return NT_STATUS_USER_SESSION_DELETED;
+	}
+
+	state = talloc_zero(req, struct smbd_smb2_crypto_state);
+	if (state == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	state->op = SMBD_SMB2_CRYPTO_DECRYPT;
+	state->cipher = xconn->smb2.server.cipher;
+	state->inbuf = buf;
+	state->inbuf_len = buflen;
+	state->now = now;
+
+	state->key = data_blob_dup_talloc(state,
+					  session->global->decryption_key);
+	if (state->key.data == NULL) {
+		TALLOC_FREE(state);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	state->tf_iov[0].iov_base = (void *)buf;
+	state->tf_iov[0].iov_len = SMB2_TF_HDR_SIZE;
+	state->tf_iov[1].iov_base = (void *)(buf + SMB2_TF_HDR_SIZE);
+	state->tf_iov[1].iov_len = buflen - SMB2_TF_HDR_SIZE;
+	state->vector = state->tf_iov;
+	state->count = ARRAY_SIZE(state->tf_iov);
+
+	subreq = pthreadpool_tevent_job_send(state, sconn->ev_ctx,
+					     sconn->pool,
+					     smbd_smb2_request_crypto_do,
+					     state);
+	if (subreq == NULL) {
+		data_blob_clear_free(&state->key);
+		TALLOC_FREE(state);
+		return NT_STATUS_NO_MEMORY;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_request_decrypt_done, req);
+
+	req->crypto_state = state;
+	xconn->smb2.decrypt_req = req;
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_request_decrypt_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *req = tevent_req_callback_data(
+		subreq, struct smbd_smb2_request);
+	struct smbd_smb2_crypto_state *state = req->crypto_state;
+	struct smbXsrv_connection *xconn = NULL;
+	uint8_t *buf = NULL;
+	size_t buflen;
+	NTTIME now;
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+
+	req->crypto_state = NULL;
+	data_blob_clear_free(&state->key);
+
+	if (state->orphaned) {
+		/*
+		 * Our connection is gone,
+		 * just cleanup.
+		 */
+		TALLOC_FREE(req);
+		return;
+	}
+
+	xconn = req->xconn;
+	xconn->smb2.decrypt_req = NULL;
+
+	if (ret != 0) {
+		status = map_nt_error_from_unix(ret);
+	} else {
+		status = state->status;
+	}
+	buf = state->inbuf;
+	buflen = state->inbuf_len;
+	now = state->now;
+	TALLOC_FREE(state);
+
+	if (NT_STATUS_IS_OK(status)) {
+		status = smbd_smb2_request_process_incoming(xconn, req, now,
+							    buf, buflen, true,
+							    0);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
 static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn);
 
 void smbd_smb2_request_dispatch_immediate(struct tevent_context *ctx,
@@ -3442,6 +4029,14 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 		return NT_STATUS_OK;
 	}
 
+	if (xconn->smb2.decrypt_req != NULL) {
+		/*
+		 * The last request is still being decrypted,
+		 * we read the next one once it got dispatched.
+		 */
+		return NT_STATUS_OK;
+	}
+
 	max_send_queue_len = MAX(1, xconn->smb2.credits.max/16);
 	cur_send_queue_len = xconn->smb2.send_queue_len;
 
@@ -3686,13 +4281,16 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 	return NT_STATUS_OK;
 }
 
+
 static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
 				     uint16_t fde_flags)
 {
-	struct smbd_server_connection *sconn = xconn->client->sconn;
 	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
 	struct smbd_smb2_request *req = NULL;
 	size_t min_recvfile_size = UINT32_MAX;
+	uint8_t *pktbuf = NULL;
+	size_t pktlen = 0;
+	size_t unread_bytes = 0;
 	int ret;
 	int err;
 	bool retry;
@@ -3851,10 +4449,44 @@ got_full:
 	req->request_time = timeval_current();
 	now = timeval_to_nttime(&req->request_time);
 
+	pktbuf = state->pktbuf;
+	pktlen = state->pktlen;
+	if (state->doing_receivefile) {
+		unread_bytes = state->pktfull - state->pktlen;
+	}
+
+	ZERO_STRUCTP(state);
+
+	if ((unread_bytes == 0) &&
+	    smbd_smb2_request_decrypt_async_possible(xconn, now,
+						     pktbuf, pktlen))
+	{
+		return smbd_smb2_request_decrypt_async(xconn, req, now,
+						       pktbuf, pktlen);
+	}
+
+	return smbd_smb2_request_process_incoming(xconn, req, now,
+						  pktbuf, pktlen, false,
+						  unread_bytes);
+}
+
+static NTSTATUS smbd_smb2_request_process_incoming(
+	struct smbXsrv_connection *xconn,
+	struct smbd_smb2_request *req,
+	NTTIME now,
+	uint8_t *pktbuf,
+	size_t pktlen,
+	bool decrypted,
+	size_t unread_bytes)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	NTSTATUS status;
+
 	status = smbd_smb2_inbuf_parse_compound(xconn,
 						now,
-						state->pktbuf,
-						state->pktlen,
+						pktbuf,
+						pktlen,
+						decrypted,
 						req,
 						&req->in.vector,
 						&req->in.vector_count);
@@ -3862,16 +4494,14 @@ got_full:
 		return status;
 	}
 
-	if (state->doing_receivefile) {
+	if (unread_bytes != 0) {
 		req->smb1req = talloc_zero(req, struct smb_request);
 		if (req->smb1req == NULL) {
 			return NT_STATUS_NO_MEMORY;
 		}
-		req->smb1req->unread_bytes = state->pktfull - state->pktlen;
+		req->smb1req->unread_bytes = unread_bytes;
 	}
 
-	ZERO_STRUCTP(state);
-
 	req->current_idx = 1;
 
 	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
@@ -29,9 +29,87 @@ static void null_job(void *private_data)
 	return;
 }
 
+#define BENCH_PTHREADPOOL_MAX_BATCH 32
+
+/*
+ * Keep "batch" jobs in flight on a pool with "num_threads" threads
+ * and report the number of jobs per second.
+ */
+static bool bench_pthreadpool_threads(unsigned num_threads, int batch)
+{
+	struct pthreadpool_pipe *pool;
+	struct timeval start;
+	double elapsed;
+	int jobids[BENCH_PTHREADPOOL_MAX_BATCH];
+	int i, ret;
+	int num_done = 0;
+
+	if (batch > BENCH_PTHREADPOOL_MAX_BATCH) {
+		return false;
+	}
+
+	ret = pthreadpool_pipe_init(num_threads, &pool);
+	if (ret != 0) {
+		d_fprintf(stderr, "pthreadpool_pipe_init failed: %s\n",
+			  strerror(ret));
+		return false;
+	}
+
+	start = timeval_current();
+
+	while (num_done < torture_numops) {
+		int num_added = 0;
+		int num_finished = 0;
+
+		for (i=0; i<batch; i++) {
+			ret = pthreadpool_pipe_add_job(pool, i, null_job,
+						       NULL);
+			if (ret != 0) {
+				d_fprintf(stderr, "pthreadpool_pipe_add_job "
+					  "failed: %s\n", strerror(ret));
+				break;
+			}
+			num_added += 1;
+		}
+
+		while (num_finished < num_added) {
+			ret = pthreadpool_pipe_finished_jobs(
+				pool, jobids, num_added - num_finished);
+			if (ret < 0) {
+				d_fprintf(stderr, "pthreadpool_pipe_finished_"
+					  "jobs failed: %s\n",
+					  strerror(-ret));
+				pthreadpool_pipe_destroy(pool);
+				return false;
+			}
+			num_finished += ret;
+		}
+
+		if (num_added < batch) {
+			pthreadpool_pipe_destroy(pool);
+			return false;
+		}
+
+		num_done += num_added;
+	}
+
+	elapsed = timeval_elapsed(&start);
+
+	d_printf("%u threads, %d jobs in flight: %d jobs in %.3f s, "
+		 "%.0f jobs/s\n", num_threads, batch, num_done, elapsed,
+		 num_done / elapsed);
+
+	pthreadpool_pipe_destroy(pool);
+
+	return true;
+}
+
 bool run_bench_pthreadpool(int dummy)
 {
+	static const unsigned num_threads[] = { 1, 2, 4, 8 };
 	struct pthreadpool_pipe *pool;
+	struct timeval start;
+	size_t t;
 	int i, ret;
 
 	ret = pthreadpool_pipe_init(1, &pool);
@@ -41,6 +119,8 @@ bool run_bench_pthreadpool(int dummy)
 		return false;
 	}
 
+	start = timeval_current();
+
 	for (i=0; i<torture_numops; i++) {
 		int jobid;
 
@@ -60,5 +140,26 @@ bool run_bench_pthreadpool(int dummy)
 
 	pthreadpool_pipe_destroy(pool);
 
-	return (ret == 1);
+	if (ret != 1) {
+		return false;
+	}
+
+	d_printf("1 thread, 1 job in flight: %d jobs in %.3f s\n",
+		 torture_numops, timeval_elapsed(&start));
+
+	/*
+	 * Throughput with a few requests in flight, as seen with
+	 * clients doing pipelined reads and writes
+	 */
+	for (t=0; t<ARRAY_SIZE(num_threads); t++) {
+		bool ok;
+
+		ok = bench_pthreadpool_threads(num_threads[t],
+					       num_threads[t] * 4);
+		if (!ok) {
+			return false;
+		}
+	}
+
+	return true;
 }
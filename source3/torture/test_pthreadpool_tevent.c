@@ -22,6 +22,8 @@
 #include "proto.h"
 #include "lib/pthreadpool/pthreadpool_tevent.h"
 
+extern int torture_numops;
+
 static void job_fn(void *private_data);
 
 bool run_pthreadpool_tevent(int dummy)
@@ -80,3 +82,146 @@ static void job_fn(void *private_data)
 
 	poll(NULL, 0, 100);
 }
+
+struct bench_pthreadpool_tevent_state {
+	struct tevent_context *ev;
+	struct pthreadpool_tevent *pool;
+	int num_sent;
+	int num_done;
+	int num_jobs;
+	int err;
+};
+
+static void bench_job_fn(void *private_data)
+{
+	return;
+}
+
+static void bench_pthreadpool_tevent_done(struct tevent_req *subreq);
+
+static bool bench_pthreadpool_tevent_send(
+	struct bench_pthreadpool_tevent_state *state)
+{
+	struct tevent_req *subreq;
+
+	subreq = pthreadpool_tevent_job_send(state, state->ev, state->pool,
+					     bench_job_fn, NULL);
+	if (subreq == NULL) {
+		state->err = ENOMEM;
+		return false;
+	}
+	tevent_req_set_callback(subreq, bench_pthreadpool_tevent_done,
+				state);
+	state->num_sent += 1;
+	return true;
+}
+
+static void bench_pthreadpool_tevent_done(struct tevent_req *subreq)
+{
+	struct bench_pthreadpool_tevent_state *state = tevent_req_callback_data(
+		subreq, struct bench_pthreadpool_tevent_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (ret != 0) {
+		state->err = ret;
+		return;
+	}
+	state->num_done += 1;
+
+	if (state->num_sent < state->num_jobs) {
+		bench_pthreadpool_tevent_send(state);
+	}
+}
+
+/*
+ * Keep "in_flight" null jobs queued on a pool with "num_threads"
+ * threads, so that completions arrive at the main thread in bursts
+ * as they do for smbd with many outstanding async I/O requests.
+ */
+static bool bench_pthreadpool_tevent_one(unsigned num_threads,
+					 int in_flight)
+{
+	struct bench_pthreadpool_tevent_state *state;
+	struct timeval start;
+	double elapsed;
+	int i, ret;
+	bool ok = false;
+
+	state = talloc_zero(NULL, struct bench_pthreadpool_tevent_state);
+	if (state == NULL) {
+		return false;
+	}
+	state->num_jobs = torture_numops;
+
+	state->ev = samba_tevent_context_init(state);
+	if (state->ev == NULL) {
+		fprintf(stderr, "tevent_context_init failed\n");
+		goto fail;
+	}
+
+	ret = pthreadpool_tevent_init(state, num_threads, &state->pool);
+	if (ret != 0) {
+		fprintf(stderr, "pthreadpool_tevent_init failed: %s\n",
+			strerror(ret));
+		goto fail;
+	}
+
+	start = timeval_current();
+
+	for (i=0; (i<in_flight) && (i<state->num_jobs); i++) {
+		if (!bench_pthreadpool_tevent_send(state)) {
+			break;
+		}
+	}
+
+	while ((state->num_done < state->num_sent) && (state->err == 0)) {
+		ret = tevent_loop_once(state->ev);
+		if (ret != 0) {
+			fprintf(stderr, "tevent_loop_once failed: %s\n",
+				strerror(errno));
+			goto fail;
+		}
+	}
+
+	if (state->err != 0) {
+		fprintf(stderr, "pthreadpool_tevent_job failed: %s\n",
+			strerror(state->err));
+		goto fail;
+	}
+
+	elapsed = timeval_elapsed(&start);
+
+	printf("%u threads, %d jobs in flight: %d jobs in %.3f s, "
+	       "%.0f jobs/s\n", num_threads, in_flight, state->num_done,
+	       elapsed, state->num_done / elapsed);
+
+	ok = true;
+fail:
+	TALLOC_FREE(state);
+	return ok;
+}
+
+bool run_bench_pthreadpool_tevent(int dummy)
+{
+	static const struct {
+		unsigned num_threads;
+		int in_flight;
+	} runs[] = {
+		{ 1, 1 }, { 1, 16 }, { 4, 16 }, { 4, 64 }, { 16, 256 },
+	};
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(runs); i++) {
+		bool ok;
+
+		ok = bench_pthreadpool_tevent_one(runs[i].num_threads,
+						  runs[i].in_flight);
+		if (!ok) {
+			return false;
+		}
+	}
+
+	return true;
+}
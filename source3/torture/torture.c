@@ -11689,6 +11689,7 @@ static struct {
 	{ "LOCAL-DBWRAP-CTDB", run_local_dbwrap_ctdb, 0 },
 	{ "LOCAL-BENCH-PTHREADPOOL", run_bench_pthreadpool, 0 },
 	{ "LOCAL-PTHREADPOOL-TEVENT", run_pthreadpool_tevent, 0 },
+	{ "LOCAL-BENCH-PTHREADPOOL-TEVENT", run_bench_pthreadpool_tevent, 0 },
 	{ "LOCAL-G-LOCK1", run_g_lock1, 0 },
 	{ "LOCAL-G-LOCK2", run_g_lock2, 0 },
 	{ "LOCAL-G-LOCK3", run_g_lock3, 0 },
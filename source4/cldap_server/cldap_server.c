@@ -243,5 +243,9 @@ static void cldapd_task_init(struct task_server *task)
 */
 NTSTATUS server_service_cldapd_init(TALLOC_CTX *ctx)
 {
-	return register_server_service(ctx, "cldap", cldapd_task_init);
+	static const struct service_details details = {
+		.inhibit_pre_fork = true,
+	};
+	return register_server_service(ctx, "cldap", cldapd_task_init,
+				       &details);
 }
@@ -929,5 +929,9 @@ static void dns_task_init(struct task_server *task)
 
 NTSTATUS server_service_dns_init(TALLOC_CTX *ctx)
 {
-	return register_server_service(ctx, "dns", dns_task_init);
+	static const struct service_details details = {
+		.inhibit_pre_fork = true,
+	};
+	return register_server_service(ctx, "dns", dns_task_init,
+				       &details);
 }
@@ -347,5 +347,9 @@ static void kccsrv_task_init(struct task_server *task)
 */
 NTSTATUS server_service_kcc_init(TALLOC_CTX *ctx)
 {
-	return register_server_service(ctx, "kcc", kccsrv_task_init);
+	static const struct service_details details = {
+		.inhibit_pre_fork = true,
+	};
+	return register_server_service(ctx, "kcc", kccsrv_task_init,
+				       &details);
 }
@@ -555,6 +555,10 @@ int dsdb_set_schema(struct ldb_context *ldb,
 
 /**
  * Global variable to hold one copy of the schema, used to avoid memory bloat
+ *
+ * Processes forked after it is loaded inherit it as well, and keep
+ * using it (and sharing its pages) for as long as its metadata_usn
+ * matches the schema sequence number in metadata.tdb.
  */
 static struct dsdb_schema *global_schema;
 
@@ -358,5 +358,9 @@ NTSTATUS server_service_mitkdc_init(TALLOC_CTX *mem_ctx);
 
 NTSTATUS server_service_mitkdc_init(TALLOC_CTX *mem_ctx)
 {
-	return register_server_service(mem_ctx, "kdc", mitkdc_task_init);
+	static const struct service_details details = {
+		.inhibit_pre_fork = true,
+	};
+	return register_server_service(mem_ctx, "kdc", mitkdc_task_init,
+				       &details);
 }
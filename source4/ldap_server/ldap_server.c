@@ -1018,7 +1018,6 @@ static NTSTATUS add_socket(struct task_server *task,
 {
 	uint16_t port = 389;
 	NTSTATUS status;
-	struct ldb_context *ldb;
 
 	status = stream_setup_socket(task, task->event_ctx, lp_ctx,
 				     model_ops, &ldap_stream_nonpriv_ops,
@@ -1047,14 +1046,7 @@ static NTSTATUS add_socket(struct task_server *task,
 		}
 	}
 
-	/* Load LDAP database, but only to read our settings */
-	ldb = samdb_connect(ldap_service, ldap_service->task->event_ctx, 
-			    lp_ctx, system_session(lp_ctx), 0);
-	if (!ldb) {
-		return NT_STATUS_INTERNAL_DB_CORRUPTION;
-	}
-
-	if (samdb_is_gc(ldb)) {
+	if (samdb_is_gc(ldap_service->sam_ctx)) {
 		port = 3268;
 		status = stream_setup_socket(task, task->event_ctx, lp_ctx,
 					     model_ops,
@@ -1084,13 +1076,38 @@ static NTSTATUS add_socket(struct task_server *task,
 		}
 	}
 
-	/* And once we are bound, free the temporary ldb, it will
-	 * connect again on each incoming LDAP connection */
-	talloc_unlink(ldap_service, ldb);
-
 	return NT_STATUS_OK;
 }
 
+/* how often the task checks that its copy of the schema is current */
+#define LDAPSRV_SCHEMA_REFRESH_INTERVAL 30
+
+/*
+  The processes forked to serve the connections share the schema
+  loaded in the task process, and only build their own copy when its
+  sequence number no longer matches the one in metadata.tdb.  Reload
+  it there after a schema change, so that not every new connection
+  has to.
+*/
+static void ldapsrv_schema_refresh(struct tevent_context *ev,
+				   struct tevent_timer *te,
+				   struct timeval current_time,
+				   void *private_data)
+{
+	struct ldapsrv_service *ldap_service =
+		talloc_get_type_abort(private_data, struct ldapsrv_service);
+
+	/* this is cheap unless the schema has changed */
+	dsdb_get_schema(ldap_service->sam_ctx, NULL);
+
+	te = tevent_add_timer(ev, ldap_service,
+			      timeval_current_ofs(LDAPSRV_SCHEMA_REFRESH_INTERVAL, 0),
+			      ldapsrv_schema_refresh, ldap_service);
+	if (te == NULL) {
+		DEBUG(0,("ldapsrv: failed to schedule the schema refresh\n"));
+	}
+}
+
 /*
   open the ldap server sockets
 */
@@ -1132,6 +1149,7 @@ static void ldapsrv_task_init(struct task_server *task)
 	if (ldap_service == NULL) goto failed;
 
 	ldap_service->task = task;
+	task->private_data = ldap_service;
 
 	dns_host_name = talloc_asprintf(ldap_service, "%s.%s",
 					lpcfg_netbios_name(task->lp_ctx),
@@ -1157,6 +1175,23 @@ static void ldapsrv_task_init(struct task_server *task)
 	ldap_service->call_queue = tevent_queue_create(ldap_service, "ldapsrv_call_queue");
 	if (ldap_service->call_queue == NULL) goto failed;
 
+	/*
+	 * Load the LDAP database to read our settings.  We keep it
+	 * open, so that the processes forked by the process model to
+	 * serve the connections find the database and the schema
+	 * already loaded.  The connections still connect again with
+	 * their own credentials.
+	 */
+	ldap_service->sam_ctx = samdb_connect(ldap_service, task->event_ctx,
+					      task->lp_ctx,
+					      system_session(task->lp_ctx),
+					      0);
+	if (ldap_service->sam_ctx == NULL) {
+		task_server_terminate(task, "ldapsrv failed to open the "
+				      "samdb", true);
+		return;
+	}
+
 	if (lpcfg_interfaces(task->lp_ctx) && lpcfg_bind_interfaces_only(task->lp_ctx)) {
 		struct interface *ifaces;
 		int num_interfaces;
@@ -1253,7 +1288,32 @@ failed:
 }
 
 
+/*
+  start the schema refresh in the process that forks the connection
+  processes, and not in each process that inherits the task
+*/
+static void ldapsrv_before_loop(struct task_server *task,
+				struct tevent_context *ev)
+{
+	struct ldapsrv_service *ldap_service =
+		talloc_get_type_abort(task->private_data,
+				      struct ldapsrv_service);
+	struct tevent_timer *te;
+
+	te = tevent_add_timer(ev, ldap_service,
+			      timeval_current_ofs(LDAPSRV_SCHEMA_REFRESH_INTERVAL, 0),
+			      ldapsrv_schema_refresh, ldap_service);
+	if (te == NULL) {
+		DEBUG(0,("ldapsrv: failed to schedule the schema refresh\n"));
+	}
+}
+
 NTSTATUS server_service_ldap_init(TALLOC_CTX *ctx)
 {
-	return register_server_service(ctx, "ldap", ldapsrv_task_init);
+	static const struct service_details details = {
+		.inhibit_pre_fork = false,
+		.before_loop = ldapsrv_before_loop,
+	};
+	return register_server_service(ctx, "ldap", ldapsrv_task_init,
+				       &details);
 }
@@ -94,6 +94,7 @@ struct ldapsrv_call {
 struct ldapsrv_service {
 	struct tstream_tls_params *tls_params;
 	struct task_server *task;
+	struct ldb_context *sam_ctx;
 	struct tevent_queue *call_queue;
 	struct ldapsrv_connection *connections;
 	struct {
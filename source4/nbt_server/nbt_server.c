@@ -100,5 +100,9 @@ static void nbtd_task_init(struct task_server *task)
 */
 NTSTATUS server_service_nbtd_init(TALLOC_CTX *ctx)
 {
-	return register_server_service(ctx, "nbt", nbtd_task_init);
+	static const struct service_details details = {
+		.inhibit_pre_fork = true,
+	};
+	return register_server_service(ctx, "nbt", nbtd_task_init,
+				       &details);
 }
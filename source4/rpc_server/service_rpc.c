@@ -142,5 +142,9 @@ failed:
 
 NTSTATUS server_service_rpc_init(TALLOC_CTX *ctx)
 {
-	return register_server_service(ctx, "rpc", dcesrv_task_init);
+	static const struct service_details details = {
+		.inhibit_pre_fork = true,
+	};
+	return register_server_service(ctx, "rpc", dcesrv_task_init,
+				       &details);
 }
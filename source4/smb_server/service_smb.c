@@ -87,7 +87,12 @@ failed:
 /* called at smbd startup - register ourselves as a server service */
 NTSTATUS server_service_smb_init(TALLOC_CTX *ctx)
 {
+	static const struct service_details details = {
+		.inhibit_pre_fork = true,
+	};
+
 	ntvfs_init(cmdline_lp_ctx);
 	share_init();
-	return register_server_service(ctx, "smb", smbsrv_task_init);
+	return register_server_service(ctx, "smb", smbsrv_task_init,
+				       &details);
 }
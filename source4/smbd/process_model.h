@@ -33,7 +33,9 @@
  * with a comment and maybe update struct process_model_critical_sizes.
  */
 /* version 1 - initial version - metze */
-#define PROCESS_MODEL_VERSION 1
+/* version 2 - service details passed to new_task */
+/* version 3 - the new_task callback returns the task */
+#define PROCESS_MODEL_VERSION 3
 
 /* the process model operations structure - contains function pointers to 
    the model-specific implementations of each operation */
@@ -58,10 +60,12 @@ struct model_ops {
 	void (*new_task)(struct tevent_context *, 
 			 struct loadparm_context *lp_ctx,
 			 const char *service_name,
-			 void (*)(struct tevent_context *, 
-				  struct loadparm_context *, struct server_id, 
-				  void *),
-			 void *);
+			 struct task_server *(*)(struct tevent_context *,
+						 struct loadparm_context *,
+						 struct server_id,
+						 void *),
+			 void *,
+			 const struct service_details *);
 
 	/* function to terminate a connection or task */
 	void (*terminate)(struct tevent_context *, struct loadparm_context *lp_ctx,
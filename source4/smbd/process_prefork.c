@@ -0,0 +1,632 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   process model: prefork (n client connections per process)
+
+   Based on the standard process model.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Each task is started in a process of its own, as with the standard
+ * process model.  Once the task has set up its listening sockets, and
+ * unless the service inhibits it, the task process forks
+ * 'prefork children' worker processes.  The workers inherit the
+ * initialised task, including its listening sockets and any
+ * databases it opened, and accept and serve the connections
+ * themselves, many of them per process.  The task process only
+ * watches over the workers from then on, restarts the ones that die,
+ * and runs the jobs the service schedules in its before_loop hook.
+ */
+
+#include "includes.h"
+#include "lib/events/events.h"
+#include "smbd/process_model.h"
+#include "system/filesys.h"
+#include "cluster/cluster.h"
+#include "param/param.h"
+#include "ldb_wrap.h"
+#include "lib/messaging/messaging.h"
+#include "lib/util/debug.h"
+#include "source3/lib/messages_dgm.h"
+
+/*
+  a worker slot of a task, kept by the task process to restart the
+  worker when it dies
+*/
+struct prefork_worker {
+	struct tevent_context *ev;
+	const char *service_name;
+	unsigned int index;
+	struct timeval started;
+	unsigned int restart_delay;
+};
+
+struct prefork_child_state {
+	const char *name;
+	pid_t pid;
+	int to_parent_fd;
+	int from_child_fd;
+	struct tevent_fd *from_child_fde;
+	struct prefork_worker *worker;
+};
+
+/*
+ * How long to wait before a worker that died is restarted, in
+ * seconds.  The delay doubles for a worker that keeps dying soon
+ * after it was started, so a crashing worker doesn't make the task
+ * process fork in a loop.
+ */
+#define PREFORK_RESTART_MIN_DELAY 1
+#define PREFORK_RESTART_MAX_DELAY 60
+
+NTSTATUS process_model_prefork_init(TALLOC_CTX *);
+
+/* we hold a pipe open in the parent, and the any child
+   processes wait for EOF on that pipe. This ensures that
+   children die when the parent dies */
+static int child_pipe[2] = { -1, -1 };
+
+static void prefork_fork_worker(struct tevent_context *ev2,
+				struct prefork_worker *worker);
+
+/* set in a task process while the task is being set up */
+static bool prefork_task_starting = false;
+
+/*
+  called when the process model is selected
+*/
+static void prefork_model_init(void)
+{
+	int rc;
+
+	rc = pipe(child_pipe);
+	if (rc < 0) {
+		smb_panic("Failed to initialize pipe!");
+	}
+}
+
+static void sighup_signal_handler(struct tevent_context *ev,
+				struct tevent_signal *se,
+				int signum, int count, void *siginfo,
+				void *private_data)
+{
+	debug_schedule_reopen_logs();
+}
+
+static void sigterm_signal_handler(struct tevent_context *ev,
+				struct tevent_signal *se,
+				int signum, int count, void *siginfo,
+				void *private_data)
+{
+#if HAVE_GETPGRP
+	if (getpgrp() == getpid()) {
+		/*
+		 * We're the process group leader, send
+		 * SIGTERM to our process group.
+		 */
+		DEBUG(0,("SIGTERM: killing children\n"));
+		kill(-getpgrp(), SIGTERM);
+	}
+#endif
+	DEBUG(0,("Exiting pid %u on SIGTERM\n", (unsigned int)getpid()));
+	talloc_free(ev);
+	exit(127);
+}
+
+/*
+  handle EOF on the parent-to-all-children pipe in the child
+*/
+static void prefork_pipe_handler(struct tevent_context *event_ctx,
+				 struct tevent_fd *fde,
+				 uint16_t flags, void *private_data)
+{
+	DEBUG(10,("Child %d exiting\n", (int)getpid()));
+	talloc_free(event_ctx);
+	exit(0);
+}
+
+static void prefork_restart_worker(struct tevent_context *ev2,
+				   struct tevent_timer *te,
+				   struct timeval current_time,
+				   void *private_data)
+{
+	struct prefork_worker *worker
+		= talloc_get_type_abort(private_data, struct prefork_worker);
+
+	prefork_fork_worker(ev2, worker);
+}
+
+/*
+  schedule the restart of a worker that died
+*/
+static void prefork_schedule_restart(struct tevent_context *ev2,
+				     struct prefork_worker *worker)
+{
+	struct tevent_timer *te;
+
+	if (timeval_elapsed(&worker->started) >= PREFORK_RESTART_MAX_DELAY) {
+		worker->restart_delay = PREFORK_RESTART_MIN_DELAY;
+	} else {
+		worker->restart_delay = MAX(worker->restart_delay * 2,
+					    PREFORK_RESTART_MIN_DELAY);
+		worker->restart_delay = MIN(worker->restart_delay,
+					    PREFORK_RESTART_MAX_DELAY);
+	}
+
+	DEBUG(0, ("Restarting worker %u of task %s in %u seconds\n",
+		  worker->index, worker->service_name,
+		  worker->restart_delay));
+
+	te = tevent_add_timer(ev2, worker,
+			      timeval_current_ofs(worker->restart_delay, 0),
+			      prefork_restart_worker, worker);
+	if (te == NULL) {
+		smb_panic("Failed to schedule the restart of a worker");
+	}
+}
+
+/*
+  handle EOF on the child pipe in the parent, so we know when a
+  process terminates without using SIGCHLD or waiting on all possible pids.
+
+  A worker of a task is restarted, a task process is not.
+ */
+static void prefork_child_pipe_handler(struct tevent_context *ev,
+				       struct tevent_fd *fde,
+				       uint16_t flags,
+				       void *private_data)
+{
+	struct prefork_child_state *state
+		= talloc_get_type_abort(private_data, struct prefork_child_state);
+	int status = 0;
+	pid_t pid;
+
+	messaging_dgm_cleanup(state->pid);
+
+	/* the child has closed the pipe, assume its dead */
+	errno = 0;
+	pid = waitpid(state->pid, &status, 0);
+
+	if (pid != state->pid) {
+		DEBUG(0, ("Error in waitpid() for child %d (%s) - %s \n",
+			  (int)state->pid, state->name, strerror(errno)));
+		if (state->worker != NULL) {
+			prefork_schedule_restart(ev, state->worker);
+		}
+		TALLOC_FREE(state);
+		return;
+	}
+	if (WIFEXITED(status)) {
+		status = WEXITSTATUS(status);
+		DEBUG(2, ("Child %d (%s) exited with status %d\n",
+			  (int)state->pid, state->name, status));
+	} else if (WIFSIGNALED(status)) {
+		status = WTERMSIG(status);
+		DEBUG(0, ("Child %d (%s) terminated with signal %d\n",
+			  (int)state->pid, state->name, status));
+	}
+	if (state->worker != NULL) {
+		prefork_schedule_restart(ev, state->worker);
+	}
+	TALLOC_FREE(state);
+	return;
+}
+
+static struct prefork_child_state *setup_prefork_child_pipe(struct tevent_context *ev,
+							    const char *name)
+{
+	struct prefork_child_state *state;
+	int parent_child_pipe[2];
+	int ret;
+
+	/*
+	 * Prepare a pipe to allow us to know when the child exits,
+	 * because it will trigger a read event on this private
+	 * pipe.
+	 *
+	 * We do all this before the fork(), so we can clean up if
+	 * it fails.
+	 */
+	state = talloc_zero(ev, struct prefork_child_state);
+	if (state == NULL) {
+		return NULL;
+	}
+
+	if (name == NULL) {
+		name = "";
+	}
+
+	state->name = talloc_strdup(state, name);
+	if (state->name == NULL) {
+		TALLOC_FREE(state);
+		return NULL;
+	}
+
+	ret = pipe(parent_child_pipe);
+	if (ret == -1) {
+		DEBUG(0, ("Failed to create parent-child pipe to handle "
+			  "SIGCHLD to track new process for %s\n", name));
+		TALLOC_FREE(state);
+		return NULL;
+	}
+
+	smb_set_close_on_exec(parent_child_pipe[0]);
+	smb_set_close_on_exec(parent_child_pipe[1]);
+
+	state->from_child_fd = parent_child_pipe[0];
+	state->to_parent_fd = parent_child_pipe[1];
+
+	state->from_child_fde = tevent_add_fd(ev, state,
+					      state->from_child_fd,
+					      TEVENT_FD_READ,
+					      prefork_child_pipe_handler,
+					      state);
+	if (state->from_child_fde == NULL) {
+		TALLOC_FREE(state);
+		return NULL;
+	}
+	tevent_fd_set_auto_close(state->from_child_fde);
+
+	return state;
+}
+
+/*
+  set up the handlers every process of a task needs, on the event
+  context ev
+*/
+static void prefork_setup_handlers(struct tevent_context *ev)
+{
+	struct tevent_fd *fde = NULL;
+	struct tevent_signal *se = NULL;
+
+	fde = tevent_add_fd(ev, ev, child_pipe[0], TEVENT_FD_READ,
+			    prefork_pipe_handler, NULL);
+	if (fde == NULL) {
+		smb_panic("Failed to add fd handler after fork");
+	}
+
+	se = tevent_add_signal(ev,
+				ev,
+				SIGHUP,
+				0,
+				sighup_signal_handler,
+				NULL);
+	if (se == NULL) {
+		smb_panic("Failed to add SIGHUP handler after fork");
+	}
+
+	se = tevent_add_signal(ev,
+				ev,
+				SIGTERM,
+				0,
+				sigterm_signal_handler,
+				NULL);
+	if (se == NULL) {
+		smb_panic("Failed to add SIGTERM handler after fork");
+	}
+}
+
+/*
+  called when a listening socket becomes readable.
+
+  All the workers of a task wait on the same listening sockets, and
+  all of them are woken up for a new connection, but only one of
+  them gets it.  The others just go back to the event loop.
+*/
+static void prefork_accept_connection(struct tevent_context *ev,
+				      struct loadparm_context *lp_ctx,
+				      struct socket_context *listen_socket,
+				      void (*new_conn)(struct tevent_context *,
+						       struct loadparm_context *,
+						       struct socket_context *,
+						       struct server_id , void *),
+				      void *private_data)
+{
+	NTSTATUS status;
+	struct socket_context *connected_socket;
+	pid_t pid = getpid();
+
+	/* accept an incoming connection. */
+	status = socket_accept(listen_socket, &connected_socket);
+	if (NT_STATUS_EQUAL(status, STATUS_MORE_ENTRIES)) {
+		/* another worker was quicker */
+		return;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0,("prefork_accept_connection: accept: %s\n",
+			 nt_errstr(status)));
+		return;
+	}
+
+	talloc_steal(private_data, connected_socket);
+
+	/*
+	 * As with the single process model, the combination of
+	 * pid/fd is unique system-wide
+	 */
+	new_conn(ev, lp_ctx, connected_socket,
+		 cluster_id(pid, socket_get_fd(connected_socket)),
+		 private_data);
+}
+
+/*
+  fork a worker process of a task, serving the connections on the
+  listening sockets set up in worker->ev. The task process watches
+  over it in ev2, and restarts it if it dies.
+*/
+static void prefork_fork_worker(struct tevent_context *ev2,
+				struct prefork_worker *worker)
+{
+	pid_t pid;
+	NTSTATUS status;
+	struct prefork_child_state *state;
+	struct tevent_context *ev = worker->ev;
+	const char *service_name;
+	unsigned int worker_index = worker->index;
+
+	worker->started = timeval_current();
+
+	state = setup_prefork_child_pipe(ev2, worker->service_name);
+	if (state == NULL) {
+		prefork_schedule_restart(ev2, worker);
+		return;
+	}
+
+	pid = fork();
+
+	if (pid != 0) {
+		close(state->to_parent_fd);
+		state->to_parent_fd = -1;
+
+		if (pid > 0) {
+			state->pid = pid;
+			state->worker = worker;
+		} else {
+			DEBUG(0, ("Failed to fork worker %u of task %s - %s\n",
+				  worker_index, worker->service_name,
+				  strerror(errno)));
+			TALLOC_FREE(state);
+			prefork_schedule_restart(ev2, worker);
+		}
+
+		/* parent or error code ... go back to the task process */
+		return;
+	}
+
+	service_name = talloc_strdup(ev, worker->service_name);
+	if (service_name == NULL) {
+		smb_panic("Failed to copy the service name of a worker");
+	}
+
+	/*
+	 * This leaves state->to_parent_fd open, and frees what the
+	 * task process uses to watch over the workers
+	 */
+	talloc_free(ev2);
+
+	pid = getpid();
+
+	/*
+	 * Unlike the other process models we keep the event context
+	 * of the task as it is, with the listening sockets of the
+	 * task and the handlers set up by prefork_setup_handlers().
+	 * The tevent backends cope with being forked.
+	 */
+
+	/* ldb/tdb need special fork handling */
+	ldb_wrap_fork_hook();
+
+	/* Must be done after a fork() to reset messaging contexts. */
+	status = imessaging_reinit_all();
+	if (!NT_STATUS_IS_OK(status)) {
+		smb_panic("Failed to re-initialise imessaging after fork");
+	}
+
+	setproctitle("task[%s] pre-forked worker(%u) server_id[%d]",
+		     service_name, worker_index, (int)pid);
+
+	tevent_loop_wait(ev);
+
+	talloc_free(ev);
+	exit(0);
+}
+
+/*
+  called to create a new server task
+*/
+static void prefork_new_task(struct tevent_context *ev,
+			     struct loadparm_context *lp_ctx,
+			     const char *service_name,
+			     struct task_server *(*new_task)(struct tevent_context *, struct loadparm_context *lp_ctx, struct server_id , void *),
+			     void *private_data,
+			     const struct service_details *service_details)
+{
+	pid_t pid;
+	NTSTATUS status;
+	struct prefork_child_state *state;
+	struct task_server *task;
+	struct tevent_context *ev2;
+	struct prefork_worker *worker;
+	int num_children;
+	int i;
+
+	state = setup_prefork_child_pipe(ev, service_name);
+	if (state == NULL) {
+		return;
+	}
+
+	pid = fork();
+
+	if (pid != 0) {
+		close(state->to_parent_fd);
+		state->to_parent_fd = -1;
+
+		if (pid > 0) {
+			state->pid = pid;
+		} else {
+			TALLOC_FREE(state);
+		}
+
+		/* parent or error code ... go back to the event loop */
+		return;
+	}
+
+	/* this leaves state->to_parent_fd open */
+	TALLOC_FREE(state);
+
+	pid = getpid();
+
+	/* this will free all the listening sockets and all state that
+	   is not associated with this new connection */
+	if (tevent_re_initialise(ev) != 0) {
+		smb_panic("Failed to re-initialise tevent after fork");
+	}
+
+	/* ldb/tdb need special fork handling */
+	ldb_wrap_fork_hook();
+
+	/* Must be done after a fork() to reset messaging contexts. */
+	status = imessaging_reinit_all();
+	if (!NT_STATUS_IS_OK(status)) {
+		smb_panic("Failed to re-initialise imessaging after fork");
+	}
+
+	prefork_setup_handlers(ev);
+	if (child_pipe[1] != -1) {
+		close(child_pipe[1]);
+		child_pipe[1] = -1;
+	}
+
+	setproctitle("task %s server_id[%d]", service_name, (int)pid);
+
+	/* setup this new task.  Cluster ID is PID based for this process model */
+	prefork_task_starting = true;
+	task = new_task(ev, lp_ctx, cluster_id(pid, 0), private_data);
+	prefork_task_starting = false;
+
+	num_children = lpcfg_prefork_children(lp_ctx);
+	if (service_details->inhibit_pre_fork || num_children < 1) {
+		/* the task serves its connections itself */
+		if (task != NULL && service_details->before_loop != NULL) {
+			service_details->before_loop(task, ev);
+		}
+
+		tevent_loop_wait(ev);
+
+		talloc_free(ev);
+		exit(0);
+	}
+
+	/*
+	 * Leave ev to the workers, the task process only waits for
+	 * the workers and the parent to exit in a new event context.
+	 */
+	ev2 = s4_event_context_init(NULL);
+	if (ev2 == NULL) {
+		smb_panic("Failed to create the event context of a "
+			  "prefork master");
+	}
+	prefork_setup_handlers(ev2);
+
+	for (i = 0; i < num_children; i++) {
+		worker = talloc_zero(ev2, struct prefork_worker);
+		if (worker == NULL) {
+			smb_panic("Failed to allocate a worker of a prefork "
+				  "master");
+		}
+		worker->ev = ev;
+		worker->service_name = talloc_strdup(worker, service_name);
+		if (worker->service_name == NULL) {
+			smb_panic("Failed to allocate a worker of a prefork "
+				  "master");
+		}
+		worker->index = i;
+		prefork_fork_worker(ev2, worker);
+	}
+
+	setproctitle("task[%s] pre-fork master server_id[%d]",
+		     service_name, (int)pid);
+
+	/*
+	 * The workers are forked with ev as it was after the task
+	 * was set up, so what the service schedules here only runs
+	 * in this process
+	 */
+	if (task != NULL && service_details->before_loop != NULL) {
+		service_details->before_loop(task, ev2);
+	}
+
+	/*
+	 * We can't return to the top level here, and have to wait
+	 * for the parent to exit
+	 */
+	tevent_loop_wait(ev2);
+
+	talloc_free(ev2);
+	talloc_free(ev);
+	exit(0);
+}
+
+
+/*
+  called when a connection or a task goes down
+
+  The processes serve many connections, so they only go down with the
+  task, if it fails to start up.
+*/
+static void prefork_terminate(struct tevent_context *ev,
+			      struct loadparm_context *lp_ctx,
+			      const char *reason)
+{
+	DEBUG(2,("prefork_terminate: reason[%s]\n",reason));
+
+	if (!prefork_task_starting) {
+		return;
+	}
+
+	/* this reload_charcnv() has the effect of freeing the iconv context memory,
+	   which makes leak checking easier */
+	reload_charcnv(lp_ctx);
+
+	/* Always free event context last before exit. */
+	talloc_free(ev);
+
+	/* terminate this process */
+	exit(0);
+}
+
+/* called to set a title of a task or connection */
+static void prefork_set_title(struct tevent_context *ev, const char *title)
+{
+}
+
+static const struct model_ops prefork_ops = {
+	.name			= "prefork",
+	.model_init		= prefork_model_init,
+	.accept_connection	= prefork_accept_connection,
+	.new_task		= prefork_new_task,
+	.terminate		= prefork_terminate,
+	.set_title		= prefork_set_title,
+};
+
+/*
+  initialise the prefork process model, registering ourselves with the
+  process model subsystem
+ */
+NTSTATUS process_model_prefork_init(TALLOC_CTX *ctx)
+{
+	return register_process_model(&prefork_ops);
+}
@@ -88,10 +88,12 @@ static void single_accept_connection(struct tevent_context *ev,
 static void single_new_task(struct tevent_context *ev, 
 			    struct loadparm_context *lp_ctx,
 			    const char *service_name,
-			    void (*new_task)(struct tevent_context *, struct loadparm_context *, struct server_id, void *), 
-			    void *private_data)
+			    struct task_server *(*new_task)(struct tevent_context *, struct loadparm_context *, struct server_id, void *),
+			    void *private_data,
+			    const struct service_details *service_details)
 {
 	pid_t pid = getpid();
+	struct task_server *task;
 	/* start our taskids at MAX_INT32, the first 2^31 tasks are is reserved for fd numbers */
 	static uint32_t taskid = INT32_MAX;
        
@@ -104,7 +106,10 @@ static void single_new_task(struct tevent_context *ev,
 	 * Using the pid unaltered makes debugging of which process
 	 * owns the messaging socket easier.
 	 */
-	new_task(ev, lp_ctx, cluster_id(pid, taskid++), private_data);
+	task = new_task(ev, lp_ctx, cluster_id(pid, taskid++), private_data);
+	if (task != NULL && service_details->before_loop != NULL) {
+		service_details->before_loop(task, ev);
+	}
 }
 
 
@@ -371,12 +371,14 @@ static void standard_accept_connection(struct tevent_context *ev,
 static void standard_new_task(struct tevent_context *ev, 
 			      struct loadparm_context *lp_ctx,
 			      const char *service_name,
-			      void (*new_task)(struct tevent_context *, struct loadparm_context *lp_ctx, struct server_id , void *),
-			      void *private_data)
+			      struct task_server *(*new_task)(struct tevent_context *, struct loadparm_context *lp_ctx, struct server_id , void *),
+			      void *private_data,
+			      const struct service_details *service_details)
 {
 	pid_t pid;
 	NTSTATUS status;
 	struct standard_child_state *state;
+	struct task_server *task;
 	struct tevent_fd *fde = NULL;
 	struct tevent_signal *se = NULL;
 
@@ -454,7 +456,10 @@ static void standard_new_task(struct tevent_context *ev,
 	setproctitle("task %s server_id[%d]", service_name, (int)pid);
 
 	/* setup this new task.  Cluster ID is PID based for this process model */
-	new_task(ev, lp_ctx, cluster_id(pid, 0), private_data);
+	task = new_task(ev, lp_ctx, cluster_id(pid, 0), private_data);
+	if (task != NULL && service_details->before_loop != NULL) {
+		service_details->before_loop(task, ev);
+	}
 
 	/* we can't return to the top level here, as that event context is gone,
 	   so we now process events in the new event context until there are no
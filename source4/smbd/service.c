@@ -31,6 +31,7 @@ static struct registered_server {
 	struct registered_server *next, *prev;
 	const char *service_name;
 	void (*task_init)(struct task_server *);
+	const struct service_details *service_details;
 } *registered_servers;
 
 /*
@@ -38,13 +39,15 @@ static struct registered_server {
 */
 NTSTATUS register_server_service(TALLOC_CTX *ctx,
 				const char *name,
-				void (*task_init)(struct task_server *))
+				void (*task_init)(struct task_server *),
+				const struct service_details *service_details)
 {
 	struct registered_server *srv;
 	srv = talloc(ctx, struct registered_server);
 	NT_STATUS_HAVE_NO_MEMORY(srv);
 	srv->service_name = name;
 	srv->task_init = task_init;
+	srv->service_details = service_details;
 	DLIST_ADD_END(registered_servers, srv);
 	return NT_STATUS_OK;
 }
@@ -62,7 +65,8 @@ static NTSTATUS server_service_init(const char *name,
 	for (srv=registered_servers; srv; srv=srv->next) {
 		if (strcasecmp(name, srv->service_name) == 0) {
 			return task_server_startup(event_context, lp_ctx, srv->service_name,
-						   model_ops, srv->task_init);
+						   model_ops, srv->task_init,
+						   srv->service_details);
 		}
 	}
 	return NT_STATUS_INVALID_SYSTEM_SERVICE;
@@ -67,15 +67,16 @@ struct task_state {
   called by the process model code when the new task starts up. This then calls
   the server specific startup code
 */
-static void task_server_callback(struct tevent_context *event_ctx, 
-				 struct loadparm_context *lp_ctx,
-				 struct server_id server_id, void *private_data)
+static struct task_server *task_server_callback(struct tevent_context *event_ctx,
+						 struct loadparm_context *lp_ctx,
+						 struct server_id server_id,
+						 void *private_data)
 {
 	struct task_state *state = talloc_get_type(private_data, struct task_state);
 	struct task_server *task;
 
 	task = talloc(event_ctx, struct task_server);
-	if (task == NULL) return;
+	if (task == NULL) return NULL;
 
 	task->event_ctx = event_ctx;
 	task->model_ops = state->model_ops;
@@ -88,10 +89,11 @@ static void task_server_callback(struct tevent_context *event_ctx,
 					task->event_ctx);
 	if (!task->msg_ctx) {
 		task_server_terminate(task, "imessaging_init() failed", true);
-		return;
+		return NULL;
 	}
 
 	state->task_init(task);
+	return task;
 }
 
 /*
@@ -101,7 +103,8 @@ NTSTATUS task_server_startup(struct tevent_context *event_ctx,
 			     struct loadparm_context *lp_ctx,
 			     const char *service_name, 
 			     const struct model_ops *model_ops, 
-			     void (*task_init)(struct task_server *))
+			     void (*task_init)(struct task_server *),
+			     const struct service_details *service_details)
 {
 	struct task_state *state;
 
@@ -111,7 +114,8 @@ NTSTATUS task_server_startup(struct tevent_context *event_ctx,
 	state->task_init = task_init;
 	state->model_ops = model_ops;
 	
-	model_ops->new_task(event_ctx, lp_ctx, service_name, task_server_callback, state);
+	model_ops->new_task(event_ctx, lp_ctx, service_name, task_server_callback,
+			    state, service_details);
 
 	return NT_STATUS_OK;
 }
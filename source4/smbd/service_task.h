@@ -33,6 +33,29 @@ struct task_server {
 	void *private_data;
 };
 
+/*
+  details of a server service, used by the process model to decide
+  how the service is run
+*/
+struct service_details {
+	/*
+	 * Don't run the service in several pre-forked worker
+	 * processes, as it keeps state or runs background jobs that
+	 * must only exist once.
+	 */
+	bool inhibit_pre_fork;
+
+	/*
+	 * If set, called once the task is set up, in the process
+	 * that runs the task and forks any processes serving it, with
+	 * the event context that process waits on.  Jobs that must
+	 * only run once per task, rather than in every process that
+	 * inherits it, are scheduled here.
+	 */
+	void (*before_loop)(struct task_server *task,
+			    struct tevent_context *ev);
+};
+
 
 
 #endif /* __SERVICE_TASK_H__ */
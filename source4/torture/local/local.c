@@ -100,6 +100,8 @@ NTSTATUS torture_local_init(TALLOC_CTX *ctx)
 				      torture_local_crypto_aes_ccm_128);
 	torture_suite_add_simple_test(suite, "crypto.aes_gcm_128",
 				      torture_local_crypto_aes_gcm_128);
+	torture_suite_add_simple_test(suite, "crypto.aes_bench",
+				      torture_local_crypto_aes_bench);
 
 	for (i = 0; suite_generators[i]; i++)
 		torture_suite_add_suite(suite,
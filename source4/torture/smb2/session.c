@@ -1307,6 +1307,163 @@ done:
 	return ret;
 }
 
+/*
+ * Write and read large blocks through both channels of a session at
+ * the same time. Over an encrypted share this has the server decrypt
+ * large requests and encrypt large responses of several channels at
+ * once.
+ */
+static bool test_session_bind_large_io(struct torture_context *tctx,
+				       struct smb2_tree *tree1)
+{
+	const char *host = torture_setting_string(tctx, "host", NULL);
+	const char *share = torture_setting_string(tctx, "share", NULL);
+	struct cli_credentials *credentials = popt_get_cmdline_credentials();
+	NTSTATUS status;
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	char fname[256];
+	struct smb2_handle _h1;
+	struct smb2_handle *h1 = NULL;
+	struct smb2_create io1;
+	struct smb2_write wr[2];
+	struct smb2_read rd[2];
+	struct smb2_request *req[2];
+	uint8_t *data = NULL;
+	size_t size = 1024 * 1024;
+	bool ret = false;
+	struct smb2_tree *tree2 = NULL;
+	struct smb2_transport *transport1 = tree1->session->transport;
+	struct smb2_transport *transport2 = NULL;
+	struct smb2_session *session1_1 = tree1->session;
+	struct smb2_session *session1_2 = NULL;
+	uint32_t caps;
+	int i;
+
+	caps = smb2cli_conn_server_capabilities(transport1->conn);
+	if (!(caps & SMB2_CAP_MULTI_CHANNEL)) {
+		torture_skip(tctx, "server doesn't support SMB2_CAP_MULTI_CHANNEL\n");
+	}
+
+	size = MIN(size, smb2cli_conn_max_write_size(transport1->conn));
+	size = MIN(size, smb2cli_conn_max_read_size(transport1->conn));
+
+	data = talloc_array(mem_ctx, uint8_t, 2 * size);
+	torture_assert_goto(tctx, data != NULL, ret, done,
+			    "talloc_array failed");
+	generate_random_buffer(data, 2 * size);
+
+	/* Add some random component to the file name. */
+	snprintf(fname, sizeof(fname), "session_bind_large_io_%s.dat",
+		 generate_random_str(tctx, 8));
+
+	smb2_util_unlink(tree1, fname);
+
+	smb2_oplock_create_share(&io1, fname,
+				 smb2_util_share_access(""),
+				 smb2_util_oplock_level(""));
+
+	status = smb2_create(tree1, mem_ctx, &io1);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_create failed");
+	_h1 = io1.out.file.handle;
+	h1 = &_h1;
+
+	status = smb2_connect(tctx,
+			      host,
+			      lpcfg_smb_ports(tctx->lp_ctx),
+			      share,
+			      lpcfg_resolve_context(tctx->lp_ctx),
+			      credentials,
+			      &tree2,
+			      tctx->ev,
+			      &transport1->options,
+			      lpcfg_socket_options(tctx->lp_ctx),
+			      lpcfg_gensec_settings(tctx, tctx->lp_ctx)
+			      );
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_connect failed");
+	transport2 = tree2->session->transport;
+
+	/*
+	 * Now bind the 2nd transport connection to the 1st session
+	 */
+	session1_2 = smb2_session_channel(transport2,
+					  lpcfg_gensec_settings(tctx, tctx->lp_ctx),
+					  tree2,
+					  session1_1);
+	torture_assert(tctx, session1_2 != NULL, "smb2_session_channel failed");
+
+	status = smb2_session_setup_spnego(session1_2,
+					   popt_get_cmdline_credentials(),
+					   0 /* previous_session_id */);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_session_setup_spnego failed");
+
+	/* one block through each channel, both in flight together */
+	for (i = 0; i < 2; i++) {
+		tree1->session = (i == 0) ? session1_1 : session1_2;
+
+		ZERO_STRUCT(wr[i]);
+		wr[i].in.file.handle = _h1;
+		wr[i].in.offset = i * size;
+		wr[i].in.data = data_blob_const(data + i * size, size);
+
+		req[i] = smb2_write_send(tree1, &wr[i]);
+		torture_assert_goto(tctx, req[i] != NULL, ret, done,
+				    "smb2_write_send failed");
+	}
+
+	for (i = 0; i < 2; i++) {
+		status = smb2_write_recv(req[i], &wr[i]);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"smb2_write_recv failed");
+		torture_assert_int_equal_goto(tctx, wr[i].out.nwritten, size,
+					      ret, done, "short write");
+	}
+
+	/* read each block back through the other channel */
+	for (i = 0; i < 2; i++) {
+		tree1->session = (i == 0) ? session1_2 : session1_1;
+
+		ZERO_STRUCT(rd[i]);
+		rd[i].in.file.handle = _h1;
+		rd[i].in.offset = i * size;
+		rd[i].in.length = size;
+
+		req[i] = smb2_read_send(tree1, &rd[i]);
+		torture_assert_goto(tctx, req[i] != NULL, ret, done,
+				    "smb2_read_send failed");
+	}
+
+	for (i = 0; i < 2; i++) {
+		status = smb2_read_recv(req[i], mem_ctx, &rd[i]);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"smb2_read_recv failed");
+		torture_assert_int_equal_goto(tctx, rd[i].out.data.length,
+					      size, ret, done, "short read");
+		torture_assert_mem_equal_goto(tctx, rd[i].out.data.data,
+					      data + i * size, size,
+					      ret, done, "data mismatch");
+	}
+
+	ret = true;
+done:
+	talloc_free(tree2);
+	tree1->session = session1_1;
+
+	if (h1 != NULL) {
+		smb2_util_close(tree1, *h1);
+	}
+
+	smb2_util_unlink(tree1, fname);
+
+	talloc_free(tree1);
+
+	talloc_free(mem_ctx);
+
+	return ret;
+}
+
 struct torture_suite *torture_smb2_session_init(TALLOC_CTX *ctx)
 {
 	struct torture_suite *suite =
@@ -1322,6 +1479,8 @@ struct torture_suite *torture_smb2_session_init(TALLOC_CTX *ctx)
 	torture_suite_add_1smb2_test(suite, "reauth6", test_session_reauth6);
 	torture_suite_add_simple_test(suite, "expire1", test_session_expire1);
 	torture_suite_add_1smb2_test(suite, "bind1", test_session_bind1);
+	torture_suite_add_1smb2_test(suite, "bind_large_io",
+				     test_session_bind_large_io);
 
 	suite->description = talloc_strdup(suite, "SMB2-SESSION tests");
 
@@ -508,5 +508,9 @@ static void wreplsrv_task_init(struct task_server *task)
 */
 NTSTATUS server_service_wrepl_init(TALLOC_CTX *ctx)
 {
-	return register_server_service(ctx, "wrepl", wreplsrv_task_init);
+	static const struct service_details details = {
+		.inhibit_pre_fork = true,
+	};
+	return register_server_service(ctx, "wrepl", wreplsrv_task_init,
+				       &details);
 }